@@ -0,0 +1,85 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#define _GNU_SOURCE	// for strptime()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmdline.h"
+#include "utils.h"
+
+/************************
+ * oftrace * open_multi(char * filename);
+ * 	the file names are copied by the time oftrace_open_multi()
+ * 	returns, so the list can go
+ */
+oftrace * open_multi(char * filename)
+{
+	char * list = strdup(filename);
+	char ** files = malloc_and_check((strlen(list)/2 + 1) * sizeof(char *));
+	oftrace * oft;
+	char * tok;
+	int n = 0;
+
+	for(tok = strtok(list,","); tok; tok = strtok(NULL,","))
+		files[n++] = tok;
+	oft = oftrace_open_multi(files,n,NULL);
+	free(files);
+	free(list);
+	return oft;
+}
+
+/************************
+ * double parse_time(char * str);
+ */
+double parse_time(char * str)
+{
+	struct tm tm;
+	char * end;
+	double t = strtod(str,&end);
+
+	if(end != str && *end == 0)
+		return t;
+	bzero(&tm,sizeof(tm));
+	end = strptime(str,"%Y-%m-%d %H:%M",&tm);
+	if(end && *end == ':')
+		end = strptime(end,":%S",&tm);
+	if(!end || *end)
+	{
+		fprintf(stderr,"Can't parse time '%s'; aborting....\n",str);
+		exit(1);
+	}
+	tm.tm_isdst = -1;	// let mktime() work out DST
+	return mktime(&tm);
+}
@@ -0,0 +1,263 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+#include "oftrace.h"
+#include "utils.h"
+
+static const char * type_names[OFTRACE_MAX_TYPE] = {
+	[OFPT_HELLO] = "hello",
+	[OFPT_ERROR] = "error",
+	[OFPT_ECHO_REQUEST] = "echo_request",
+	[OFPT_ECHO_REPLY] = "echo_reply",
+	[OFPT_VENDOR] = "vendor",
+	[OFPT_FEATURES_REQUEST] = "features_request",
+	[OFPT_FEATURES_REPLY] = "features_reply",
+	[OFPT_GET_CONFIG_REQUEST] = "get_config_request",
+	[OFPT_GET_CONFIG_REPLY] = "get_config_reply",
+	[OFPT_SET_CONFIG] = "set_config",
+	[OFPT_PACKET_IN] = "packet_in",
+	[OFPT_FLOW_REMOVED] = "flow_removed",
+	[OFPT_PORT_STATUS] = "port_status",
+	[OFPT_PACKET_OUT] = "packet_out",
+	[OFPT_FLOW_MOD] = "flow_mod",
+	[OFPT_PORT_MOD] = "port_mod",
+	[OFPT_STATS_REQUEST] = "stats_request",
+	[OFPT_STATS_REPLY] = "stats_reply",
+	[OFPT_BARRIER_REQUEST] = "barrier_request",
+	[OFPT_BARRIER_REPLY] = "barrier_reply",
+};
+
+int add_traces(char * path, char *** files, int * n_files);
+void print_report(const oftrace_stats * stats, int n_files);
+void print_delay(const char * prefix, const oftrace_hist * h);
+void print_secs(const char * label, uint64_t nsec);
+
+int main(int argc, char * argv[])
+{
+	char * controller = "0.0.0.0";
+	char * colon;
+	int port = OFP_TCP_PORT;
+	uint32_t controller_ip;
+	int n_workers = 0;
+	char ** files = NULL;
+	int n_files = 0;
+	oftrace_stats stats;
+	int i, merged;
+
+	while(argc>1 && argv[1][0] == '-' && argv[1][1] != 0)
+	{
+		if(!strcmp(argv[1],"-j") && argc>2)
+		{
+			n_workers = atoi(argv[2]);	// traces read at once
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-c") && argc>2)
+		{
+			controller = argv[2];		// ip[:port]
+			argc--;
+			argv++;
+		}
+		else
+		{
+			fprintf(stderr,"Usage: ofbatch [-j workers] [-c controller[:port]] trace|dir [trace|dir ...]\n");
+			return 1;
+		}
+		argc--;
+		argv++;
+	}
+	if(argc < 2)
+	{
+		fprintf(stderr,"Usage: ofbatch [-j workers] [-c controller[:port]] trace|dir [trace|dir ...]\n");
+		return 1;
+	}
+	controller = strdup(controller);
+	if((colon = strchr(controller,':')))
+	{
+		*colon = 0;
+		port = atoi(colon + 1);
+	}
+	if(inet_pton(AF_INET,controller,&controller_ip) != 1)	// FIXME: use getaddrinfo
+	{
+		fprintf(stderr,"Can't parse controller '%s'; aborting....\n",controller);
+		return 1;
+	}
+	for(i = 1; i < argc; i++)
+		if(add_traces(argv[i],&files,&n_files))
+			return 1;
+	if(n_files == 0)
+	{
+		fprintf(stderr,"No traces to read; aborting....\n");
+		return 1;
+	}
+	fprintf(stderr,"Reading %d pcap files for %s controller ip on port %d\n",
+			n_files,strcmp(controller,"0.0.0.0") ? controller : "any",port);
+	bzero(&stats,sizeof(stats));
+	merged = oftrace_run_batch(files,n_files,n_workers,controller_ip,port,&oftrace_stats_analysis,&stats);
+	if(merged < 0)
+	{
+		fprintf(stderr,"Problem starting the workers; aborting....\n");
+		return 1;
+	}
+	print_report(&stats,n_files);
+	oftrace_stats_clear(&stats);
+	return merged == n_files ? 0 : 2;
+}
+
+/************************
+ * add_traces():
+ * 	a file, or every regular file in a directory (in name order)
+ * 	but hidden ones and oftrace indexes
+ */
+int add_traces(char * path, char *** files, int * n_files)
+{
+	struct dirent ** names;
+	struct stat sbuf;
+	char * file;
+	int i, n, len;
+
+	if(stat(path,&sbuf))
+	{
+		perror(path);
+		return 1;
+	}
+	if(!S_ISDIR(sbuf.st_mode))
+	{
+		*files = realloc_and_check(*files,(*n_files + 1) * sizeof(char *));
+		(*files)[(*n_files)++] = path;
+		return 0;
+	}
+	if((n = scandir(path,&names,NULL,alphasort)) < 0)
+	{
+		perror(path);
+		return 1;
+	}
+	for(i = 0; i < n; i++)
+	{
+		len = strlen(names[i]->d_name);
+		file = malloc_and_check(strlen(path) + len + 2);
+		sprintf(file,"%s/%s",path,names[i]->d_name);
+		if(names[i]->d_name[0] == '.' || (len > 7 && !strcmp(names[i]->d_name + len - 7,".oftidx")) ||
+				stat(file,&sbuf) || !S_ISREG(sbuf.st_mode))
+			free(file);
+		else
+		{
+			*files = realloc_and_check(*files,(*n_files + 1) * sizeof(char *));
+			(*files)[(*n_files)++] = file;
+		}
+		free(names[i]);
+	}
+	free(names);
+	return 0;
+}
+
+/************************
+ * print_report():
+ * 	totals, then one line per switch
+ */
+void print_report(const oftrace_stats * stats, int n_files)
+{
+	const oftrace_switch_stats * sw;
+	char addr[BUFLEN];
+	uint64_t total = 0;
+	int i, j;
+
+	printf("traces %llu of %d\n",(unsigned long long) stats->traces,n_files);
+	if(stats->first_nsec)
+	{
+		print_secs("from ",stats->first_nsec);
+		print_secs(" to ",stats->last_nsec);
+		printf("\n");
+	}
+	for(i = 0; i < OFTRACE_MAX_TYPE; i++)
+	{
+		total += stats->msgs[i];
+		if(stats->msgs[i])
+			printf("%-20s %llu\n",type_names[i] ? type_names[i] : "unknown",
+					(unsigned long long) stats->msgs[i]);
+	}
+	printf("%-20s %llu msgs %llu bytes\n","total",(unsigned long long) total,
+			(unsigned long long) stats->bytes);
+	print_delay("secs_to_resp",&stats->delay);
+	printf("unmatched buffer_ids %llu\n",(unsigned long long) stats->unmatched);
+	printf("switches %d\n",stats->n_switches);
+	for(i = 0; i < stats->n_switches; i++)
+	{
+		sw = &stats->switches[i];
+		inet_ntop(sw->ip6 ? AF_INET6 : AF_INET,sw->addr,addr,BUFLEN);
+		for(total = 0, j = 0; j < OFTRACE_MAX_TYPE; j++)
+			total += sw->msgs[j];
+		printf("switch %s msgs %llu bytes %llu packet_in %llu unmatched %llu ",addr,
+				(unsigned long long) total,
+				(unsigned long long) sw->bytes,
+				(unsigned long long) sw->msgs[OFPT_PACKET_IN],
+				(unsigned long long) sw->unmatched);
+		print_delay("secs_to_resp",&sw->delay);
+	}
+}
+
+/************************
+ * print_delay():
+ * 	count, mean and quantiles, in seconds like ofstats prints them
+ */
+void print_delay(const char * prefix, const oftrace_hist * h)
+{
+	double q[] = { 0.5, 0.9, 0.99 };
+	const char * names[] = { " p50<=", " p90<=", " p99<=" };
+	int i;
+
+	printf("%s n=%llu",prefix,(unsigned long long) h->count);
+	if(h->count)
+	{
+		print_secs(" mean=",h->sum_nsec / h->count);
+		print_secs(" min=",h->min_nsec);
+		for(i = 0; i < 3; i++)
+			print_secs(names[i],oftrace_hist_quantile(h,q[i]));
+		print_secs(" max=",h->max_nsec);
+	}
+	printf("\n");
+}
+
+void print_secs(const char * label, uint64_t nsec)
+{
+	printf("%s%llu.%.6llu",label,(unsigned long long) nsec / 1000000000,
+			(unsigned long long) nsec % 1000000000 / 1000);
+}
@@ -37,6 +37,7 @@ without specific, written prior permission.
 #include <unistd.h>
 
 
+#include "cmdline.h"
 #include "oftrace.h"
 
 #ifndef MIN
@@ -56,7 +57,68 @@ int main(int argc, char * argv[])
 	int port = OFP_TCP_PORT;
 	uint32_t controller_ip;
 	oftrace *oft;
+	int follow = 0;
+	double seek = -1;
+	double budget_mb = -1, idle = -1;
+	char * spill_dir = NULL;
+	char * filter = NULL;
+	char * prefilter = NULL;
+	char * controllers = NULL;
 	// FIXME: parse options from cmdline
+	while(argc>1 && argv[1][0] == '-' && argv[1][1] != 0)
+	{
+		if(!strcmp(argv[1],"-f"))
+			follow = 1;	// like tail -f
+		else if(!strcmp(argv[1],"-s") && argc>2)
+		{
+			seek = parse_time(argv[2]);	// start at this time
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-m") && argc>2)
+		{
+			budget_mb = atof(argv[2]);	// MB for tcp reassembly
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-d") && argc>2)
+		{
+			spill_dir = argv[2];	// put long out of order backlogs here
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-e") && argc>2)
+		{
+			filter = argv[2];	// only these messages
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-c") && argc>2)
+		{
+			controllers = argv[2];	// several, instead of controller and port
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-b") && argc>2)
+		{
+			prefilter = argv[2];	// tcpdump style, on the raw packets
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-i") && argc>2)
+		{
+			idle = atof(argv[2]);	// drop connections idle this long
+			argc--;
+			argv++;
+		}
+		else
+		{
+			fprintf(stderr,"Usage: ofdump [-f] [-s time] [-m megabytes] [-i idle_secs] [-d spill_dir] [-e filter] [-b pcap_filter] [-c controllers] [trace [controller [port]]]\n");
+			return 1;
+		}
+		argc--;
+		argv++;
+	}
 	if(argc>1)
 		filename=argv[1];
 	if(argc>2)
@@ -70,12 +132,40 @@ int main(int argc, char * argv[])
 		fprintf(stderr,"Reading from pcap file %s for controller %s on port %d\n",
 				filename,controller,port);
 	inet_pton(AF_INET,controller,&controller_ip);	// FIXME: use getaddrinfo
-	oft= oftrace_open(filename);
+	if(follow)
+		oft= oftrace_open_follow(filename);
+	else if(strpbrk(filename,",*?["))	// several captures: merge them by time
+		oft= open_multi(filename);
+	else
+		oft= oftrace_open(filename);
 	if(!oft)
 	{
 		fprintf(stderr,"Problem openning %s; aborting....\n",filename);
 		return 0;
 	}
+	if(seek >= 0 && oftrace_seek_time(oft,seek))
+		fprintf(stderr,"WARN: couldn't seek to %f; reading from the start\n",seek);
+	if(budget_mb >= 0 || idle >= 0)
+		oftrace_set_limits(oft,
+				budget_mb >= 0 ? (size_t) (budget_mb * 1024 * 1024) : OFTRACE_MEM_BUDGET,
+				idle >= 0 ? idle : OFTRACE_IDLE_TIMEOUT);
+	if(spill_dir && oftrace_set_spill(oft,spill_dir,0))
+		fprintf(stderr,"WARN: can't spill to %s; keeping everything in memory\n",spill_dir);
+	if(controllers && oftrace_set_controllers(oft,controllers))
+	{
+		fprintf(stderr,"Bad controller list; aborting....\n");
+		return 1;
+	}
+	if(prefilter && oftrace_set_prefilter(oft,prefilter))
+	{
+		fprintf(stderr,"Bad packet filter expression; aborting....\n");
+		return 1;
+	}
+	if(filter && oftrace_set_filter(oft,filter))
+	{
+		fprintf(stderr,"Bad filter expression; aborting....\n");
+		return 1;
+	}
 	return do_analyze(oft,controller_ip, port);
 }
 /************************************************************************
@@ -88,51 +178,76 @@ int do_analyze(oftrace * oft, uint32_t ip, int port)
 	int count = 0;
 	int tcp_list[BUFLEN];
 	int n_sessions,i;
-	const openflow_msg *m;
+	oftrace_mem_stats mem;
+	oftrace_prefilter_stats pre;
+	oftrace_batch_msg batch[256];
+	const oftrace_batch_msg *m;
+	int n_batch,j;
 	char dst_ip[BUFLEN];
 	char src_ip[BUFLEN];
 	struct timeval start,diff;
 	start.tv_sec = start.tv_usec= 0;	
-	memset(&m, 0, sizeof(m));	// zero msg contents
-	// for each openflow msg
-	while( (m = oftrace_next_msg(oft, ip, port)) != NULL)
+	// for each batch of openflow msgs
+	while( (n_batch = oftrace_next_batch(oft, ip, port, batch, 256)) > 0)
 	{
-		count ++;
-		if((count%10000)==0)
-		{
-			n_sessions =oftrace_tcp_stats(oft,BUFLEN,tcp_list);
-			fprintf(stderr," --- %d sessions: ",n_sessions);
-			for(i=0;i<MIN(n_sessions,BUFLEN);i++)
-				fprintf(stderr, " %d",tcp_list[i]);
-		 	fprintf(stderr,"\n");
-		}
-		if(start.tv_sec == 0)
+		for(j=0;j<n_batch;j++)
 		{
-			start.tv_sec = m->phdr.ts_sec;
-			start.tv_usec = m->phdr.ts_usec;
+			m = &batch[j];
+			count ++;
+			if((count%10000)==0)
+			{
+				n_sessions =oftrace_tcp_stats(oft,BUFLEN,tcp_list);
+				fprintf(stderr," --- %d sessions: ",n_sessions);
+				for(i=0;i<MIN(n_sessions,BUFLEN);i++)
+					fprintf(stderr, " %d",tcp_list[i]);
+			 	fprintf(stderr,"\n");
+				oftrace_mem_stats_get(oft,&mem);
+				fprintf(stderr," --- %llu bytes queued (peak %llu), %llu spilled; evicted %llu idle, %llu over budget, losing %llu bytes\n",
+						(unsigned long long) mem.bytes, (unsigned long long) mem.peak_bytes,
+						(unsigned long long) mem.spilled_bytes,
+						(unsigned long long) mem.idle_evictions, (unsigned long long) mem.budget_evictions,
+						(unsigned long long) mem.evicted_bytes);
+			}
+			if(start.tv_sec == 0)
+			{
+				start.tv_sec = m->ts_sec;
+				start.tv_usec = m->ts_nsec / 1000;
+			}
+			diff.tv_sec = m->ts_sec - start.tv_sec;
+			if(m->ts_nsec / 1000 < start.tv_usec)
+			{
+				diff.tv_usec = m->ts_nsec / 1000 + 100000 + start.tv_usec;
+				diff.tv_sec--;
+			}
+			else
+				diff.tv_usec = m->ts_nsec / 1000 - start.tv_usec;
+			if(m->ip6)
+			{
+				inet_ntop(AF_INET6,m->sip6,src_ip,BUFLEN);
+				inet_ntop(AF_INET6,m->dip6,dst_ip,BUFLEN);
+			}
+			else
+			{
+				inet_ntop(AF_INET,&m->sip,src_ip,BUFLEN);
+				inet_ntop(AF_INET,&m->dip,dst_ip,BUFLEN);
+			}
+			printf("FROM %s:%u		TO  %s:%u	OFP_TYPE %d	LEN %d	TIME %lu.%.6lu\n",
+					src_ip,
+					ntohs(m->sport),
+					dst_ip,
+					ntohs(m->dport),
+					m->type,
+					m->length,
+					diff.tv_sec,
+					diff.tv_usec
+					);
 		}
-		diff.tv_sec = m->phdr.ts_sec - start.tv_sec;
-		if(m->phdr.ts_usec < start.tv_usec)
-		{
-			diff.tv_usec = m->phdr.ts_usec + 100000 + start.tv_usec;
-			diff.tv_sec--;
-		}
-		else
-			diff.tv_usec = m->phdr.ts_usec - start.tv_usec;
-		inet_ntop(AF_INET,&m->ip->saddr,src_ip,BUFLEN);
-		inet_ntop(AF_INET,&m->ip->daddr,dst_ip,BUFLEN);
-		printf("FROM %s:%u		TO  %s:%u	OFP_TYPE %d	LEN %d	TIME %lu.%.6lu\n",
-				src_ip,
-				ntohs(m->tcp->source),
-				dst_ip,
-				ntohs(m->tcp->dest),
-				m->ofph->type,
-				ntohs(m->ofph->length),
-				diff.tv_sec,
-				diff.tv_usec
-				);
 	}
 	fprintf(stderr,"Total OpenFlow Messages: %d\n",count);
+	oftrace_prefilter_stats_get(oft,&pre);
+	fprintf(stderr," --- %llu of %llu packets (%llu of %llu bytes) dropped before parsing\n",
+			(unsigned long long) pre.rejected, (unsigned long long) pre.packets,
+			(unsigned long long) pre.rejected_bytes, (unsigned long long) pre.bytes);
 	return count;
 }
 
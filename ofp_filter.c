@@ -0,0 +1,1040 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#include "ofp_filter.h"
+#include "utils.h"
+
+#define OFP_FILTER_MAX_WORD	64
+#define OFP_FILTER_REJECT	0	// program counters that end the program
+#define OFP_FILTER_ACCEPT	1
+
+// the fields an expression can look at
+enum {
+	FLD_TYPE, FLD_VERSION, FLD_LENGTH, FLD_XID, FLD_DPID,
+	FLD_BUFFER_ID, FLD_IN_PORT, FLD_REASON, FLD_COMMAND, FLD_PRIORITY, FLD_COOKIE,
+	FLD_DL_SRC, FLD_DL_DST, FLD_DL_VLAN, FLD_DL_TYPE,
+	FLD_NW_PROTO, FLD_NW_SRC, FLD_NW_DST, FLD_TP_SRC, FLD_TP_DST,
+	FLD_MAX
+};
+
+// which messages have a field, when not all of them do
+#define IN_PACKET_IN	0x01
+#define IN_PACKET_OUT	0x02
+#define IN_FLOW_MOD	0x04
+#define IN_FLOW_REMOVED	0x08
+#define IN_MATCH	(IN_PACKET_IN|IN_PACKET_OUT|IN_FLOW_MOD|IN_FLOW_REMOVED)
+
+static const struct ofp_filter_field {
+	const char * name;
+	int bits;	// width of its values
+	int cost;	// 0: header, 1: fixed offset in the body, 2: in the embedded
+			// 	frame, 3: past the frame's ethernet header
+	int in;		// IN_* flags, 0 for every message
+} ofp_filter_fields[FLD_MAX] = {
+	{ "type",	8,	0, 0 },
+	{ "version",	8,	0, 0 },
+	{ "length",	16,	0, 0 },
+	{ "xid",	32,	0, 0 },
+	{ "dpid",	64,	1, 0 },
+	{ "buffer_id",	32,	1, IN_PACKET_IN|IN_PACKET_OUT|IN_FLOW_MOD },
+	{ "in_port",	16,	1, IN_MATCH },
+	{ "reason",	8,	1, IN_PACKET_IN|IN_FLOW_REMOVED },
+	{ "command",	16,	1, IN_FLOW_MOD },
+	{ "priority",	16,	1, IN_FLOW_MOD|IN_FLOW_REMOVED },
+	{ "cookie",	64,	1, IN_FLOW_MOD|IN_FLOW_REMOVED },
+	{ "dl_src",	48,	2, IN_MATCH },
+	{ "dl_dst",	48,	2, IN_MATCH },
+	{ "dl_vlan",	16,	2, IN_MATCH },
+	{ "dl_type",	16,	2, IN_MATCH },
+	{ "nw_proto",	8,	3, IN_MATCH },
+	{ "nw_src",	32,	3, IN_MATCH },
+	{ "nw_dst",	32,	3, IN_MATCH },
+	{ "tp_src",	16,	3, IN_MATCH },
+	{ "tp_dst",	16,	3, IN_MATCH },
+};
+
+static const struct ofp_filter_alias {
+	const char * name;
+	int field;
+} ofp_filter_aliases[] = {
+	{ "ether_type",		FLD_DL_TYPE },
+	{ "datapath_id",	FLD_DPID },
+	{ NULL, 0 }
+};
+
+// symbolic values; a bare type name is short for "type == name"
+static const struct ofp_filter_name {
+	int field;
+	const char * name;
+	uint64_t value;
+} ofp_filter_names[] = {
+	{ FLD_TYPE,	"hello",		OFPT_HELLO },
+	{ FLD_TYPE,	"error",		OFPT_ERROR },
+	{ FLD_TYPE,	"echo_request",		OFPT_ECHO_REQUEST },
+	{ FLD_TYPE,	"echo_reply",		OFPT_ECHO_REPLY },
+	{ FLD_TYPE,	"vendor",		OFPT_VENDOR },
+	{ FLD_TYPE,	"features_request",	OFPT_FEATURES_REQUEST },
+	{ FLD_TYPE,	"features_reply",	OFPT_FEATURES_REPLY },
+	{ FLD_TYPE,	"get_config_request",	OFPT_GET_CONFIG_REQUEST },
+	{ FLD_TYPE,	"get_config_reply",	OFPT_GET_CONFIG_REPLY },
+	{ FLD_TYPE,	"set_config",		OFPT_SET_CONFIG },
+	{ FLD_TYPE,	"packet_in",		OFPT_PACKET_IN },
+	{ FLD_TYPE,	"flow_removed",		OFPT_FLOW_REMOVED },
+	{ FLD_TYPE,	"port_status",		OFPT_PORT_STATUS },
+	{ FLD_TYPE,	"packet_out",		OFPT_PACKET_OUT },
+	{ FLD_TYPE,	"flow_mod",		OFPT_FLOW_MOD },
+	{ FLD_TYPE,	"port_mod",		OFPT_PORT_MOD },
+	{ FLD_TYPE,	"stats_request",	OFPT_STATS_REQUEST },
+	{ FLD_TYPE,	"stats_reply",		OFPT_STATS_REPLY },
+	{ FLD_TYPE,	"barrier_request",	OFPT_BARRIER_REQUEST },
+	{ FLD_TYPE,	"barrier_reply",	OFPT_BARRIER_REPLY },
+	{ FLD_COMMAND,	"add",			OFPFC_ADD },
+	{ FLD_COMMAND,	"modify",		OFPFC_MODIFY },
+	{ FLD_COMMAND,	"modify_strict",	OFPFC_MODIFY_STRICT },
+	{ FLD_COMMAND,	"delete",		OFPFC_DELETE },
+	{ FLD_COMMAND,	"delete_strict",	OFPFC_DELETE_STRICT },
+	{ FLD_IN_PORT,	"local",		OFPP_LOCAL },
+	{ FLD_IN_PORT,	"controller",		OFPP_CONTROLLER },
+	{ FLD_IN_PORT,	"none",			OFPP_NONE },
+	{ FLD_BUFFER_ID,"none",			0xffffffff },
+	{ FLD_DL_VLAN,	"none",			OFP_VLAN_NONE },
+	{ FLD_DL_TYPE,	"ip",			ETHERTYPE_IP },
+	{ FLD_DL_TYPE,	"arp",			ETHERTYPE_ARP },
+	{ FLD_DL_TYPE,	"lldp",			0x88cc },
+	{ FLD_DL_TYPE,	"ipv6",			0x86dd },
+	{ FLD_NW_PROTO,	"icmp",			IPPROTO_ICMP },
+	{ FLD_NW_PROTO,	"tcp",			IPPROTO_TCP },
+	{ FLD_NW_PROTO,	"udp",			IPPROTO_UDP },
+	{ 0, NULL, 0 }
+};
+
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+// a set of message types, one bit each
+typedef struct ofp_filter_types {
+	uint32_t w[8];
+} ofp_filter_types;
+
+#define TYPE_IS_SET(ts,t)	((ts)->w[(t)>>5] & (1u << ((t) & 31)))
+
+enum { NODE_CMP, NODE_NOT, NODE_AND, NODE_OR };
+
+// the parsed expression, before it is flattened
+typedef struct ofp_filter_node {
+	int kind;
+	int field;	// NODE_CMP: field op (value & mask)
+	int op;
+	uint64_t mask;
+	uint64_t value;
+	struct ofp_filter_node ** kids;	// NODE_NOT has one
+	int n_kids;
+	int cost;	// of its most expensive field
+	ofp_filter_types may;	// it can only be true for these types
+	ofp_filter_types must;	// and is always true for these
+} ofp_filter_node;
+
+// one step of the program: if the field is there and compares,
+// 	go to jt, else to jf
+typedef struct ofp_filter_insn {
+	uint8_t field;
+	uint8_t op;
+	uint16_t jt;
+	uint16_t jf;
+	uint64_t mask;
+	uint64_t value;
+} ofp_filter_insn;
+
+struct ofp_filter {
+	ofp_filter_types may;
+	ofp_filter_types must;
+	ofp_filter_insn * prog;	// prog[start] is the first step; the
+	int n_insns;		// 	first two are OFP_FILTER_REJECT/ACCEPT
+	int max_insns;
+	int start;
+};
+
+typedef struct ofp_filter_parser {
+	const char * expr;
+	const char * p;		// next thing to parse
+	int failed;
+} ofp_filter_parser;
+
+// a message being matched; the embedded frame is only parsed if asked for
+typedef struct ofp_filter_msg {
+	const uint8_t * ofp;
+	int len;
+	int type;
+	uint64_t dpid;
+	int l3;		// offset of what follows the frame's ethernet header;
+			// 	-2 before looking, -1 if there is no frame
+	uint64_t dl_vlan;
+	uint64_t dl_type;
+} ofp_filter_msg;
+
+static ofp_filter_node * ofp_filter_parse_or(ofp_filter_parser * ps);
+static ofp_filter_node * ofp_filter_parse_and(ofp_filter_parser * ps);
+static ofp_filter_node * ofp_filter_parse_not(ofp_filter_parser * ps);
+static ofp_filter_node * ofp_filter_parse_cmp(ofp_filter_parser * ps);
+static int ofp_filter_parse_value(ofp_filter_parser * ps, int field, const char * word, ofp_filter_node * n);
+static ofp_filter_node * ofp_filter_error(ofp_filter_parser * ps, const char * why);
+static ofp_filter_node * ofp_filter_node_new(int kind);
+static void ofp_filter_node_add(ofp_filter_node * n, ofp_filter_node * kid);
+static void ofp_filter_node_free(ofp_filter_node * n);
+static int ofp_filter_word(ofp_filter_parser * ps, char * word);
+static int ofp_filter_punct(ofp_filter_parser * ps, const char * s);
+static int ofp_filter_keyword(ofp_filter_parser * ps, const char * s);
+static void ofp_filter_analyze(ofp_filter_node * n);
+static int ofp_filter_gen(ofp_filter * f, ofp_filter_node * n, int jt, int jf);
+static int ofp_filter_compare(int op, uint64_t v, uint64_t value);
+static int ofp_filter_get(ofp_filter_msg * m, int field, uint64_t * v);
+static int ofp_filter_load(ofp_filter_msg * m, int off, int width, uint64_t * v);
+static int ofp_filter_get_match(ofp_filter_msg * m, int field, uint64_t * v);
+static int ofp_filter_get_frame(ofp_filter_msg * m, int field, uint64_t * v);
+
+
+/***************************
+ * ofp_filter * ofp_filter_compile(const char * expr);
+ * 	parse, order, flatten
+ */
+ofp_filter * ofp_filter_compile(const char * expr)
+{
+	ofp_filter_parser ps;
+	ofp_filter_node * root;
+	ofp_filter * f;
+
+	ps.expr = ps.p = expr;
+	ps.failed = 0;
+	root = ofp_filter_parse_or(&ps);
+	if(root && (ofp_filter_word(&ps,NULL) || *ps.p))
+	{
+		ofp_filter_node_free(root);
+		root = ofp_filter_error(&ps,"expected 'and', 'or' or the end");
+	}
+	if(root == NULL)
+		return NULL;
+	ofp_filter_analyze(root);
+	f = malloc_and_check(sizeof(ofp_filter));
+	bzero(f,sizeof(ofp_filter));
+	f->may = root->may;
+	f->must = root->must;
+	f->max_insns = 16;
+	f->prog = malloc_and_check(f->max_insns * sizeof(ofp_filter_insn));
+	f->n_insns = 2;		// OFP_FILTER_REJECT and OFP_FILTER_ACCEPT
+	f->start = ofp_filter_gen(f,root,OFP_FILTER_ACCEPT,OFP_FILTER_REJECT);
+	ofp_filter_node_free(root);
+	return f;
+}
+
+void ofp_filter_free(ofp_filter * f)
+{
+	if(f == NULL)
+		return;
+	free(f->prog);
+	free(f);
+}
+
+/***************************
+ * int ofp_filter_match(const ofp_filter * f, const char * ofp, int len, uint64_t dpid);
+ * 	the type sets decide most messages; the program only runs for
+ * 	the types the expression could go either way on
+ */
+int ofp_filter_match(const ofp_filter * f, const char * ofp, int len, uint64_t dpid)
+{
+	ofp_filter_msg m;
+	const ofp_filter_insn * in;
+	uint64_t v;
+	int pc;
+
+	if(len < sizeof(struct ofp_header))
+		return 0;
+	m.ofp = (const uint8_t *) ofp;
+	m.type = m.ofp[offsetof(struct ofp_header,type)];
+	if(!TYPE_IS_SET(&f->may,m.type))
+		return 0;
+	if(TYPE_IS_SET(&f->must,m.type))
+		return 1;
+	m.len = len;
+	m.dpid = dpid;
+	m.l3 = -2;
+	m.dl_vlan = OFP_VLAN_NONE;	// set for real along with l3
+	m.dl_type = 0;
+	pc = f->start;
+	while(pc > OFP_FILTER_ACCEPT)
+	{
+		in = &f->prog[pc];
+		if(!ofp_filter_get(&m,in->field,&v))
+		{
+			pc = in->jf;	// not there: no comparison is true
+			continue;
+		}
+		pc = ofp_filter_compare(in->op,v & in->mask,in->value) ? in->jt : in->jf;
+	}
+	return pc == OFP_FILTER_ACCEPT;
+}
+
+/***************************
+ * parsing:
+ * 	or	:= and { ("or" | "||") and }
+ * 	and	:= not { ("and" | "&&") not }
+ * 	not	:= ("not" | "!") not | "(" or ")" | cmp
+ * 	cmp	:= field op value | type_name
+ */
+static ofp_filter_node * ofp_filter_parse_or(ofp_filter_parser * ps)
+{
+	ofp_filter_node * n, * kid, * or;
+
+	if((n = ofp_filter_parse_and(ps)) == NULL)
+		return NULL;
+	if(!ofp_filter_punct(ps,"||") && !ofp_filter_keyword(ps,"or"))
+		return n;
+	or = ofp_filter_node_new(NODE_OR);
+	ofp_filter_node_add(or,n);
+	do
+	{
+		if((kid = ofp_filter_parse_and(ps)) == NULL)
+		{
+			ofp_filter_node_free(or);
+			return NULL;
+		}
+		ofp_filter_node_add(or,kid);
+	} while(ofp_filter_punct(ps,"||") || ofp_filter_keyword(ps,"or"));
+	return or;
+}
+
+static ofp_filter_node * ofp_filter_parse_and(ofp_filter_parser * ps)
+{
+	ofp_filter_node * n, * kid, * and;
+
+	if((n = ofp_filter_parse_not(ps)) == NULL)
+		return NULL;
+	if(!ofp_filter_punct(ps,"&&") && !ofp_filter_keyword(ps,"and"))
+		return n;
+	and = ofp_filter_node_new(NODE_AND);
+	ofp_filter_node_add(and,n);
+	do
+	{
+		if((kid = ofp_filter_parse_not(ps)) == NULL)
+		{
+			ofp_filter_node_free(and);
+			return NULL;
+		}
+		ofp_filter_node_add(and,kid);
+	} while(ofp_filter_punct(ps,"&&") || ofp_filter_keyword(ps,"and"));
+	return and;
+}
+
+static ofp_filter_node * ofp_filter_parse_not(ofp_filter_parser * ps)
+{
+	ofp_filter_node * n, * kid;
+
+	if(ofp_filter_punct(ps,"!") || ofp_filter_keyword(ps,"not"))
+	{
+		if((kid = ofp_filter_parse_not(ps)) == NULL)
+			return NULL;
+		n = ofp_filter_node_new(NODE_NOT);
+		ofp_filter_node_add(n,kid);
+		return n;
+	}
+	if(ofp_filter_punct(ps,"("))
+	{
+		if((n = ofp_filter_parse_or(ps)) == NULL)
+			return NULL;
+		if(!ofp_filter_punct(ps,")"))
+		{
+			ofp_filter_node_free(n);
+			return ofp_filter_error(ps,"expected ')'");
+		}
+		return n;
+	}
+	return ofp_filter_parse_cmp(ps);
+}
+
+static ofp_filter_node * ofp_filter_parse_cmp(ofp_filter_parser * ps)
+{
+	static const struct { const char * s; int op; } ops[] = {
+		{ "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE },
+		{ "<", OP_LT }, { ">", OP_GT }, { "=", OP_EQ }, { NULL, 0 }
+	};
+	char word[OFP_FILTER_MAX_WORD];
+	const char * start;
+	ofp_filter_node * n;
+	int field, i;
+
+	start = ps->p;
+	if(!ofp_filter_word(ps,word))
+		return ofp_filter_error(ps,"expected a field or message type");
+	for(field = 0; field < FLD_MAX; field++)
+		if(!strcmp(word,ofp_filter_fields[field].name))
+			break;
+	for(i = 0; field == FLD_MAX && ofp_filter_aliases[i].name; i++)
+		if(!strcmp(word,ofp_filter_aliases[i].name))
+			field = ofp_filter_aliases[i].field;
+	n = ofp_filter_node_new(NODE_CMP);
+	if(field == FLD_MAX)
+	{
+		// maybe a bare message type
+		n->field = FLD_TYPE;
+		n->op = OP_EQ;
+		if(!isdigit(word[0]) && ofp_filter_parse_value(ps,FLD_TYPE,word,n))
+			return n;
+		ofp_filter_node_free(n);
+		ps->p = start;
+		return ofp_filter_error(ps,"unknown field or message type");
+	}
+	n->field = field;
+	while(isspace(*ps->p))
+		ps->p++;
+	for(i = 0; ops[i].s; i++)
+		if(ofp_filter_punct(ps,ops[i].s))
+			break;
+	if(ops[i].s == NULL)
+	{
+		ofp_filter_node_free(n);
+		return ofp_filter_error(ps,"expected a comparison");
+	}
+	n->op = ops[i].op;
+	start = ps->p;
+	if(!ofp_filter_word(ps,word) || !ofp_filter_parse_value(ps,field,word,n))
+	{
+		ofp_filter_node_free(n);
+		ps->p = start;
+		return ofp_filter_error(ps,"expected a value for the field");
+	}
+	return n;
+}
+
+/***************************
+ * static int ofp_filter_parse_value(ofp_filter_parser * ps, int field, const char * word, ofp_filter_node * n);
+ * 	a number, a dotted quad with an optional /prefix, a mac
+ * 	address, or one of the field's names; fill in n's value and mask
+ */
+static int ofp_filter_parse_value(ofp_filter_parser * ps, int field, const char * word, ofp_filter_node * n)
+{
+	int bits = ofp_filter_fields[field].bits;
+	unsigned int mac[6];
+	char addr[OFP_FILTER_MAX_WORD];
+	struct in_addr in;
+	const char * slash;
+	char * end;
+	int i, len;
+	char c;
+
+	n->mask = bits < 64 ? ((uint64_t) 1 << bits) - 1 : ~(uint64_t) 0;
+	if(strchr(word,':'))
+	{
+		if(sscanf(word,"%x:%x:%x:%x:%x:%x%c",&mac[0],&mac[1],&mac[2],
+					&mac[3],&mac[4],&mac[5],&c) != 6)
+			return 0;
+		n->value = 0;
+		for(i = 0; i < 6; i++)
+		{
+			if(mac[i] > 0xff)
+				return 0;
+			n->value = (n->value << 8) | mac[i];
+		}
+	}
+	else if(strchr(word,'.'))
+	{
+		strcpy(addr,word);
+		len = 32;
+		if((slash = strchr(word,'/')) != NULL)
+		{
+			addr[slash - word] = 0;
+			len = strtol(slash + 1,&end,10);
+			if(end == slash + 1 || *end || len < 0 || len > 32)
+				return 0;
+		}
+		if(inet_pton(AF_INET,addr,&in) != 1)
+			return 0;
+		n->value = ntohl(in.s_addr);
+		if(len < 32)	// only compare the prefix
+			n->mask = len == 0 ? 0 : (0xffffffffu << (32 - len)) & 0xffffffffu;
+	}
+	else if(isdigit(word[0]))
+	{
+		n->value = strtoull(word,&end,0);
+		if(*end)
+			return 0;
+	}
+	else
+	{
+		for(i = 0; ofp_filter_names[i].name; i++)
+			if(ofp_filter_names[i].field == field && !strcmp(word,ofp_filter_names[i].name))
+				break;
+		if(ofp_filter_names[i].name == NULL)
+			return 0;
+		n->value = ofp_filter_names[i].value;
+	}
+	if(n->value & ~(bits < 64 ? ((uint64_t) 1 << bits) - 1 : ~(uint64_t) 0))
+		return 0;	// too big for the field
+	n->value &= n->mask;
+	return 1;
+}
+
+/***************************
+ * static ofp_filter_node * ofp_filter_error(ofp_filter_parser * ps, const char * why);
+ * 	complain about the first thing that went wrong; return NULL
+ */
+static ofp_filter_node * ofp_filter_error(ofp_filter_parser * ps, const char * why)
+{
+	if(!ps->failed)
+		fprintf(stderr,"WARN: bad filter '%s': %s at '%s'\n",ps->expr,why,ps->p);
+	ps->failed = 1;
+	return NULL;
+}
+
+static ofp_filter_node * ofp_filter_node_new(int kind)
+{
+	ofp_filter_node * n = malloc_and_check(sizeof(ofp_filter_node));
+	bzero(n,sizeof(ofp_filter_node));
+	n->kind = kind;
+	return n;
+}
+
+static void ofp_filter_node_add(ofp_filter_node * n, ofp_filter_node * kid)
+{
+	n->kids = realloc_and_check(n->kids,(n->n_kids + 1) * sizeof(ofp_filter_node *));
+	n->kids[n->n_kids++] = kid;
+}
+
+static void ofp_filter_node_free(ofp_filter_node * n)
+{
+	int i;
+	for(i = 0; i < n->n_kids; i++)
+		ofp_filter_node_free(n->kids[i]);
+	free(n->kids);
+	free(n);
+}
+
+/***************************
+ * tokens: words are runs of letters, digits and _.:/ (so that
+ * 	addresses are one word); return whether the next token was the
+ * 	one asked for, consuming it if so
+ */
+static int ofp_filter_word(ofp_filter_parser * ps, char * word)
+{
+	const char * p;
+	int len;
+
+	while(isspace(*ps->p))
+		ps->p++;
+	for(p = ps->p; *p && (isalnum(*p) || strchr("_.:/",*p)); p++)
+		;
+	len = p - ps->p;
+	if(len == 0 || len >= OFP_FILTER_MAX_WORD)
+		return 0;
+	if(word == NULL)
+		return 1;	// just looking
+	memcpy(word,ps->p,len);
+	word[len] = 0;
+	ps->p = p;
+	return 1;
+}
+
+static int ofp_filter_punct(ofp_filter_parser * ps, const char * s)
+{
+	while(isspace(*ps->p))
+		ps->p++;
+	if(strncmp(ps->p,s,strlen(s)))
+		return 0;
+	if(!strcmp(s,"!") && ps->p[1] == '=')
+		return 0;	// that's not a "not"
+	ps->p += strlen(s);
+	return 1;
+}
+
+static int ofp_filter_keyword(ofp_filter_parser * ps, const char * s)
+{
+	int len = strlen(s);
+
+	while(isspace(*ps->p))
+		ps->p++;
+	if(strncmp(ps->p,s,len) || isalnum(ps->p[len]) || ps->p[len] == '_')
+		return 0;
+	ps->p += len;
+	return 1;
+}
+
+/***************************
+ * static void ofp_filter_analyze(ofp_filter_node * n);
+ * 	work out each node's cost and type sets, and put the cheap
+ * 	operands of and/or first, where they can cut the rest short
+ */
+static void ofp_filter_analyze(ofp_filter_node * n)
+{
+	const struct ofp_filter_field * fld;
+	ofp_filter_node * kid;
+	int i, j, t;
+
+	if(n->kind == NODE_CMP)
+	{
+		fld = &ofp_filter_fields[n->field];
+		n->cost = fld->cost;
+		for(t = 0; t < 256; t++)
+		{
+			if(n->field == FLD_TYPE)
+			{
+				if(!ofp_filter_compare(n->op,t & n->mask,n->value))
+					continue;
+				n->must.w[t >> 5] |= 1u << (t & 31);	// decided by the type alone
+			}
+			else if(fld->in != 0 &&
+					!((fld->in & IN_PACKET_IN) && t == OFPT_PACKET_IN) &&
+					!((fld->in & IN_PACKET_OUT) && t == OFPT_PACKET_OUT) &&
+					!((fld->in & IN_FLOW_MOD) && t == OFPT_FLOW_MOD) &&
+					!((fld->in & IN_FLOW_REMOVED) && t == OFPT_FLOW_REMOVED))
+				continue;	// these don't have the field
+			n->may.w[t >> 5] |= 1u << (t & 31);
+		}
+		return;
+	}
+	for(i = 0; i < n->n_kids; i++)
+		ofp_filter_analyze(n->kids[i]);
+	// stable insertion sort by cost
+	for(i = 1; i < n->n_kids; i++)
+	{
+		kid = n->kids[i];
+		for(j = i; j > 0 && n->kids[j-1]->cost > kid->cost; j--)
+			n->kids[j] = n->kids[j-1];
+		n->kids[j] = kid;
+	}
+	n->cost = 0;
+	for(i = 0; i < n->n_kids; i++)
+		n->cost = MAX(n->cost,n->kids[i]->cost);
+	for(j = 0; j < 8; j++)
+	{
+		switch(n->kind)
+		{
+			case NODE_NOT:
+				n->may.w[j] = ~n->kids[0]->must.w[j];
+				n->must.w[j] = ~n->kids[0]->may.w[j];
+				break;
+			case NODE_AND:
+				n->may.w[j] = n->must.w[j] = ~0u;
+				for(i = 0; i < n->n_kids; i++)
+				{
+					n->may.w[j] &= n->kids[i]->may.w[j];
+					n->must.w[j] &= n->kids[i]->must.w[j];
+				}
+				break;
+			case NODE_OR:
+				n->may.w[j] = n->must.w[j] = 0;
+				for(i = 0; i < n->n_kids; i++)
+				{
+					n->may.w[j] |= n->kids[i]->may.w[j];
+					n->must.w[j] |= n->kids[i]->must.w[j];
+				}
+				break;
+		}
+	}
+}
+
+/***************************
+ * static int ofp_filter_gen(ofp_filter * f, ofp_filter_node * n, int jt, int jf);
+ * 	append the steps for n, which go on to jt if it is true and jf
+ * 	if not, and return its first step.  Each operand of an and/or is
+ * 	generated after the ones it can jump to, so jumps only go
+ * 	backwards and the program always ends
+ */
+static int ofp_filter_gen(ofp_filter * f, ofp_filter_node * n, int jt, int jf)
+{
+	ofp_filter_insn * in;
+	int i, entry;
+
+	switch(n->kind)
+	{
+		case NODE_NOT:
+			return ofp_filter_gen(f,n->kids[0],jf,jt);
+		case NODE_AND:
+			entry = jt;
+			for(i = n->n_kids - 1; i >= 0; i--)
+				entry = ofp_filter_gen(f,n->kids[i],entry,jf);
+			return entry;
+		case NODE_OR:
+			entry = jf;
+			for(i = n->n_kids - 1; i >= 0; i--)
+				entry = ofp_filter_gen(f,n->kids[i],jt,entry);
+			return entry;
+	}
+	if(f->n_insns >= f->max_insns)
+	{
+		f->max_insns *= 2;
+		f->prog = realloc_and_check(f->prog,f->max_insns * sizeof(ofp_filter_insn));
+	}
+	in = &f->prog[f->n_insns];
+	in->field = n->field;
+	in->op = n->op;
+	in->jt = jt;
+	in->jf = jf;
+	in->mask = n->mask;
+	in->value = n->value;
+	return f->n_insns++;
+}
+
+static int ofp_filter_compare(int op, uint64_t v, uint64_t value)
+{
+	switch(op)
+	{
+		case OP_EQ: return v == value;
+		case OP_NE: return v != value;
+		case OP_LT: return v <  value;
+		case OP_LE: return v <= value;
+		case OP_GT: return v >  value;
+		default:    return v >= value;
+	}
+}
+
+/***************************
+ * static int ofp_filter_get(ofp_filter_msg * m, int field, uint64_t * v);
+ * 	return 1 and the field's value in v, or 0 if m doesn't have it
+ */
+static int ofp_filter_get(ofp_filter_msg * m, int field, uint64_t * v)
+{
+	switch(field)
+	{
+		case FLD_TYPE:
+			*v = m->type;
+			return 1;
+		case FLD_VERSION:
+			return ofp_filter_load(m,offsetof(struct ofp_header,version),1,v);
+		case FLD_LENGTH:
+			return ofp_filter_load(m,offsetof(struct ofp_header,length),2,v);
+		case FLD_XID:
+			return ofp_filter_load(m,offsetof(struct ofp_header,xid),4,v);
+		case FLD_DPID:
+			*v = m->dpid;
+			return m->dpid != 0;
+		case FLD_BUFFER_ID:
+			if(m->type == OFPT_PACKET_IN)
+				return ofp_filter_load(m,offsetof(struct ofp_packet_in,buffer_id),4,v);
+			if(m->type == OFPT_PACKET_OUT)
+				return ofp_filter_load(m,offsetof(struct ofp_packet_out,buffer_id),4,v);
+			if(m->type == OFPT_FLOW_MOD)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_mod,buffer_id),4,v);
+			return 0;
+		case FLD_REASON:
+			if(m->type == OFPT_PACKET_IN)
+				return ofp_filter_load(m,offsetof(struct ofp_packet_in,reason),1,v);
+			if(m->type == OFPT_FLOW_REMOVED)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_removed,reason),1,v);
+			return 0;
+		case FLD_COMMAND:
+			if(m->type == OFPT_FLOW_MOD)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_mod,command),2,v);
+			return 0;
+		case FLD_PRIORITY:
+			if(m->type == OFPT_FLOW_MOD)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_mod,priority),2,v);
+			if(m->type == OFPT_FLOW_REMOVED)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_removed,priority),2,v);
+			return 0;
+		case FLD_COOKIE:
+			if(m->type == OFPT_FLOW_MOD)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_mod,cookie),8,v);
+			if(m->type == OFPT_FLOW_REMOVED)
+				return ofp_filter_load(m,offsetof(struct ofp_flow_removed,cookie),8,v);
+			return 0;
+	}
+	// the rest are match fields: from the ofp_match of a flow, or
+	// 	worked out from the frame of a packet
+	if(m->type == OFPT_FLOW_MOD || m->type == OFPT_FLOW_REMOVED)
+		return ofp_filter_get_match(m,field,v);
+	if(field == FLD_IN_PORT)
+	{
+		if(m->type == OFPT_PACKET_IN)
+			return ofp_filter_load(m,offsetof(struct ofp_packet_in,in_port),2,v);
+		if(m->type == OFPT_PACKET_OUT)
+			return ofp_filter_load(m,offsetof(struct ofp_packet_out,in_port),2,v);
+		return 0;
+	}
+	return ofp_filter_get_frame(m,field,v);
+}
+
+/***************************
+ * static int ofp_filter_load(ofp_filter_msg * m, int off, int width, uint64_t * v);
+ * 	the width byte big endian number at off, if the message is that long
+ */
+static int ofp_filter_load(ofp_filter_msg * m, int off, int width, uint64_t * v)
+{
+	const uint8_t * p = &m->ofp[off];
+	int i;
+
+	if(off < 0 || off + width > m->len)
+		return 0;
+	*v = 0;
+	for(i = 0; i < width; i++)
+		*v = (*v << 8) | p[i];
+	return 1;
+}
+
+/***************************
+ * static int ofp_filter_get_match(ofp_filter_msg * m, int field, uint64_t * v);
+ * 	a field of a FLOW_MOD's or FLOW_REMOVED's ofp_match (they are at
+ * 	the same place in both); wildcarded fields aren't there, and
+ * 	wildcarded address bits read as 0
+ */
+static int ofp_filter_get_match(ofp_filter_msg * m, int field, uint64_t * v)
+{
+	int match = offsetof(struct ofp_flow_mod,match);
+	uint64_t wildcards;
+	int off, width, bits;
+	uint32_t wild;
+
+	switch(field)
+	{
+		case FLD_IN_PORT:  off = offsetof(struct ofp_match,in_port);  width = 2; wild = OFPFW_IN_PORT; break;
+		case FLD_DL_SRC:   off = offsetof(struct ofp_match,dl_src);   width = 6; wild = OFPFW_DL_SRC; break;
+		case FLD_DL_DST:   off = offsetof(struct ofp_match,dl_dst);   width = 6; wild = OFPFW_DL_DST; break;
+		case FLD_DL_VLAN:  off = offsetof(struct ofp_match,dl_vlan);  width = 2; wild = OFPFW_DL_VLAN; break;
+		case FLD_DL_TYPE:  off = offsetof(struct ofp_match,dl_type);  width = 2; wild = OFPFW_DL_TYPE; break;
+		case FLD_NW_PROTO: off = offsetof(struct ofp_match,nw_proto); width = 1; wild = OFPFW_NW_PROTO; break;
+		case FLD_NW_SRC:   off = offsetof(struct ofp_match,nw_src);   width = 4; wild = 0; break;
+		case FLD_NW_DST:   off = offsetof(struct ofp_match,nw_dst);   width = 4; wild = 0; break;
+		case FLD_TP_SRC:   off = offsetof(struct ofp_match,tp_src);   width = 2; wild = OFPFW_TP_SRC; break;
+		case FLD_TP_DST:   off = offsetof(struct ofp_match,tp_dst);   width = 2; wild = OFPFW_TP_DST; break;
+		default:
+			return 0;
+	}
+	if(!ofp_filter_load(m,match + offsetof(struct ofp_match,wildcards),4,&wildcards))
+		return 0;
+	if(wildcards & wild)
+		return 0;
+	if(!ofp_filter_load(m,match + off,width,v))
+		return 0;
+	if(field == FLD_NW_SRC || field == FLD_NW_DST)
+	{
+		// the number of low bits wildcarded
+		if(field == FLD_NW_SRC)
+			bits = (wildcards & OFPFW_NW_SRC_MASK) >> OFPFW_NW_SRC_SHIFT;
+		else
+			bits = (wildcards & OFPFW_NW_DST_MASK) >> OFPFW_NW_DST_SHIFT;
+		if(bits >= 32)
+			return 0;
+		*v &= (0xffffffffu << bits) & 0xffffffffu;
+	}
+	return 1;
+}
+
+/***************************
+ * static int ofp_filter_get_frame(ofp_filter_msg * m, int field, uint64_t * v);
+ * 	a match field of the frame in a PACKET_IN or PACKET_OUT, the way
+ * 	a switch would fill in an ofp_match from it: dl_vlan is
+ * 	OFP_VLAN_NONE if untagged, and ARP gives its opcode as nw_proto
+ * 	and its addresses as nw_src/nw_dst
+ */
+static int ofp_filter_get_frame(ofp_filter_msg * m, int field, uint64_t * v)
+{
+	uint64_t actions_len, vhl, frag;
+	int frame, l4;
+
+	if(m->l3 == -2)
+	{
+		// find the frame and get past its ethernet and vlan headers, once
+		m->l3 = -1;
+		if(m->type == OFPT_PACKET_IN)
+			frame = offsetof(struct ofp_packet_in,data);
+		else if(m->type == OFPT_PACKET_OUT &&
+				ofp_filter_load(m,offsetof(struct ofp_packet_out,actions_len),2,&actions_len))
+			frame = sizeof(struct ofp_packet_out) + actions_len;
+		else
+			return 0;
+		if(!ofp_filter_load(m,frame + 2 * ETH_ALEN,2,&m->dl_type))
+			return 0;	// no frame, e.g. a PACKET_OUT of a buffered packet
+		m->dl_vlan = OFP_VLAN_NONE;
+		m->l3 = frame + sizeof(struct ether_header);
+		if(m->dl_type == ETHERTYPE_VLAN)
+		{
+			if(!ofp_filter_load(m,m->l3,2,&m->dl_vlan) ||
+					!ofp_filter_load(m,m->l3 + 2,2,&m->dl_type))
+			{
+				m->l3 = -1;
+				return 0;
+			}
+			m->dl_vlan &= 0xfff;
+			m->l3 += 4;
+		}
+	}
+	if(m->l3 < 0)
+		return 0;
+	frame = m->l3 - sizeof(struct ether_header) - (m->dl_vlan != OFP_VLAN_NONE ? 4 : 0);
+	switch(field)
+	{
+		case FLD_DL_DST:
+			return ofp_filter_load(m,frame,ETH_ALEN,v);
+		case FLD_DL_SRC:
+			return ofp_filter_load(m,frame + ETH_ALEN,ETH_ALEN,v);
+		case FLD_DL_VLAN:
+			*v = m->dl_vlan;
+			return 1;
+		case FLD_DL_TYPE:
+			*v = m->dl_type;
+			return 1;
+	}
+	if(m->dl_type == ETHERTYPE_ARP)
+	{
+		switch(field)
+		{
+			case FLD_NW_PROTO:
+				if(!ofp_filter_load(m,m->l3 + 6,2,v))	// opcode
+					return 0;
+				*v &= 0xff;
+				return 1;
+			case FLD_NW_SRC:
+				return ofp_filter_load(m,m->l3 + 14,4,v);
+			case FLD_NW_DST:
+				return ofp_filter_load(m,m->l3 + 24,4,v);
+		}
+		return 0;
+	}
+	if(m->dl_type != ETHERTYPE_IP)
+		return 0;
+	switch(field)
+	{
+		case FLD_NW_PROTO:
+			return ofp_filter_load(m,m->l3 + 9,1,v);
+		case FLD_NW_SRC:
+			return ofp_filter_load(m,m->l3 + 12,4,v);
+		case FLD_NW_DST:
+			return ofp_filter_load(m,m->l3 + 16,4,v);
+	}
+	// tp_src/tp_dst: ports, or icmp type/code, of a first fragment
+	if(!ofp_filter_load(m,m->l3,1,&vhl) || !ofp_filter_load(m,m->l3 + 6,2,&frag) ||
+			!ofp_filter_load(m,m->l3 + 9,1,v))
+		return 0;
+	if(frag & 0x1fff)
+		return 0;
+	l4 = m->l3 + 4 * (vhl & 0xf);
+	if(*v == IPPROTO_TCP || *v == IPPROTO_UDP)
+		return ofp_filter_load(m,l4 + (field == FLD_TP_SRC ? 0 : 2),2,v);
+	if(*v == IPPROTO_ICMP)
+		return ofp_filter_load(m,l4 + (field == FLD_TP_SRC ? 0 : 1),1,v);
+	return 0;
+}
+
+/*************************************************************
+ * unittest hooks
+ */
+
+static int unittest_ofp_filter_check(const char * expr, const char * ofp, int len, uint64_t dpid)
+{
+	ofp_filter * f = ofp_filter_compile(expr);
+	int r;
+
+	if(f == NULL)
+		return -1;
+	r = ofp_filter_match(f,ofp,len,dpid);
+	ofp_filter_free(f);
+	return r;
+}
+
+int unittest_do_ofp_filter(void)
+{
+	uint64_t pin_buf[16], fm_buf[16], echo_buf[1];
+	char * pin = (char *) pin_buf, * fm = (char *) fm_buf, * echo = (char *) echo_buf;
+	struct ofp_packet_in * opi = (struct ofp_packet_in *) pin;
+	struct ofp_flow_mod * ofm = (struct ofp_flow_mod *) fm;
+	struct ofp_header * oh = (struct ofp_header *) echo;
+	uint8_t * frame = opi->data;
+	int pin_len, fm_len;
+
+	// PACKET_IN on port 3 of a tcp packet 10.0.0.1:1234 -> 10.0.0.2:80
+	bzero(pin_buf,sizeof(pin_buf));
+	pin_len = offsetof(struct ofp_packet_in,data) + 14 + 20 + 20;
+	opi->header.version = OFP_VERSION;
+	opi->header.type = OFPT_PACKET_IN;
+	opi->header.length = htons(pin_len);
+	opi->header.xid = htonl(7);
+	opi->buffer_id = htonl(7);
+	opi->in_port = htons(3);
+	memcpy(frame,"\xff\xff\xff\xff\xff\xff\x00\x11\x22\x33\x44\x55\x08\x00",14);
+	frame[14] = 0x45;
+	frame[14 + 9] = IPPROTO_TCP;
+	memcpy(&frame[14 + 12],"\x0a\x00\x00\x01\x0a\x00\x00\x02",8);
+	memcpy(&frame[14 + 20],"\x04\xd2\x00\x50",4);
+	// FLOW_MOD adding a flow for ip to 10.1.0.0/16, anything else wildcarded
+	bzero(fm_buf,sizeof(fm_buf));
+	fm_len = sizeof(struct ofp_flow_mod);
+	ofm->header.version = OFP_VERSION;
+	ofm->header.type = OFPT_FLOW_MOD;
+	ofm->header.length = htons(fm_len);
+	ofm->header.xid = htonl(1);
+	ofm->match.wildcards = htonl((OFPFW_ALL & ~(OFPFW_DL_TYPE | OFPFW_NW_DST_MASK)) |
+			(16 << OFPFW_NW_DST_SHIFT));
+	ofm->match.dl_type = htons(ETHERTYPE_IP);
+	ofm->match.nw_dst = htonl(0x0a010203);
+	ofm->command = htons(OFPFC_ADD);
+	ofm->priority = htons(100);
+	ofm->buffer_id = htonl(0xffffffff);
+	bzero(echo_buf,sizeof(echo_buf));
+	oh->version = OFP_VERSION;
+	oh->type = OFPT_ECHO_REQUEST;
+	oh->length = htons(sizeof(struct ofp_header));
+
+	assert(unittest_ofp_filter_check("packet_in",pin,pin_len,0) == 1);
+	assert(unittest_ofp_filter_check("packet_in",fm,fm_len,0) == 0);
+	assert(unittest_ofp_filter_check("type != packet_in",echo,8,0) == 1);
+	assert(unittest_ofp_filter_check("type == packet_in && in_port == 3",pin,pin_len,0) == 1);
+	assert(unittest_ofp_filter_check("packet_in and in_port == local",pin,pin_len,0) == 0);
+	assert(unittest_ofp_filter_check("tp_dst == 80 and nw_src == 10.0.0.0/8",pin,pin_len,0) == 1);
+	assert(unittest_ofp_filter_check("nw_proto == udp or tp_src < 1000",pin,pin_len,0) == 0);
+	assert(unittest_ofp_filter_check("dl_src == 00:11:22:33:44:55 && ether_type == ip",pin,pin_len,0) == 1);
+	assert(unittest_ofp_filter_check("dl_vlan == none",pin,pin_len,0) == 1);
+	assert(unittest_ofp_filter_check("not buffer_id == 7",echo,8,0) == 1);
+	assert(unittest_ofp_filter_check("buffer_id != 7",echo,8,0) == 0);
+	assert(unittest_ofp_filter_check("buffer_id != 7",fm,fm_len,0) == 1);
+	assert(unittest_ofp_filter_check("flow_mod and command == add and dl_type == ip",fm,fm_len,0) == 1);
+	assert(unittest_ofp_filter_check("nw_dst == 10.1.0.0",fm,fm_len,0) == 1);	// low bits wildcarded
+	assert(unittest_ofp_filter_check("nw_src == 0.0.0.0/0",fm,fm_len,0) == 0);	// wildcarded
+	assert(unittest_ofp_filter_check("priority >= 100 && !(xid > 5 || xid < 1)",fm,fm_len,0) == 1);
+	assert(unittest_ofp_filter_check("dpid == 0x10",echo,8,0x10) == 1);
+	assert(unittest_ofp_filter_check("dpid == 0x10",echo,8,0) == 0);
+	assert(unittest_ofp_filter_check("xid = 7 and length > 8",pin,pin_len,0) == 1);
+	assert(unittest_ofp_filter_check("packet_in and tp_dst == 80",pin,pin_len - 20,0) == 0);	// truncated
+	// these shouldn't parse
+	assert(unittest_ofp_filter_check("in_port ==",pin,pin_len,0) == -1);
+	assert(unittest_ofp_filter_check("bogus == 1",pin,pin_len,0) == -1);
+	assert(unittest_ofp_filter_check("(packet_in",pin,pin_len,0) == -1);
+	assert(unittest_ofp_filter_check("packet_in flow_mod",pin,pin_len,0) == -1);
+	assert(unittest_ofp_filter_check("in_port == 70000",pin,pin_len,0) == -1);
+	assert(unittest_ofp_filter_check("command == packet_in",pin,pin_len,0) == -1);
+	return 1;
+}
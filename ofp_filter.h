@@ -0,0 +1,78 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef OFP_FILTER_H
+#define OFP_FILTER_H
+
+#include <stdint.h>
+
+/*******************************************************
+ * ofp_filter: predicates over openflow messages, compiled once
+ *
+ * 	an expression like
+ * 		packet_in and dl_type == arp and in_port != 3
+ * 	is parsed into a tree, the operands of each and/or are put in
+ * 	order of how much work their fields take to get at (header,
+ * 	then fixed offsets in the body, then the embedded frame), and
+ * 	the tree is flattened into a short program of compare-and-branch
+ * 	steps, like bpf.  Before running it, the message type is checked
+ * 	against the set of types the expression can possibly (and
+ * 	certainly) be true for, which settles most messages outright.
+ *
+ * 	Fields are read straight out of the framed message, so nothing
+ * 	needs copying or decoding first.  A field the message doesn't
+ * 	have (buffer_id of an ECHO_REQUEST, a wildcarded match field)
+ * 	makes any comparison on it false
+ */
+
+typedef struct ofp_filter ofp_filter;
+
+/***************************
+ * 	parse and compile expr; return NULL, after saying why on
+ * 	stderr, if it doesn't parse
+ */
+ofp_filter * ofp_filter_compile(const char * expr);
+
+void ofp_filter_free(ofp_filter * f);
+
+/***************************
+ * 	does the len byte message at ofp match?  dpid is the datapath
+ * 	id of the connection it is on, or 0 if not known yet
+ */
+int ofp_filter_match(const ofp_filter * f, const char * ofp, int len, uint64_t dpid);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_ofp_filter(void);
+
+#endif
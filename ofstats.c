@@ -40,6 +40,7 @@ without specific, written prior permission.
 #include <time.h>	// for handy macro
 
 
+#include "cmdline.h"
 #include "oftrace.h"
 #include "utils.h"
 
@@ -56,11 +57,19 @@ typedef struct buffer_id
 	struct buffer_id * next;
 } buffer_id;
 
+typedef struct stats_ctx
+{
+	oftrace * oft;		// for the progress meter
+	buffer_id * b_list;	// packet_ins waiting for their buffer to be released
+} stats_ctx;
+
 /************************
  * main()
  *
  */
 int calc_stats(oftrace * oft, uint32_t ip, int port);
+int track_packet_in(const openflow_msg * m, void * ctx);
+int match_release(const openflow_msg * m, void * ctx);
 int count_list(buffer_id *b);
 
 int main(int argc, char * argv[])
@@ -70,7 +79,27 @@ int main(int argc, char * argv[])
 	int port = OFP_TCP_PORT;
 	uint32_t controller_ip;
 	oftrace *oft;
+	double seek = -1;
+	int pipeline = 0;
 	// FIXME: parse options from cmdline
+	while(argc>1 && argv[1][0] == '-' && argv[1][1] != 0)
+	{
+		if(!strcmp(argv[1],"-s") && argc>2)
+		{
+			seek = parse_time(argv[2]);	// start at this time
+			argc--;
+			argv++;
+		}
+		else if(!strcmp(argv[1],"-p"))
+			pipeline = 1;	// decode on other threads while matching here
+		else
+		{
+			fprintf(stderr,"Usage: ofstats [-p] [-s time] [trace [controller [port]]]\n");
+			return 1;
+		}
+		argc--;
+		argv++;
+	}
 	if(argc>1)
 		filename=argv[1];
 	if(argc>2)
@@ -84,110 +113,143 @@ int main(int argc, char * argv[])
 		fprintf(stderr,"Reading from pcap file %s for controller %s on port %d\n",
 				filename,controller,port);
 	inet_pton(AF_INET,controller,&controller_ip);	// FIXME: use getaddrinfo
-	oft= oftrace_open(filename);
+	if(strpbrk(filename,",*?["))	// several captures: merge them by time
+		oft= open_multi(filename);
+	else
+		oft= oftrace_open(filename);
 	if(!oft)
 	{
 		fprintf(stderr,"Problem openning %s; aborting....\n",filename);
 		return 0;
 	}
+	if(seek >= 0 && oftrace_seek_time(oft,seek))
+		fprintf(stderr,"WARN: couldn't seek to %f; reading from the start\n",seek);
+	if(pipeline)
+		oftrace_set_pipeline(oft,1);
 	return calc_stats(oft,controller_ip, port);
 }
 /************************************************************************
  * calc_stats:
  * 	match packet_in to packet_out or flow_mod statements that release the buffer
+ * 	only those three types get handlers, so the library skips the rest
  */
 
 int calc_stats(oftrace * oft, uint32_t ip, int port)
 {
-	const openflow_msg *m;
+	oftrace_handlers handlers;
+	stats_ctx ctx;
+	ctx.oft = oft;
+	ctx.b_list = NULL;
+	memset(&handlers, 0, sizeof(handlers));
+	handlers.handler[OFPT_PACKET_IN] = track_packet_in;
+	handlers.handler[OFPT_PACKET_OUT] = match_release;
+	handlers.handler[OFPT_FLOW_MOD] = match_release;
+	oftrace_run(oft, ip, port, &handlers, &ctx);
+	return 0;
+}
+
+/************************************************************************
+ * track_packet_in:
+ * 	create a new buffer_id struct and track this buffer_id
+ */
+int track_packet_in(const openflow_msg * m, void * ctx)
+{
+	buffer_id ** b_list = &((stats_ctx *) ctx)->b_list;
+	buffer_id * b;
+	struct ether_header * eth;
+	int etype;
+
+	fprintf(stderr,"------------ %f done\r", oftrace_progress(((stats_ctx *) ctx)->oft));
+	eth = (struct ether_header * ) m->ptr.packet_in->data;
+	etype = ntohs(eth->ether_type);
+	if(etype != 0x88cc ) // don't record LLDP
+	//if(etype != 0x88cc && etype != ETHERTYPE_ARP) // don't record LLDP or ARP
+	// if(ntohs(eth->ether_type) == ETHERTYPE_IP) // don't record anything but IP
+	{
+		b = malloc_and_check(sizeof(buffer_id));
+		b->sip = m->ip ? m->ip->saddr : 0;	// not kept for ipv6
+		b->dip = m->ip ? m->ip->daddr : 0;
+		b->sport = m->tcp->source;
+		b->dport = m->tcp->dest;
+		b->b_id = ntohl(m->ptr.packet_in->buffer_id);
+		b->ts.tv_sec = m->phdr.ts_sec;
+		b->ts.tv_usec = m->phdr.ts_usec;
+		b->datalen = ntohs(m->ofph->length) - offsetof(struct ofp_packet_in,data);
+		memcpy(b->data,m->ptr.packet_in->data,b->datalen);
+		b->next=*b_list;
+		*b_list = b;
+		if(etype != ETHERTYPE_IP && etype != ETHERTYPE_ARP && etype!= ETHERTYPE_VLAN)
+			fprintf(stderr,"ADDING packet_in ether_type=%.4x\n",etype);
+	}
+	return 0;
+}
+
+/************************************************************************
+ * match_release:
+ * 	a packet_out or flow_mod: find the packet_in whose buffer it releases
+ */
+int match_release(const openflow_msg * m, void * ctx)
+{
+	buffer_id ** b_list = &((stats_ctx *) ctx)->b_list;
+	buffer_id * b, *b_prev;
 	char dst_ip[BUFLEN];
 	char src_ip[BUFLEN];
 	struct timeval diff;
-	int etype;
-	struct ether_header * eth;
 	uint32_t id;
-	buffer_id * b, *b_list, *b_prev;
-	b_list = NULL;
-	memset(&m, 0, sizeof(m));	// zero msg contents
-	// for each openflow msg
-	while( (m = oftrace_next_msg(oft, ip, port)) != NULL)
+
+	fprintf(stderr,"------------ %f done\r", oftrace_progress(((stats_ctx *) ctx)->oft));
+	if(m->ip)
 	{
-		fprintf(stderr,"------------ %f done\r", oftrace_progress(oft));
-		switch(m->type)
+		inet_ntop(AF_INET,&m->ip->saddr,src_ip,BUFLEN);
+		inet_ntop(AF_INET,&m->ip->daddr,dst_ip,BUFLEN);
+	}
+	else
+	{
+		inet_ntop(AF_INET6,m->ip6->saddr,src_ip,BUFLEN);
+		inet_ntop(AF_INET6,m->ip6->daddr,dst_ip,BUFLEN);
+	}
+	if(m->type == OFPT_PACKET_OUT)
+	        id = ntohl(m->ptr.packet_out->buffer_id);
+	else
+	        id = ntohl(m->ptr.flow_mod->buffer_id);
+	// now find this buffer_id in the list
+	b_prev=NULL;
+	b= *b_list;
+	while(b)
+	{
+		if(b->b_id == id)
+			break;
+		else
 		{
-			case OFPT_PACKET_IN:
-				// create a new buffer_id struct and track this buffer_id
-				eth = (struct ether_header * ) m->ptr.packet_in->data;
-				etype = ntohs(eth->ether_type);
-				if(etype != 0x88cc ) // don't record LLDP
-				//if(etype != 0x88cc && etype != ETHERTYPE_ARP) // don't record LLDP or ARP
-				// if(ntohs(eth->ether_type) == ETHERTYPE_IP) // don't record anything but IP
-				{
-					b = malloc_and_check(sizeof(buffer_id));
-					b->sip = m->ip->saddr;
-					b->dip = m->ip->daddr;
-					b->sport = m->tcp->source;
-					b->dport = m->tcp->dest;
-					b->b_id = ntohl(m->ptr.packet_in->buffer_id);
-					b->ts.tv_sec = m->phdr.ts_sec;
-					b->ts.tv_usec = m->phdr.ts_usec;
-					b->datalen = ntohs(m->ofph->length) - offsetof(struct ofp_packet_in,data);
-					memcpy(b->data,m->ptr.packet_in->data,b->datalen);
-					b->next=b_list;
-					b_list = b;
-					if(etype != ETHERTYPE_IP && etype != ETHERTYPE_ARP && etype!= ETHERTYPE_VLAN)
-						fprintf(stderr,"ADDING packet_in ether_type=%.4x\n",etype);
-				}
-				break;
-			case OFPT_PACKET_OUT:
-			case OFPT_FLOW_MOD:
-				inet_ntop(AF_INET,&m->ip->saddr,src_ip,BUFLEN);
-				inet_ntop(AF_INET,&m->ip->daddr,dst_ip,BUFLEN);
-				if(m->type == OFPT_PACKET_OUT)
-				        id = ntohl(m->ptr.packet_out->buffer_id);
-				else
-       				        id = ntohl(m->ptr.flow_mod->buffer_id);
-				// now find this buffer_id in the list
-				b_prev=NULL;
-				b= b_list;
-				while(b)
-				{
-					if(b->b_id == id)
-						break;
-					else
-					{
-						b_prev=b;
-						b=b->next;
-					}
-				}
-				if(!b)
-				{
-					if(id != -1)
-						fprintf(stderr,"WEIRD: unmatched buffer_id %u in flow %s:%u -> %s:%u\n",
-								id,
-								src_ip, ntohs(m->tcp->source),
-								dst_ip, ntohs(m->tcp->dest));
-				}
-				else	// found it
-				{
-					diff.tv_sec = m->phdr.ts_sec;
-					diff.tv_usec = m->phdr.ts_usec;
-					timersub(&diff,&b->ts,&diff);	// handy macro
-					if(b_prev)
-						b_prev->next=b->next;
-					else
-						b_list=b->next;
-					printf("%ld.%.6ld 	secs_to_resp buf_id=%u in flow %s:%u -> %s:%u - %s - %d queued\n",
-							diff.tv_sec, diff.tv_usec,
-							id,
-							src_ip, ntohs(m->tcp->source),
-							dst_ip, ntohs(m->tcp->dest),
-							m->type==OFPT_PACKET_OUT? "packet_out":"flow_mod",
-							count_list(b_list));
-					free(b);
-				}
-				break;
-		};
+			b_prev=b;
+			b=b->next;
+		}
+	}
+	if(!b)
+	{
+		if(id != -1)
+			fprintf(stderr,"WEIRD: unmatched buffer_id %u in flow %s:%u -> %s:%u\n",
+					id,
+					src_ip, ntohs(m->tcp->source),
+					dst_ip, ntohs(m->tcp->dest));
+	}
+	else	// found it
+	{
+		diff.tv_sec = m->phdr.ts_sec;
+		diff.tv_usec = m->phdr.ts_usec;
+		timersub(&diff,&b->ts,&diff);	// handy macro
+		if(b_prev)
+			b_prev->next=b->next;
+		else
+			*b_list=b->next;
+		printf("%ld.%.6ld 	secs_to_resp buf_id=%u in flow %s:%u -> %s:%u - %s - %d queued\n",
+				diff.tv_sec, diff.tv_usec,
+				id,
+				src_ip, ntohs(m->tcp->source),
+				dst_ip, ntohs(m->tcp->dest),
+				m->type==OFPT_PACKET_OUT? "packet_out":"flow_mod",
+				count_list(*b_list));
+		free(b);
 	}
 	return 0;
 }
@@ -31,39 +31,172 @@ without specific, written prior permission.
 *****************************************************************/
 
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/stat.h>
+#include <unistd.h>
 
 
 #include "oftrace.h"
+#include "ofp_filter.h"
+#include "pcap_bpf.h"
+#include "pcap_decode.h"
+#include "pcap_index.h"
+#include "pcap_merge.h"
+#include "pcap_reader.h"
+#include "spsc_ring.h"
+#include "tcp_endpoints.h"
 #include "tcp_session.h"
 #include "utils.h"
 
-typedef struct pcap_hdr_s {
-	uint32_t magic_number;   /* magic number */
-	uint16_t version_major;  /* major version number */
-	uint16_t version_minor;  /* minor version number */
-	int32_t  thiszone;       /* GMT to local correction */
-	uint32_t sigfigs;        /* accuracy of timestamps */
-	uint32_t snaplen;        /* max length of captured packets, in octets */
-	uint32_t network;        /* data link type */
-} pcap_hdr_t;
+/*******************************************************
+ * what oftrace_select() asked for, worked out against the index
+ */
+struct oftrace_selection {
+	int active;
+	uint32_t ip1, ip2;
+	int port1, port2;
+	double start, end;
+	int n_conn;		// index sessions of the selected connection (0 = all)
+	int conn[2];
+	uint64_t cur[2];	// next record of each, relative to its first_rec
+	off_t warm_off;		// records before here only rebuild session state
+	off_t stop_off;		// stop at this record (0 = end of file)
+	int64_t start_nsec;	// messages before this are not returned
+	int64_t end_nsec;	// skip records after this (0 = no limit)
+};
+
+/*******************************************************
+ * oftrace_set_pipeline(): the parser thread reads and prefilters
+ * 	records, the framer thread reassembles and frames them, and
+ * 	the caller gets the messages; each hand-off is a spsc_ring.
+ * 	With shards, the parser deals records out by connection to
+ * 	several framers, each with an oftrace (so sessions) and a
+ * 	pipeline of its own, and the caller merges what they pass on
+ * 	back into the order of the records that completed them
+ */
+struct oftrace_pipeline {
+	pthread_t parser;
+	pthread_t framer;
+	int has_parser;		// the threads were started
+	int has_framer;
+	spsc_ring * records;	// of oftrace_stage_rec, parser -> framer
+	spsc_ring * msgs;	// of oftrace_stage_msg, framer -> caller
+	uint32_t ip;		// what the first call asked for
+	int port;
+	int copy;		// records don't stay put: copy them into the slots
+	int have_rec;		// the framer is using the oldest slot of records
+	int have_msg;		// 	and the caller the oldest one of msgs
+	uint64_t seq;		// of the record in the framer's slot
+	int stop;		// set to make the threads quit
+	// sharded
+	int n_shards;		// 0 for one framer on this oftrace
+	oftrace ** shards;	// each pipe has a framer, records and msgs
+	struct oftrace_pipeline * top;	// a shard's: the one dealing to it
+	uint64_t dealt;		// records dealt out so far
+	uint64_t given;		// a shard's: the last record dealt to it
+	uint64_t done;		// 	and the last one it passed all messages of on
+	int current;		// shard whose message the caller has, or -1
+	int merge_waiting;	// the caller is asleep on progress
+	pthread_mutex_t lock;
+	pthread_cond_t progress;	// a shard passed a message on, or got further
+	// oftrace_run_sharded(): a shard's framer calls handlers itself
+	const oftrace_handlers * handlers;
+	void * ctx;
+	int count;
+};
+
+#define OFTRACE_SHARD_DONE	UINT64_MAX	// done, when the framer has quit
 
+typedef struct oftrace_stage_rec {
+	uint64_t seq;		// in the order they were read, from 1
+	pcap_record rec;	// with data in the file, or in buf
+	pcap_decoded d;
+	char * buf;
+	int buf_size;
+} oftrace_stage_rec;
+
+typedef struct oftrace_stage_msg {
+	uint64_t seq;		// of the record that completed it
+	openflow_msg msg;
+} oftrace_stage_msg;
 
 struct oftrace {
 	int packet_count;
-	char * filename;
-	FILE * file;
-	int n_sessions;
-	int max_sessions;
-	tcp_session ** sessions;
+	pcap_reader * reader;
+	pcap_merge * merge;	// instead of reader, when reading several files
+	tcp_session_table sessions;	// hashed on the 4-tuple
 	tcp_session * curr;
-	struct pcap_hdr_s ghdr;
+	int warned_linktype;
+	pcap_index * index;		// from oftrace_open_indexed()
+	pcap_index_builder * build;	// in oftrace_build_index()
+	struct oftrace_selection sel;
+	int warming;		// current record is before sel.warm_off
+	int early;		// current record is before sel.start_nsec
+	int resync;		// we jumped into the middle: new sessions need to find their framing
+	char * fast;		// rest of an in-order segment of curr, framed straight
+	int fast_len;		// 	out of the record instead of going through curr's queue
+	off_t fast_off;		// 	and the record it's in
+	char * batch;		// oftrace_next_batch()'s messages
+	int batch_used;
+	const oftrace_handlers * want;	// in oftrace_run(): what to bother copying
+	ofp_filter * filter;	// see oftrace_set_filter()
+	pcap_bpf * bpf;		// see oftrace_set_prefilter()
+	tcp_endpoints * controllers;	// see oftrace_set_controllers()
+	oftrace_prefilter_stats pre;
+	int pipelined;		// see oftrace_set_pipeline(); how many framers
+	struct oftrace_pipeline * pipe;	// 	and its threads, once they are going
+	off_t range_end;	// see oftrace_set_range(); 0 for none
+	int mid_range;		// 	and it started past the top of the file
+	int past_end;		// read up to range_end: only finishing messages
+	oftrace_taken_fn taken;	// see oftrace_set_handoff()
+	void * taken_ctx;
+	size_t mem_budget;	// see oftrace_set_limits()
+	int64_t idle_nsec;
 	openflow_msg msg;	// where the current message is actually allocated
 };
 
 static int sanity_check_of_mesg(char * tmp,int tmplen);
+static oftrace * oftrace_open_flags(char * filename, int flags);
+static oftrace * oftrace_new(void);
+static int oftrace_check_linktype(pcap_reader * pr, char * filename);
+static int oftrace_next_record(oftrace * oft, pcap_record * rec);
+static int oftrace_next_kept(oftrace * oft, uint32_t ip, int port, pcap_record * rec, pcap_decoded * d);
+static int oftrace_next_selected(oftrace * oft, pcap_record * rec);
+static int oftrace_past_end(oftrace * oft, pcap_record * rec);
+static int oftrace_handed_off(oftrace * oft);
+static int oftrace_prefilter(oftrace * oft, pcap_record * rec, uint32_t ip, int port, pcap_decoded * d);
+static int oftrace_to_controller(oftrace * oft, uint32_t ip, int port,
+		uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport);
+static int oftrace_apply_selection(oftrace * oft);
+static void oftrace_reset_sessions(oftrace * oft);
+static void oftrace_index_bucket(oftrace * oft, pcap_record * rec);
+static char * oftrace_index_name(char * pcapfile, char * indexfile);
+static void oftrace_free(oftrace * oft);
+static void oftrace_skip_queued(oftrace * oft);
+static int oftrace_peek(oftrace * oft, char ** data);
+static int oftrace_pull(oftrace * oft, int len);
+static int oftrace_next_frame(oftrace * oft, uint32_t ip, int port, oftrace_batch_msg * bm);
+static int oftrace_next_queued(oftrace * oft, oftrace_batch_msg * bm, int * ofplen, int * index);
+static int oftrace_wanted(oftrace * oft, char * ofp, int ofplen);
+static int oftrace_handles(const oftrace_handlers * h, char * ofp, int ofplen);
+static void oftrace_describe(const openflow_msg * msg, oftrace_batch_msg * bm, int ofplen);
+static void oftrace_msg_copy(openflow_msg * dst, const openflow_msg * src);
+static int oftrace_pipeline_ready(oftrace * oft, uint32_t ip, int port);
+static struct oftrace_pipeline * oftrace_pipeline_new(oftrace * oft, uint32_t ip, int port, int n_shards);
+static void oftrace_pipeline_rings(struct oftrace_pipeline * pipe);
+static int oftrace_pipeline_start(oftrace * oft, int with_parser);
+static const openflow_msg * oftrace_pipeline_next(oftrace * oft);
+static void oftrace_pipeline_poke(struct oftrace_pipeline * top);
+static void oftrace_pipeline_stop(oftrace * oft);
+static void oftrace_deal(oftrace * oft);
+static void * oftrace_parser_main(void * arg);
+static void * oftrace_framer_main(void * arg);
+static int oftrace_merge_pick(struct oftrace_pipeline * top);
+static uint32_t oftrace_shard_of(pcap_record * rec, pcap_decoded * d);
+static void oftrace_learn_dpid(oftrace * oft, char * ofp, int ofplen);
 
 
 /**********************************************************
@@ -73,251 +206,703 @@ static int sanity_check_of_mesg(char * tmp,int tmplen);
  * 	and return a pointer to our oftrace context
  */
 oftrace * oftrace_open(char * filename)
+{
+	return oftrace_open_flags(filename,0);
+}
+
+/**********************************************************
+ * oftrace * oftrace_open_follow(char * filename)
+ * 	like oftrace_open(), but at the end of the file wait for
+ * 	more to be written, and move on to the next file when
+ * 	tcpdump -C/-G rotates
+ */
+oftrace * oftrace_open_follow(char * filename)
+{
+	return oftrace_open_flags(filename,PCAP_READER_FOLLOW);
+}
+
+/**********************************************************
+ * static oftrace * oftrace_open_flags(char * filename, int flags)
+ */
+static oftrace * oftrace_open_flags(char * filename, int flags)
+{
+	oftrace * oft;
+	pcap_reader * pr;
+
+	pr = pcap_reader_open(filename,flags);
+	if(!pr)
+		return NULL;
+	if(oftrace_check_linktype(pr,filename))
+	{
+		pcap_reader_close(pr);
+		return NULL;
+	}
+	oft = oftrace_new();
+	oft->reader=pr;
+	return oft;
+}
+
+/**********************************************************
+ * oftrace * oftrace_open_multi(char ** pcapfiles, int n_files, const double * clock_offsets)
+ * 	open several captures (each entry may be a glob pattern) and
+ * 	read them as one, merged by timestamp
+ */
+oftrace * oftrace_open_multi(char ** pcapfiles, int n_files, const double * clock_offsets)
+{
+	oftrace * oft;
+	pcap_merge * pm;
+	int i;
+
+	pm = pcap_merge_open(pcapfiles,n_files,clock_offsets);
+	if(!pm)
+		return NULL;
+	for(i=0;i<pm->n_readers;i++)
+		if(oftrace_check_linktype(pm->readers[i],pm->readers[i]->filename))
+		{
+			pcap_merge_close(pm);
+			return NULL;
+		}
+	oft = oftrace_new();
+	oft->merge=pm;
+	return oft;
+}
+
+/**********************************************************
+ * int oftrace_build_index(char * pcapfile, char * indexfile, uint32_t ip, int port, double bucket_secs)
+ * 	run the whole trace through oftrace_next_msg() once, noting
+ * 	which records belong to which session and checkpointing the
+ * 	sessions at the start of every time bucket
+ */
+int oftrace_build_index(char * pcapfile, char * indexfile, uint32_t ip, int port, double bucket_secs)
 {
 	oftrace * oft;
-	FILE * pcap;
+	char * name;
 	int err;
-	oft = malloc_and_check(sizeof(oftrace));
-	bzero(oft,sizeof(oftrace));
 
-        if(filename==NULL) {
-            pcap = stdin;
-            filename = "(stdin)";
-        } else {
-            pcap = fopen(filename,"r");
-        }
+	oft = oftrace_open(pcapfile);
+	if(!oft)
+		return -1;
+	if(oft->reader->dc || oft->reader->size == 0)
+	{
+		fprintf(stderr,"Can't index %s: only uncompressed trace files can be indexed\n",pcapfile);
+		oftrace_free(oft);
+		return -1;
+	}
+	if(bucket_secs <= 0)
+		bucket_secs = OFTRACE_INDEX_BUCKET_SECS;
+	oft->build = pcap_index_builder_new((int64_t) (bucket_secs * NSEC_PER_SEC),ip,port);
+	while(oftrace_next_msg(oft,ip,port) != NULL)
+		;
+	name = oftrace_index_name(pcapfile,indexfile);
+	err = pcap_index_write(oft->build,name,pcapfile);
+	free(name);
+	oftrace_free(oft);
+	return err;
+}
+
+/**********************************************************
+ * oftrace * oftrace_open_indexed(char * pcapfile, char * indexfile)
+ */
+oftrace * oftrace_open_indexed(char * pcapfile, char * indexfile)
+{
+	oftrace * oft;
+	pcap_index * pi;
+	pcap_record rec;
+	char * name;
 
-	if(!pcap)
+	oft = oftrace_open(pcapfile);
+	if(!oft)
+		return NULL;
+	name = oftrace_index_name(pcapfile,indexfile);
+	pi = pcap_index_open(name,pcapfile);
+	free(name);
+	oft->index = pi;
+	if(!pi || oft->reader->dc)
 	{
-		fprintf(stderr,"Failed to open %s ; exiting\n",filename);
-		perror("fopen");
+		if(pi)
+			fprintf(stderr,"Can't use an index on compressed trace %s\n",pcapfile);
+		oftrace_free(oft);
 		return NULL;
 	}
-	err = fread(&oft->ghdr, sizeof(oft->ghdr),1,pcap);
-	if(err != 1)
+	// pcapng interfaces are described up front; read past them
+	// 	once so that we can jump straight to any packet later
+	if(oft->reader->format == PCAP_FORMAT_PCAPNG && pcap_reader_next(oft->reader,&rec) >= 0)
+		pcap_reader_rewind(oft->reader);
+	return oft;
+}
+
+/**********************************************************
+ * static char * oftrace_index_name(char * pcapfile, char * indexfile)
+ * 	return a malloc'ed copy of indexfile, or of the default name
+ */
+static char * oftrace_index_name(char * pcapfile, char * indexfile)
+{
+	char * name;
+	if(indexfile)
+		return strdup(indexfile);
+	name = malloc_and_check(strlen(pcapfile) + strlen(PCAP_INDEX_SUFFIX) + 1);
+	sprintf(name,"%s%s",pcapfile,PCAP_INDEX_SUFFIX);
+	return name;
+}
+
+/**********************************************************
+ * int oftrace_select(oftrace * oft, uint32_t ip1, int port1, uint32_t ip2, int port2, double start, double end)
+ * 	limit what oftrace_next_msg() returns to one connection (if
+ * 	ip1 is not 0) and/or a time window, using the index
+ */
+int oftrace_select(oftrace * oft, uint32_t ip1, int port1, uint32_t ip2, int port2, double start, double end)
+{
+	assert(oft);
+	if(!oft->index)
+	{
+		fprintf(stderr,"oftrace_select() needs a trace opened with oftrace_open_indexed()\n");
+		return -1;
+	}
+	oftrace_pipeline_stop(oft);
+	bzero(&oft->sel,sizeof(oft->sel));
+	oft->sel.ip1 = ip1;
+	oft->sel.port1 = port1;
+	oft->sel.ip2 = ip2;
+	oft->sel.port2 = port2;
+	oft->sel.start = start;
+	oft->sel.end = end;
+	oft->sel.active = 1;
+	return oftrace_apply_selection(oft);
+}
+
+/**********************************************************
+ * static int oftrace_apply_selection(oftrace * oft)
+ * 	find the bucket the window starts in, recreate the sessions
+ * 	from its checkpoints, and position the reader at the oldest
+ * 	record that still had bytes queued at that point
+ */
+static int oftrace_apply_selection(oftrace * oft)
+{
+	struct oftrace_selection * sel = &oft->sel;
+	pcap_index * pi = oft->index;
+	pcap_index_bucket * b;
+	pcap_index_ckpt * c;
+	pcap_index_session * s;
+	off_t off;
+	int i, j, bucket, last;
+
+	oftrace_reset_sessions(oft);
+	sel->n_conn = 0;
+	if(sel->ip1 != 0)
+	{
+		i = pcap_index_find_session(pi,sel->ip1,sel->ip2,htons(sel->port1),htons(sel->port2));
+		if(i >= 0)
+			sel->conn[sel->n_conn++] = i;
+		i = pcap_index_find_session(pi,sel->ip2,sel->ip1,htons(sel->port2),htons(sel->port1));
+		if(i >= 0)
+			sel->conn[sel->n_conn++] = i;
+		if(sel->n_conn == 0)
+			fprintf(stderr,"WARN: the index has no connection like that\n");
+	}
+	sel->start_nsec = (int64_t) (sel->start * NSEC_PER_SEC);
+	sel->end_nsec = (sel->end > 0) ? (int64_t) (sel->end * NSEC_PER_SEC) : 0;
+	sel->stop_off = 0;
+	if(pi->hdr->n_buckets == 0)	// empty trace
+		return pcap_reader_rewind(oft->reader);
+	bucket = pcap_index_find_bucket(pi,sel->start_nsec);
+	if(sel->end_nsec)
 	{
-		fprintf(stderr," Short file read on pcap global header!\n");
-		perror("fread");
-		return NULL;
+		last = pcap_index_find_bucket(pi,sel->end_nsec);
+		if(last + 1 < pi->hdr->n_buckets)
+			sel->stop_off = pi->buckets[last + 1].offset;
+	}
+	b = &pi->buckets[bucket];
+	sel->warm_off = off = b->offset;
+	for(i=0;i<b->n_ckpts;i++)
+	{
+		c = &pi->ckpts[b->first_ckpt + i];
+		for(j=0;j<sel->n_conn;j++)
+			if(sel->conn[j] == c->session)
+				break;
+		if(sel->ip1 != 0 && j == sel->n_conn)
+			continue;	// not part of the selected connection
+		s = &pi->sessions[c->session];
+		tcp_session_add(&oft->sessions,tcp_session_resume(s->sip,s->dip,s->sport,s->dport,c->seqno));
+		off = MIN(off,(off_t) c->offset);
+	}
+	for(j=0;j<sel->n_conn;j++)
+		sel->cur[j] = pcap_index_find_rec(pi,sel->conn[j],off);
+	return pcap_reader_seek(oft->reader,off);
+}
+
+/**********************************************************
+ * void oftrace_close(oftrace * oft)
+ */
+void oftrace_close(oftrace * oft)
+{
+	assert(oft);
+	oftrace_free(oft);
+}
+
+/**********************************************************
+ * static void oftrace_free(oftrace * oft)
+ */
+static void oftrace_free(oftrace * oft)
+{
+	oftrace_pipeline_stop(oft);
+	oftrace_reset_sessions(oft);
+	pcap_reader_close(oft->reader);
+	pcap_merge_close(oft->merge);
+	pcap_index_close(oft->index);
+	pcap_index_builder_free(oft->build);
+	tcp_session_table_free(&oft->sessions);
+	if(oft->batch)
+		free(oft->batch);
+	ofp_filter_free(oft->filter);
+	pcap_bpf_free(oft->bpf);
+	tcp_endpoints_free(oft->controllers);
+	free(oft);
+}
+
+/**********************************************************
+ * static oftrace * oftrace_new(void)
+ */
+static oftrace * oftrace_new(void)
+{
+	oftrace * oft;
+	oft = malloc_and_check(sizeof(oftrace));
+	bzero(oft,sizeof(oftrace));
+	tcp_session_table_init(&oft->sessions);
+	oft->warned_linktype = -1;
+	oft->mem_budget = OFTRACE_MEM_BUDGET;
+	oft->idle_nsec = (int64_t) OFTRACE_IDLE_TIMEOUT * NSEC_PER_SEC;
+	return oft;
+}
+
+/**********************************************************
+ * static int oftrace_check_linktype(pcap_reader * pr, char * filename)
+ * 	pcapng link types are per interface, so those get checked per packet
+ */
+static int oftrace_check_linktype(pcap_reader * pr, char * filename)
+{
+	if(pr->format == PCAP_FORMAT_PCAP && pr->link == NULL)
+	{
+		fprintf(stderr,"Unsupported link type %u in %s: only ethernet, linux cooked, raw ip and loopback captures are handled\n",
+				pr->ghdr.network, filename);
+		return -1;
 	}
-	if(oft->ghdr.magic_number != PCAP_MAGIC)	// make sure the magic number is right
+	return 0;
+}
+
+/**********************************************************
+ * static int oftrace_next_record(oftrace * oft, pcap_record * rec)
+ */
+static int oftrace_next_record(oftrace * oft, pcap_record * rec)
+{
+	if(oft->merge)
+		return pcap_merge_next(oft->merge,rec);
+	if(oft->sel.active)
+		return oftrace_next_selected(oft,rec);
+	if(oft->range_end)
+		return oftrace_past_end(oft,rec);
+	return pcap_reader_next(oft->reader,rec);
+}
+
+/**********************************************************
+ * static int oftrace_next_kept(oftrace * oft, uint32_t ip, int port, pcap_record * rec, pcap_decoded * d)
+ * 	the next record that gets past oftrace_prefilter(), from the
+ * 	parser thread if there is one; either way it stays valid until
+ * 	the next call
+ * 	return 1 if found, 0 at the end (or on error)
+ */
+static int oftrace_next_kept(oftrace * oft, uint32_t ip, int port, pcap_record * rec, pcap_decoded * d)
+{
+	struct oftrace_pipeline * pipe = oft->pipe;
+	oftrace_stage_rec * sr;
+	int keep;
+
+	if(pipe)
 	{
-		if(oft->ghdr.magic_number == PCAP_BACKWARDS_MAGIC)
+		if(pipe->have_rec)
 		{
-			fprintf(stderr,"The pcap magic number is backwards: byte ordering issues?\n");
+			// framing only gets here once the last record's messages
+			// 	have all been passed on
+			spsc_ring_release(pipe->records);
+			__atomic_store_n(&pipe->done,pipe->seq,__ATOMIC_SEQ_CST);
+			if(pipe->top)
+				oftrace_pipeline_poke(pipe->top);
 		}
-		else
+		pipe->have_rec = 0;
+		if((sr = spsc_ring_peek(pipe->records)) == NULL)
+			return 0;
+		pipe->have_rec = 1;
+		pipe->seq = sr->seq;
+		*rec = sr->rec;
+		*d = sr->d;
+		return 1;
+	}
+	do
+	{
+		oft->packet_count++;
+		if(oftrace_next_record(oft,rec) < 1)
+			return 0;
+		keep = oftrace_prefilter(oft,rec,ip,port,d);
+		if(oft->build)
+			oftrace_index_bucket(oft,rec);
+	} while(!keep);	// not tcp data to or from a controller
+	return 1;
+}
+
+/**********************************************************
+ * static int oftrace_past_end(oftrace * oft, pcap_record * rec)
+ * 	past range_end, the sessions there were are followed until they
+ * 	hand off (see oftrace_handed_off()), or for OFTRACE_RANGE_SLACK
+ * 	bytes at most
+ */
+static int oftrace_past_end(oftrace * oft, pcap_record * rec)
+{
+	int err;
+
+	err = pcap_reader_next(oft->reader,rec);
+	if(err < 1 || rec->offset < oft->range_end)
+		return err;
+	oft->past_end = 1;
+	if(oft->sessions.n_sessions == 0 || rec->offset - oft->range_end > OFTRACE_RANGE_SLACK)
+		return 0;
+	return 1;
+}
+
+/**********************************************************
+ * static int oftrace_handed_off(oftrace * oft)
+ * 	past the range, oft->curr is followed while it has bytes queued
+ * 	from a record before range_end, or whole messages held up behind
+ * 	them; after that, the next range picks up the stream where its
+ * 	own records start.  With oftrace_set_handoff(), only once the
+ * 	next range is known to have the message just returned: it may
+ * 	not find a message boundary until well past its first record
+ */
+static int oftrace_handed_off(oftrace * oft)
+{
+	struct ofp_header * ofph;
+	char * ofp;
+	off_t off;
+	int avail;
+
+	if(!oft->past_end || oft->curr == NULL)
+		return 0;
+	if(oft->taken)
+		return oft->taken(&oft->msg,oft->taken_ctx);
+	if(oft->fast_len == 0)
+	{
+		off = tcp_session_queued_offset(oft->curr);
+		if(off >= 0 && off < oft->range_end)
+			return 0;
+	}
+	avail = oftrace_peek(oft,&ofp);
+	if(avail < sizeof(struct ofp_header))
+		return 1;
+	ofph = (struct ofp_header *) ofp;
+	return avail < ntohs(ofph->length);
+}
+
+/**********************************************************
+ * static int oftrace_next_selected(oftrace * oft, pcap_record * rec)
+ * 	for one connection, jump from one of its records to the next;
+ * 	otherwise read on until the bucket after the window
+ */
+static int oftrace_next_selected(oftrace * oft, pcap_record * rec)
+{
+	struct oftrace_selection * sel = &oft->sel;
+	pcap_index * pi = oft->index;
+	uint64_t * recs[2];
+	int i, pick, err;
+	int64_t t;
+	off_t off;
+
+	for(;;)
+	{
+		if(sel->ip1 != 0)
 		{
-			fprintf(stderr,"Got %u for pcap magic number: are you sure this is a pcap file?\n",
-					oft->ghdr.magic_number);
+			pick = -1;
+			for(i=0;i<sel->n_conn;i++)
+			{
+				recs[i] = &pi->recs[pi->sessions[sel->conn[i]].first_rec];
+				if(sel->cur[i] < pi->sessions[sel->conn[i]].n_recs &&
+						(pick < 0 || recs[i][sel->cur[i]] < recs[pick][sel->cur[pick]]))
+					pick = i;
+			}
+			if(pick < 0)
+				return 0;	// no more records for this connection
+			off = recs[pick][sel->cur[pick]++];
+			if(sel->stop_off && off >= sel->stop_off)
+				return 0;
+			if(pcap_reader_seek(oft->reader,off))
+				return -1;
 		}
-		return NULL;
+		err = pcap_reader_next(oft->reader,rec);
+		if(err < 1)
+			return err;
+		if(sel->stop_off && rec->offset >= sel->stop_off)
+			return 0;
+		t = (int64_t) rec->phdr.ts_sec * NSEC_PER_SEC + rec->ts_nsec;
+		if(sel->end_nsec && t > sel->end_nsec)
+			continue;
+		oft->warming = (rec->offset < sel->warm_off);
+		oft->early = (t < sel->start_nsec);
+		return 1;
 	}
-	assert(oft->ghdr.network == DLT_EN10MB || 	// currently, we only handle ethernet :-(
-			oft->ghdr.network == DLT_LINUX_SLL);	// or the LINUX link encap
-	oft->max_sessions = 10;			// will dynamically re-allocate - don't worry
-	oft->n_sessions=0;			// redundant with bzero()
-	oft->sessions = malloc_and_check(oft->max_sessions * sizeof(tcp_session));
-	oft->file=pcap;
-	oft->filename=strdup(filename);
-	return oft;
 }
 /**************************************************************************
- * int get_next_openflow_msg(oftrace *oft, int port)
- * 	keep reading until end_of_file or we find an openflow message;
- * 	if we find an openflow message, copy it into the databuf and fixup
- * 	the utility pointers
- *
- * 	if we get an out-of-order packet, enqueue it on the session and keep going
- *
+ * const openflow_msg * oftrace_next_msg(oftrace * oft, uint32_t ip, int port);
  * 	expects the caller not to modify info stored in mesg between calls
  * 	(that's why we have the const)
  *
  * 	if ip == 0.0.0.0 ; acts as a wildcard and matches all ips
  */
 const openflow_msg * oftrace_next_msg(oftrace * oft, uint32_t ip, int port)
+{
+	if(oftrace_pipeline_ready(oft,ip,port))
+		return oftrace_pipeline_next(oft);
+	if(!oftrace_next_frame(oft,ip,port,NULL))
+		return NULL;
+	return &oft->msg;
+}
+
+/**************************************************************************
+ * int oftrace_run(oftrace * oft, uint32_t ip, int port, const oftrace_handlers * handlers, void * ctx);
+ * 	oftrace_next_msg(), but only copying out the messages there's
+ * 	a handler for
+ */
+int oftrace_run(oftrace * oft, uint32_t ip, int port, const oftrace_handlers * handlers, void * ctx)
+{
+	const openflow_msg * m;
+	int count = 0;
+
+	assert(oft);
+	if(!oft->pipelined)
+		oft->want = handlers;	// the framer thread can outlive this call: check here
+	while((m = oftrace_next_msg(oft,ip,port)) != NULL)
+	{
+		if(oft->pipelined && !oftrace_handles(handlers,(char *) m->ofph,ntohs(m->ofph->length)))
+			continue;
+		count++;
+		if(handlers->handler[m->type](m,ctx))
+			break;	// asked to stop
+	}
+	if(!oft->pipelined)
+		oft->want = NULL;
+	return count;
+}
+
+/**************************************************************************
+ * int oftrace_next_batch(oftrace * oft, uint32_t ip, int port, oftrace_batch_msg * out, int max);
+ * 	the messages are packed into oft->batch, 8 byte aligned; stop
+ * 	early rather than risk a message not fitting, since moving the
+ * 	buffer would leave the earlier descriptors dangling
+ */
+int oftrace_next_batch(oftrace * oft, uint32_t ip, int port, oftrace_batch_msg * out, int max)
+{
+	const openflow_msg * m;
+	int n = 0;
+
+	assert(oft);
+	if(oft->batch == NULL)
+		oft->batch = malloc_and_check(OFTRACE_BATCH_BUF);
+	oft->batch_used = 0;
+	while(n < max && OFTRACE_BATCH_BUF - oft->batch_used >= 65536)	// biggest possible message
+	{
+		out[n].ofph = (struct ofp_header *) &oft->batch[oft->batch_used];
+		if(oftrace_pipeline_ready(oft,ip,port))
+		{
+			if((m = oftrace_pipeline_next(oft)) == NULL)
+				break;
+			memcpy((char *) out[n].ofph,m->ofph,ntohs(m->ofph->length));
+			oftrace_describe(m,&out[n],ntohs(m->ofph->length));
+		}
+		else if(!oftrace_next_frame(oft,ip,port,&out[n]))
+			break;
+		oft->batch_used += (out[n].length + 7) & ~7;
+		n++;
+	}
+	return n;
+}
+
+/**************************************************************************
+ * static int oftrace_next_frame(oftrace * oft, uint32_t ip, int port, oftrace_batch_msg * bm);
+ * 	keep reading until end_of_file or we find an openflow message;
+ * 	if we find an openflow message, copy it into the databuf and fixup
+ * 	the utility pointers; or, with bm, copy just the message to
+ * 	bm->ofph and describe it in bm.  The link/ip/tcp headers go in
+ * 	the databuf either way, for the next call's leftover messages
+ *
+ * 	if we get an out-of-order packet, enqueue it on the session and keep going
+ * 	return 1 if found, 0 at the end
+ */
+static int oftrace_next_frame(oftrace * oft, uint32_t ip, int port, oftrace_batch_msg * bm)
 {
 	int found=0;
-	int err;
 	int index;
 	openflow_msg * msg = &oft->msg;
 	struct ofp_header * ofph;
-	char tmp[BUFLEN];
-	int tmplen = 0;
-	int ip_packet_len=0;
+	char * ofp;	// view of the message, still in the session
+	int avail;
+	int ofplen = 0;
 	int payload_len=0;
+	pcap_record rec;
+	pcap_decoded d;
+	char * pkt;
+	struct oft_iphdr * iph = NULL;
+	struct oft_ip6hdr * ip6h = NULL;
+	struct oft_tcphdr * tcp;
+	tcp_session * rev;
+	int64_t now;
+	int wanted;
 
-	if(oft->curr)	// from previous call, are there multiple mesgs in this one tcp session?
-	{
-		tmplen = sizeof(struct ofp_header);
-		if(tcp_session_peek(oft->curr,tmp,tmplen)==1)		// check to see if there is another ofp header queued in the session
-		{
-			ofph = (struct ofp_header * ) tmp;
-			tmplen = ntohs(ofph->length);
-			if(tcp_session_peek(oft->curr,tmp,tmplen)==1)
-			{
-				// sigh, code duplication: FIXME
-				if(sanity_check_of_mesg(tmp,tmplen) == 0)
-				{
-					char srcbuf[BUFLEN];
-					char dstbuf[BUFLEN];
-					inet_ntop(AF_INET, &msg->ip->saddr, srcbuf, BUFLEN);
-					inet_ntop(AF_INET, &msg->ip->daddr, dstbuf, BUFLEN);
-					fprintf(stderr,"WARN: corrupted openflow control channel: giving up on %s:%d -> %s:%d\n",
-						srcbuf,
-						ntohs(msg->tcp->source),
-						dstbuf,
-						ntohs(msg->tcp->dest));
-					tcp_session_delete(oft->sessions,&oft->n_sessions,oft->curr);
-				}
-				else 
-				{
-					tcp_session_pull(oft->curr,tmplen);
-					index = sizeof(struct ether_header) + (msg->ip->ihl + msg->tcp->doff) * 4;
-					found = 1;
-					msg->captured = -1; 	// indicate that the true captured amount was lost in reconstruction
-				}
-			}
-		}
-	}
+	// from previous call, are there multiple mesgs in this one tcp session?
+	found = oftrace_next_queued(oft,bm,&ofplen,&index);
 	// go into this loop if we didn't find anything in the previous test
 	while(found == 0)
 	{
-		oft->packet_count++;
-		err= fread(&msg->phdr,sizeof(msg->phdr),1, oft->file);	// grab a header
-		if (err < 1)
-		{
-			if(!feof(oft->file))
-			{
-				fprintf(stderr,"short file reading header -- terminating\n");
-				perror("fread");
-			}
-			return NULL;	// not found; stop
-		}
+		oft->fast_len = 0;	// whatever was left went with a deleted session
+		if(!oftrace_next_kept(oft,ip,port,&rec,&d))	// grab a record; no copying
+			return 0;	// not found; stop
+		now = (int64_t) rec.phdr.ts_sec * NSEC_PER_SEC + rec.ts_nsec;
+		oft->curr = NULL;	// might be evicted
+		tcp_session_table_expire(&oft->sessions,now,oft->idle_nsec,oft->mem_budget);
+		// the record was decoded in place; only the headers of a record
+		// 	that completes a message get copied into msg->data
+		pkt = rec.data;
+		msg->phdr = rec.phdr;
+		msg->ts_nsec = rec.ts_nsec;
 		msg->captured = msg->phdr.incl_len;
-		err = fread(msg->data,1,msg->phdr.incl_len,oft->file);
-		if (err < msg->captured)
-		{
-			fprintf(stderr,"short file reading packet (%d bytes instead of %d) -- terminating\n",
-					err, msg->phdr.incl_len); 
-			perror("fread");
-			return NULL;	// not found; stop
-		}
-		index = 0;
-		// if linux link header, skip it
-		if(oft->ghdr.network == DLT_LINUX_SLL)	// linux_sll parsing
+		tcp = (struct oft_tcphdr * ) &pkt[d.tcp_off];
+		index = d.payload_off;
+		payload_len = d.payload_len;
+		if(d.ip_version == 4)
 		{
-			msg->linux_sll = (struct dlt_linux_sll *) &msg->data[index];
-			index += sizeof(struct dlt_linux_sll);
-			// hack in the ether type field
-			msg->ether= (struct oft_ethhdr * ) &msg->data[index-sizeof(struct oft_ethhdr)];
+			iph = (struct oft_iphdr * ) &pkt[d.net_off];
+			oft->curr = tcp_session_find(&oft->sessions,iph, tcp);
 		}
-		else // ethernet parsing
-		{
-			msg->linux_sll = NULL;
-			msg->ether = (struct oft_ethhdr *) &msg->data[index];
-			index+=sizeof(struct ether_header);
-		}
-		if(msg->ether->ether_type != htons(ETHERTYPE_IP))
-			continue;		// ether frame doesn't contain IP
-		if( msg->captured < index)
+		else
 		{
-			fprintf(stderr, "captured partial ethernet frame -- skipping (but weird)\n");
-			continue;
+			ip6h = (struct oft_ip6hdr * ) &pkt[d.net_off];
+			oft->curr = tcp_session_find6(&oft->sessions,ip6h->saddr,ip6h->daddr,tcp);
 		}
-		// IP parsing
-		msg->ip = (struct oft_iphdr * ) &msg->data[index];
-		if(msg->ip->version != 4)
+		if(oft->curr == NULL)
 		{
-			fprintf(stderr, "captured non-ipv4 ip packet (%d) -- skipping (but weird)\n",msg->ip->version);
-			continue;
+			if(oft->warming || oft->past_end)
+				continue;	// before the checkpoint, or past the range: only sessions it had matter
+			// new session
+			if(d.ip_version == 4)
+				oft->curr = tcp_session_new(iph,tcp);
+			else
+				oft->curr = tcp_session_new6(ip6h->saddr,ip6h->daddr,tcp);
+			// one whose queued bytes an eviction threw away is likely
+			// 	coming back mid-message
+			oft->curr->resync = oft->resync || tcp_session_was_evicted(&oft->sessions,oft->curr);
+			if(oft->build)
+				oft->curr->index_id = pcap_index_session_id(oft->build,
+						oft->curr->sip,oft->curr->dip,tcp->source,tcp->dest);
+			oft->curr->mid_range = oft->mid_range;
+			tcp_session_add(&oft->sessions,oft->curr);
+			if((rev = tcp_session_find_reverse(&oft->sessions,oft->curr)) != NULL)
+				oft->curr->dpid = rev->dpid;
 		}
-		if(msg->ip->protocol != IPPROTO_TCP)
-			continue; 	// not a tcp packet
-		ip_packet_len = ntohs(msg->ip->tot_len);
-		index += 4 * msg->ip->ihl;
-		if( msg->captured < index)
+		tcp_session_touch(&oft->sessions,oft->curr,now);
+		if(msg->captured <= index)
+			continue;	// tcp packet has no payload (e.g., an ACK)
+		if(oft->past_end && !oft->taken && tcp_session_is_empty(oft->curr) && ntohl(tcp->seq) == oft->curr->seqno)
 		{
-			fprintf(stderr, "captured partial ip packet -- skipping (but weird)\n");
+			// nothing missing from before the end: the next range has it all
+			tcp_session_delete(&oft->sessions,oft->curr);
+			oft->curr = NULL;
 			continue;
 		}
-		// TCP parsing
-		msg->tcp = (struct oft_tcphdr * ) &msg->data[index];
-		index += msg->tcp->doff*4;
-		payload_len = ip_packet_len - 4*(msg->ip->ihl + msg->tcp->doff);
-		if(payload_len <=0)
-			continue;	// skip if the only thing left is an ethernet trailer
-
-		// Is this to or from the controller?
-		if ( ip == 0 ) // do we care about the controller's ip?
+		if(oft->build)
+			pcap_index_add_rec(oft->build,oft->curr->index_id,rec.offset);
+		if(!oft->curr->resync && tcp_session_is_empty(oft->curr) &&
+				ntohl(tcp->seq) == oft->curr->seqno &&
+				payload_len <= msg->captured-index)
 		{
-			if(port!= 0 && msg->tcp->source != htons(port) &&
-					msg->tcp->dest != htons(port))
-				continue;	// not to/from the controller
+			// fast path: the next bytes of a stream with nothing
+			// queued; frame messages in place, and only queue
+			// what's left of the last one
+			oft->fast = &pkt[index];
+			oft->fast_len = payload_len;
+			oft->fast_off = rec.offset;
 		}
-		else if (port == 0)
-		{
-			if ((msg->ip->saddr != ip) && (msg->ip->daddr != ip)) 
-				continue;	// not to/from the controller; port = wildcard
-        }
-			else if((!(msg->ip->saddr == ip && msg->tcp->source == htons(port))) &&
-					(! (msg->ip->daddr == ip && msg->tcp->dest == htons(port))))
-				continue;	// not to/from the controller; port = specified
-
-		oft->curr = tcp_session_find(oft->sessions,oft->n_sessions,msg->ip, msg->tcp);
-		if(oft->curr == NULL)
+		else
 		{
-			// new session
-			oft->curr = tcp_session_new(msg->ip,msg->tcp);
-			oft->sessions[oft->n_sessions++]=oft->curr;	// add to list
-			if(oft->n_sessions>= oft->max_sessions)		// grow list if need be
-			{
-				oft->max_sessions*=2;
-				oft->sessions=realloc_and_check(oft->sessions, sizeof(tcp_session)*oft->max_sessions);
-			}
+			// add this data to the sessions' tcp stream
+			tcp_session_add_frag(oft->curr,ntohl(tcp->seq),
+					&pkt[index],	
+					MIN(payload_len,msg->captured-index),
+					payload_len, rec.offset);
+			if(oft->curr->resync && !tcp_session_resync(oft->curr))
+				continue;	// no message boundary yet
 		}
-		if(msg->captured <= index)
-			continue;	// tcp packet has no payload (e.g., an ACK)
-		// add this data to the sessions' tcp stream
-		tcp_session_add_frag(oft->curr,ntohl(msg->tcp->seq),
-				&msg->data[index],	
-				MIN(payload_len,msg->captured-index),
-				payload_len);
-		tmplen = sizeof(struct ofp_header);
-		if(tcp_session_peek(oft->curr,tmp,tmplen)!=1)		// check to see if there is another ofp header queued in the session
+		avail = oftrace_peek(oft,&ofp);
+		if(avail < sizeof(struct ofp_header))		// check to see if there is another ofp header queued in the session
 			continue;
-		ofph = (struct ofp_header * ) tmp;
-		tmplen = ntohs(ofph->length);
-		if(tcp_session_peek(oft->curr,tmp,tmplen)!=1)		// does there exist a full openflow msg buffered?
+		ofph = (struct ofp_header * ) ofp;
+		ofplen = ntohs(ofph->length);
+		if(avail < ofplen)		// does there exist a full openflow msg buffered?
 			continue;
 		// sigh, code duplication: FIXME
-		if(sanity_check_of_mesg(tmp,tmplen)== 0)
+		if(sanity_check_of_mesg(ofp,ofplen)== 0)
 		{
 			char srcbuf[BUFLEN];
 			char dstbuf[BUFLEN];
-			inet_ntop(AF_INET, &msg->ip->saddr, srcbuf, BUFLEN);
-			inet_ntop(AF_INET, &msg->ip->daddr, dstbuf, BUFLEN);
+			tcp_session_ntop(oft->curr, srcbuf, dstbuf, BUFLEN);
 			fprintf(stderr,"WARN: corrupted openflow control channel: giving up on %s:%d -> %s:%d\n",
 				srcbuf,
-				ntohs(msg->tcp->source),
+				ntohs(tcp->source),
 				dstbuf,
-				ntohs(msg->tcp->dest));
-			tcp_session_delete(oft->sessions,&oft->n_sessions,oft->curr);
+				ntohs(tcp->dest));
+			tcp_session_delete(&oft->sessions,oft->curr);
+			oft->curr = NULL;
 		}
 		else
 		{
-			if(OFTRACE_DELETE_FLOW == tcp_session_pull(oft->curr,tmplen))
-				tcp_session_delete(oft->sessions,&oft->n_sessions,oft->curr);
-			else if(msg->tcp->rst || msg->tcp->fin)
-				tcp_session_close(oft->sessions,&oft->n_sessions,oft->curr);	// mark the session "close on empty"
-			found =1;
+			// copy just the link/ip/tcp headers out of the record, and
+			// the message out of the session, before the pull can free it
+			memcpy(msg->data,pkt,index);
+			oftrace_learn_dpid(oft,ofp,ofplen);
+			wanted = oftrace_wanted(oft,ofp,ofplen);
+			if(wanted)	// otherwise, just frame it
+				memcpy(bm ? (char *) bm->ofph : &msg->data[index],ofp,ofplen);
+			msg->linux_sll = (rec.linktype == DLT_LINUX_SLL) ? (struct dlt_linux_sll *) msg->data : NULL;
+			msg->ether = (d.link_off >= 0) ? (struct oft_ethhdr *) &msg->data[d.link_off] : NULL;
+			msg->ip = (d.ip_version == 4) ? (struct oft_iphdr *) &msg->data[d.net_off] : NULL;
+			msg->ip6 = (d.ip_version == 6) ? (struct oft_ip6hdr *) &msg->data[d.net_off] : NULL;
+			msg->tcp = (struct oft_tcphdr *) &msg->data[d.tcp_off];
+			msg->seq = oft->curr->seqno;
+			if(OFTRACE_DELETE_FLOW == oftrace_pull(oft,ofplen) || oftrace_handed_off(oft))
+			{
+				tcp_session_delete(&oft->sessions,oft->curr);
+				oft->curr = NULL;
+			}
+			else if(tcp->rst || tcp->fin)
+			{
+				if(oft->fast_len > 0)
+					oft->curr->close_on_empty = 1;	// more messages in this segment
+				else if(tcp_session_close(&oft->sessions,oft->curr))	// mark the session "close on empty"
+					oft->curr = NULL;	// was already empty, so it's gone
+			}
+			found = wanted;
+			if(oft->warming || oft->early)
+			{
+				// reassembled, but not what was asked for
+				oftrace_skip_queued(oft);
+				found = 0;
+			}
+			else if(!found)	// maybe the segment held one that is wanted
+				found = oftrace_next_queued(oft,bm,&ofplen,&index);
 		}
 	}
 	assert(found==1);
-	assert(tmplen>0);
-	// OFP parsing; new mesg is in tmp[] of length tmpbuf; index is set to the point to write the
-	// 	next packet
-	memcpy(&msg->data[index],tmp,tmplen);	// put new data into place
+	assert(ofplen>0);
+	if(bm)
+	{
+		oftrace_describe(msg,bm,ofplen);
+		return 1;
+	}
+	// OFP parsing; new mesg is already at msg->data[index], ofplen long
 	msg->ofph = (struct ofp_header * ) &msg->data[index];	// set convenience ptr
 	// use the packet_in entry, even though
 	// it doesn't really matter; it works for all openflow msg types b/c it's a union
@@ -337,43 +922,1008 @@ const openflow_msg * oftrace_next_msg(oftrace * oft, uint32_t ip, int port)
 			msg->embedded_packet=NULL;
 	};
 	// done parsing; found a msg to return!
-	return msg;
+	return 1;
 }
 
 
 /******************************************************
- * int oftrace_rewind(oftrace * oft);
- * 	rewind to the top of the file
+ * static void oftrace_describe(const openflow_msg * msg, oftrace_batch_msg * bm, int ofplen)
+ * 	fill in bm for the message already at bm->ofph, which came
+ * 	in the packet whose headers are in msg
  */
-
-int oftrace_rewind(oftrace * oft)
+static void oftrace_describe(const openflow_msg * msg, oftrace_batch_msg * bm, int ofplen)
 {
-	assert(oft);
-	rewind(oft->file);
-	oft->curr=NULL;
-	oft->n_sessions=0;
-	return 0;
+	bm->ts_sec = msg->phdr.ts_sec;
+	bm->ts_nsec = msg->ts_nsec;
+	if(msg->ip)
+	{
+		bm->sip = msg->ip->saddr;
+		bm->dip = msg->ip->daddr;
+		bm->ip6 = 0;
+	}
+	else
+	{
+		bm->sip = tcp_session_addr6(msg->ip6->saddr);
+		bm->dip = tcp_session_addr6(msg->ip6->daddr);
+		bm->ip6 = 1;
+		memcpy(bm->sip6,msg->ip6->saddr,sizeof(bm->sip6));
+		memcpy(bm->dip6,msg->ip6->daddr,sizeof(bm->dip6));
+	}
+	bm->sport = msg->tcp->source;
+	bm->dport = msg->tcp->dest;
+	bm->xid = ntohl(bm->ofph->xid);
+	bm->length = ofplen;
+	bm->type = bm->ofph->type;
 }
 
-
-/************************************************
- * double oftrace_progress(oftrace *oft);
- * 	return the fraction of the file processed
+/******************************************************
+ * static int oftrace_prefilter(oftrace * oft, pcap_record * rec, uint32_t ip, int port, pcap_decoded * d)
+ * 	decode rec in place with its link type's decoder, before any
+ * 	other per record work, and throw out anything that isn't tcp
+ * 	data to or from a controller, or doesn't pass the packet
+ * 	filter, if any.  Where the headers are goes in d
  */
-
-double oftrace_progress(oftrace *oft)
+static int oftrace_prefilter(oftrace * oft, pcap_record * rec, uint32_t ip, int port, pcap_decoded * d)
 {
-	struct stat sbuf;
-	long fpos = ftell(oft->file);
-	assert(oft);
-	if(stat(oft->filename,&sbuf))
-		return -2.0;	// stat failed for some reason.. which is pretty weird
-	return (double)fpos/ (double) sbuf.st_size;
-}
-
+	const uint8_t * p = (const uint8_t *) rec->data;
+	int caplen = rec->phdr.incl_len;
+	int err;
+	uint16_t sport, dport;
+	uint32_t saddr, daddr;
 
-/***************************************************
- * int oftrace_tcp_stats(oftrace *oft, int len, int *list);
+	oft->pre.packets++;
+	oft->pre.bytes += caplen;
+	if(rec->link == NULL)
+	{
+		if(rec->linktype != oft->warned_linktype)
+			fprintf(stderr,"WARN: skipping packets with unsupported link type %d\n",rec->linktype);
+		oft->warned_linktype = rec->linktype;
+		goto reject;
+	}
+	err = pcap_decode_tcp(rec->link,p,caplen,d);
+	if(err < 0)
+		fprintf(stderr, "captured partial ip packet -- skipping (but weird)\n");
+	if(err <= 0)
+		goto reject;
+	memcpy(&sport,&p[d->tcp_off],sizeof(sport));
+	memcpy(&dport,&p[d->tcp_off + 2],sizeof(dport));
+	if(d->ip_version == 4)
+	{
+		memcpy(&saddr,&p[d->net_off + offsetof(struct oft_iphdr,saddr)],sizeof(saddr));
+		memcpy(&daddr,&p[d->net_off + offsetof(struct oft_iphdr,daddr)],sizeof(daddr));
+	}
+	else	// the stand-ins, which only a port can match
+	{
+		saddr = tcp_session_addr6(&p[d->net_off + offsetof(struct oft_ip6hdr,saddr)]);
+		daddr = tcp_session_addr6(&p[d->net_off + offsetof(struct oft_ip6hdr,daddr)]);
+	}
+	if(!oftrace_to_controller(oft,ip,port,saddr,sport,daddr,dport))
+		goto reject;
+	if(oft->bpf == NULL || pcap_bpf_match(oft->bpf,rec))
+		return 1;
+reject:
+	oft->pre.rejected++;
+	oft->pre.rejected_bytes += caplen;
+	return 0;
+}
+
+/******************************************************
+ * static int oftrace_to_controller(oftrace * oft, uint32_t ip, int port,
+ * 		uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport)
+ * 	is either end of the connection a controller: one of the set
+ * 	from oftrace_set_controllers(), or else ip and port, where 0
+ * 	is a wildcard?  Everything in network byte order but port
+ */
+static int oftrace_to_controller(oftrace * oft, uint32_t ip, int port,
+		uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport)
+{
+	if(oft->controllers)
+		return tcp_endpoints_match(oft->controllers,saddr,sport) ||
+			tcp_endpoints_match(oft->controllers,daddr,dport);
+	if(ip == 0)	// do we care about the controller's ip?
+		return port == 0 || sport == htons(port) || dport == htons(port);
+	if(port == 0)
+		return saddr == ip || daddr == ip;
+	return (saddr == ip && sport == htons(port)) || (daddr == ip && dport == htons(port));
+}
+
+/******************************************************
+ * int oftrace_rewind(oftrace * oft);
+ * 	rewind to the top of the file
+ */
+
+int oftrace_rewind(oftrace * oft)
+{
+	assert(oft);
+	oftrace_pipeline_stop(oft);
+	if(oft->merge)
+	{
+		if(pcap_merge_rewind(oft->merge))
+			return -1;
+	}
+	else if(oft->sel.active)
+		return oftrace_apply_selection(oft);
+	else if(pcap_reader_rewind(oft->reader))
+		return -1;	// reading from a pipe
+	oftrace_reset_sessions(oft);
+	return 0;
+}
+
+/******************************************************
+ * int oftrace_seek_time(oftrace * oft, double ts);
+ * 	jump to the first packet at or after ts without an index;
+ * 	the sessions start over from there
+ */
+
+int oftrace_seek_time(oftrace * oft, double ts)
+{
+	int64_t t = (int64_t) (ts * NSEC_PER_SEC);
+	assert(oft);
+	oftrace_pipeline_stop(oft);
+	if(oft->index)	// can do better than guessing
+		return oftrace_select(oft,0,0,0,0,ts,0);
+	if(oft->merge)
+	{
+		if(pcap_merge_seek_time(oft->merge,t))
+			return -1;
+	}
+	else if(pcap_reader_seek_time(oft->reader,t))
+		return -1;
+	oftrace_reset_sessions(oft);
+	oft->resync = 1;
+	return 0;
+}
+
+/******************************************************
+ * int oftrace_set_range(oftrace * oft, off_t start, off_t end);
+ */
+int oftrace_set_range(oftrace * oft, off_t start, off_t end)
+{
+	assert(oft);
+	oftrace_pipeline_stop(oft);
+	if(oft->merge || oft->sel.active || oft->build)
+		return -1;
+	if(start > 0)
+	{
+		if(pcap_reader_seek_record(oft->reader,start))
+			return -1;
+		oftrace_reset_sessions(oft);
+		oft->resync = 1;
+	}
+	oft->range_end = end;
+	oft->mid_range = (start > 0);
+	oft->past_end = 0;
+	return 0;
+}
+
+/******************************************************
+ * void oftrace_set_handoff(oftrace * oft, oftrace_taken_fn taken, void * ctx);
+ */
+void oftrace_set_handoff(oftrace * oft, oftrace_taken_fn taken, void * ctx)
+{
+	assert(oft);
+	oft->taken = taken;
+	oft->taken_ctx = ctx;
+}
+
+/******************************************************
+ * int oftrace_past_range(oftrace * oft);
+ */
+int oftrace_past_range(oftrace * oft)
+{
+	assert(oft);
+	return oft->past_end;
+}
+
+/******************************************************
+ * static int oftrace_next_queued(oftrace * oft, oftrace_batch_msg * bm, int * ofplen, int * index)
+ * 	the next wanted message already queued in oft->curr, if any,
+ * 	copied after the headers of the last one, which are still in
+ * 	msg->data (or to bm->ofph); unwanted ones are just framed
+ * 	return 1 if found, with its length and offset in msg->data
+ */
+static int oftrace_next_queued(oftrace * oft, oftrace_batch_msg * bm, int * ofplen, int * index)
+{
+	openflow_msg * msg = &oft->msg;
+	struct ofp_header * ofph;
+	char * ofp;
+	int avail, len, wanted;
+
+	while(oft->curr)
+	{
+		avail = oftrace_peek(oft,&ofp);
+		if(avail < sizeof(struct ofp_header))		// check to see if there is another ofp header queued in the session
+			return 0;
+		ofph = (struct ofp_header * ) ofp;
+		len = ntohs(ofph->length);
+		if(avail < len)
+			return 0;
+		// sigh, code duplication: FIXME
+		if(sanity_check_of_mesg(ofp,len) == 0)
+		{
+			char srcbuf[BUFLEN];
+			char dstbuf[BUFLEN];
+			tcp_session_ntop(oft->curr, srcbuf, dstbuf, BUFLEN);
+			fprintf(stderr,"WARN: corrupted openflow control channel: giving up on %s:%d -> %s:%d\n",
+				srcbuf,
+				ntohs(msg->tcp->source),
+				dstbuf,
+				ntohs(msg->tcp->dest));
+			tcp_session_delete(&oft->sessions,oft->curr);
+			oft->curr = NULL;
+			return 0;
+		}
+		oftrace_learn_dpid(oft,ofp,len);
+		wanted = !oft->warming && !oft->early && oftrace_wanted(oft,ofp,len);
+		*index = ((char *) msg->tcp - msg->data) + msg->tcp->doff * 4;
+		if(wanted)
+			memcpy(bm ? (char *) bm->ofph : &msg->data[*index],ofp,len);	// before the pull can free it
+		msg->seq = oft->curr->seqno;
+		if(OFTRACE_DELETE_FLOW == oftrace_pull(oft,len) || oftrace_handed_off(oft))
+		{
+			tcp_session_delete(&oft->sessions,oft->curr);
+			oft->curr = NULL;
+		}
+		if(wanted)
+		{
+			*ofplen = len;
+			msg->captured = -1; 	// indicate that the true captured amount was lost in reconstruction
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/******************************************************
+ * static int oftrace_wanted(oftrace * oft, char * ofp, int ofplen)
+ * 	does oftrace_run() have a handler for this message, and does
+ * 	it pass the filter?
+ */
+static int oftrace_wanted(oftrace * oft, char * ofp, int ofplen)
+{
+	if(oft->want && !oftrace_handles(oft->want,ofp,ofplen))
+		return 0;
+	return oft->filter == NULL || ofp_filter_match(oft->filter,ofp,ofplen,oft->curr->dpid);
+}
+
+/******************************************************
+ * static int oftrace_handles(const oftrace_handlers * h, char * ofp, int ofplen)
+ * 	is there a handler for this message in h, and, if it asks for
+ * 	one, the right ether type in its embedded frame?
+ */
+static int oftrace_handles(const oftrace_handlers * h, char * ofp, int ofplen)
+{
+	struct ofp_header * ofph = (struct ofp_header *) ofp;
+	uint16_t ether_type;
+	int off;
+
+	if(ofph->type >= OFTRACE_MAX_TYPE || h->handler[ofph->type] == NULL)
+		return 0;
+	if(h->ether_type[ofph->type] == 0)
+		return 1;
+	if(ofph->type == OFPT_PACKET_IN)
+		off = offsetof(struct ofp_packet_in,data);
+	else if(ofph->type == OFPT_PACKET_OUT && ofplen >= sizeof(struct ofp_packet_out))
+		off = sizeof(struct ofp_packet_out) + ntohs(((struct ofp_packet_out *) ofp)->actions_len);
+	else
+		return 1;	// no embedded frame to check
+	off += 2 * ETH_ALEN;	// the ether type is just past the addresses
+	if(off + sizeof(ether_type) > ofplen)
+		return 0;
+	memcpy(&ether_type,&ofp[off],sizeof(ether_type));
+	return ntohs(ether_type) == h->ether_type[ofph->type];
+}
+
+/******************************************************
+ * static void oftrace_learn_dpid(oftrace * oft, char * ofp, int ofplen)
+ * 	note the datapath id in a FEATURES_REPLY on both directions of
+ * 	oft->curr's connection, for the filter's dpid field
+ */
+static void oftrace_learn_dpid(oftrace * oft, char * ofp, int ofplen)
+{
+	struct ofp_switch_features * osf = (struct ofp_switch_features *) ofp;
+	tcp_session * rev;
+	uint32_t half[2];
+	uint64_t dpid;
+
+	if(osf->header.type != OFPT_FEATURES_REPLY || ofplen < sizeof(struct ofp_switch_features))
+		return;
+	memcpy(half,&osf->datapath_id,sizeof(half));	// network byte order
+	dpid = ((uint64_t) ntohl(half[0]) << 32) | ntohl(half[1]);
+	oft->curr->dpid = dpid;
+	if((rev = tcp_session_find_reverse(&oft->sessions,oft->curr)) != NULL)
+		rev->dpid = dpid;
+}
+
+/******************************************************
+ * static void oftrace_skip_queued(oftrace * oft)
+ * 	silently consume any more whole messages in oft->curr, so that
+ * 	they aren't handed out later with the wrong record
+ */
+static void oftrace_skip_queued(oftrace * oft)
+{
+	char * ofp;
+	struct ofp_header * ofph;
+	int len;
+
+	while(oft->curr && oftrace_peek(oft,&ofp) >= sizeof(struct ofp_header))
+	{
+		ofph = (struct ofp_header *) ofp;
+		len = ntohs(ofph->length);
+		if(oftrace_peek(oft,&ofp) < len || sanity_check_of_mesg(ofp,len)==0)
+			return;		// not there yet; or corrupt, which the next call will deal with
+		oftrace_learn_dpid(oft,ofp,len);
+		if(OFTRACE_DELETE_FLOW == oftrace_pull(oft,len))
+		{
+			tcp_session_delete(&oft->sessions,oft->curr);
+			oft->curr = NULL;
+		}
+	}
+}
+
+/******************************************************
+ * static int oftrace_peek(oftrace * oft, char ** data)
+ * 	tcp_session_peek() on oft->curr, but for a fast path segment,
+ * 	point into the record as long as it holds a whole message;
+ * 	a trailing partial message gets queued in the session
+ */
+static int oftrace_peek(oftrace * oft, char ** data)
+{
+	struct ofp_header * ofph;
+
+	if(oft->fast_len > 0)
+	{
+		ofph = (struct ofp_header *) oft->fast;
+		if(oft->fast_len >= sizeof(struct ofp_header) && oft->fast_len >= ntohs(ofph->length))
+		{
+			*data = oft->fast;
+			return oft->fast_len;
+		}
+		tcp_session_add_frag(oft->curr,oft->curr->seqno,oft->fast,oft->fast_len,oft->fast_len,oft->fast_off);
+		oft->fast_len = 0;
+	}
+	return tcp_session_peek(oft->curr,data);
+}
+
+/******************************************************
+ * static int oftrace_pull(oftrace * oft, int len)
+ * 	tcp_session_pull() to go with oftrace_peek()
+ */
+static int oftrace_pull(oftrace * oft, int len)
+{
+	if(oft->fast_len > 0)
+	{
+		oft->fast += len;
+		oft->fast_len -= len;
+		return tcp_session_advance(oft->curr,len);
+	}
+	return tcp_session_pull(oft->curr,len);
+}
+
+/******************************************************
+ * static void oftrace_reset_sessions(oftrace * oft)
+ * 	forget all tcp state, e.g., before jumping somewhere else
+ */
+static void oftrace_reset_sessions(oftrace * oft)
+{
+	while(oft->sessions.n_sessions > 0)
+		tcp_session_delete(&oft->sessions,oft->sessions.list[0]);
+	oft->curr = NULL;
+	oft->fast_len = 0;
+	oft->warming = oft->early = oft->resync = 0;
+	oft->past_end = 0;
+	oft->mid_range = 0;
+}
+
+/******************************************************
+ * static void oftrace_index_bucket(oftrace * oft, pcap_record * rec)
+ * 	if rec starts a new time bucket, checkpoint every session;
+ * 	the sessions have no complete messages queued whenever we
+ * 	read a new record, so seqno is always a message boundary
+ */
+static void oftrace_index_bucket(oftrace * oft, pcap_record * rec)
+{
+	tcp_session * ts;
+	off_t off;
+	int i;
+
+	if(!pcap_index_start_bucket(oft->build,(int64_t) rec->phdr.ts_sec * NSEC_PER_SEC + rec->ts_nsec,rec->offset))
+		return;
+	for(i=0;i<oft->sessions.n_sessions;i++)
+	{
+		ts = oft->sessions.list[i];
+		off = tcp_session_queued_offset(ts);
+		pcap_index_add_ckpt(oft->build,ts->index_id,ts->seqno,off >= 0 ? off : rec->offset);
+	}
+}
+
+
+/************************************************
+ * double oftrace_progress(oftrace *oft);
+ * 	return the fraction of the file processed
+ */
+
+double oftrace_progress(oftrace *oft)
+{
+	assert(oft);
+	if(oft->merge)
+		return pcap_merge_progress(oft->merge);
+	return pcap_reader_progress(oft->reader);
+}
+
+
+/***************************************************
+ * void oftrace_set_limits(oftrace * oft, size_t mem_budget, double idle_secs);
+ * 	checked as each record is read, against its timestamp
+ */
+
+void oftrace_set_limits(oftrace * oft, size_t mem_budget, double idle_secs)
+{
+	assert(oft);
+	oft->mem_budget = mem_budget;
+	oft->idle_nsec = (idle_secs > 0) ? (int64_t) (idle_secs * NSEC_PER_SEC) : 0;
+}
+
+/***************************************************
+ * void oftrace_mem_stats_get(oftrace * oft, oftrace_mem_stats * stats);
+ */
+
+void oftrace_mem_stats_get(oftrace * oft, oftrace_mem_stats * stats)
+{
+	assert(oft);
+	stats->bytes = oft->sessions.mem;
+	stats->peak_bytes = oft->sessions.peak_mem;
+	stats->idle_evictions = oft->sessions.idle_evictions;
+	stats->budget_evictions = oft->sessions.budget_evictions;
+	stats->evicted_bytes = oft->sessions.evicted_bytes;
+	stats->spilled_bytes = tcp_spill_bytes(oft->sessions.spill);
+}
+
+/***************************************************
+ * int oftrace_set_spill(oftrace * oft, const char * dir, size_t threshold);
+ */
+
+int oftrace_set_spill(oftrace * oft, const char * dir, size_t threshold)
+{
+	assert(oft);
+	return tcp_session_table_spill(&oft->sessions,dir,threshold > 0 ? threshold : OFTRACE_SPILL_AFTER);
+}
+
+/***************************************************
+ * int oftrace_set_filter(oftrace * oft, const char * expr);
+ */
+
+int oftrace_set_filter(oftrace * oft, const char * expr)
+{
+	ofp_filter * f = NULL;
+
+	assert(oft);
+	if(expr && *expr && (f = ofp_filter_compile(expr)) == NULL)
+		return -1;	// keep the old one
+	ofp_filter_free(oft->filter);
+	oft->filter = f;
+	return 0;
+}
+
+/***************************************************
+ * int oftrace_set_prefilter(oftrace * oft, const char * expr);
+ */
+
+int oftrace_set_prefilter(oftrace * oft, const char * expr)
+{
+	pcap_bpf * bpf = NULL;
+
+	assert(oft);
+	if(expr && *expr && (bpf = pcap_bpf_compile(expr)) == NULL)
+		return -1;	// keep the old one
+	pcap_bpf_free(oft->bpf);
+	oft->bpf = bpf;
+	return 0;
+}
+
+/***************************************************
+ * int oftrace_set_controllers(oftrace * oft, const char * spec);
+ */
+
+int oftrace_set_controllers(oftrace * oft, const char * spec)
+{
+	tcp_endpoints * te = NULL;
+
+	assert(oft);
+	if(spec && *spec)
+	{
+		te = tcp_endpoints_new();
+		if(tcp_endpoints_parse(te,spec) < 0)
+		{
+			tcp_endpoints_free(te);
+			return -1;	// keep the old ones
+		}
+	}
+	tcp_endpoints_free(oft->controllers);
+	oft->controllers = te;
+	return 0;
+}
+
+/***************************************************
+ * int oftrace_set_pipeline(oftrace * oft, int n_framers);
+ */
+
+int oftrace_set_pipeline(oftrace * oft, int n_framers)
+{
+	assert(oft);
+	if(oft->pipe)
+		return -1;	// already going
+	oft->pipelined = MAX(n_framers,0);
+	return 0;
+}
+
+/***************************************************
+ * int oftrace_run_sharded(oftrace * oft, uint32_t ip, int port, int n_shards,
+ * 		const oftrace_handlers * handlers, void ** ctxs);
+ * 	this thread deals the records out, and each shard's framer
+ * 	calls the handlers for what it frames
+ */
+
+int oftrace_run_sharded(oftrace * oft, uint32_t ip, int port, int n_shards,
+		const oftrace_handlers * handlers, void ** ctxs)
+{
+	struct oftrace_pipeline * top;
+	oftrace * shard;
+	int i, count = 0;
+
+	assert(oft);
+	if(oft->pipe || n_shards < 2 || oft->sel.active || oft->build || oft->range_end)
+		return oftrace_run(oft,ip,port,handlers,ctxs[0]);
+	top = oft->pipe = oftrace_pipeline_new(oft,ip,port,n_shards);
+	for(i=0;i<n_shards;i++)
+	{
+		shard = top->shards[i];
+		shard->want = handlers;
+		shard->pipe->handlers = handlers;
+		shard->pipe->ctx = ctxs[i];
+	}
+	if(oftrace_pipeline_start(oft,0))
+		return oftrace_run(oft,ip,port,handlers,ctxs[0]);
+	oftrace_deal(oft);
+	for(i=0;i<n_shards;i++)
+	{
+		shard = top->shards[i];
+		pthread_join(shard->pipe->framer,NULL);
+		shard->pipe->has_framer = 0;
+		count += shard->pipe->count;
+	}
+	oftrace_pipeline_stop(oft);
+	return count;
+}
+
+/******************************************************
+ * static int oftrace_pipeline_ready(oftrace * oft, uint32_t ip, int port)
+ * 	start the parser and framer threads the first time they're
+ * 	needed; jumping around with an index, or stopping at the end
+ * 	of a range, needs the framer's sessions in step with the
+ * 	reader, so those stay in this thread
+ * 	return 1 if messages come from the pipeline
+ */
+static int oftrace_pipeline_ready(oftrace * oft, uint32_t ip, int port)
+{
+	if(oft->pipe)
+		return 1;
+	if(!oft->pipelined || oft->sel.active || oft->build || oft->range_end)
+		return 0;
+	oft->pipe = oftrace_pipeline_new(oft,ip,port,oft->pipelined > 1 ? oft->pipelined : 0);
+	if(oft->pipe->n_shards == 0)
+		oftrace_pipeline_rings(oft->pipe);
+	return oftrace_pipeline_start(oft,1) == 0;
+}
+
+/******************************************************
+ * static struct oftrace_pipeline * oftrace_pipeline_new(oftrace * oft, uint32_t ip, int port, int n_shards)
+ * 	a shard gets its own sessions, with its share of the memory
+ * 	budget, and shares the filter, which is only ever read
+ */
+static struct oftrace_pipeline * oftrace_pipeline_new(oftrace * oft, uint32_t ip, int port, int n_shards)
+{
+	struct oftrace_pipeline * pipe;
+	oftrace * shard;
+	int i;
+
+	pipe = malloc_and_check(sizeof(struct oftrace_pipeline));
+	bzero(pipe,sizeof(struct oftrace_pipeline));
+	pipe->ip = ip;
+	pipe->port = port;
+	pipe->copy = oft->merge != NULL || !pcap_reader_stable(oft->reader);
+	pipe->current = -1;
+	pthread_mutex_init(&pipe->lock,NULL);
+	pthread_cond_init(&pipe->progress,NULL);
+	pipe->n_shards = n_shards;
+	if(n_shards > 0)
+		pipe->shards = malloc_and_check(n_shards * sizeof(oftrace *));
+	for(i=0;i<n_shards;i++)
+	{
+		shard = pipe->shards[i] = oftrace_new();
+		shard->filter = oft->filter;
+		shard->mem_budget = oft->mem_budget / n_shards;
+		shard->idle_nsec = oft->idle_nsec;
+		shard->resync = oft->resync;
+		shard->pipe = oftrace_pipeline_new(oft,ip,port,0);
+		shard->pipe->top = pipe;
+		oftrace_pipeline_rings(shard->pipe);
+	}
+	return pipe;
+}
+
+/******************************************************
+ * static void oftrace_pipeline_rings(struct oftrace_pipeline * pipe)
+ * 	the rings into and out of one framer; records slots start out
+ * 	with no buffer
+ */
+static void oftrace_pipeline_rings(struct oftrace_pipeline * pipe)
+{
+	pipe->records = spsc_ring_new(OFTRACE_PIPELINE_RECORDS,sizeof(oftrace_stage_rec));
+	bzero(pipe->records->slots,pipe->records->n_slots * pipe->records->slot_size);
+	pipe->msgs = spsc_ring_new(OFTRACE_PIPELINE_MSGS,sizeof(oftrace_stage_msg));
+}
+
+/******************************************************
+ * static int oftrace_pipeline_start(oftrace * oft, int with_parser)
+ * 	the framers first: if something can't start, nothing has been
+ * 	read yet, and it all runs in this thread instead
+ * 	return 0 on success
+ */
+static int oftrace_pipeline_start(oftrace * oft, int with_parser)
+{
+	struct oftrace_pipeline * pipe = oft->pipe;
+	struct oftrace_pipeline * sp;
+	int i;
+
+	for(i=0;i<MAX(pipe->n_shards,1);i++)
+	{
+		sp = pipe->n_shards ? pipe->shards[i]->pipe : pipe;
+		if(pthread_create(&sp->framer,NULL,oftrace_framer_main,pipe->n_shards ? pipe->shards[i] : oft))
+			break;
+		sp->has_framer = 1;
+	}
+	if(i == MAX(pipe->n_shards,1) && with_parser &&
+			pthread_create(&pipe->parser,NULL,oftrace_parser_main,oft) == 0)
+		pipe->has_parser = 1;
+	if(i == MAX(pipe->n_shards,1) && (pipe->has_parser || !with_parser))
+		return 0;
+	fprintf(stderr,"WARN: couldn't start the decoding threads; decoding in this one\n");
+	oftrace_pipeline_stop(oft);
+	oft->pipelined = 0;
+	return -1;
+}
+
+/******************************************************
+ * static void oftrace_deal(oftrace * oft)
+ * 	read and prefilter records, and pass the ones that are kept
+ * 	on to the framer, or to the shard that their connection
+ * 	hashes to: in place if the reader leaves them where they are,
+ * 	copied into the slot otherwise
+ */
+static void oftrace_deal(oftrace * oft)
+{
+	struct oftrace_pipeline * pipe = oft->pipe;
+	struct oftrace_pipeline * to = pipe;
+	oftrace_stage_rec * sr;
+	pcap_record rec;
+	pcap_decoded d;
+	int i;
+
+	while(!__atomic_load_n(&pipe->stop,__ATOMIC_ACQUIRE))
+	{
+		oft->packet_count++;
+		if(oftrace_next_record(oft,&rec) < 1)
+			break;
+		if(!oftrace_prefilter(oft,&rec,pipe->ip,pipe->port,&d))
+			continue;
+		if(pipe->n_shards)
+			to = pipe->shards[oftrace_shard_of(&rec,&d) % pipe->n_shards]->pipe;
+		if((sr = spsc_ring_claim(to->records)) == NULL)
+			break;	// stopped
+		sr->seq = ++pipe->dealt;
+		sr->rec = rec;
+		sr->d = d;
+		if(pipe->copy)
+		{
+			if(sr->buf_size < rec.phdr.incl_len)
+			{
+				sr->buf_size = rec.phdr.incl_len;
+				sr->buf = realloc_and_check(sr->buf,sr->buf_size);
+			}
+			memcpy(sr->buf,rec.data,rec.phdr.incl_len);
+			sr->rec.data = sr->buf;
+		}
+		__atomic_store_n(&to->given,sr->seq,__ATOMIC_SEQ_CST);
+		spsc_ring_publish(to->records);
+	}
+	for(i=0;i<MAX(pipe->n_shards,1);i++)
+		spsc_ring_close(pipe->n_shards ? pipe->shards[i]->pipe->records : pipe->records);
+}
+
+/******************************************************
+ * static uint32_t oftrace_shard_of(pcap_record * rec, pcap_decoded * d)
+ * 	both directions of a connection go to the same shard, which
+ * 	then has the datapath id for both
+ */
+static uint32_t oftrace_shard_of(pcap_record * rec, pcap_decoded * d)
+{
+	const uint8_t * p = (const uint8_t *) rec->data;
+	uint32_t saddr, daddr;
+	uint16_t sport, dport;
+
+	memcpy(&sport,&p[d->tcp_off],sizeof(sport));
+	memcpy(&dport,&p[d->tcp_off + 2],sizeof(dport));
+	if(d->ip_version == 4)
+	{
+		memcpy(&saddr,&p[d->net_off + offsetof(struct oft_iphdr,saddr)],sizeof(saddr));
+		memcpy(&daddr,&p[d->net_off + offsetof(struct oft_iphdr,daddr)],sizeof(daddr));
+	}
+	else
+	{
+		saddr = tcp_session_addr6(&p[d->net_off + offsetof(struct oft_ip6hdr,saddr)]);
+		daddr = tcp_session_addr6(&p[d->net_off + offsetof(struct oft_ip6hdr,daddr)]);
+	}
+	return tcp_session_conn_hash(saddr,daddr,sport,dport);
+}
+
+/******************************************************
+ * static void * oftrace_parser_main(void * arg)
+ */
+static void * oftrace_parser_main(void * arg)
+{
+	oftrace_deal(arg);
+	return NULL;
+}
+
+/******************************************************
+ * static void * oftrace_framer_main(void * arg)
+ * 	reassemble and frame what the parser passes on, and copy each
+ * 	message into a slot for the caller (or, for
+ * 	oftrace_run_sharded(), hand it to the handlers right here)
+ */
+static void * oftrace_framer_main(void * arg)
+{
+	oftrace * oft = arg;
+	struct oftrace_pipeline * pipe = oft->pipe;
+	struct oftrace_pipeline * top = pipe->top ? pipe->top : pipe;
+	oftrace_stage_msg * sm;
+
+	while(!__atomic_load_n(&top->stop,__ATOMIC_ACQUIRE) &&
+			oftrace_next_frame(oft,pipe->ip,pipe->port,NULL))
+	{
+		if(pipe->handlers)
+		{
+			pipe->count++;
+			if(pipe->handlers->handler[oft->msg.type](&oft->msg,pipe->ctx))
+				__atomic_store_n(&top->stop,1,__ATOMIC_RELEASE);	// asked to stop
+			continue;
+		}
+		if((sm = spsc_ring_claim(pipe->msgs)) == NULL)
+			break;	// stopped
+		sm->seq = pipe->seq;
+		oftrace_msg_copy(&sm->msg,&oft->msg);
+		spsc_ring_publish(pipe->msgs);
+		if(pipe->top)
+			oftrace_pipeline_poke(pipe->top);
+	}
+	__atomic_store_n(&pipe->done,OFTRACE_SHARD_DONE,__ATOMIC_SEQ_CST);
+	spsc_ring_close(pipe->msgs);
+	spsc_ring_close(pipe->records);	// in case it stopped first
+	if(pipe->top)
+		oftrace_pipeline_poke(pipe->top);
+	return NULL;
+}
+
+/******************************************************
+ * static const openflow_msg * oftrace_pipeline_next(oftrace * oft)
+ * 	the next message from the framer, or the shards; it stays in
+ * 	its slot until the next call
+ */
+static const openflow_msg * oftrace_pipeline_next(oftrace * oft)
+{
+	struct oftrace_pipeline * pipe = oft->pipe;
+	oftrace_stage_msg * sm;
+	int k, spins = 0;
+
+	if(pipe->n_shards == 0)
+	{
+		if(pipe->have_msg)
+			spsc_ring_release(pipe->msgs);
+		pipe->have_msg = 0;
+		if((sm = spsc_ring_peek(pipe->msgs)) == NULL)
+			return NULL;
+		pipe->have_msg = 1;
+		return &sm->msg;
+	}
+	if(pipe->current >= 0)
+		spsc_ring_release(pipe->shards[pipe->current]->pipe->msgs);
+	pipe->current = -1;
+	// same dance as spsc_ring_peek(): the flag goes up before the
+	// 	last look, and the shards move on before looking at it
+	while((k = oftrace_merge_pick(pipe)) == -1)
+	{
+		if(spins++ < OFTRACE_RING_SPINS)
+			continue;
+		pthread_mutex_lock(&pipe->lock);
+		__atomic_store_n(&pipe->merge_waiting,1,__ATOMIC_SEQ_CST);
+		if((k = oftrace_merge_pick(pipe)) == -1)
+			pthread_cond_wait(&pipe->progress,&pipe->lock);
+		__atomic_store_n(&pipe->merge_waiting,0,__ATOMIC_RELAXED);
+		pthread_mutex_unlock(&pipe->lock);
+		if(k != -1)
+			break;
+	}
+	if(k < 0)
+		return NULL;	// all done
+	pipe->current = k;
+	sm = spsc_ring_poll(pipe->shards[k]->pipe->msgs);
+	return &sm->msg;
+}
+
+/******************************************************
+ * static int oftrace_merge_pick(struct oftrace_pipeline * top)
+ * 	the shard whose next message is from the earliest record, as
+ * 	long as none of the others can still come up with one from an
+ * 	earlier record: each that has nothing waiting must have framed
+ * 	every record it was dealt up to there.  Ties can't happen, since
+ * 	a record only goes to one shard, so this is the order one
+ * 	framer would have passed them on in
+ * 	return the shard, -1 to wait for them, or -2 when they're done
+ */
+static int oftrace_merge_pick(struct oftrace_pipeline * top)
+{
+	struct oftrace_pipeline * sp;
+	oftrace_stage_msg * sm;
+	uint64_t seq = 0, given, done;
+	int i, best = -1, finished = 1;
+
+	for(i=0;i<top->n_shards;i++)
+	{
+		sp = top->shards[i]->pipe;
+		done = __atomic_load_n(&sp->done,__ATOMIC_SEQ_CST);	// before the look: see below
+		if((sm = spsc_ring_poll(sp->msgs)) != NULL)
+		{
+			if(best < 0 || sm->seq < seq)
+			{
+				best = i;
+				seq = sm->seq;
+			}
+			finished = 0;
+		}
+		else if(done != OFTRACE_SHARD_DONE)
+			finished = 0;
+	}
+	if(best < 0)
+		return finished ? -2 : -1;
+	for(i=0;i<top->n_shards;i++)
+	{
+		if(i == best)
+			continue;
+		sp = top->shards[i]->pipe;
+		given = __atomic_load_n(&sp->given,__ATOMIC_SEQ_CST);
+		done = __atomic_load_n(&sp->done,__ATOMIC_SEQ_CST);
+		// a record's messages are all passed on before done moves
+		// 	past it, so after reading done, an empty ring means
+		// 	there are none from up to there
+		if((sm = spsc_ring_poll(sp->msgs)) != NULL)
+		{
+			if(sm->seq < seq)
+				return -1;	// turned up since the first look
+			continue;
+		}
+		if(done < MIN(given,seq - 1))
+			return -1;	// still framing a record from before seq
+	}
+	return best;
+}
+
+/******************************************************
+ * static void oftrace_pipeline_poke(struct oftrace_pipeline * top)
+ * 	a shard moved on: wake up the merge, if it's waiting
+ */
+static void oftrace_pipeline_poke(struct oftrace_pipeline * top)
+{
+	if(!__atomic_load_n(&top->merge_waiting,__ATOMIC_SEQ_CST))
+		return;
+	pthread_mutex_lock(&top->lock);
+	pthread_cond_broadcast(&top->progress);
+	pthread_mutex_unlock(&top->lock);
+}
+
+/******************************************************
+ * static void oftrace_msg_copy(openflow_msg * dst, const openflow_msg * src)
+ * 	copy the headers and the message, but not the rest of data,
+ * 	and point dst's convenience pointers into dst
+ */
+#define OFTRACE_REBASE(p) ((p) ? (void *) ((char *) (p) + shift) : NULL)
+static void oftrace_msg_copy(openflow_msg * dst, const openflow_msg * src)
+{
+	ptrdiff_t shift = dst->data - src->data;
+
+	memcpy(dst->data,src->data,((char *) src->ofph - src->data) + ntohs(src->ofph->length));
+	dst->captured = src->captured;
+	dst->phdr = src->phdr;
+	dst->ts_nsec = src->ts_nsec;
+	dst->seq = src->seq;
+	dst->type = src->type;
+	dst->linux_sll = OFTRACE_REBASE(src->linux_sll);
+	dst->ether = OFTRACE_REBASE(src->ether);
+	dst->ip = OFTRACE_REBASE(src->ip);
+	dst->ip6 = OFTRACE_REBASE(src->ip6);
+	dst->tcp = OFTRACE_REBASE(src->tcp);
+	dst->ofph = OFTRACE_REBASE(src->ofph);
+	dst->ptr.packet_in = OFTRACE_REBASE(src->ptr.packet_in);
+	dst->embedded_packet = OFTRACE_REBASE(src->embedded_packet);
+}
+
+/******************************************************
+ * static void oftrace_pipeline_stop(oftrace * oft)
+ * 	throw away whatever is in flight, and wait for the threads;
+ * 	the shards go with it
+ */
+static void oftrace_pipeline_stop(oftrace * oft)
+{
+	struct oftrace_pipeline * pipe = oft->pipe;
+	oftrace_stage_rec * sr;
+	uint32_t i;
+
+	if(pipe == NULL)
+		return;
+	__atomic_store_n(&pipe->stop,1,__ATOMIC_RELEASE);
+	for(i=0;i<pipe->n_shards;i++)
+	{
+		spsc_ring_close(pipe->shards[i]->pipe->msgs);
+		spsc_ring_close(pipe->shards[i]->pipe->records);
+	}
+	if(pipe->records)
+	{
+		spsc_ring_close(pipe->msgs);
+		spsc_ring_close(pipe->records);
+	}
+	if(pipe->has_framer)
+		pthread_join(pipe->framer,NULL);
+	if(pipe->has_parser)
+		pthread_join(pipe->parser,NULL);
+	for(i=0;i<pipe->n_shards;i++)
+	{
+		oftrace_pipeline_stop(pipe->shards[i]);	// waits for its framer
+		pipe->shards[i]->filter = NULL;	// oft's
+		oftrace_free(pipe->shards[i]);
+	}
+	if(pipe->shards)
+		free(pipe->shards);
+	if(pipe->records)
+	{
+		for(i=0;i<pipe->records->n_slots;i++)
+		{
+			sr = (oftrace_stage_rec *) &pipe->records->slots[i * pipe->records->slot_size];
+			if(sr->buf)
+				free(sr->buf);
+		}
+		spsc_ring_free(pipe->records);
+		spsc_ring_free(pipe->msgs);
+	}
+	pthread_mutex_destroy(&pipe->lock);
+	pthread_cond_destroy(&pipe->progress);
+	free(pipe);
+	oft->pipe = NULL;
+	oft->curr = NULL;
+	oft->fast_len = 0;	// was in a slot
+}
+
+/***************************************************
+ * void oftrace_prefilter_stats_get(oftrace * oft, oftrace_prefilter_stats * stats);
+ */
+
+void oftrace_prefilter_stats_get(oftrace * oft, oftrace_prefilter_stats * stats)
+{
+	assert(oft);
+	*stats = oft->pre;
+}
+
+/***************************************************
+ * int oftrace_tcp_stats(oftrace *oft, int len, int *list);
  * 	return an integer array, where each element is the number of stored tcp fragments
  * 	of each tcp session being tracked
  * 	caller allocates list, and specifies its initial length via len
@@ -385,9 +1935,9 @@ int oftrace_tcp_stats(oftrace *oft, int len, int *list)
 {
 	int i;
 	assert(oft);
-	for(i=0;i<MIN(oft->n_sessions,len);i++)
-		list[i] = tcp_session_count_frags(oft->sessions[i]);
-	return oft->n_sessions;
+	for(i=0;i<MIN(oft->sessions.n_sessions,len);i++)
+		list[i] = tcp_session_count_frags(oft->sessions.list[i]);
+	return oft->sessions.n_sessions;
 }
 
 /******************************************************
@@ -406,3 +1956,241 @@ static int sanity_check_of_mesg(char * tmp,int tmplen)
 	else
 		return 0;
 }
+
+/******************************************************
+ * 	unittests
+ */
+
+#define UNITTEST_MSGS 60
+#define UNITTEST_SEGS 2048
+
+/***************************
+ * static int unittest_stream(char * stream, int * starts);
+ * 	a control channel's worth of hellos and echoes, from header
+ * 	only to a couple of segments long; starts gets where each
+ * 	one is, and one past the end
+ */
+static int unittest_stream(char * stream, int * starts)
+{
+	struct ofp_header * ofph;
+	int i, j, len;
+
+	starts[0] = 0;
+	for(i = 0; i < UNITTEST_MSGS; i++)
+	{
+		len = sizeof(struct ofp_header) + (i * 397) % 2900;
+		ofph = (struct ofp_header *) &stream[starts[i]];
+		ofph->version = OFP_VERSION;
+		ofph->type = (i % 3 == 0) ? OFPT_HELLO : (i % 3 == 1) ? OFPT_ECHO_REQUEST : OFPT_ECHO_REPLY;
+		ofph->length = htons(len);
+		ofph->xid = htonl(i);
+		for(j = sizeof(struct ofp_header); j < len; j++)
+			stream[starts[i] + j] = (char) (i + j);
+		starts[i + 1] = starts[i] + len;
+	}
+	return starts[UNITTEST_MSGS];
+}
+
+/***************************
+ * static int unittest_segment(int mode, int * starts, int * cuts, int * order);
+ * 	cut the stream up into segments, and put them in the order
+ * 	they go on the wire; segment i is cuts[i] up to cuts[i+1]
+ * 	0: one message per segment: all of it is framed in place
+ * 	1: full sized segments, that messages straddle
+ * 	2: every segment ends three bytes into a message's header
+ * 	3: 100 byte segments
+ * 	4: 3's, with each pair after the first swapped and every
+ * 		seventh one sent twice: most of it goes through the queue
+ * 	5: 1's, with all but the first back to front
+ * 	return how many segments go on the wire
+ */
+static int unittest_segment(int mode, int * starts, int * cuts, int * order)
+{
+	int len = starts[UNITTEST_MSGS];
+	int i, n, n_order;
+
+	n = 0;
+	if(mode == 0 || mode == 2)
+	{
+		for(i = 0; i < UNITTEST_MSGS; i++)
+			cuts[n++] = (mode == 2 && i > 0) ? starts[i] + 3 : starts[i];
+	}
+	else
+	{
+		for(i = 0; i < len; i += (mode == 1 || mode == 5) ? 1448 : 100)
+			cuts[n++] = i;
+	}
+	cuts[n] = len;
+	assert(n < UNITTEST_SEGS / 2);
+	n_order = 0;
+	for(i = 0; i < n; i++)
+	{
+		if(mode == 4 && i > 0)
+			order[n_order++] = (i % 2 == 1 && i + 1 < n) ? i + 1 : (i % 2 == 0) ? i - 1 : i;
+		else if(mode == 5 && i > 0)
+			order[n_order++] = n - i;
+		else
+			order[n_order++] = i;
+		if(mode == 4 && i % 7 == 6)
+			order[n_order] = order[n_order - 1], n_order++;
+	}
+	return n_order;
+}
+
+/***************************
+ * static int unittest_pcap(char * path, char * stream, uint32_t isn, int * cuts, int * order, int n);
+ * 	write the segments, in order, from one switch to its
+ * 	controller, to a new temp file; its name goes in path
+ */
+static int unittest_pcap(char * path, char * stream, uint32_t isn, int * cuts, int * order, int n)
+{
+	static char pkt[BUFLEN];
+	struct oft_ethhdr * eth = (struct oft_ethhdr *) pkt;
+	struct oft_iphdr * ip = (struct oft_iphdr *) &pkt[sizeof(*eth)];
+	struct oft_tcphdr * tcp = (struct oft_tcphdr *) &pkt[sizeof(*eth) + sizeof(*ip)];
+	int hdrlen = sizeof(*eth) + sizeof(*ip) + sizeof(*tcp);
+	pcap_hdr_t hdr;
+	pcaprec_hdr_t rec;
+	char * dir;
+	FILE * f;
+	int fd, i, seg, len;
+
+	if((dir = getenv("TMPDIR")) == NULL)
+		dir = "/tmp";
+	snprintf(path,PATH_MAX,"%s/oftrace-unittest.XXXXXX",dir);
+	if((fd = mkstemp(path)) < 0 || (f = fdopen(fd,"w")) == NULL)
+		return 0;
+	bzero(&hdr,sizeof(hdr));
+	hdr.magic_number = 0xa1b2c3d4;
+	hdr.version_major = 2;
+	hdr.version_minor = 4;
+	hdr.snaplen = 65535;
+	hdr.network = DLT_EN10MB;
+	fwrite(&hdr,sizeof(hdr),1,f);
+	bzero(pkt,hdrlen);
+	eth->ether_type = htons(ETHERTYPE_IP);
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_TCP;
+	ip->saddr = htonl(0x0a000002);
+	ip->daddr = htonl(0x0a000001);
+	tcp->source = htons(40000);
+	tcp->dest = htons(OFP_TCP_PORT);
+	tcp->doff = 5;
+	tcp->ack = 1;
+	for(i = 0; i < n; i++)
+	{
+		seg = order[i];
+		len = cuts[seg + 1] - cuts[seg];
+		ip->tot_len = htons(sizeof(*ip) + sizeof(*tcp) + len);
+		tcp->seq = htonl(isn + cuts[seg]);
+		memcpy(&pkt[hdrlen],&stream[cuts[seg]],len);
+		rec.ts_sec = 1000000000 + i;
+		rec.ts_usec = 0;
+		rec.incl_len = rec.orig_len = hdrlen + len;
+		fwrite(&rec,sizeof(rec),1,f);
+		fwrite(pkt,hdrlen + len,1,f);
+	}
+	return fclose(f) == 0;
+}
+
+/***************************
+ * int unittest_do_oftrace_framing(void);
+ * 	the same messages, however they were cut up and in whatever
+ * 	order the segments came, frame the same; with the stream
+ * 	starting just before the sequence numbers wrap, too
+ */
+int unittest_do_oftrace_framing(void)
+{
+	static char stream[UNITTEST_MSGS * 2908];
+	int starts[UNITTEST_MSGS + 1];
+	int cuts[UNITTEST_SEGS], order[UNITTEST_SEGS];
+	char path[PATH_MAX];
+	uint32_t isns[] = { 1000, 0xfffff000 };
+	const openflow_msg * m;
+	oftrace * oft;
+	int mode, w, i, n;
+
+	unittest_stream(stream,starts);
+	for(w = 0; w < 2; w++)
+		for(mode = 0; mode < 6; mode++)
+		{
+			n = unittest_segment(mode,starts,cuts,order);
+			if(!unittest_pcap(path,stream,isns[w],cuts,order,n))
+				return 0;
+			oft = oftrace_open(path);
+			assert(oft);
+			for(i = 0; (m = oftrace_next_msg(oft,0,OFP_TCP_PORT)) != NULL; i++)
+			{
+				assert(i < UNITTEST_MSGS);
+				assert(m->seq == isns[w] + starts[i]);
+				assert(ntohs(m->ofph->length) == starts[i + 1] - starts[i]);
+				assert(ntohl(m->ofph->xid) == i);
+				assert(m->type == stream[starts[i] + 1]);
+				assert(memcmp(m->ofph,&stream[starts[i]],starts[i + 1] - starts[i]) == 0);
+			}
+			assert(i == UNITTEST_MSGS);	// and nothing stuck in the queue
+			oftrace_close(oft);
+			unlink(path);
+		}
+	return 1;
+}
+
+/***************************
+ * static int unittest_count(const openflow_msg * msg, void * ctx);
+ * 	nothing to do: the runs count the calls
+ */
+static int unittest_count(const openflow_msg * msg, void * ctx)
+{
+	return 0;
+}
+
+/***************************
+ * int unittest_do_oftrace_handoff(void);
+ * 	split into any number of ranges, with the boundaries inside
+ * 	messages several segments long and more messages after them,
+ * 	in order or not, a trace still has every message handled once.
+ * 	The payloads are zeroed: a range resyncing inside one that
+ * 	could pass for headers would return messages that aren't there
+ */
+int unittest_do_oftrace_handoff(void)
+{
+	static char stream[UNITTEST_MSGS * 2908];
+	int starts[UNITTEST_MSGS + 1];
+	int cuts[UNITTEST_SEGS], order[UNITTEST_SEGS];
+	int modes[] = { 1, 4 };
+	void * ctxs[8];
+	char path[PATH_MAX];
+	oftrace_handlers handlers;
+	oftrace * oft;
+	int i, k, n, n_seq;
+
+	bzero(&handlers,sizeof(handlers));
+	handlers.handler[OFPT_HELLO] = unittest_count;
+	handlers.handler[OFPT_ECHO_REQUEST] = unittest_count;
+	handlers.handler[OFPT_ECHO_REPLY] = unittest_count;
+	bzero(ctxs,sizeof(ctxs));
+	unittest_stream(stream,starts);
+	for(i = 0; i < UNITTEST_MSGS; i++)
+		bzero(&stream[starts[i] + sizeof(struct ofp_header)],
+				starts[i + 1] - starts[i] - sizeof(struct ofp_header));
+	for(i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+	{
+		n = unittest_segment(modes[i],starts,cuts,order);
+		if(!unittest_pcap(path,stream,1000,cuts,order,n))
+			return 0;
+		oft = oftrace_open(path);
+		assert(oft);
+		n_seq = oftrace_run(oft,0,OFP_TCP_PORT,&handlers,NULL);
+		oftrace_close(oft);
+		assert(n_seq == UNITTEST_MSGS);
+		for(k = 2; k <= 8; k++)
+		{
+			assert(oftrace_run_parallel(path,k,0,OFP_TCP_PORT,&handlers,ctxs,0) == n_seq);
+			assert(oftrace_run_parallel(path,k,0,OFP_TCP_PORT,&handlers,ctxs,OFTRACE_PARALLEL_ORDERED) == n_seq);
+		}
+		unlink(path);
+	}
+	return 1;
+}
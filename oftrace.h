@@ -53,6 +53,9 @@ without specific, written prior permission.
 
 #define PCAP_MAGIC 		0xa1b2c3d4
 #define PCAP_BACKWARDS_MAGIC 	0xd4c3b2a1
+#define PCAP_NSEC_MAGIC		0xa1b23c4d	// timestamps in nanoseconds
+#define PCAP_NSEC_BACKWARDS_MAGIC	0x4d3cb2a1
+#define PCAPNG_MAGIC		0x0a0d0d0a	// section header block type; same either endian
 
 #ifndef DLT_EN10MB
 #define DLT_EN10MB      1       /* Ethernet (10Mb) */
@@ -123,6 +126,17 @@ struct oft_iphdr
 	/*The options start here. */
 };
 
+struct oft_ip6hdr
+{
+	uint32_t vtc_flow;	// version, traffic class, flow label
+	uint16_t payload_len;
+	uint8_t next_header;
+	uint8_t hop_limit;
+	uint8_t saddr[16];
+	uint8_t daddr[16];
+	/* extension headers, if any, start here */
+};
+
 struct oft_tcphdr
 {
 	uint16_t source;
@@ -182,12 +196,15 @@ typedef struct openflow_msg
 	struct pcaprec_hdr_s phdr;	// when the packet was received; for fragments, this actually the packet that 
 					// 	filled in the whole that cause this message to be pushed to the application
 					// 	- subtle but important distinction
+	uint32_t ts_nsec;		// full precision fraction of phdr.ts_sec; phdr.ts_usec is this rounded down
+	uint32_t seq;			// tcp sequence number of the message's first byte
 	// OFPT_something
 	uint16_t type;		
 	// convenience pointers
 	struct dlt_linux_sll *linux_sll;
-	struct oft_ethhdr * ether;
-	struct oft_iphdr * ip;
+	struct oft_ethhdr * ether;	// NULL for raw ip and loopback captures
+	struct oft_iphdr * ip;		// NULL for ipv6,
+	struct oft_ip6hdr * ip6;	// 	and this NULL for ipv4
 	struct oft_tcphdr * tcp;
 	struct ofp_header * ofph;
 	union openflow_msg_ptr ptr;
@@ -206,17 +223,311 @@ typedef struct oftrace oftrace;
 // 	or NULL on failure
 oftrace * oftrace_open(char * pcapfile);
 
+// same, but keep waiting for packets at the end of the file
+// 	(like tail -f) and follow tcpdump -C/-G file rotation;
+// 	oftrace_next_msg() then only returns NULL on error
+oftrace * oftrace_open_follow(char * pcapfile);
+
+// read several captures (rotated files, or one per interface) as a
+// 	single trace, merged by timestamp; each entry of pcapfiles may
+// 	be a glob pattern.  clock_offsets is NULL or has n_files entries,
+// 	in seconds, added to the timestamps of the matching files
+oftrace * oftrace_open_multi(char ** pcapfiles, int n_files, const double * clock_offsets);
+
+// close the trace and free everything that goes with oft
+void oftrace_close(oftrace * oft);
+
+// scan pcapfile once and write a sidecar index of where each tcp
+// 	session's records are, plus checkpoints of the reassembly state
+// 	every bucket_secs seconds (<= 0 for the default); ip and port
+// 	filter like oftrace_next_msg().  indexfile NULL means pcapfile.oftidx
+// 	return 0 on success
+int oftrace_build_index(char * pcapfile, char * indexfile, uint32_t ip, int port, double bucket_secs);
+
+// open pcapfile with the index oftrace_build_index() wrote for it;
+// 	NULL if the index is missing or stale
+oftrace * oftrace_open_indexed(char * pcapfile, char * indexfile);
+
+// with an indexed oftrace, have oftrace_next_msg() return only the
+// 	messages of the connection ip1:port1 <-> ip2:port2 (both directions;
+// 	ip1 == 0 for all connections) between the times start and end, in
+// 	seconds since the epoch (0 for no limit).  Jumps straight there
+// 	without reading what comes before; oftrace_rewind() goes back to
+// 	the start of the selection
+int oftrace_select(oftrace * oft, uint32_t ip1, int port1, uint32_t ip2, int port2, double start, double end);
+
+// follow every controller in spec, in one pass, instead of the ip and
+// 	port passed to oftrace_next_msg() and friends (which are then
+// 	ignored): whitespace separated ip[/prefix_len][:ports], where
+// 	ports is a comma separated list of ports and first-last ranges,
+// 	e.g. "10.0.0.1:6633,6634 10.0.0.2:6633 10.1.0.0/16:6653-6655";
+// 	no ip, or no ports, means any.  NULL or "" goes back to ip and
+// 	port.  Return 0, or -1 (and say why on stderr) if spec doesn't parse
+int oftrace_set_controllers(oftrace * oft, const char * spec);
+
 // pass an oftrace, and an IP and PORT to look for,
 // 	and a reference to an openflow_msg struct
 // 	return 1 if found, 0 otherwise 
 const openflow_msg * oftrace_next_msg(oftrace * oft, uint32_t ip, int port);
 
+// only return messages that match expr, e.g.
+// 	"packet_in and dl_type == arp"; see oftrace(3) for the fields.
+// 	It is compiled once, here, and checked before anything is copied
+// 	out of the capture.  NULL or "" turns filtering off.  Return 0,
+// 	or -1 (and say why on stderr) if expr doesn't parse
+int oftrace_set_filter(oftrace * oft, const char * expr);
+
+// drop records that don't match a tcpdump(8) style expr, e.g.
+// 	"vlan 10 and tcp port 6633", before any other work is done on
+// 	them; NULL or "" for none.  Needs libpcap.  Return 0, or -1 (and
+// 	say why on stderr) if expr doesn't compile
+int oftrace_set_prefilter(oftrace * oft, const char * expr);
+
+// how many records were read, and how many of those were thrown out
+// 	before being parsed: for not being tcp with a payload to or from
+// 	the ip and port asked for, or by oftrace_set_prefilter()
+typedef struct oftrace_prefilter_stats {
+	uint64_t packets;
+	uint64_t bytes;		// captured
+	uint64_t rejected;
+	uint64_t rejected_bytes;
+} oftrace_prefilter_stats;
+
+void oftrace_prefilter_stats_get(oftrace * oft, oftrace_prefilter_stats * stats);
+
+// decode in stages on their own threads: one reads and prefilters
+// 	records, n_framers reassemble and frame them, and the caller
+// 	gets the messages, with bounded queues in between (a stage that
+// 	gets ahead waits for the next one).  With more than one framer,
+// 	each connection's records go to one of them, which keeps its
+// 	sessions to itself, and their messages are merged back.  0 turns
+// 	it off.  The threads start with the first message; set up filters
+// 	and controllers before that, since the framers keep what they
+// 	started with.  Messages come out in the same order either way,
+// 	and each is good until the next call.  Selections, ranges and
+// 	index building stay in one thread.  While the threads run, the
+// 	stats are only approximate (and don't count sharded sessions) and
+// 	oftrace_tcp_stats() isn't safe.  Return 0, or -1 if they're
+// 	already running
+#define OFTRACE_PIPELINE_RECORDS	1024	// records in flight, per framer
+#define OFTRACE_PIPELINE_MSGS		64	// messages in flight, per framer
+int oftrace_set_pipeline(oftrace * oft, int n_framers);
+
+// called by oftrace_run() for each message of a type it has a handler
+// 	for; the message is good until the handler returns.  Return
+// 	nonzero to stop the run
+typedef int (*oftrace_handler)(const openflow_msg * msg, void * ctx);
+
+// more than enough for OFPT_*
+#define OFTRACE_MAX_TYPE 32
+
+typedef struct oftrace_handlers {
+	oftrace_handler handler[OFTRACE_MAX_TYPE];	// by OFPT_ type; NULL to skip those messages
+	uint16_t ether_type[OFTRACE_MAX_TYPE];	// for PACKET_IN/OUT: if nonzero, only call the
+						// 	handler when the embedded frame has this
+						// 	ether type (host byte order)
+} oftrace_handlers;
+
+// read the trace like oftrace_next_msg(), calling ctx's handler for each
+// 	message; messages nobody has a handler for are framed and skipped,
+// 	without being copied out.  return how many handlers were called;
+// 	after a handler stops the run, calling it again picks up from there
+int oftrace_run(oftrace * oft, uint32_t ip, int port, const oftrace_handlers * handlers, void * ctx);
+
+// a message as oftrace_next_batch() returns it
+typedef struct oftrace_batch_msg {
+	const struct ofp_header * ofph;	// the whole message, in a buffer of the oftrace's
+	uint32_t ts_sec;	// when the packet that completed it was captured
+	uint32_t ts_nsec;
+	uint32_t sip;		// network byte order, as in the ip header
+	uint32_t dip;
+	uint16_t sport;		// network byte order, as in the tcp header
+	uint16_t dport;
+	uint32_t xid;		// host byte order
+	uint16_t length;	// host byte order
+	uint8_t type;		// OFPT_something
+	uint8_t ip6;		// an ipv6 connection: the addresses are in sip6
+	uint8_t sip6[16];	// 	and dip6, and sip and dip are only 32 bits
+	uint8_t dip6[16];	// 	that stand in for them
+} oftrace_batch_msg;
+
+// the messages of one oftrace_next_batch() call share a buffer this big
+#define OFTRACE_BATCH_BUF (1<<20)
+
+// like oftrace_next_msg(), but fill in up to max messages at a time;
+// 	their data stays valid until the next oftrace_next_batch() call.
+// 	return how many; this can be less than max before the end of
+// 	the trace (when the buffer fills up), but 0 means the end
+int oftrace_next_batch(oftrace * oft, uint32_t ip, int port, oftrace_batch_msg * out, int max);
+
 // restart tracing from the beginning of the pcap file (implicit on open) 
 int oftrace_rewind(oftrace * oft);
 
+// jump to the first packet at or after ts (seconds since the epoch),
+// 	by bisecting the file; no index needed, but it assumes the packets
+// 	are roughly in time order.  Connections seen from there on first
+// 	look for a message boundary.  return 0 on success
+int oftrace_seek_time(oftrace * oft, double ts);
+
+// only read the records that start in bytes [start, end) of the file
+// 	(end 0 for the rest of it), so that several oftraces can split
+// 	one trace between them: start moves up to the next record, and
+// 	connections first seen there look for a message boundary, as
+// 	after oftrace_seek_time().  Connections with a message under way
+// 	at end are still followed from the records after it (up to
+// 	OFTRACE_RANGE_SLACK bytes on) until they are past what they had
+// 	queued, or see oftrace_set_handoff(); the next range may return some of those messages too,
+// 	so see oftrace_past_range().  Only for regular, uncompressed,
+// 	single files; return 0 on success
+#define OFTRACE_RANGE_SLACK ((off_t) 64*1024*1024)
+int oftrace_set_range(oftrace * oft, off_t start, off_t end);
+
+// nonzero once the records being read are past oftrace_set_range()'s
+// 	end.  The messages returned from then on overlap with the later
+// 	ranges': drop one if a later range returned a message the same
+// 	way on the same connection with the same msg->seq
+int oftrace_past_range(oftrace * oft);
+
+// past oftrace_set_range()'s end, keep following each connection until
+// 	taken(msg,ctx) says a later range returned msg too, instead of
+// 	only until what it had under way at end is done: the later range
+// 	may not find a message boundary on its first records.  taken is
+// 	called from inside oftrace_next_msg() and friends
+typedef int (*oftrace_taken_fn)(const openflow_msg * msg, void * ctx);
+void oftrace_set_handoff(oftrace * oft, oftrace_taken_fn taken, void * ctx);
+
+// run handlers over pcapfile like oftrace_run(), with n_workers threads
+// 	that each take a byte range of it (see oftrace_set_range()); the
+// 	messages of connections under way at a boundary are stitched back
+// 	together at the end, so each is handled once.  By default
+// 	handlers are called from the workers, all at once, with ctxs[k]
+// 	for worker k (ctxs has n_workers entries, each seeing part of the
+// 	trace, e.g. for counts to add up afterwards); messages held for
+// 	the stitching go to the same ctxs[k] once all are done.  With
+// 	OFTRACE_PARALLEL_ORDERED, they are spooled to temp files instead
+// 	and handed to handlers from this thread, with ctxs[0], in
+// 	timestamp order.  A file oftrace_set_range() can't split is run
+// 	in one pass with ctxs[0].  A handler returning nonzero stops
+// 	everything.  Return how many handlers were called, -1 on error
+#define OFTRACE_PARALLEL_ORDERED	0x1
+int oftrace_run_parallel(char * pcapfile, int n_workers, uint32_t ip, int port,
+		const oftrace_handlers * handlers, void ** ctxs, int flags);
+
+// oftrace_run() for the rest of the trace, with the records dealt out
+// 	by connection to n_shards framer threads, each with its own
+// 	sessions, which call the handlers themselves with ctxs[k] for
+// 	shard k (ctxs has n_shards entries): all at once, but in order
+// 	for any one connection, e.g. for counts to add up afterwards.
+// 	For one ordered stream instead, use oftrace_set_pipeline() with
+// 	n_shards framers and oftrace_run().  A handler returning nonzero
+// 	stops them all.  Selections, ranges and index building run in one
+// 	pass with ctxs[0].  Return how many handlers were called
+int oftrace_run_sharded(oftrace * oft, uint32_t ip, int port, int n_shards,
+		const oftrace_handlers * handlers, void ** ctxs);
+
+// what oftrace_run_batch() does with each trace: run() fills in a
+// 	result_size byte result, zeroed first, from a freshly opened
+// 	oftrace (return 0, or nonzero to leave the trace out); merge()
+// 	folds one result into another, and must be associative, with a
+// 	zeroed result as the identity; clear() frees what run() or
+// 	merge() allocated inside a result (NULL if nothing)
+typedef struct oftrace_analysis {
+	size_t result_size;
+	int (*run)(oftrace * oft, uint32_t ip, int port, void * result);
+	void (*merge)(void * into, const void * from);
+	void (*clear)(void * result);
+} oftrace_analysis;
+
+// run analysis over each of n_files traces, with n_workers threads
+// 	(<= 0 for one per cpu) that each open one trace at a time, and
+// 	merge every trace's result into result, in the order of
+// 	pcapfiles; result must be zeroed, or hold earlier results to add
+// 	to.  A trace that can't be opened or analysed is left out, with
+// 	a warning.  Return how many were merged, -1 on error
+int oftrace_run_batch(char ** pcapfiles, int n_files, int n_workers, uint32_t ip, int port,
+		const oftrace_analysis * analysis, void * result);
+
+// a latency histogram: bucket[i] counts the values, in nanoseconds,
+// 	with i significant bits, so each bucket spans a power of two
+#define OFTRACE_HIST_BUCKETS 65
+typedef struct oftrace_hist {
+	uint64_t count;
+	uint64_t sum_nsec;
+	uint64_t min_nsec;	// when count > 0
+	uint64_t max_nsec;
+	uint64_t bucket[OFTRACE_HIST_BUCKETS];
+} oftrace_hist;
+
+void oftrace_hist_add(oftrace_hist * hist, uint64_t nsec);
+void oftrace_hist_merge(oftrace_hist * into, const oftrace_hist * from);
+
+// the top of the bucket the q quantile (0 to 1) falls in, clamped to
+// 	the smallest and largest values added
+uint64_t oftrace_hist_quantile(const oftrace_hist * hist, double q);
+
+// what oftrace_stats_analysis finds for one switch, i.e. the end of its
+// 	connections that isn't the controller's port (or, with port 0, the
+// 	end with the higher tcp port)
+typedef struct oftrace_switch_stats {
+	uint8_t addr[16];		// ipv4 addresses take the first 4 bytes
+	int ip6;
+	uint64_t msgs[OFTRACE_MAX_TYPE];	// by OFPT_ type, both directions
+	uint64_t bytes;			// of openflow messages
+	uint64_t unmatched;		// packet_outs and flow_mods releasing a buffer no packet_in had
+	oftrace_hist delay;		// packet_in to the packet_out or flow_mod releasing its buffer
+} oftrace_switch_stats;
+
+typedef struct oftrace_stats {
+	uint64_t traces;		// merged in
+	uint64_t first_nsec;		// timestamp of the first message, 0 if none
+	uint64_t last_nsec;
+	uint64_t msgs[OFTRACE_MAX_TYPE];	// the sums over the switches
+	uint64_t bytes;
+	uint64_t unmatched;
+	oftrace_hist delay;
+	oftrace_switch_stats * switches;	// sorted by ip6, then addr
+	int n_switches;
+	int max_switches;
+} oftrace_stats;
+
+// an oftrace_analysis with an oftrace_stats result: ofstats' controller
+// 	delay, message counts, and both per switch
+extern const oftrace_analysis oftrace_stats_analysis;
+
+void oftrace_stats_merge(oftrace_stats * into, const oftrace_stats * from);
+void oftrace_stats_clear(oftrace_stats * stats);
+
 // return the fraction of the file processed from 0 to 1
 double oftrace_progress(oftrace *oft);
 
+// bound what the tcp sessions hold: a session that hasn't had a packet
+// 	for idle_secs of trace time is dropped, and while they hold more
+// 	than mem_budget bytes, the least recently used ones are.  0 turns
+// 	either limit off.  A session that shows up again afterwards looks
+// 	for a message boundary first
+#define OFTRACE_MEM_BUDGET ((size_t) 256*1024*1024)
+#define OFTRACE_IDLE_TIMEOUT 600
+void oftrace_set_limits(oftrace * oft, size_t mem_budget, double idle_secs);
+
+typedef struct oftrace_mem_stats {
+	uint64_t bytes;			// held by the tcp sessions now
+	uint64_t peak_bytes;
+	uint64_t idle_evictions;	// sessions dropped for being idle
+	uint64_t budget_evictions;	// sessions dropped to stay in the budget
+	uint64_t evicted_bytes;		// queued stream bytes dropped with them
+	uint64_t spilled_bytes;		// out of order bytes in the spill file now
+} oftrace_mem_stats;
+
+// fill in how much memory the tcp sessions use, and what was evicted
+void oftrace_mem_stats_get(oftrace * oft, oftrace_mem_stats * stats);
+
+// once a connection has threshold bytes of out of order data waiting
+// 	for a hole to fill (0 for the default, 1MB), put the rest in an
+// 	mmap()'d temp file in dir (NULL for $TMPDIR) instead of memory.
+// 	Off unless called; calling it again changes the threshold.
+// 	return 0 on success, -1 if the file couldn't be created
+int oftrace_set_spill(oftrace * oft, const char * dir, size_t threshold);
+
 // return an integer array, where each element is the number of stored tcp fragments
 //  of each tcp session being tracked
 //  caller allocates list, and specifies its initial length via len
@@ -224,4 +535,8 @@ double oftrace_progress(oftrace *oft);
 //  elements into the array
 int oftrace_tcp_stats(oftrace *oft, int len, int *list);
 
+// expose hooks for unittesting; not part of the api
+int unittest_do_oftrace_framing(void);
+int unittest_do_oftrace_handoff(void);
+
 #endif
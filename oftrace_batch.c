@@ -0,0 +1,674 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oftrace_batch.h"
+#include "tcp_session.h"
+#include "utils.h"
+
+typedef struct batch_run {
+	char ** pcapfiles;
+	int n_files;
+	uint32_t ip;
+	int port;
+	const oftrace_analysis * analysis;
+	void * result;
+	pthread_mutex_t lock;		// for the rest
+	int next;			// file to hand out
+	int folded;			// files before this are in result
+	void ** results;		// of the files past folded, NULL if they failed
+	char * finished;
+	int merged;
+} batch_run;
+
+// a packet_in waiting for its buffer to be released
+typedef struct batch_pending {
+	uint8_t addr[16];	// the switch's
+	uint16_t port;
+	uint32_t buffer_id;
+	uint64_t nsec;
+	struct batch_pending * next;
+} batch_pending;
+
+typedef struct batch_stats_ctx {
+	oftrace_stats * stats;
+	int port;
+	batch_pending ** buckets;
+	int n_buckets;		// a power of two
+	int n_pending;
+} batch_stats_ctx;
+
+static void * batch_worker_main(void * arg);
+static void * batch_analyse(batch_run * run, int i);
+static int batch_stats_run(oftrace * oft, uint32_t ip, int port, void * result);
+static void batch_stats_merge(void * into, const void * from);
+static void batch_stats_clear(void * result);
+static int batch_stats_msg(const openflow_msg * msg, void * ctx);
+static int batch_switch_cmp(const uint8_t * addr, int ip6, const oftrace_switch_stats * sw);
+static void batch_switch_merge(oftrace_switch_stats * into, const oftrace_switch_stats * from);
+static batch_pending ** batch_pending_find(batch_stats_ctx * ctx, const uint8_t * addr, uint16_t port, uint32_t buffer_id);
+static void batch_pending_grow(batch_stats_ctx * ctx);
+
+const oftrace_analysis oftrace_stats_analysis = {
+	sizeof(oftrace_stats),
+	batch_stats_run,
+	batch_stats_merge,
+	batch_stats_clear,
+};
+
+/**********************************************************
+ * int oftrace_run_batch(char ** pcapfiles, int n_files, int n_workers, uint32_t ip, int port,
+ * 		const oftrace_analysis * analysis, void * result);
+ * 	each worker opens its own oftrace, so nothing but the queue
+ * 	and the folding is shared
+ */
+int oftrace_run_batch(char ** pcapfiles, int n_files, int n_workers, uint32_t ip, int port,
+		const oftrace_analysis * analysis, void * result)
+{
+	batch_run run;
+	pthread_t * threads;
+	int k, n_started;
+
+	assert(analysis);
+	assert(result);
+	if(n_workers <= 0)
+		n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n_workers > n_files)
+		n_workers = n_files;
+	if(n_workers < 1)
+		n_workers = 1;
+	bzero(&run,sizeof(run));
+	run.pcapfiles = pcapfiles;
+	run.n_files = n_files;
+	run.ip = ip;
+	run.port = port;
+	run.analysis = analysis;
+	run.result = result;
+	pthread_mutex_init(&run.lock,NULL);
+	run.results = malloc_and_check((n_files + 1) * sizeof(void *));
+	bzero(run.results,(n_files + 1) * sizeof(void *));
+	run.finished = malloc_and_check(n_files + 1);
+	bzero(run.finished,n_files + 1);
+	threads = malloc_and_check(n_workers * sizeof(pthread_t));
+	for(n_started = 0; n_started < n_workers; n_started++)
+		if(pthread_create(&threads[n_started],NULL,batch_worker_main,&run))
+		{
+			perror("pthread_create");
+			break;		// the ones going get through the files anyway
+		}
+	if(n_started == 0)
+		run.merged = -1;
+	for(k = 0; k < n_started; k++)
+		pthread_join(threads[k],NULL);
+	assert(n_started == 0 || run.folded == n_files);
+	pthread_mutex_destroy(&run.lock);
+	free(threads);
+	free(run.finished);
+	free(run.results);
+	return run.merged;
+}
+
+/**********************************************************
+ * static void * batch_worker_main(void * arg);
+ * 	analyse files until there are none left; fold in whatever
+ * 	is next in line each time one is done
+ */
+static void * batch_worker_main(void * arg)
+{
+	batch_run * run = arg;
+	void * r;
+	int i;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&run->lock);
+		i = run->next;
+		if(i < run->n_files)
+			run->next++;
+		pthread_mutex_unlock(&run->lock);
+		if(i >= run->n_files)
+			return NULL;
+		r = batch_analyse(run,i);
+		pthread_mutex_lock(&run->lock);
+		run->results[i] = r;
+		run->finished[i] = 1;
+		while(run->folded < run->n_files && run->finished[run->folded])
+		{
+			r = run->results[run->folded];
+			if(r)
+			{
+				run->analysis->merge(run->result,r);
+				if(run->analysis->clear)
+					run->analysis->clear(r);
+				free(r);
+				run->merged++;
+			}
+			run->results[run->folded++] = NULL;
+		}
+		pthread_mutex_unlock(&run->lock);
+	}
+}
+
+/**********************************************************
+ * static void * batch_analyse(batch_run * run, int i);
+ * 	the result for file i, or NULL if it can't be had
+ */
+static void * batch_analyse(batch_run * run, int i)
+{
+	const oftrace_analysis * a = run->analysis;
+	oftrace * oft;
+	void * r;
+
+	oft = oftrace_open(run->pcapfiles[i]);
+	if(oft == NULL)
+	{
+		fprintf(stderr,"WARN: couldn't open %s; leaving it out\n",run->pcapfiles[i]);
+		return NULL;
+	}
+	r = malloc_and_check(a->result_size);
+	bzero(r,a->result_size);
+	if(a->run(oft,run->ip,run->port,r))
+	{
+		fprintf(stderr,"WARN: couldn't analyse %s; leaving it out\n",run->pcapfiles[i]);
+		if(a->clear)
+			a->clear(r);
+		free(r);
+		r = NULL;
+	}
+	oftrace_close(oft);
+	return r;
+}
+
+/**********************************************************
+ * void oftrace_hist_add(oftrace_hist * hist, uint64_t nsec);
+ */
+void oftrace_hist_add(oftrace_hist * hist, uint64_t nsec)
+{
+	int bits = 0;
+	uint64_t v;
+
+	for(v = nsec; v; v >>= 1)
+		bits++;
+	hist->bucket[bits]++;
+	if(hist->count == 0 || nsec < hist->min_nsec)
+		hist->min_nsec = nsec;
+	if(nsec > hist->max_nsec)
+		hist->max_nsec = nsec;
+	hist->count++;
+	hist->sum_nsec += nsec;
+}
+
+/**********************************************************
+ * void oftrace_hist_merge(oftrace_hist * into, const oftrace_hist * from);
+ */
+void oftrace_hist_merge(oftrace_hist * into, const oftrace_hist * from)
+{
+	int i;
+
+	if(from->count == 0)
+		return;
+	if(into->count == 0 || from->min_nsec < into->min_nsec)
+		into->min_nsec = from->min_nsec;
+	if(from->max_nsec > into->max_nsec)
+		into->max_nsec = from->max_nsec;
+	into->count += from->count;
+	into->sum_nsec += from->sum_nsec;
+	for(i = 0; i < OFTRACE_HIST_BUCKETS; i++)
+		into->bucket[i] += from->bucket[i];
+}
+
+/**********************************************************
+ * uint64_t oftrace_hist_quantile(const oftrace_hist * hist, double q);
+ * 	bucket i > 0 holds [2^(i-1), 2^i - 1]
+ */
+uint64_t oftrace_hist_quantile(const oftrace_hist * hist, double q)
+{
+	uint64_t rank, seen, top;
+	int i;
+
+	if(hist->count == 0)
+		return 0;
+	if(q < 0)
+		q = 0;
+	rank = q * hist->count;
+	if(rank < q * hist->count)	// round up
+		rank++;
+	if(rank < 1)
+		rank = 1;
+	if(rank > hist->count)
+		rank = hist->count;
+	seen = 0;
+	for(i = 0; i < OFTRACE_HIST_BUCKETS - 1; i++)
+	{
+		seen += hist->bucket[i];
+		if(seen >= rank)
+			break;
+	}
+	top = (i == 0) ? 0 : (i == 64) ? UINT64_MAX : ((uint64_t) 1 << i) - 1;
+	if(top > hist->max_nsec)
+		top = hist->max_nsec;
+	if(top < hist->min_nsec)
+		top = hist->min_nsec;
+	return top;
+}
+
+/**********************************************************
+ * void oftrace_stats_merge(oftrace_stats * into, const oftrace_stats * from);
+ * 	the two switch tables are merged like two sorted lists
+ */
+void oftrace_stats_merge(oftrace_stats * into, const oftrace_stats * from)
+{
+	oftrace_switch_stats * switches;
+	int i, j, n, c, max;
+
+	into->traces += from->traces;
+	if(from->first_nsec && (into->first_nsec == 0 || from->first_nsec < into->first_nsec))
+		into->first_nsec = from->first_nsec;
+	if(from->last_nsec > into->last_nsec)
+		into->last_nsec = from->last_nsec;
+	for(i = 0; i < OFTRACE_MAX_TYPE; i++)
+		into->msgs[i] += from->msgs[i];
+	into->bytes += from->bytes;
+	into->unmatched += from->unmatched;
+	oftrace_hist_merge(&into->delay,&from->delay);
+	if(from->n_switches == 0)
+		return;
+	max = into->n_switches + from->n_switches;
+	switches = malloc_and_check(max * sizeof(oftrace_switch_stats));
+	i = j = n = 0;
+	while(i < into->n_switches || j < from->n_switches)
+	{
+		if(i == into->n_switches)
+			c = 1;
+		else if(j == from->n_switches)
+			c = -1;
+		else
+			c = batch_switch_cmp(into->switches[i].addr,into->switches[i].ip6,&from->switches[j]);
+		if(c <= 0)
+			switches[n] = into->switches[i++];
+		else
+			switches[n] = from->switches[j++];
+		if(c == 0)
+			batch_switch_merge(&switches[n],&from->switches[j++]);
+		n++;
+	}
+	free(into->switches);
+	into->switches = switches;
+	into->n_switches = n;
+	into->max_switches = max;
+}
+
+/**********************************************************
+ * void oftrace_stats_clear(oftrace_stats * stats);
+ */
+void oftrace_stats_clear(oftrace_stats * stats)
+{
+	if(stats->switches)
+		free(stats->switches);
+	bzero(stats,sizeof(*stats));
+}
+
+/**********************************************************
+ * oftrace_switch_stats * batch_switch_get(oftrace_stats * stats, const uint8_t * addr, int ip6);
+ */
+oftrace_switch_stats * batch_switch_get(oftrace_stats * stats, const uint8_t * addr, int ip6)
+{
+	oftrace_switch_stats * sw;
+	int lo = 0, hi = stats->n_switches, mid, c;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		c = batch_switch_cmp(addr,ip6,&stats->switches[mid]);
+		if(c == 0)
+			return &stats->switches[mid];
+		if(c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if(stats->n_switches == stats->max_switches)
+	{
+		stats->max_switches = stats->max_switches ? 2 * stats->max_switches : 16;
+		stats->switches = realloc_and_check(stats->switches,
+				stats->max_switches * sizeof(oftrace_switch_stats));
+	}
+	sw = &stats->switches[lo];
+	memmove(sw + 1,sw,(stats->n_switches - lo) * sizeof(oftrace_switch_stats));
+	stats->n_switches++;
+	bzero(sw,sizeof(*sw));
+	memcpy(sw->addr,addr,16);
+	sw->ip6 = ip6;
+	return sw;
+}
+
+/**********************************************************
+ * static int batch_switch_cmp(const uint8_t * addr, int ip6, const oftrace_switch_stats * sw);
+ */
+static int batch_switch_cmp(const uint8_t * addr, int ip6, const oftrace_switch_stats * sw)
+{
+	if(ip6 != sw->ip6)
+		return ip6 < sw->ip6 ? -1 : 1;
+	return memcmp(addr,sw->addr,16);
+}
+
+/**********************************************************
+ * static void batch_switch_merge(oftrace_switch_stats * into, const oftrace_switch_stats * from);
+ */
+static void batch_switch_merge(oftrace_switch_stats * into, const oftrace_switch_stats * from)
+{
+	int i;
+
+	for(i = 0; i < OFTRACE_MAX_TYPE; i++)
+		into->msgs[i] += from->msgs[i];
+	into->bytes += from->bytes;
+	into->unmatched += from->unmatched;
+	oftrace_hist_merge(&into->delay,&from->delay);
+}
+
+/**********************************************************
+ * static int batch_stats_run(oftrace * oft, uint32_t ip, int port, void * result);
+ * 	every type gets the handler, so every message is counted
+ */
+static int batch_stats_run(oftrace * oft, uint32_t ip, int port, void * result)
+{
+	oftrace_handlers handlers;
+	batch_stats_ctx ctx;
+	batch_pending * p;
+	int i;
+
+	bzero(&handlers,sizeof(handlers));
+	for(i = 0; i < OFTRACE_MAX_TYPE; i++)
+		handlers.handler[i] = batch_stats_msg;
+	bzero(&ctx,sizeof(ctx));
+	ctx.stats = result;
+	ctx.port = port;
+	ctx.n_buckets = 1024;
+	ctx.buckets = malloc_and_check(ctx.n_buckets * sizeof(batch_pending *));
+	bzero(ctx.buckets,ctx.n_buckets * sizeof(batch_pending *));
+	oftrace_run(oft,ip,port,&handlers,&ctx);
+	for(i = 0; i < ctx.n_buckets; i++)
+		while((p = ctx.buckets[i]))
+		{
+			ctx.buckets[i] = p->next;
+			free(p);
+		}
+	free(ctx.buckets);
+	ctx.stats->traces = 1;
+	return 0;
+}
+
+static void batch_stats_merge(void * into, const void * from)
+{
+	oftrace_stats_merge(into,from);
+}
+
+static void batch_stats_clear(void * result)
+{
+	oftrace_stats_clear(result);
+}
+
+/**********************************************************
+ * static int batch_stats_msg(const openflow_msg * msg, void * ctx);
+ * 	count msg against its switch; a packet_in with a buffer waits,
+ * 	by switch connection and buffer_id, for the packet_out or
+ * 	flow_mod that releases it, like ofstats does.  A packet_in
+ * 	with a buffer_id that is already waiting replaces it: the switch
+ * 	has reused a buffer the controller never released
+ */
+static int batch_stats_msg(const openflow_msg * msg, void * c)
+{
+	batch_stats_ctx * ctx = c;
+	oftrace_stats * stats = ctx->stats;
+	oftrace_switch_stats * sw;
+	batch_pending ** pp, * p;
+	uint8_t addr[16];
+	uint16_t sw_port, sport = ntohs(msg->tcp->source), dport = ntohs(msg->tcp->dest);
+	uint64_t nsec = (uint64_t) msg->phdr.ts_sec * 1000000000 + msg->ts_nsec;
+	uint32_t buffer_id;
+	int len = ntohs(msg->ofph->length);
+	int from_switch;
+
+	if(ctx->port)
+		from_switch = (sport != ctx->port);
+	else
+		from_switch = (sport > dport);
+	bzero(addr,sizeof(addr));
+	if(msg->ip)
+		memcpy(addr,from_switch ? &msg->ip->saddr : &msg->ip->daddr,4);
+	else
+		memcpy(addr,from_switch ? msg->ip6->saddr : msg->ip6->daddr,16);
+	sw_port = from_switch ? sport : dport;
+	if(stats->first_nsec == 0 || nsec < stats->first_nsec)
+		stats->first_nsec = nsec;
+	if(nsec > stats->last_nsec)
+		stats->last_nsec = nsec;
+	sw = batch_switch_get(stats,addr,msg->ip == NULL);
+	sw->msgs[msg->type]++;
+	sw->bytes += len;
+	stats->msgs[msg->type]++;
+	stats->bytes += len;
+	switch(msg->type)
+	{
+		case OFPT_PACKET_IN:
+			buffer_id = ntohl(msg->ptr.packet_in->buffer_id);
+			if(buffer_id == 0xffffffff)
+				break;
+			pp = batch_pending_find(ctx,addr,sw_port,buffer_id);
+			if((p = *pp) == NULL)
+			{
+				p = malloc_and_check(sizeof(batch_pending));
+				bzero(p,sizeof(batch_pending));
+				memcpy(p->addr,addr,16);
+				p->port = sw_port;
+				p->buffer_id = buffer_id;
+				*pp = p;
+				if(++ctx->n_pending > ctx->n_buckets)
+					batch_pending_grow(ctx);
+			}
+			p->nsec = nsec;
+			break;
+		case OFPT_PACKET_OUT:
+		case OFPT_FLOW_MOD:
+			if(msg->type == OFPT_PACKET_OUT)
+				buffer_id = ntohl(msg->ptr.packet_out->buffer_id);
+			else
+				buffer_id = ntohl(msg->ptr.flow_mod->buffer_id);
+			if(buffer_id == 0xffffffff)
+				break;
+			pp = batch_pending_find(ctx,addr,sw_port,buffer_id);
+			if((p = *pp) == NULL)
+			{
+				sw->unmatched++;
+				stats->unmatched++;
+				break;
+			}
+			oftrace_hist_add(&sw->delay,nsec > p->nsec ? nsec - p->nsec : 0);
+			oftrace_hist_add(&stats->delay,nsec > p->nsec ? nsec - p->nsec : 0);
+			*pp = p->next;
+			free(p);
+			ctx->n_pending--;
+			break;
+	}
+	return 0;
+}
+
+/**********************************************************
+ * static batch_pending ** batch_pending_find(batch_stats_ctx * ctx, const uint8_t * addr, uint16_t port, uint32_t buffer_id);
+ * 	where the match is linked from, or the NULL at the end of its chain
+ */
+static batch_pending ** batch_pending_find(batch_stats_ctx * ctx, const uint8_t * addr, uint16_t port, uint32_t buffer_id)
+{
+	batch_pending ** pp;
+	uint32_t a[4];
+
+	memcpy(a,addr,16);
+	pp = &ctx->buckets[(tcp_session_conn_hash(a[0] ^ a[1] ^ a[2] ^ a[3],buffer_id,port,0))
+			& (ctx->n_buckets - 1)];
+	while(*pp && ((*pp)->buffer_id != buffer_id || (*pp)->port != port || memcmp((*pp)->addr,addr,16)))
+		pp = &(*pp)->next;
+	return pp;
+}
+
+/**********************************************************
+ * static void batch_pending_grow(batch_stats_ctx * ctx);
+ */
+static void batch_pending_grow(batch_stats_ctx * ctx)
+{
+	batch_pending ** old = ctx->buckets, * p, ** pp;
+	int i, n_old = ctx->n_buckets;
+
+	ctx->n_buckets *= 2;
+	ctx->buckets = malloc_and_check(ctx->n_buckets * sizeof(batch_pending *));
+	bzero(ctx->buckets,ctx->n_buckets * sizeof(batch_pending *));
+	for(i = 0; i < n_old; i++)
+		while((p = old[i]))
+		{
+			old[i] = p->next;
+			pp = batch_pending_find(ctx,p->addr,p->port,p->buffer_id);
+			p->next = NULL;
+			*pp = p;
+		}
+	free(old);
+}
+
+/***************************
+ * static void unittest_batch_fill(oftrace_stats * stats, int seed);
+ * 	a few switches, some shared between seeds, with made up counts
+ */
+static void unittest_batch_fill(oftrace_stats * stats, int seed)
+{
+	oftrace_switch_stats * sw;
+	uint8_t addr[16];
+	int i, j;
+
+	bzero(stats,sizeof(*stats));
+	bzero(addr,sizeof(addr));
+	stats->traces = 1;
+	stats->first_nsec = 1000000000ULL * (10 - seed);
+	stats->last_nsec = 1000000000ULL * (20 + seed);
+	for(i = 0; i < 40; i++)
+	{
+		addr[0] = 10;
+		addr[3] = (i * 7 + seed * 3) % 50;	// some in every seed's table
+		sw = batch_switch_get(stats,addr,i % 5 == 0);
+		sw->msgs[OFPT_PACKET_IN] += seed + 1;
+		stats->msgs[OFPT_PACKET_IN] += seed + 1;
+		sw->bytes += 100 * i;
+		stats->bytes += 100 * i;
+		for(j = 0; j < seed + 2; j++)
+		{
+			oftrace_hist_add(&sw->delay,(uint64_t) 1000 * i * j + seed);
+			oftrace_hist_add(&stats->delay,(uint64_t) 1000 * i * j + seed);
+		}
+	}
+}
+
+/***************************
+ * static int unittest_batch_same(const oftrace_stats * a, const oftrace_stats * b);
+ */
+static int unittest_batch_same(const oftrace_stats * a, const oftrace_stats * b)
+{
+	int i;
+
+	if(a->traces != b->traces || a->first_nsec != b->first_nsec || a->last_nsec != b->last_nsec ||
+			memcmp(a->msgs,b->msgs,sizeof(a->msgs)) || a->bytes != b->bytes ||
+			a->unmatched != b->unmatched || memcmp(&a->delay,&b->delay,sizeof(a->delay)) ||
+			a->n_switches != b->n_switches)
+		return 0;
+	for(i = 0; i < a->n_switches; i++)
+		if(memcmp(&a->switches[i],&b->switches[i],sizeof(oftrace_switch_stats)))
+			return 0;
+	return 1;
+}
+
+/***************************
+ * int unittest_do_oftrace_batch(void);
+ */
+int unittest_do_oftrace_batch(void)
+{
+	oftrace_hist h;
+	oftrace_stats s[3], left, right, bc, zero;
+	uint64_t values[] = { 0, 1, 2, 3, 1000 };
+	int i;
+
+	bzero(&h,sizeof(h));
+	assert(oftrace_hist_quantile(&h,0.5) == 0);
+	for(i = 0; i < 5; i++)
+		oftrace_hist_add(&h,values[i]);
+	assert(h.count == 5 && h.sum_nsec == 1006 && h.min_nsec == 0 && h.max_nsec == 1000);
+	assert(h.bucket[0] == 1 && h.bucket[1] == 1 && h.bucket[2] == 2 && h.bucket[10] == 1);
+	assert(oftrace_hist_quantile(&h,0) == 0);
+	assert(oftrace_hist_quantile(&h,0.5) == 3);	// 2 is in [2,3]
+	assert(oftrace_hist_quantile(&h,1) == 1000);	// [512,1023], but nothing past 1000
+	oftrace_hist_add(&h,UINT64_MAX);
+	assert(h.bucket[64] == 1 && oftrace_hist_quantile(&h,1) == UINT64_MAX);
+
+	for(i = 0; i < 3; i++)
+		unittest_batch_fill(&s[i],i);
+	for(i = 1; i < s[0].n_switches; i++)	// kept sorted
+		assert(batch_switch_cmp(s[0].switches[i - 1].addr,s[0].switches[i - 1].ip6,&s[0].switches[i]) < 0);
+	// (a + b) + c
+	bzero(&left,sizeof(left));
+	oftrace_stats_merge(&left,&s[0]);
+	assert(unittest_batch_same(&left,&s[0]));	// zeroed is the identity
+	oftrace_stats_merge(&left,&s[1]);
+	oftrace_stats_merge(&left,&s[2]);
+	// a + (b + c)
+	bzero(&bc,sizeof(bc));
+	oftrace_stats_merge(&bc,&s[1]);
+	oftrace_stats_merge(&bc,&s[2]);
+	bzero(&right,sizeof(right));
+	oftrace_stats_merge(&right,&s[0]);
+	oftrace_stats_merge(&right,&bc);
+	assert(unittest_batch_same(&left,&right));
+	assert(left.traces == 3 && left.first_nsec == 8000000000ULL && left.last_nsec == 22000000000ULL);
+	assert(left.msgs[OFPT_PACKET_IN] == 40 * (1 + 2 + 3));
+	assert(left.delay.count == 40 * (2 + 3 + 4));
+	assert(left.n_switches > s[0].n_switches && left.n_switches < 3 * s[0].n_switches);
+	bzero(&zero,sizeof(zero));
+	oftrace_stats_merge(&right,&zero);
+	assert(unittest_batch_same(&left,&right));
+	for(i = 0; i < 3; i++)
+		oftrace_stats_clear(&s[i]);
+	oftrace_stats_clear(&left);
+	oftrace_stats_clear(&right);
+	oftrace_stats_clear(&bc);
+	assert(left.switches == NULL && left.n_switches == 0);
+	return 1;
+}
@@ -0,0 +1,63 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef OFTRACE_BATCH_H
+#define OFTRACE_BATCH_H
+
+#include <stdint.h>
+
+#include "oftrace.h"
+
+/*******************************************************
+ * oftrace_batch: oftrace_run_batch() and the oftrace_stats analysis
+ *
+ * 	workers take the next file off a shared counter, analyse it
+ * 	with an oftrace of their own into a fresh result, and hand the
+ * 	result back; results are folded into the caller's in the order
+ * 	of the file list as soon as all the ones before them are in, so
+ * 	a merge only has to be associative, and only the results of
+ * 	files that finished out of order are held at once
+ */
+
+/***************************
+ * 	the entry of stats->switches for the switch at addr (ipv4
+ * 	addresses in the first 4 bytes, the rest zero), added in order
+ * 	if it isn't there; the pointer lasts until the next one is added
+ */
+oftrace_switch_stats * batch_switch_get(oftrace_stats * stats, const uint8_t * addr, int ip6);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_oftrace_batch(void);
+
+#endif
@@ -0,0 +1,620 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "oftrace_parallel.h"
+#include "utils.h"
+
+// openflow_msg's convenience pointers, as offsets into its data
+enum { SPOOL_SLL, SPOOL_ETHER, SPOOL_IP, SPOOL_IP6, SPOOL_TCP, SPOOL_OFPH, SPOOL_EMBEDDED, SPOOL_N_PTRS };
+#define SPOOL_OFF(msg,p) ((p) ? (int) ((char *) (p) - (msg)->data) : -1)
+#define SPOOL_PTR(msg,off) ((off) < 0 ? NULL : (void *) &(msg)->data[off])
+
+// what goes in a spool file ahead of each message's data
+typedef struct parallel_spooled {
+	int tail;		// returned past the end of the range
+	int len;		// bytes of data
+	int captured;
+	struct pcaprec_hdr_s phdr;
+	uint32_t ts_nsec;
+	uint32_t seq;
+	uint16_t type;
+	int offs[SPOOL_N_PTRS];	// -1 for NULL
+} parallel_spooled;
+
+typedef struct parallel_run parallel_run;
+
+typedef struct parallel_worker {
+	int k;
+	parallel_run * run;
+	oftrace * oft;
+	pthread_t thread;
+	off_t head_end;		// remember the messages returned before here
+	parallel_set seen;	// 	and past the end of the range
+	pthread_mutex_t lock;	// seen is looked at by the range before, too
+	FILE * spool;		// messages for the final merge
+	int called;		// handlers
+} parallel_worker;
+
+struct parallel_run {
+	const oftrace_handlers * handlers;
+	oftrace_handlers wrap;	// parallel_handle() for each type handlers has
+	void ** ctxs;
+	uint32_t ip;
+	int port;
+	int ordered;
+	off_t size;		// of the file
+	int n_workers;
+	parallel_worker * workers;
+	volatile int stop;	// a handler said so, or a spool write failed
+};
+
+static void * parallel_worker_main(void * arg);
+static int parallel_handle(const openflow_msg * msg, void * ctx);
+static int parallel_taken(const openflow_msg * msg, void * ctx);
+static int parallel_spool(parallel_worker * w, const openflow_msg * msg, int tail);
+static int parallel_unspool(FILE * spool, openflow_msg * msg, int * tail);
+static int parallel_next_kept(parallel_run * run, int k, openflow_msg * msg);
+static int parallel_finish(parallel_run * run);
+static int parallel_finish_ordered(parallel_run * run);
+static int parallel_one_pass(char * pcapfile, uint32_t ip, int port, const oftrace_handlers * handlers, void * ctx);
+static FILE * parallel_spool_open(void);
+static uint32_t parallel_key_hash(const parallel_key * key);
+static void parallel_set_insert(parallel_set * ps, const parallel_key * key);
+
+/**********************************************************
+ * int oftrace_run_parallel(char * pcapfile, int n_workers, uint32_t ip, int port,
+ * 		const oftrace_handlers * handlers, void ** ctxs, int flags);
+ * 	every range is set up here, before any thread starts, so that
+ * 	a file that can't be split falls back to one pass cleanly
+ */
+int oftrace_run_parallel(char * pcapfile, int n_workers, uint32_t ip, int port,
+		const oftrace_handlers * handlers, void ** ctxs, int flags)
+{
+	parallel_run run;
+	parallel_worker * w;
+	struct stat sbuf;
+	off_t start, end;
+	int i, k, n_started, ret;
+
+	assert(handlers);
+	assert(ctxs);
+	if(n_workers <= 1 || pcapfile == NULL || stat(pcapfile,&sbuf) || !S_ISREG(sbuf.st_mode))
+		return parallel_one_pass(pcapfile,ip,port,handlers,ctxs[0]);
+	bzero(&run,sizeof(run));
+	run.handlers = handlers;
+	for(i = 0; i < OFTRACE_MAX_TYPE; i++)
+		if(handlers->handler[i])
+		{
+			run.wrap.handler[i] = parallel_handle;
+			run.wrap.ether_type[i] = handlers->ether_type[i];
+		}
+	run.ctxs = ctxs;
+	run.ip = ip;
+	run.port = port;
+	run.ordered = (flags & OFTRACE_PARALLEL_ORDERED) != 0;
+	run.size = sbuf.st_size;
+	run.n_workers = n_workers;
+	run.workers = malloc_and_check(n_workers * sizeof(parallel_worker));
+	bzero(run.workers,n_workers * sizeof(parallel_worker));
+	ret = 0;
+	for(k = 0; k < n_workers && ret == 0; k++)
+	{
+		w = &run.workers[k];
+		w->k = k;
+		w->run = &run;
+		start = run.size * k / n_workers;
+		end = (k == n_workers - 1) ? 0 : run.size * (k + 1) / n_workers;
+		w->head_end = (k > 0) ? start + OFTRACE_RANGE_SLACK : 0;	// nothing before range 0
+		parallel_set_init(&w->seen);
+		pthread_mutex_init(&w->lock,NULL);
+		if((w->oft = oftrace_open(pcapfile)) == NULL)
+			ret = -1;
+		else if(oftrace_set_range(w->oft,start,end))
+			ret = 1;
+		else if((w->spool = parallel_spool_open()) == NULL)
+			ret = -1;
+		else if(k < n_workers - 1)
+			oftrace_set_handoff(w->oft,parallel_taken,&run.workers[k + 1]);
+	}
+	if(ret > 0)
+	{
+		fprintf(stderr,"WARN: %s can't be split between workers; reading it in one pass\n",pcapfile);
+		ret = parallel_one_pass(pcapfile,ip,port,handlers,ctxs[0]);
+		n_started = 0;
+	}
+	else
+	{
+		for(n_started = 0; ret == 0 && n_started < n_workers; n_started++)
+		{
+			w = &run.workers[n_started];
+			if(pthread_create(&w->thread,NULL,parallel_worker_main,w))
+			{
+				perror("pthread_create");
+				run.stop = 1;	// the ones already going finish early
+				ret = -1;
+				break;
+			}
+		}
+		for(k = 0; k < n_started; k++)
+			pthread_join(run.workers[k].thread,NULL);
+		for(k = 0; k < n_started && ret == 0; k++)
+			if(ferror(run.workers[k].spool))
+			{
+				fprintf(stderr,"WARN: failed to write a spool file for %s: %s\n",pcapfile,strerror(errno));
+				ret = -1;
+			}
+		if(ret == 0)
+			ret = run.ordered ? parallel_finish_ordered(&run) : parallel_finish(&run);
+	}
+	for(k = 0; k < n_workers; k++)
+	{
+		w = &run.workers[k];
+		if(w->oft)
+			oftrace_close(w->oft);
+		if(w->spool)
+			fclose(w->spool);
+		parallel_set_clear(&w->seen);
+		pthread_mutex_destroy(&w->lock);
+	}
+	free(run.workers);
+	return ret;
+}
+
+/**********************************************************
+ * static int parallel_one_pass(char * pcapfile, uint32_t ip, int port, const oftrace_handlers * handlers, void * ctx);
+ */
+static int parallel_one_pass(char * pcapfile, uint32_t ip, int port, const oftrace_handlers * handlers, void * ctx)
+{
+	oftrace * oft;
+	int n;
+
+	if((oft = oftrace_open(pcapfile)) == NULL)
+		return -1;
+	n = oftrace_run(oft,ip,port,handlers,ctx);
+	oftrace_close(oft);
+	return n;
+}
+
+static void * parallel_worker_main(void * arg)
+{
+	parallel_worker * w = arg;
+	oftrace_run(w->oft,w->run->ip,w->run->port,&w->run->wrap,w);
+	return NULL;
+}
+
+/**********************************************************
+ * static int parallel_handle(const openflow_msg * msg, void * ctx);
+ * 	every message of a range goes through here: remember the ones
+ * 	a range before this one might also have returned, and hand the
+ * 	rest to the real handler, or keep them for the merge
+ */
+static int parallel_handle(const openflow_msg * msg, void * ctx)
+{
+	parallel_worker * w = ctx;
+	parallel_run * run = w->run;
+	parallel_key key;
+	int tail;
+
+	if(run->stop)
+		return 1;
+	tail = oftrace_past_range(w->oft);
+	if(tail || (off_t) (oftrace_progress(w->oft) * run->size) < w->head_end)
+	{
+		parallel_key_of(msg,&key);
+		pthread_mutex_lock(&w->lock);
+		parallel_set_add(&w->seen,&key);
+		pthread_mutex_unlock(&w->lock);
+	}
+	if(tail || run->ordered)
+		return parallel_spool(w,msg,tail);
+	w->called++;
+	if(run->handlers->handler[msg->type](msg,run->ctxs[w->k]))
+		run->stop = 1;
+	return run->stop;
+}
+
+/**********************************************************
+ * static int parallel_taken(const openflow_msg * msg, void * ctx);
+ * 	past its end, a range follows a connection until the next range
+ * 	(ctx) has returned one of the same messages; from there on, the
+ * 	next range has the rest.  If the next range hasn't got that far
+ * 	yet, the worker just follows the connection a while longer
+ */
+static int parallel_taken(const openflow_msg * msg, void * ctx)
+{
+	parallel_worker * next = ctx;
+	parallel_key key;
+	int has;
+
+	parallel_key_of(msg,&key);
+	pthread_mutex_lock(&next->lock);
+	has = parallel_set_has(&next->seen,&key);
+	pthread_mutex_unlock(&next->lock);
+	return has;
+}
+
+/**********************************************************
+ * static int parallel_spool(parallel_worker * w, const openflow_msg * msg, int tail);
+ * 	only what's in use of msg->data is written; the pointers into
+ * 	it go as offsets
+ */
+static int parallel_spool(parallel_worker * w, const openflow_msg * msg, int tail)
+{
+	parallel_spooled sp;
+
+	bzero(&sp,sizeof(sp));
+	sp.tail = tail;
+	sp.len = ((char *) msg->ofph - msg->data) + ntohs(msg->ofph->length);
+	sp.captured = msg->captured;
+	sp.phdr = msg->phdr;
+	sp.ts_nsec = msg->ts_nsec;
+	sp.seq = msg->seq;
+	sp.type = msg->type;
+	sp.offs[SPOOL_SLL] = SPOOL_OFF(msg,msg->linux_sll);
+	sp.offs[SPOOL_ETHER] = SPOOL_OFF(msg,msg->ether);
+	sp.offs[SPOOL_IP] = SPOOL_OFF(msg,msg->ip);
+	sp.offs[SPOOL_IP6] = SPOOL_OFF(msg,msg->ip6);
+	sp.offs[SPOOL_TCP] = SPOOL_OFF(msg,msg->tcp);
+	sp.offs[SPOOL_OFPH] = SPOOL_OFF(msg,msg->ofph);
+	sp.offs[SPOOL_EMBEDDED] = SPOOL_OFF(msg,msg->embedded_packet);
+	if(fwrite(&sp,sizeof(sp),1,w->spool) != 1 || fwrite(msg->data,sp.len,1,w->spool) != 1)
+		w->run->stop = 1;	// ferror() says so after the join
+	return w->run->stop;
+}
+
+/**********************************************************
+ * static int parallel_unspool(FILE * spool, openflow_msg * msg, int * tail);
+ * 	read back the next message parallel_spool() wrote; 0 at the end
+ */
+static int parallel_unspool(FILE * spool, openflow_msg * msg, int * tail)
+{
+	parallel_spooled sp;
+
+	if(fread(&sp,sizeof(sp),1,spool) != 1)
+		return 0;
+	assert(sp.len > 0 && sp.len <= BUFLEN);
+	if(fread(msg->data,sp.len,1,spool) != 1)
+		return 0;
+	*tail = sp.tail;
+	msg->captured = sp.captured;
+	msg->phdr = sp.phdr;
+	msg->ts_nsec = sp.ts_nsec;
+	msg->seq = sp.seq;
+	msg->type = sp.type;
+	msg->linux_sll = SPOOL_PTR(msg,sp.offs[SPOOL_SLL]);
+	msg->ether = SPOOL_PTR(msg,sp.offs[SPOOL_ETHER]);
+	msg->ip = SPOOL_PTR(msg,sp.offs[SPOOL_IP]);
+	msg->ip6 = SPOOL_PTR(msg,sp.offs[SPOOL_IP6]);
+	msg->tcp = SPOOL_PTR(msg,sp.offs[SPOOL_TCP]);
+	msg->ofph = SPOOL_PTR(msg,sp.offs[SPOOL_OFPH]);
+	msg->ptr.packet_in = (struct ofp_packet_in *) msg->ofph;
+	msg->embedded_packet = SPOOL_PTR(msg,sp.offs[SPOOL_EMBEDDED]);
+	return 1;
+}
+
+/**********************************************************
+ * static int parallel_next_kept(parallel_run * run, int k, openflow_msg * msg);
+ * 	the next message in worker k's spool that survives the merge:
+ * 	one it returned past the end of its range is dropped if a later
+ * 	range returned it too.  That one is more likely to have its real
+ * 	timestamp: it can be from a retransmission the earlier range
+ * 	took for new data, or the earlier range waited out a hole the
+ * 	later one didn't have
+ */
+static int parallel_next_kept(parallel_run * run, int k, openflow_msg * msg)
+{
+	parallel_key key;
+	int j, tail;
+
+	while(parallel_unspool(run->workers[k].spool,msg,&tail))
+	{
+		if(!tail)
+			return 1;
+		parallel_key_of(msg,&key);
+		for(j = k + 1; j < run->n_workers; j++)
+			if(parallel_set_has(&run->workers[j].seen,&key))
+				break;
+		if(j == run->n_workers)
+			return 1;
+	}
+	return 0;
+}
+
+/**********************************************************
+ * static int parallel_finish(parallel_run * run);
+ * 	hand what each worker held back to its own ctx, in its order
+ */
+static int parallel_finish(parallel_run * run)
+{
+	openflow_msg * msg = malloc_and_check(sizeof(openflow_msg));
+	parallel_worker * w;
+	int k, n = 0;
+
+	for(k = 0; k < run->n_workers; k++)
+	{
+		w = &run->workers[k];
+		rewind(w->spool);
+		while(!run->stop && parallel_next_kept(run,k,msg))
+		{
+			w->called++;
+			if(run->handlers->handler[msg->type](msg,run->ctxs[k]))
+				run->stop = 1;
+		}
+		n += w->called;
+	}
+	free(msg);
+	return n;
+}
+
+/**********************************************************
+ * static int parallel_finish_ordered(parallel_run * run);
+ * 	merge the spools by timestamp; each is already in the order a
+ * 	single pass would return its messages, and ties go to the
+ * 	earlier range, so a trace in time order comes out as it would
+ * 	have from oftrace_run()
+ */
+static int parallel_finish_ordered(parallel_run * run)
+{
+	openflow_msg ** msgs = malloc_and_check(run->n_workers * sizeof(openflow_msg *));
+	int * have = malloc_and_check(run->n_workers * sizeof(int));
+	openflow_msg * m;
+	int k, best, n = 0;
+
+	for(k = 0; k < run->n_workers; k++)
+	{
+		msgs[k] = malloc_and_check(sizeof(openflow_msg));
+		rewind(run->workers[k].spool);
+		have[k] = parallel_next_kept(run,k,msgs[k]);
+	}
+	while(!run->stop)
+	{
+		best = -1;
+		for(k = 0; k < run->n_workers; k++)
+		{
+			if(!have[k])
+				continue;
+			m = msgs[k];
+			if(best < 0 || m->phdr.ts_sec < msgs[best]->phdr.ts_sec ||
+					(m->phdr.ts_sec == msgs[best]->phdr.ts_sec && m->ts_nsec < msgs[best]->ts_nsec))
+				best = k;
+		}
+		if(best < 0)
+			break;
+		n++;
+		if(run->handlers->handler[msgs[best]->type](msgs[best],run->ctxs[0]))
+			run->stop = 1;
+		have[best] = parallel_next_kept(run,best,msgs[best]);
+	}
+	for(k = 0; k < run->n_workers; k++)
+		free(msgs[k]);
+	free(msgs);
+	free(have);
+	return n;
+}
+
+/**********************************************************
+ * static FILE * parallel_spool_open(void);
+ * 	an already unlinked temp file in $TMPDIR, or /tmp
+ */
+static FILE * parallel_spool_open(void)
+{
+	char path[PATH_MAX];
+	char * dir;
+	FILE * f;
+	int fd;
+
+	if((dir = getenv("TMPDIR")) == NULL)
+		dir = "/tmp";
+	snprintf(path,PATH_MAX,"%s/oftrace-spool.XXXXXX",dir);
+	if((fd = mkstemp(path)) < 0)
+	{
+		fprintf(stderr,"Failed to create spool file in %s: %s\n",dir,strerror(errno));
+		return NULL;
+	}
+	unlink(path);	// gone when we close it, or die
+	if((f = fdopen(fd,"w+")) == NULL)
+		close(fd);
+	return f;
+}
+
+/***************************
+ * void parallel_key_of(const openflow_msg * msg, parallel_key * key);
+ */
+void parallel_key_of(const openflow_msg * msg, parallel_key * key)
+{
+	bzero(key,sizeof(parallel_key));	// so that the padding hashes the same
+	if(msg->ip)
+	{
+		memcpy(key->saddr,&msg->ip->saddr,sizeof(uint32_t));
+		memcpy(key->daddr,&msg->ip->daddr,sizeof(uint32_t));
+	}
+	else
+	{
+		memcpy(key->saddr,msg->ip6->saddr,sizeof(key->saddr));
+		memcpy(key->daddr,msg->ip6->daddr,sizeof(key->daddr));
+	}
+	key->sport = msg->tcp->source;
+	key->dport = msg->tcp->dest;
+	key->seq = msg->seq;
+}
+
+void parallel_set_init(parallel_set * ps)
+{
+	ps->n = 0;
+	ps->n_slots = 64;
+	ps->slots = malloc_and_check(ps->n_slots * sizeof(parallel_key));
+	ps->used = malloc_and_check(ps->n_slots);
+	bzero(ps->used,ps->n_slots);
+}
+
+void parallel_set_clear(parallel_set * ps)
+{
+	free(ps->slots);
+	free(ps->used);
+	ps->slots = NULL;
+	ps->used = NULL;
+	ps->n = ps->n_slots = 0;
+}
+
+/***************************
+ * void parallel_set_add(parallel_set * ps, const parallel_key * key);
+ */
+void parallel_set_add(parallel_set * ps, const parallel_key * key)
+{
+	parallel_key * old;
+	char * old_used;
+	int i, old_n;
+
+	if(parallel_set_has(ps,key))
+		return;
+	if(2 * (ps->n + 1) > ps->n_slots)
+	{
+		// grow and rehash
+		old = ps->slots;
+		old_used = ps->used;
+		old_n = ps->n_slots;
+		ps->n_slots *= 2;
+		ps->slots = malloc_and_check(ps->n_slots * sizeof(parallel_key));
+		ps->used = malloc_and_check(ps->n_slots);
+		bzero(ps->used,ps->n_slots);
+		for(i = 0; i < old_n; i++)
+			if(old_used[i])
+				parallel_set_insert(ps,&old[i]);
+		free(old);
+		free(old_used);
+	}
+	parallel_set_insert(ps,key);
+	ps->n++;
+}
+
+/***************************
+ * int parallel_set_has(const parallel_set * ps, const parallel_key * key);
+ */
+int parallel_set_has(const parallel_set * ps, const parallel_key * key)
+{
+	uint32_t mask = ps->n_slots - 1;
+	uint32_t i;
+
+	for(i = parallel_key_hash(key) & mask; ps->used[i]; i = (i + 1) & mask)
+		if(!memcmp(&ps->slots[i],key,sizeof(parallel_key)))
+			return 1;
+	return 0;
+}
+
+static void parallel_set_insert(parallel_set * ps, const parallel_key * key)
+{
+	uint32_t mask = ps->n_slots - 1;
+	uint32_t i;
+
+	for(i = parallel_key_hash(key) & mask; ps->used[i]; i = (i + 1) & mask)
+		;
+	ps->slots[i] = *key;
+	ps->used[i] = 1;
+}
+
+/***************************
+ * static uint32_t parallel_key_hash(const parallel_key * key);
+ * 	same mix as tcp_session_hash(), over the ends and the seq
+ */
+static uint32_t parallel_key_hash(const parallel_key * key)
+{
+	uint32_t h = key->seq, w;
+	int i;
+
+	for(i = 0; i < sizeof(key->saddr); i += sizeof(uint32_t))
+	{
+		memcpy(&w,&key->saddr[i],sizeof(w));
+		h = h * 0x9e3779b1 ^ w;
+		memcpy(&w,&key->daddr[i],sizeof(w));
+		h = h * 0x9e3779b1 ^ w;
+	}
+	h = h * 0x9e3779b1 ^ (((uint32_t) key->sport << 16) | key->dport);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/***************************
+ * int unittest_do_oftrace_parallel(void);
+ */
+int unittest_do_oftrace_parallel(void)
+{
+	parallel_set ps;
+	parallel_key key;
+	int i;
+
+	parallel_set_init(&ps);
+	bzero(&key,sizeof(key));
+	key.saddr[0] = 10;
+	key.daddr[0] = 10;
+	key.daddr[3] = 1;
+	key.sport = htons(40000);
+	key.dport = htons(6633);
+	// enough to make it grow a few times
+	for(i = 0; i < 1000; i++)
+	{
+		key.seq = 0xfffffe00 + 77 * i;	// across the wrap
+		parallel_set_add(&ps,&key);
+	}
+	parallel_set_add(&ps,&key);	// already there
+	assert(ps.n == 1000);
+	for(i = 0; i < 1000; i++)
+	{
+		key.seq = 0xfffffe00 + 77 * i;
+		assert(parallel_set_has(&ps,&key));
+		key.seq++;
+		assert(!parallel_set_has(&ps,&key));
+	}
+	key.seq = 0xfffffe00;
+	assert(parallel_set_has(&ps,&key));
+	key.dport = htons(6634);	// the same seq on another connection
+	assert(!parallel_set_has(&ps,&key));
+	key.dport = htons(6633);
+	key.daddr[15] = 1;		// or an ipv6 one
+	assert(!parallel_set_has(&ps,&key));
+	parallel_set_clear(&ps);
+	return 1;
+}
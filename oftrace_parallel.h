@@ -0,0 +1,82 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef OFTRACE_PARALLEL_H
+#define OFTRACE_PARALLEL_H
+
+#include <stdint.h>
+
+#include "oftrace.h"
+
+/*******************************************************
+ * oftrace_parallel: oftrace_run_parallel() and what its final
+ * 	merge uses to stitch the ranges back together
+ *
+ * 	a message is known by its connection (the direction it went)
+ * 	and msg->seq; each range remembers the messages it returned
+ * 	near its start, and every one it returned past its end, in an
+ * 	open addressed hash set of those keys.  A message range k
+ * 	returned past its end is dropped if a later range has its key
+ */
+
+typedef struct parallel_key {
+	uint8_t saddr[16];	// ipv4 addresses take the first 4 bytes
+	uint8_t daddr[16];
+	uint16_t sport;		// network byte order
+	uint16_t dport;
+	uint32_t seq;
+} parallel_key;
+
+typedef struct parallel_set {
+	parallel_key * slots;
+	char * used;
+	int n;
+	int n_slots;		// a power of two
+} parallel_set;
+
+void parallel_set_init(parallel_set * ps);
+void parallel_set_clear(parallel_set * ps);
+
+/***************************
+ * 	fill in msg's key
+ */
+void parallel_key_of(const openflow_msg * msg, parallel_key * key);
+
+void parallel_set_add(parallel_set * ps, const parallel_key * key);
+int parallel_set_has(const parallel_set * ps, const parallel_key * key);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_oftrace_parallel(void);
+
+#endif
@@ -0,0 +1,168 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBPCAP
+#include <pcap.h>
+#endif
+
+#include "pcap_bpf.h"
+#include "utils.h"
+
+#ifdef HAVE_LIBPCAP
+
+#ifndef PCAP_NETMASK_UNKNOWN
+#define PCAP_NETMASK_UNKNOWN	0xffffffff	// older libpcaps
+#endif
+
+typedef struct pcap_bpf_prog {
+	int linktype;
+	int ok;		// if it didn't compile, everything passes
+	struct bpf_program prog;
+} pcap_bpf_prog;
+
+struct pcap_bpf {
+	char * expr;
+	pcap_bpf_prog * progs;	// one per link type seen
+	int n_progs;
+	int last;		// the one used last; usually the only one
+};
+
+static int pcap_bpf_compile_for(pcap_bpf_prog * p, const char * expr, int linktype);
+
+/***************************
+ * pcap_bpf * pcap_bpf_compile(const char * expr);
+ * 	try it on ethernet straight away, to catch syntax errors
+ */
+pcap_bpf * pcap_bpf_compile(const char * expr)
+{
+	pcap_bpf * bpf;
+	pcap_bpf_prog p;
+
+	if(!pcap_bpf_compile_for(&p,expr,DLT_EN10MB))
+		return NULL;
+	bpf = malloc_and_check(sizeof(pcap_bpf));
+	bpf->expr = strdup(expr);
+	bpf->progs = malloc_and_check(sizeof(pcap_bpf_prog));
+	bpf->progs[0] = p;
+	bpf->n_progs = 1;
+	bpf->last = 0;
+	return bpf;
+}
+
+/***************************
+ * int pcap_bpf_match(pcap_bpf * bpf, pcap_record * rec);
+ */
+int pcap_bpf_match(pcap_bpf * bpf, pcap_record * rec)
+{
+	struct pcap_pkthdr hdr;
+	pcap_bpf_prog * p;
+	int i;
+
+	if(bpf->progs[bpf->last].linktype != rec->linktype)
+	{
+		for(i = 0; i < bpf->n_progs && bpf->progs[i].linktype != rec->linktype; i++)
+			;
+		if(i == bpf->n_progs)	// a new one
+		{
+			bpf->progs = realloc_and_check(bpf->progs,(bpf->n_progs + 1) * sizeof(pcap_bpf_prog));
+			pcap_bpf_compile_for(&bpf->progs[i],bpf->expr,rec->linktype);
+			bpf->n_progs++;
+		}
+		bpf->last = i;
+	}
+	p = &bpf->progs[bpf->last];
+	if(!p->ok)
+		return 1;
+	hdr.ts.tv_sec = rec->phdr.ts_sec;
+	hdr.ts.tv_usec = rec->phdr.ts_usec;
+	hdr.caplen = rec->phdr.incl_len;
+	hdr.len = rec->phdr.orig_len;
+	return pcap_offline_filter(&p->prog,&hdr,(const u_char *) rec->data) != 0;
+}
+
+void pcap_bpf_free(pcap_bpf * bpf)
+{
+	int i;
+
+	if(bpf == NULL)
+		return;
+	for(i = 0; i < bpf->n_progs; i++)
+		if(bpf->progs[i].ok)
+			pcap_freecode(&bpf->progs[i].prog);
+	free(bpf->progs);
+	free(bpf->expr);
+	free(bpf);
+}
+
+/***************************
+ * static int pcap_bpf_compile_for(pcap_bpf_prog * p, const char * expr, int linktype);
+ * 	return p->ok
+ */
+static int pcap_bpf_compile_for(pcap_bpf_prog * p, const char * expr, int linktype)
+{
+	pcap_t * pcap = pcap_open_dead(linktype,65535);
+
+	p->linktype = linktype;
+	p->ok = 0;
+	if(pcap == NULL)
+		return 0;
+	if(pcap_compile(pcap,&p->prog,(char *) expr,1,PCAP_NETMASK_UNKNOWN) == 0)
+		p->ok = 1;
+	else
+		fprintf(stderr,"WARN: bad packet filter '%s' for link type %d: %s\n",
+				expr,linktype,pcap_geterr(pcap));
+	pcap_close(pcap);
+	return p->ok;
+}
+
+#else	// no libpcap
+
+pcap_bpf * pcap_bpf_compile(const char * expr)
+{
+	fprintf(stderr,"WARN: built without libpcap: can't use packet filter '%s'\n",expr);
+	return NULL;
+}
+
+int pcap_bpf_match(pcap_bpf * bpf, pcap_record * rec)
+{
+	return 1;
+}
+
+void pcap_bpf_free(pcap_bpf * bpf)
+{
+}
+
+#endif
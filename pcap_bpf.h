@@ -0,0 +1,63 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef PCAP_BPF_H
+#define PCAP_BPF_H
+
+#include "pcap_reader.h"
+
+/*******************************************************
+ * pcap_bpf: a tcpdump filter expression, run on raw records
+ *
+ * 	compiled with libpcap's pcap_compile() once for each link type
+ * 	that shows up (pcapng and merged traces can mix them), and run
+ * 	with pcap_offline_filter() on the record's data where it lies.
+ * 	Only there if libpcap was found (HAVE_LIBPCAP)
+ */
+
+typedef struct pcap_bpf pcap_bpf;
+
+/***************************
+ * 	compile expr; return NULL, after saying why on stderr, if it
+ * 	doesn't compile or there is no libpcap
+ */
+pcap_bpf * pcap_bpf_compile(const char * expr);
+
+/***************************
+ * 	does rec pass?  Records of a link type the expression can't
+ * 	be compiled for all pass
+ */
+int pcap_bpf_match(pcap_bpf * bpf, pcap_record * rec);
+
+void pcap_bpf_free(pcap_bpf * bpf);
+
+#endif
@@ -0,0 +1,380 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pcap_decode.h"
+
+#define PCAP_DECODE_ETHER_LEN	14
+#define PCAP_DECODE_SLL_LEN	16
+#define PCAP_DECODE_IP_LEN	20
+#define PCAP_DECODE_IP6_LEN	40
+#define PCAP_DECODE_TCP_LEN	20
+
+// ether types of an 802.1Q tag, an 802.1ad (QinQ) service tag, and
+// 	the pre-standard QinQ one
+#define PCAP_DECODE_VLAN	0x8100
+#define PCAP_DECODE_QINQ	0x88a8
+#define PCAP_DECODE_QINQ_OLD	0x9100
+
+static int pcap_decode_ether(const uint8_t * p, int caplen, int * net_off, int * link_off);
+static int pcap_decode_sll(const uint8_t * p, int caplen, int * net_off, int * link_off);
+static int pcap_decode_raw(const uint8_t * p, int caplen, int * net_off, int * link_off);
+static int pcap_decode_null(const uint8_t * p, int caplen, int * net_off, int * link_off);
+static int pcap_decode_vlan(const uint8_t * p, int caplen, int * off, int ether_type);
+static int pcap_decode_ipv4(const uint8_t * p, int caplen, pcap_decoded * d);
+static int pcap_decode_ipv6(const uint8_t * p, int caplen, pcap_decoded * d);
+static int pcap_decode_tcp_hdr(const uint8_t * p, int caplen, int off, int ip_payload, pcap_decoded * d);
+
+static const struct {
+	int linktype;
+	pcap_link_decoder decode;
+} pcap_decoders[] = {
+	{ PCAP_LINKTYPE_ETHERNET,	pcap_decode_ether },
+	{ PCAP_LINKTYPE_LINUX_SLL,	pcap_decode_sll },
+	{ PCAP_LINKTYPE_RAW,		pcap_decode_raw },
+	{ PCAP_LINKTYPE_IPV4,		pcap_decode_raw },
+	{ PCAP_LINKTYPE_IPV6,		pcap_decode_raw },
+	{ 12,				pcap_decode_raw },	// DLT_RAW, written by old libpcaps
+	{ 14,				pcap_decode_raw },	// same, on OpenBSD
+	{ PCAP_LINKTYPE_NULL,		pcap_decode_null },
+	{ PCAP_LINKTYPE_LOOP,		pcap_decode_null },
+};
+
+/***************************
+ * pcap_link_decoder pcap_decode_link(int linktype);
+ */
+pcap_link_decoder pcap_decode_link(int linktype)
+{
+	int i;
+
+	for(i = 0; i < sizeof(pcap_decoders) / sizeof(pcap_decoders[0]); i++)
+		if(pcap_decoders[i].linktype == linktype)
+			return pcap_decoders[i].decode;
+	return NULL;
+}
+
+/***************************
+ * int pcap_decode_tcp(pcap_link_decoder link, const uint8_t * p, int caplen, pcap_decoded * d);
+ */
+int pcap_decode_tcp(pcap_link_decoder link, const uint8_t * p, int caplen, pcap_decoded * d)
+{
+	switch(link(p,caplen,&d->net_off,&d->link_off))
+	{
+		case ETHERTYPE_IP:
+			return pcap_decode_ipv4(p,caplen,d);
+		case ETHERTYPE_IPV6:
+			return pcap_decode_ipv6(p,caplen,d);
+		case -1:
+			return -1;
+		default:
+			return 0;
+	}
+}
+
+/***************************
+ * static int pcap_decode_ether(const uint8_t * p, int caplen, int * net_off, int * link_off);
+ */
+static int pcap_decode_ether(const uint8_t * p, int caplen, int * net_off, int * link_off)
+{
+	if(caplen < PCAP_DECODE_ETHER_LEN)
+		return -1;
+	*link_off = 0;
+	*net_off = PCAP_DECODE_ETHER_LEN;
+	return pcap_decode_vlan(p,caplen,net_off,(p[12] << 8) | p[13]);
+}
+
+/***************************
+ * static int pcap_decode_sll(const uint8_t * p, int caplen, int * net_off, int * link_off);
+ * 	the protocol is in the last two bytes, where an ethernet
+ * 	header's ether_type would be
+ */
+static int pcap_decode_sll(const uint8_t * p, int caplen, int * net_off, int * link_off)
+{
+	if(caplen < PCAP_DECODE_SLL_LEN)
+		return -1;
+	*link_off = PCAP_DECODE_SLL_LEN - PCAP_DECODE_ETHER_LEN;
+	*net_off = PCAP_DECODE_SLL_LEN;
+	return pcap_decode_vlan(p,caplen,net_off,(p[14] << 8) | p[15]);
+}
+
+/***************************
+ * static int pcap_decode_raw(const uint8_t * p, int caplen, int * net_off, int * link_off);
+ * 	no link header: the ip version says which
+ */
+static int pcap_decode_raw(const uint8_t * p, int caplen, int * net_off, int * link_off)
+{
+	if(caplen < 1)
+		return -1;
+	*link_off = -1;
+	*net_off = 0;
+	switch(p[0] >> 4)
+	{
+		case 4:
+			return ETHERTYPE_IP;
+		case 6:
+			return ETHERTYPE_IPV6;
+		default:
+			return 0;
+	}
+}
+
+/***************************
+ * static int pcap_decode_null(const uint8_t * p, int caplen, int * net_off, int * link_off);
+ * 	a 4 byte address family, in the capturing host's byte order
+ * 	(DLT_NULL) or in network byte order (DLT_LOOP); the families
+ * 	are all small, so whichever end is non-zero has it.  Every
+ * 	BSD numbers AF_INET6 differently
+ */
+static int pcap_decode_null(const uint8_t * p, int caplen, int * net_off, int * link_off)
+{
+	int family;
+
+	if(caplen < 4)
+		return -1;
+	*link_off = -1;
+	*net_off = 4;
+	family = p[0] ? p[0] : p[3];
+	switch(family)
+	{
+		case 2:		// AF_INET everywhere
+			return ETHERTYPE_IP;
+		case 10:	// linux
+		case 24:	// NetBSD, OpenBSD
+		case 28:	// FreeBSD
+		case 30:	// Darwin
+			return ETHERTYPE_IPV6;
+		default:
+			return 0;
+	}
+}
+
+/***************************
+ * static int pcap_decode_vlan(const uint8_t * p, int caplen, int * off, int ether_type);
+ * 	skip any 802.1Q/802.1ad tags at *off, each a 2 byte tag control
+ * 	plus the ether type of what follows it; return the last
+ */
+static int pcap_decode_vlan(const uint8_t * p, int caplen, int * off, int ether_type)
+{
+	while(ether_type == PCAP_DECODE_VLAN || ether_type == PCAP_DECODE_QINQ ||
+			ether_type == PCAP_DECODE_QINQ_OLD)
+	{
+		if(caplen < *off + 4)
+			return -1;
+		ether_type = (p[*off + 2] << 8) | p[*off + 3];
+		*off += 4;
+	}
+	return ether_type;
+}
+
+/***************************
+ * static int pcap_decode_ipv4(const uint8_t * p, int caplen, pcap_decoded * d);
+ */
+static int pcap_decode_ipv4(const uint8_t * p, int caplen, pcap_decoded * d)
+{
+	const uint8_t * ip = &p[d->net_off];
+	int ihl;
+
+	if(caplen < d->net_off + PCAP_DECODE_IP_LEN || (ip[0] >> 4) != 4)
+		return -1;
+	d->ip_version = 4;
+	ihl = 4 * (ip[0] & 0xf);
+	if(ihl < PCAP_DECODE_IP_LEN || caplen < d->net_off + ihl)
+		return -1;	// the header can't be that short, or wasn't all captured
+	if(ip[9] != IPPROTO_TCP)
+		return 0;
+	return pcap_decode_tcp_hdr(p,caplen,d->net_off + ihl,((ip[2] << 8) | ip[3]) - ihl,d);
+}
+
+/***************************
+ * static int pcap_decode_ipv6(const uint8_t * p, int caplen, pcap_decoded * d);
+ * 	follow the next header chain past hop-by-hop, routing,
+ * 	destination options and authentication headers to tcp.
+ * 	Fragments are skipped: we don't put ip fragments back together
+ * 	for ipv4 either
+ */
+static int pcap_decode_ipv6(const uint8_t * p, int caplen, pcap_decoded * d)
+{
+	const uint8_t * ip = &p[d->net_off];
+	int next, off, len;
+	int ip_payload;
+
+	if(caplen < d->net_off + PCAP_DECODE_IP6_LEN || (ip[0] >> 4) != 6)
+		return -1;
+	d->ip_version = 6;
+	ip_payload = (ip[4] << 8) | ip[5];	// 0 for a jumbogram: no payload, as far as we care
+	next = ip[6];
+	off = d->net_off + PCAP_DECODE_IP6_LEN;
+	for(;;)
+	{
+		switch(next)
+		{
+			case IPPROTO_TCP:
+				return pcap_decode_tcp_hdr(p,caplen,off,ip_payload,d);
+			case 0:		// hop-by-hop options
+			case 43:	// routing
+			case 60:	// destination options
+				if(caplen < off + 2)
+					return -1;
+				len = 8 * (p[off + 1] + 1);
+				break;
+			case 51:	// authentication header
+				if(caplen < off + 2)
+					return -1;
+				len = 4 * (p[off + 1] + 2);
+				break;
+			case 44:	// fragment
+				if(caplen < off + 8)
+					return -1;
+				if(((p[off + 2] << 8) | p[off + 3]) != 0)
+					return 0;	// any offset, or more fragments
+				len = 8;
+				break;
+			default:
+				return 0;	// not tcp (or no next header)
+		}
+		next = p[off];
+		off += len;
+		ip_payload -= len;
+	}
+}
+
+/***************************
+ * static int pcap_decode_tcp_hdr(const uint8_t * p, int caplen, int off, int ip_payload, pcap_decoded * d);
+ * 	the tcp header is at off, with ip_payload bytes of it and its
+ * 	payload by the ip header
+ */
+static int pcap_decode_tcp_hdr(const uint8_t * p, int caplen, int off, int ip_payload, pcap_decoded * d)
+{
+	if(caplen < off + PCAP_DECODE_TCP_LEN || (p[off + 12] >> 4) < 5)
+		return -1;
+	d->tcp_off = off;
+	d->payload_off = off + 4 * (p[off + 12] >> 4);
+	d->payload_len = ip_payload - (d->payload_off - off);
+	return d->payload_len > 0;	// not just an ethernet trailer
+}
+
+/**********************************************************************
+ * unittest: build a tcp segment under each link header
+ */
+static int unittest_frame(uint8_t * p, const uint8_t * link, int link_len, int version, int ext)
+{
+	uint8_t * ip = &p[link_len];
+	uint8_t * tcp;
+	int ip_len = version == 4 ? PCAP_DECODE_IP_LEN : PCAP_DECODE_IP6_LEN + ext;
+	int payload = 100;
+
+	memcpy(p,link,link_len);
+	bzero(ip,ip_len + PCAP_DECODE_TCP_LEN + payload);
+	if(version == 4)
+	{
+		ip[0] = 0x45;
+		ip[2] = (ip_len + PCAP_DECODE_TCP_LEN + payload) >> 8;
+		ip[3] = (ip_len + PCAP_DECODE_TCP_LEN + payload) & 0xff;
+		ip[9] = IPPROTO_TCP;
+	}
+	else
+	{
+		ip[0] = 0x60;
+		ip[4] = (ip_len - PCAP_DECODE_IP6_LEN + PCAP_DECODE_TCP_LEN + payload) >> 8;
+		ip[5] = (ip_len - PCAP_DECODE_IP6_LEN + PCAP_DECODE_TCP_LEN + payload) & 0xff;
+		if(ext)		// a hop-by-hop option header, then a fragment header
+		{
+			ip[6] = 0;
+			ip[PCAP_DECODE_IP6_LEN] = 44;
+			ip[PCAP_DECODE_IP6_LEN + 1] = (ext - 8) / 8 - 1;
+			ip[PCAP_DECODE_IP6_LEN + ext - 8] = IPPROTO_TCP;
+		}
+		else
+			ip[6] = IPPROTO_TCP;
+	}
+	tcp = &ip[ip_len];
+	tcp[12] = 5 << 4;
+	return link_len + ip_len + PCAP_DECODE_TCP_LEN + payload;
+}
+
+int unittest_do_pcap_decode(void)
+{
+	static const uint8_t ether[] = { 0,0,0,0,0,0, 0,0,0,0,0,0, 0x08,0x00 };
+	static const uint8_t ether6[] = { 0,0,0,0,0,0, 0,0,0,0,0,0, 0x86,0xdd };
+	static const uint8_t qinq[] = { 0,0,0,0,0,0, 0,0,0,0,0,0, 0x88,0xa8, 0,5, 0x81,0x00, 0,7, 0x08,0x00 };
+	static const uint8_t sll[] = { 0,0, 0,1, 0,6, 0,0,0,0,0,0,0,0, 0x08,0x00 };
+	static const uint8_t null[] = { 2,0,0,0 };
+	static const uint8_t loop6[] = { 0,0,0,30 };
+	static const uint8_t arp[] = { 0,0,0,0,0,0, 0,0,0,0,0,0, 0x08,0x06 };
+	uint8_t p[512];
+	pcap_decoded d;
+	int len;
+
+	assert(pcap_decode_link(4242) == NULL);
+	len = unittest_frame(p,ether,sizeof(ether),4,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == 1);
+	assert(d.link_off == 0 && d.net_off == 14 && d.tcp_off == 34 && d.payload_off == 54);
+	assert(d.payload_len == 100 && d.ip_version == 4);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,40,&d) == -1);
+	p[14] = 0x44;		// ip header shorter than 20 bytes
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == -1);
+	p[14] = 0x4f;		// 60 bytes of ip header, not all captured
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,14 + 40,&d) == -1);
+	p[14] = 0x45;
+	p[34 + 12] = 4 << 4;	// tcp header shorter than 20 bytes
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == -1);
+	len = unittest_frame(p,qinq,sizeof(qinq),4,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == 1);
+	assert(d.link_off == 0 && d.net_off == 22 && d.payload_off == 62);
+	len = unittest_frame(p,sll,sizeof(sll),4,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_LINUX_SLL),p,len,&d) == 1);
+	assert(d.link_off == 2 && d.net_off == 16);
+	len = unittest_frame(p,null,sizeof(null),4,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_NULL),p,len,&d) == 1);
+	assert(d.link_off == -1 && d.net_off == 4);
+	len = unittest_frame(p,NULL,0,6,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_RAW),p,len,&d) == 1);
+	assert(d.net_off == 0 && d.tcp_off == 40 && d.payload_len == 100 && d.ip_version == 6);
+	len = unittest_frame(p,loop6,sizeof(loop6),6,24);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_LOOP),p,len,&d) == 1);
+	assert(d.tcp_off == 4 + 40 + 24 && d.payload_len == 100);
+	p[4 + 40 + 16 + 3] = 1;		// more fragments
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_LOOP),p,len,&d) == 0);
+	len = unittest_frame(p,ether6,sizeof(ether6),6,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == 1);
+	assert(d.net_off == 14 && d.payload_off == 74);
+	p[14 + 4] = 0;
+	p[14 + 5] = 20;		// just the tcp header: the rest is an ethernet trailer
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == 0);
+	len = unittest_frame(p,arp,sizeof(arp),4,0);
+	assert(pcap_decode_tcp(pcap_decode_link(PCAP_LINKTYPE_ETHERNET),p,len,&d) == 0);
+	return 1;
+}
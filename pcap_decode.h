@@ -0,0 +1,101 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef PCAP_DECODE_H
+#define PCAP_DECODE_H
+
+#include <stdint.h>
+#include <net/ethernet.h>
+
+/*******************************************************
+ * pcap_decode: find the tcp segment in a raw record
+ *
+ * 	a link-layer decoder per link type (ethernet, with any number
+ * 	of 802.1Q/802.1ad tags; linux cooked; raw ip; BSD loopback)
+ * 	says where the network header is and what it is, then ipv4
+ * 	or ipv6 (past any extension headers) says where the tcp
+ * 	header and payload are.  The link decoder is looked up once,
+ * 	when the reader learns the link type, and travels with each
+ * 	pcap_record, so nothing per packet switches on the link type
+ */
+
+// link types as they are in capture files; the platform's DLT_*
+// 	can differ (DLT_RAW is 12 or 14, DLT_LOOP 12 on OpenBSD)
+#define PCAP_LINKTYPE_NULL	0
+#define PCAP_LINKTYPE_ETHERNET	1
+#define PCAP_LINKTYPE_RAW	101
+#define PCAP_LINKTYPE_LOOP	108
+#define PCAP_LINKTYPE_LINUX_SLL	113
+#define PCAP_LINKTYPE_IPV4	228
+#define PCAP_LINKTYPE_IPV6	229
+
+#ifndef ETHERTYPE_IPV6
+#define ETHERTYPE_IPV6		0x86dd
+#endif
+
+/***************************
+ * 	p is caplen bytes of a packet; set *net_off to where the
+ * 	network header is, and *link_off to where an ethernet header
+ * 	is (or -1 if there isn't one; for linux cooked, 14 bytes
+ * 	before the network header, so its ether_type is the protocol)
+ * 	return the ether type of the network header, or -1 if the
+ * 	packet is too short to tell
+ */
+typedef int (*pcap_link_decoder)(const uint8_t * p, int caplen, int * net_off, int * link_off);
+
+typedef struct pcap_decoded {
+	int link_off;		// see pcap_link_decoder
+	int net_off;		// ip or ipv6 header
+	int tcp_off;
+	int payload_off;	// tcp payload
+	int payload_len;	// by the ip header; may be more than was captured
+	int ip_version;		// 4 or 6
+} pcap_decoded;
+
+/***************************
+ * 	the decoder for linktype, or NULL if it isn't supported
+ */
+pcap_link_decoder pcap_decode_link(int linktype);
+
+/***************************
+ * 	decode the caplen bytes at p with link
+ * 	return 1 if it is a tcp segment with a payload, 0 if it is
+ * 	anything else, or -1 if it is cut short or doesn't make sense
+ */
+int pcap_decode_tcp(pcap_link_decoder link, const uint8_t * p, int caplen, pcap_decoded * d);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_pcap_decode(void);
+
+#endif
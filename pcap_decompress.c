@@ -0,0 +1,727 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "pcap_decompress.h"
+#include "utils.h"
+
+#ifdef HAVE_ZSTD
+/*******************************************************
+ * parallel zstd: the compressed file is mmap()'d and split on
+ * 	frame boundaries; workers decompress whole frames into
+ * 	their own buffers, and pcap_decompress_read() hands the
+ * 	results back in file order
+ */
+#define ZSTD_JOBS	(2*OFTRACE_DECOMPRESS_THREADS)
+
+struct zstd_job {
+	const char * src;
+	size_t src_len;
+	off_t src_end;		// file offset just past this frame
+	char * out;
+	size_t out_len;
+	int done;
+	int err;
+};
+
+struct zstd_parallel {
+	char * map;
+	size_t map_len;
+	size_t next_frame;	// offset of the next frame to queue
+	struct zstd_job jobs[ZSTD_JOBS];
+	int head;		// oldest job; the one being read out
+	int n_jobs;
+	int next_claim;		// oldest job no worker has taken yet
+	size_t out_off;		// how much of jobs[head] has been read out
+	int n_workers;
+	pthread_t workers[OFTRACE_DECOMPRESS_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	int stop;
+};
+#endif
+
+struct pcap_decompressor {
+	int type;
+	pcap_raw_read_fn rd;
+	void * ctx;
+	int fd;
+	off_t size;
+	char * in;		// compressed input waiting to be decoded
+	int in_len;
+	int in_off;
+	int eof;		// rd() has nothing more to give
+	int mid_frame;		// decoder is part way through a member/frame
+	off_t consumed;
+#ifdef HAVE_ZLIB
+	z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream * zds;
+	struct zstd_parallel * par;
+#endif
+#ifdef HAVE_LZ4
+	LZ4F_dctx * lz4;
+#endif
+};
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+static int dc_refill(pcap_decompressor * dc);
+#endif
+#ifdef HAVE_ZLIB
+static int gzip_read(pcap_decompressor * dc, char * buf, int len);
+#endif
+#ifdef HAVE_ZSTD
+static int zstd_read(pcap_decompressor * dc, char * buf, int len);
+static struct zstd_parallel * zstd_parallel_new(int fd, off_t size);
+static int zstd_parallel_read(pcap_decompressor * dc, char * buf, int len);
+static void zstd_parallel_drain(struct zstd_parallel * par);
+static void zstd_parallel_free(struct zstd_parallel * par);
+static void * zstd_worker_main(void * arg);
+#endif
+#ifdef HAVE_LZ4
+static int lz4_read(pcap_decompressor * dc, char * buf, int len);
+#endif
+
+/**********************************************************
+ * int pcap_decompress_detect(unsigned char * magic, int len)
+ */
+int pcap_decompress_detect(unsigned char * magic, int len)
+{
+	if(len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return PCAP_COMPRESS_GZIP;
+	if(len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		return PCAP_COMPRESS_ZSTD;
+	if(len >= 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18)
+		return PCAP_COMPRESS_LZ4;
+	return PCAP_COMPRESS_NONE;
+}
+
+/**********************************************************
+ * const char * pcap_decompress_name(int type)
+ */
+const char * pcap_decompress_name(int type)
+{
+	switch(type)
+	{
+		case PCAP_COMPRESS_GZIP:
+			return "gzip";
+		case PCAP_COMPRESS_ZSTD:
+			return "zstd";
+		case PCAP_COMPRESS_LZ4:
+			return "lz4";
+		default:
+			return "uncompressed";
+	}
+}
+
+/**********************************************************
+ * pcap_decompressor * pcap_decompress_new(int type, pcap_raw_read_fn rd, void * ctx, int fd, off_t size)
+ */
+pcap_decompressor * pcap_decompress_new(int type, pcap_raw_read_fn rd, void * ctx, int fd, off_t size)
+{
+	pcap_decompressor * dc;
+
+	dc = malloc_and_check(sizeof(pcap_decompressor));
+	bzero(dc,sizeof(pcap_decompressor));
+	dc->type = type;
+	dc->rd = rd;
+	dc->ctx = ctx;
+	dc->fd = fd;
+	dc->size = size;
+	switch(type)
+	{
+#ifdef HAVE_ZLIB
+		case PCAP_COMPRESS_GZIP:
+			// 15+32: auto-detect the gzip header, max window
+			if(inflateInit2(&dc->zs,15+32) != Z_OK)
+			{
+				fprintf(stderr,"inflateInit2 failed: %s\n",dc->zs.msg ? dc->zs.msg : "?");
+				free(dc);
+				return NULL;
+			}
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case PCAP_COMPRESS_ZSTD:
+			if(size > 0)
+				dc->par = zstd_parallel_new(fd,size);
+			if(dc->par == NULL)
+			{
+				dc->zds = ZSTD_createDStream();
+				ZSTD_initDStream(dc->zds);
+			}
+			break;
+#endif
+#ifdef HAVE_LZ4
+		case PCAP_COMPRESS_LZ4:
+			if(LZ4F_isError(LZ4F_createDecompressionContext(&dc->lz4,LZ4F_VERSION)))
+			{
+				fprintf(stderr,"LZ4F_createDecompressionContext failed\n");
+				free(dc);
+				return NULL;
+			}
+			break;
+#endif
+		default:
+			fprintf(stderr,"trace is %s compressed, but oftrace was built without %s support\n",
+					pcap_decompress_name(type),pcap_decompress_name(type));
+			free(dc);
+			return NULL;
+	}
+	dc->in = malloc_and_check(OFTRACE_DECOMPRESS_INLEN);
+	return dc;
+}
+
+/**********************************************************
+ * int pcap_decompress_read(pcap_decompressor * dc, char * buf, int len)
+ * 	like read(2), may return less than len: it gives back what it has
+ * 	rather than block on more compressed input
+ */
+int pcap_decompress_read(pcap_decompressor * dc, char * buf, int len)
+{
+	assert(dc);
+	switch(dc->type)
+	{
+#ifdef HAVE_ZLIB
+		case PCAP_COMPRESS_GZIP:
+			return gzip_read(dc,buf,len);
+#endif
+#ifdef HAVE_ZSTD
+		case PCAP_COMPRESS_ZSTD:
+			if(dc->par)
+				return zstd_parallel_read(dc,buf,len);
+			return zstd_read(dc,buf,len);
+#endif
+#ifdef HAVE_LZ4
+		case PCAP_COMPRESS_LZ4:
+			return lz4_read(dc,buf,len);
+#endif
+	}
+	return -1;
+}
+
+/**********************************************************
+ * off_t pcap_decompress_consumed(pcap_decompressor * dc)
+ */
+off_t pcap_decompress_consumed(pcap_decompressor * dc)
+{
+	assert(dc);
+	return dc->consumed;
+}
+
+/**********************************************************
+ * int pcap_decompress_reset(pcap_decompressor * dc)
+ */
+int pcap_decompress_reset(pcap_decompressor * dc)
+{
+	assert(dc);
+#ifdef HAVE_ZSTD
+	if(dc->par)
+	{
+		zstd_parallel_drain(dc->par);
+		dc->consumed = 0;
+		return 0;
+	}
+#endif
+	if(lseek(dc->fd,0,SEEK_SET) == (off_t) -1)
+		return -1;
+	dc->in_len = dc->in_off = 0;
+	dc->eof = 0;
+	dc->consumed = 0;
+	switch(dc->type)
+	{
+#ifdef HAVE_ZLIB
+		case PCAP_COMPRESS_GZIP:
+			inflateReset(&dc->zs);
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case PCAP_COMPRESS_ZSTD:
+			ZSTD_DCtx_reset(dc->zds,ZSTD_reset_session_only);
+			break;
+#endif
+#ifdef HAVE_LZ4
+		case PCAP_COMPRESS_LZ4:
+			LZ4F_freeDecompressionContext(dc->lz4);
+			LZ4F_createDecompressionContext(&dc->lz4,LZ4F_VERSION);
+			break;
+#endif
+	}
+	return 0;
+}
+
+/**********************************************************
+ * void pcap_decompress_free(pcap_decompressor * dc)
+ */
+void pcap_decompress_free(pcap_decompressor * dc)
+{
+	if(!dc)
+		return;
+	switch(dc->type)
+	{
+#ifdef HAVE_ZLIB
+		case PCAP_COMPRESS_GZIP:
+			inflateEnd(&dc->zs);
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case PCAP_COMPRESS_ZSTD:
+			if(dc->par)
+				zstd_parallel_free(dc->par);
+			else
+				ZSTD_freeDStream(dc->zds);
+			break;
+#endif
+#ifdef HAVE_LZ4
+		case PCAP_COMPRESS_LZ4:
+			LZ4F_freeDecompressionContext(dc->lz4);
+			break;
+#endif
+	}
+	free(dc->in);
+	free(dc);
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+/**********************************************************
+ * static int dc_refill(pcap_decompressor * dc)
+ * 	pull more compressed input once the last batch is used up
+ * 	return 1 if there is input to decode, 0 at EOF or error
+ */
+static int dc_refill(pcap_decompressor * dc)
+{
+	int err;
+	if(dc->in_off < dc->in_len)
+		return 1;
+	if(dc->eof)
+		return 0;
+	err = dc->rd(dc->ctx,dc->in,OFTRACE_DECOMPRESS_INLEN);
+	if(err <= 0)
+	{
+		dc->eof = 1;
+		dc->in_len = dc->in_off = 0;
+		return 0;
+	}
+	dc->in_len = err;
+	dc->in_off = 0;
+	return 1;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+/**********************************************************
+ * static int gzip_read(pcap_decompressor * dc, char * buf, int len)
+ * 	concatenated members (pigz, bgzip, cat a.gz b.gz) are decoded
+ * 	back to back
+ */
+static int gzip_read(pcap_decompressor * dc, char * buf, int len)
+{
+	int err, used;
+
+	dc->zs.next_out = (Bytef *) buf;
+	dc->zs.avail_out = len;
+	while(dc->zs.avail_out > 0)
+	{
+		if(dc->in_off == dc->in_len)
+		{
+			if(dc->zs.avail_out < (uInt) len)
+				break;		// have something; don't block for more
+			if(!dc_refill(dc))
+			{
+				if(dc->mid_frame)
+					fprintf(stderr,"gzip: trace is truncated\n");
+				dc->mid_frame = 0;
+				break;
+			}
+		}
+		dc->zs.next_in = (Bytef *) &dc->in[dc->in_off];
+		dc->zs.avail_in = dc->in_len - dc->in_off;
+		err = inflate(&dc->zs,Z_NO_FLUSH);
+		used = (dc->in_len - dc->in_off) - dc->zs.avail_in;
+		dc->in_off += used;
+		dc->consumed += used;
+		dc->mid_frame = 1;
+		if(err == Z_STREAM_END)
+		{
+			inflateReset(&dc->zs);	// maybe another member follows
+			dc->mid_frame = 0;
+			continue;
+		}
+		if(err != Z_OK && err != Z_BUF_ERROR)
+		{
+			fprintf(stderr,"gzip: corrupted input at compressed offset %lld: %s\n",
+					(long long) dc->consumed, dc->zs.msg ? dc->zs.msg : "?");
+			return -1;
+		}
+	}
+	return len - dc->zs.avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**********************************************************
+ * static int zstd_read(pcap_decompressor * dc, char * buf, int len)
+ * 	single threaded streaming decode; used for pipes and
+ * 	single-frame files
+ */
+static int zstd_read(pcap_decompressor * dc, char * buf, int len)
+{
+	ZSTD_outBuffer out;
+	ZSTD_inBuffer zin;
+	size_t err, before;
+
+	out.dst = buf;
+	out.size = len;
+	out.pos = 0;
+	while(out.pos < out.size)
+	{
+		if(dc->in_off == dc->in_len && !dc->eof)
+		{
+			if(out.pos > 0)
+				break;		// have something; don't block for more
+			dc_refill(dc);
+		}
+		zin.src = &dc->in[dc->in_off];
+		zin.size = dc->in_len - dc->in_off;
+		zin.pos = 0;
+		before = out.pos;
+		err = ZSTD_decompressStream(dc->zds,&out,&zin);
+		if(ZSTD_isError(err))
+		{
+			fprintf(stderr,"zstd: corrupted input at compressed offset %lld: %s\n",
+					(long long) dc->consumed, ZSTD_getErrorName(err));
+			return -1;
+		}
+		dc->in_off += zin.pos;
+		dc->consumed += zin.pos;
+		if(dc->eof && zin.size == 0 && out.pos == before)
+		{
+			if(err != 0)		// 0 means it ended on a frame boundary
+				fprintf(stderr,"zstd: trace is truncated\n");
+			break;		// all flushed
+		}
+	}
+	return out.pos;
+}
+
+/**********************************************************
+ * static struct zstd_parallel * zstd_parallel_new(int fd, off_t size)
+ * 	only worth it if the trace was written as many frames (zstd -T,
+ * 	pzstd, the seekable format); return NULL to stream instead
+ */
+static struct zstd_parallel * zstd_parallel_new(int fd, off_t size)
+{
+	struct zstd_parallel * par;
+	size_t first;
+	long ncpus;
+	char * map;
+	int i;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(ncpus < 2 || (off_t)(size_t) size != size)
+		return NULL;
+	map = mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+	if(map == MAP_FAILED)
+		return NULL;
+	first = ZSTD_findFrameCompressedSize(map,size);
+	if(ZSTD_isError(first) || first >= (size_t) size)
+	{
+		munmap(map,size);
+		return NULL;	// one big frame; nothing to split
+	}
+	madvise(map,size,MADV_SEQUENTIAL);
+	par = malloc_and_check(sizeof(struct zstd_parallel));
+	bzero(par,sizeof(struct zstd_parallel));
+	par->map = map;
+	par->map_len = size;
+	pthread_mutex_init(&par->lock,NULL);
+	pthread_cond_init(&par->work,NULL);
+	pthread_cond_init(&par->done,NULL);
+	par->n_workers = MIN(ncpus,OFTRACE_DECOMPRESS_THREADS);
+	for(i=0;i<par->n_workers;i++)
+		if(pthread_create(&par->workers[i],NULL,zstd_worker_main,par))
+		{
+			perror("pthread_create");
+			break;
+		}
+	par->n_workers = i;
+	if(par->n_workers == 0)
+	{
+		zstd_parallel_free(par);
+		return NULL;
+	}
+	return par;
+}
+
+/**********************************************************
+ * static int zstd_parallel_read(pcap_decompressor * dc, char * buf, int len)
+ * 	keep the job queue topped up with frames, then copy out of the
+ * 	oldest job once a worker has finished it
+ */
+static int zstd_parallel_read(pcap_decompressor * dc, char * buf, int len)
+{
+	struct zstd_parallel * par = dc->par;
+	struct zstd_job * job;
+	size_t frame;
+	int n, slot;
+
+	pthread_mutex_lock(&par->lock);
+	while(par->n_jobs < ZSTD_JOBS && par->next_frame < par->map_len)
+	{
+		frame = ZSTD_findFrameCompressedSize(&par->map[par->next_frame],par->map_len - par->next_frame);
+		if(ZSTD_isError(frame))
+		{
+			fprintf(stderr,"zstd: corrupted frame at compressed offset %lld: %s\n",
+					(long long) par->next_frame, ZSTD_getErrorName(frame));
+			par->next_frame = par->map_len;		// stop queueing; the reader sees EOF
+			break;
+		}
+		slot = (par->head + par->n_jobs) % ZSTD_JOBS;
+		job = &par->jobs[slot];
+		bzero(job,sizeof(*job));
+		job->src = &par->map[par->next_frame];
+		job->src_len = frame;
+		par->next_frame += frame;
+		job->src_end = par->next_frame;
+		par->n_jobs++;
+		pthread_cond_signal(&par->work);
+	}
+	if(par->n_jobs == 0)
+	{
+		pthread_mutex_unlock(&par->lock);
+		return 0;	// all frames read out
+	}
+	job = &par->jobs[par->head];
+	while(!job->done)
+		pthread_cond_wait(&par->done,&par->lock);
+	pthread_mutex_unlock(&par->lock);
+	if(job->err)
+		return -1;
+	n = MIN((size_t) len,job->out_len - par->out_off);
+	memcpy(buf,&job->out[par->out_off],n);
+	par->out_off += n;
+	if(par->out_off == job->out_len)
+	{
+		// done with this frame; only now count it as consumed
+		dc->consumed = job->src_end;
+		free(job->out);
+		job->out = NULL;
+		par->out_off = 0;
+		pthread_mutex_lock(&par->lock);
+		par->head = (par->head + 1) % ZSTD_JOBS;
+		par->n_jobs--;
+		if(par->next_claim > 0)
+			par->next_claim--;
+		pthread_mutex_unlock(&par->lock);
+		if(n == 0)
+			return zstd_parallel_read(dc,buf,len);	// empty (e.g., skippable) frame
+	}
+	return n;
+}
+
+/**********************************************************
+ * static void * zstd_worker_main(void * arg)
+ * 	claim the oldest unclaimed frame and decompress it whole
+ */
+static void * zstd_worker_main(void * arg)
+{
+	struct zstd_parallel * par = arg;
+	struct zstd_job * job;
+	ZSTD_DCtx * dctx = ZSTD_createDCtx();
+	unsigned long long content;
+	ZSTD_outBuffer out;
+	ZSTD_inBuffer zin;
+	size_t err, cap;
+
+	pthread_mutex_lock(&par->lock);
+	for(;;)
+	{
+		while(!par->stop && par->next_claim >= par->n_jobs)
+			pthread_cond_wait(&par->work,&par->lock);
+		if(par->stop)
+			break;
+		job = &par->jobs[(par->head + par->next_claim) % ZSTD_JOBS];
+		par->next_claim++;
+		pthread_mutex_unlock(&par->lock);
+
+		content = ZSTD_getFrameContentSize(job->src,job->src_len);
+		if(content != ZSTD_CONTENTSIZE_UNKNOWN && content != ZSTD_CONTENTSIZE_ERROR)
+		{
+			job->out = malloc_and_check(content ? content : 1);
+			err = ZSTD_decompressDCtx(dctx,job->out,content,job->src,job->src_len);
+			job->out_len = err;
+		}
+		else
+		{
+			// frame header doesn't say how big it is: stream into a growing buffer
+			ZSTD_DCtx_reset(dctx,ZSTD_reset_session_only);
+			cap = OFTRACE_DECOMPRESS_INLEN;
+			job->out = malloc_and_check(cap);
+			out.dst = job->out;
+			out.size = cap;
+			out.pos = 0;
+			zin.src = job->src;
+			zin.size = job->src_len;
+			zin.pos = 0;
+			do {
+				if(out.pos == out.size)
+				{
+					cap *= 2;
+					job->out = realloc_and_check(job->out,cap);
+					out.dst = job->out;
+					out.size = cap;
+				}
+				err = ZSTD_decompressStream(dctx,&out,&zin);
+			} while(!ZSTD_isError(err) && (zin.pos < zin.size || out.pos == out.size));
+			job->out_len = out.pos;
+		}
+		if(ZSTD_isError(err))
+		{
+			fprintf(stderr,"zstd: corrupted frame: %s\n",ZSTD_getErrorName(err));
+			job->err = 1;
+		}
+		pthread_mutex_lock(&par->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&par->done);
+	}
+	pthread_mutex_unlock(&par->lock);
+	ZSTD_freeDCtx(dctx);
+	return NULL;
+}
+
+/**********************************************************
+ * static void zstd_parallel_drain(struct zstd_parallel * par)
+ * 	throw away all queued work and go back to the first frame
+ */
+static void zstd_parallel_drain(struct zstd_parallel * par)
+{
+	struct zstd_job * job;
+	int i;
+
+	pthread_mutex_lock(&par->lock);
+	par->n_jobs = par->next_claim;	// nobody may start on the rest
+	for(i=0;i<par->n_jobs;i++)
+	{
+		job = &par->jobs[(par->head + i) % ZSTD_JOBS];
+		while(!job->done)
+			pthread_cond_wait(&par->done,&par->lock);
+		if(job->out)
+			free(job->out);
+		job->out = NULL;
+	}
+	par->head = par->n_jobs = par->next_claim = 0;
+	par->next_frame = 0;
+	par->out_off = 0;
+	pthread_mutex_unlock(&par->lock);
+}
+
+/**********************************************************
+ * static void zstd_parallel_free(struct zstd_parallel * par)
+ */
+static void zstd_parallel_free(struct zstd_parallel * par)
+{
+	int i;
+
+	zstd_parallel_drain(par);
+	pthread_mutex_lock(&par->lock);
+	par->stop = 1;
+	pthread_cond_broadcast(&par->work);
+	pthread_mutex_unlock(&par->lock);
+	for(i=0;i<par->n_workers;i++)
+		pthread_join(par->workers[i],NULL);
+	munmap(par->map,par->map_len);
+	pthread_mutex_destroy(&par->lock);
+	pthread_cond_destroy(&par->work);
+	pthread_cond_destroy(&par->done);
+	free(par);
+}
+#endif
+
+#ifdef HAVE_LZ4
+/**********************************************************
+ * static int lz4_read(pcap_decompressor * dc, char * buf, int len)
+ * 	LZ4F_decompress() moves on to the next frame by itself
+ */
+static int lz4_read(pcap_decompressor * dc, char * buf, int len)
+{
+	size_t dst_len, src_len, err;
+	int out = 0;
+
+	while(out < len)
+	{
+		if(dc->in_off == dc->in_len && !dc->eof)
+		{
+			if(out > 0)
+				break;		// have something; don't block for more
+			dc_refill(dc);
+		}
+		dst_len = len - out;
+		src_len = dc->in_len - dc->in_off;
+		err = LZ4F_decompress(dc->lz4,&buf[out],&dst_len,&dc->in[dc->in_off],&src_len,NULL);
+		if(LZ4F_isError(err))
+		{
+			fprintf(stderr,"lz4: corrupted input at compressed offset %lld: %s\n",
+					(long long) dc->consumed, LZ4F_getErrorName(err));
+			return -1;
+		}
+		dc->in_off += src_len;
+		dc->consumed += src_len;
+		out += dst_len;
+		if(dc->eof && src_len == 0 && dst_len == 0)
+		{
+			if(err != 0)		// 0 means it ended on a frame boundary
+				fprintf(stderr,"lz4: trace is truncated\n");
+			break;		// all flushed
+		}
+	}
+	return out;
+}
+#endif
@@ -0,0 +1,99 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef PCAP_DECOMPRESS_H
+#define PCAP_DECOMPRESS_H
+
+#include <sys/types.h>
+
+/*******************************************************
+ * pcap_decompress: in-library decompression of archived traces
+ *
+ * 	the compression is detected from the magic number, and the
+ * 	decompressed bytes are handed to pcap_reader's read-ahead
+ * 	thread as if they had come straight from read(2).  Which
+ * 	formats are available depends on what configure found.
+ */
+
+#define PCAP_COMPRESS_NONE	0
+#define PCAP_COMPRESS_GZIP	1
+#define PCAP_COMPRESS_ZSTD	2
+#define PCAP_COMPRESS_LZ4	3
+
+#ifndef OFTRACE_DECOMPRESS_INLEN
+#define OFTRACE_DECOMPRESS_INLEN	(1<<20)
+#endif
+#ifndef OFTRACE_DECOMPRESS_THREADS
+// upper bound on workers decompressing zstd frames in parallel
+#define OFTRACE_DECOMPRESS_THREADS	8
+#endif
+
+// where the compressed bytes come from; same contract as read(2)
+typedef int (*pcap_raw_read_fn)(void * ctx, char * buf, int len);
+
+typedef struct pcap_decompressor pcap_decompressor;
+
+/***************************
+ * 	return the PCAP_COMPRESS_* type for the first len bytes of a file
+ */
+int pcap_decompress_detect(unsigned char * magic, int len);
+
+const char * pcap_decompress_name(int type);
+
+/***************************
+ * 	create a decompressor pulling compressed bytes through rd(ctx,...)
+ * 	if fd is a regular file of the given size, multi-frame zstd
+ * 	traces are mmap()'d and their frames decompressed in parallel
+ * 	return NULL if support for type wasn't compiled in
+ */
+pcap_decompressor * pcap_decompress_new(int type, pcap_raw_read_fn rd, void * ctx, int fd, off_t size);
+
+/***************************
+ * 	fill buf with up to len decompressed bytes
+ * 	return the number of bytes, 0 at the end of the stream, -1 on error
+ */
+int pcap_decompress_read(pcap_decompressor * dc, char * buf, int len);
+
+/***************************
+ * 	how many compressed bytes have been turned into output so far
+ */
+off_t pcap_decompress_consumed(pcap_decompressor * dc);
+
+/***************************
+ * 	start over from the beginning of the compressed file
+ * 	return -1 if fd isn't seekable
+ */
+int pcap_decompress_reset(pcap_decompressor * dc);
+
+void pcap_decompress_free(pcap_decompressor * dc);
+
+#endif
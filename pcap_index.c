@@ -0,0 +1,382 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "pcap_index.h"
+#include "utils.h"
+
+/*******************************************************
+ * per-session record offsets are collected in their own
+ * 	growing arrays and concatenated at write time
+ */
+struct pcap_index_builder {
+	pcap_index_hdr hdr;
+	pcap_index_session * sessions;
+	uint64_t ** recs;
+	int max_sessions;
+	pcap_index_bucket * buckets;
+	int max_buckets;
+	pcap_index_ckpt * ckpts;
+	uint64_t max_ckpts;
+	int64_t latest;		// buckets follow the latest timestamp seen so far
+	int first_new;		// first bucket opened by the last pcap_index_start_bucket()
+};
+
+static int pcap_index_write_all(FILE * f, void * buf, size_t len);
+
+/**********************************************************
+ * pcap_index_builder * pcap_index_builder_new(int64_t bucket_nsec, uint32_t ip, int port)
+ */
+pcap_index_builder * pcap_index_builder_new(int64_t bucket_nsec, uint32_t ip, int port)
+{
+	pcap_index_builder * ib;
+
+	assert(bucket_nsec > 0);
+	ib = malloc_and_check(sizeof(pcap_index_builder));
+	bzero(ib,sizeof(pcap_index_builder));
+	memcpy(ib->hdr.magic,PCAP_INDEX_MAGIC,sizeof(ib->hdr.magic));
+	ib->hdr.bucket_nsec = bucket_nsec;
+	ib->hdr.ip = ip;
+	ib->hdr.port = port;
+	return ib;
+}
+
+/**********************************************************
+ * int pcap_index_session_id(pcap_index_builder * ib, uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport)
+ * 	only called when oftrace starts tracking a session, so a
+ * 	linear search is fine; a session that gets deleted and
+ * 	comes back keeps its id
+ */
+int pcap_index_session_id(pcap_index_builder * ib, uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport)
+{
+	pcap_index_session * s;
+	int i;
+
+	for(i=0;i<ib->hdr.n_sessions;i++)
+	{
+		s = &ib->sessions[i];
+		if(s->sip == sip && s->dip == dip && s->sport == sport && s->dport == dport)
+			return i;
+	}
+	if(ib->hdr.n_sessions >= ib->max_sessions)
+	{
+		ib->max_sessions = ib->max_sessions ? 2 * ib->max_sessions : 16;
+		ib->sessions = realloc_and_check(ib->sessions,ib->max_sessions * sizeof(pcap_index_session));
+		ib->recs = realloc_and_check(ib->recs,ib->max_sessions * sizeof(uint64_t *));
+	}
+	s = &ib->sessions[i];
+	bzero(s,sizeof(*s));
+	s->sip = sip;
+	s->dip = dip;
+	s->sport = sport;
+	s->dport = dport;
+	ib->recs[i] = NULL;
+	ib->hdr.n_sessions++;
+	return i;
+}
+
+/**********************************************************
+ * int pcap_index_start_bucket(pcap_index_builder * ib, int64_t t, off_t offset)
+ * 	buckets that had no records at all share the offset and
+ * 	checkpoints of the bucket after them
+ */
+int pcap_index_start_bucket(pcap_index_builder * ib, int64_t t, off_t offset)
+{
+	pcap_index_bucket * b;
+	int started = 0;
+
+	if(ib->hdr.n_buckets == 0)
+		ib->hdr.t0 = ib->latest = t;
+	ib->latest = MAX(ib->latest,t);
+	ib->first_new = ib->hdr.n_buckets;
+	while(ib->hdr.n_buckets == 0 ||
+			ib->latest >= ib->hdr.t0 + (int64_t) ib->hdr.n_buckets * ib->hdr.bucket_nsec)
+	{
+		if(ib->hdr.n_buckets >= ib->max_buckets)
+		{
+			ib->max_buckets = ib->max_buckets ? 2 * ib->max_buckets : 64;
+			ib->buckets = realloc_and_check(ib->buckets,ib->max_buckets * sizeof(pcap_index_bucket));
+		}
+		b = &ib->buckets[ib->hdr.n_buckets++];
+		bzero(b,sizeof(*b));
+		b->offset = offset;
+		b->first_ckpt = ib->hdr.n_ckpts;
+		started = 1;
+	}
+	return started;
+}
+
+/**********************************************************
+ * void pcap_index_add_ckpt(pcap_index_builder * ib, int session, uint32_t seqno, off_t offset)
+ * 	the checkpoint counts towards every bucket that was just started
+ */
+void pcap_index_add_ckpt(pcap_index_builder * ib, int session, uint32_t seqno, off_t offset)
+{
+	pcap_index_ckpt * c;
+	int i;
+
+	assert(session >= 0 && session < ib->hdr.n_sessions);
+	if(ib->hdr.n_ckpts >= ib->max_ckpts)
+	{
+		ib->max_ckpts = ib->max_ckpts ? 2 * ib->max_ckpts : 256;
+		ib->ckpts = realloc_and_check(ib->ckpts,ib->max_ckpts * sizeof(pcap_index_ckpt));
+	}
+	c = &ib->ckpts[ib->hdr.n_ckpts++];
+	c->session = session;
+	c->seqno = seqno;
+	c->offset = offset;
+	for(i = ib->first_new; i < ib->hdr.n_buckets; i++)
+		ib->buckets[i].n_ckpts++;
+}
+
+/**********************************************************
+ * void pcap_index_add_rec(pcap_index_builder * ib, int session, off_t offset)
+ */
+void pcap_index_add_rec(pcap_index_builder * ib, int session, off_t offset)
+{
+	pcap_index_session * s;
+	uint32_t n;
+
+	assert(session >= 0 && session < ib->hdr.n_sessions);
+	s = &ib->sessions[session];
+	n = s->n_recs;
+	if((n & (n-1)) == 0)	// grow at powers of two
+		ib->recs[session] = realloc_and_check(ib->recs[session],(n ? 2*n : 1) * sizeof(uint64_t));
+	ib->recs[session][n] = offset;
+	s->n_recs++;
+}
+
+/**********************************************************
+ * int pcap_index_write(pcap_index_builder * ib, char * indexfile, char * tracefile)
+ * 	header, sessions, buckets, checkpoints, then all the record
+ * 	offsets session by session
+ */
+int pcap_index_write(pcap_index_builder * ib, char * indexfile, char * tracefile)
+{
+	struct stat sbuf;
+	FILE * f;
+	int i, err = 0;
+
+	if(stat(tracefile,&sbuf))
+	{
+		perror(tracefile);
+		return -1;
+	}
+	ib->hdr.trace_size = sbuf.st_size;
+	ib->hdr.trace_mtime = sbuf.st_mtime;
+	ib->hdr.n_recs = 0;
+	for(i=0;i<ib->hdr.n_sessions;i++)
+	{
+		ib->sessions[i].first_rec = ib->hdr.n_recs;
+		ib->hdr.n_recs += ib->sessions[i].n_recs;
+	}
+	f = fopen(indexfile,"w");
+	if(f == NULL)
+	{
+		fprintf(stderr,"Failed to create index %s\n",indexfile);
+		perror("fopen");
+		return -1;
+	}
+	err |= pcap_index_write_all(f,&ib->hdr,sizeof(ib->hdr));
+	err |= pcap_index_write_all(f,ib->sessions,ib->hdr.n_sessions * sizeof(pcap_index_session));
+	err |= pcap_index_write_all(f,ib->buckets,ib->hdr.n_buckets * sizeof(pcap_index_bucket));
+	err |= pcap_index_write_all(f,ib->ckpts,ib->hdr.n_ckpts * sizeof(pcap_index_ckpt));
+	for(i=0;i<ib->hdr.n_sessions;i++)
+		err |= pcap_index_write_all(f,ib->recs[i],ib->sessions[i].n_recs * sizeof(uint64_t));
+	if(fclose(f))
+		err = -1;
+	if(err)
+	{
+		fprintf(stderr,"Failed to write index %s\n",indexfile);
+		unlink(indexfile);
+		return -1;
+	}
+	return 0;
+}
+
+static int pcap_index_write_all(FILE * f, void * buf, size_t len)
+{
+	if(len == 0)
+		return 0;
+	return fwrite(buf,len,1,f) == 1 ? 0 : -1;
+}
+
+/**********************************************************
+ * void pcap_index_builder_free(pcap_index_builder * ib)
+ */
+void pcap_index_builder_free(pcap_index_builder * ib)
+{
+	int i;
+	if(!ib)
+		return;
+	for(i=0;i<ib->hdr.n_sessions;i++)
+		if(ib->recs[i])
+			free(ib->recs[i]);
+	if(ib->recs)
+		free(ib->recs);
+	if(ib->sessions)
+		free(ib->sessions);
+	if(ib->buckets)
+		free(ib->buckets);
+	if(ib->ckpts)
+		free(ib->ckpts);
+	free(ib);
+}
+
+/**********************************************************
+ * pcap_index * pcap_index_open(char * indexfile, char * tracefile)
+ */
+pcap_index * pcap_index_open(char * indexfile, char * tracefile)
+{
+	pcap_index * pi;
+	pcap_index_hdr * hdr;
+	struct stat sbuf, tbuf;
+	uint64_t len;
+	int fd;
+
+	fd = open(indexfile,O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr,"Failed to open index %s\n",indexfile);
+		perror("open");
+		return NULL;
+	}
+	if(fstat(fd,&sbuf) || sbuf.st_size < sizeof(pcap_index_hdr))
+	{
+		fprintf(stderr,"Index %s is truncated\n",indexfile);
+		close(fd);
+		return NULL;
+	}
+	pi = malloc_and_check(sizeof(pcap_index));
+	bzero(pi,sizeof(pcap_index));
+	pi->map_len = sbuf.st_size;
+	pi->map = mmap(NULL,pi->map_len,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if(pi->map == MAP_FAILED)
+	{
+		perror("mmap");
+		free(pi);
+		return NULL;
+	}
+	hdr = pi->hdr = (pcap_index_hdr *) pi->map;
+	len = sizeof(pcap_index_hdr) + hdr->n_sessions * sizeof(pcap_index_session) +
+		hdr->n_buckets * sizeof(pcap_index_bucket) + hdr->n_ckpts * sizeof(pcap_index_ckpt) +
+		hdr->n_recs * sizeof(uint64_t);
+	if(memcmp(hdr->magic,PCAP_INDEX_MAGIC,sizeof(hdr->magic)) || len != pi->map_len)
+	{
+		fprintf(stderr,"%s is not an oftrace index (or was written on another kind of machine)\n",indexfile);
+		pcap_index_close(pi);
+		return NULL;
+	}
+	if(stat(tracefile,&tbuf) || tbuf.st_size != hdr->trace_size || tbuf.st_mtime != hdr->trace_mtime)
+	{
+		fprintf(stderr,"Index %s is out of date for %s: rebuild it\n",indexfile,tracefile);
+		pcap_index_close(pi);
+		return NULL;
+	}
+	pi->sessions = (pcap_index_session *) &hdr[1];
+	pi->buckets = (pcap_index_bucket *) &pi->sessions[hdr->n_sessions];
+	pi->ckpts = (pcap_index_ckpt *) &pi->buckets[hdr->n_buckets];
+	pi->recs = (uint64_t *) &pi->ckpts[hdr->n_ckpts];
+	madvise(pi->map,pi->map_len,MADV_RANDOM);
+	return pi;
+}
+
+/**********************************************************
+ * int pcap_index_find_session(pcap_index * pi, uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport)
+ */
+int pcap_index_find_session(pcap_index * pi, uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport)
+{
+	pcap_index_session * s;
+	int i;
+
+	for(i=0;i<pi->hdr->n_sessions;i++)
+	{
+		s = &pi->sessions[i];
+		if(s->sip == sip && s->dip == dip && s->sport == sport && s->dport == dport)
+			return i;
+	}
+	return -1;
+}
+
+/**********************************************************
+ * int pcap_index_find_bucket(pcap_index * pi, int64_t t)
+ */
+int pcap_index_find_bucket(pcap_index * pi, int64_t t)
+{
+	int64_t b;
+
+	if(pi->hdr->n_buckets == 0 || t <= pi->hdr->t0)
+		return 0;
+	b = (t - pi->hdr->t0) / pi->hdr->bucket_nsec;
+	return MIN(b,(int64_t) pi->hdr->n_buckets - 1);
+}
+
+/**********************************************************
+ * uint64_t pcap_index_find_rec(pcap_index * pi, int session, off_t offset)
+ */
+uint64_t pcap_index_find_rec(pcap_index * pi, int session, off_t offset)
+{
+	uint64_t * recs = &pi->recs[pi->sessions[session].first_rec];
+	uint64_t lo = 0, hi = pi->sessions[session].n_recs, mid;
+
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if(recs[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**********************************************************
+ * void pcap_index_close(pcap_index * pi)
+ */
+void pcap_index_close(pcap_index * pi)
+{
+	if(!pi)
+		return;
+	munmap(pi->map,pi->map_len);
+	free(pi);
+}
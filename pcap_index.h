@@ -0,0 +1,165 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef PCAP_INDEX_H
+#define PCAP_INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*******************************************************
+ * pcap_index: a sidecar file for random access into a trace
+ *
+ * 	built by one pass of oftrace over the trace, it lists the
+ * 	file offset of every record carrying payload for each tcp
+ * 	session, and cuts the trace into fixed time buckets.  At the
+ * 	start of each bucket it saves a checkpoint of every live
+ * 	session: the seqno of its next message and the offset of
+ * 	the oldest record still holding queued bytes for it, which
+ * 	is enough to rebuild the reassembly state without reading
+ * 	anything before that.
+ *
+ * 	The file is written in host byte order and mmap()'d whole
+ * 	when read back
+ */
+
+#define PCAP_INDEX_MAGIC	"OFTIDX01"
+#define PCAP_INDEX_SUFFIX	".oftidx"
+
+#ifndef OFTRACE_INDEX_BUCKET_SECS
+#define OFTRACE_INDEX_BUCKET_SECS	10
+#endif
+
+typedef struct pcap_index_hdr {
+	char magic[8];
+	uint64_t trace_size;	// to notice that the trace changed under us
+	int64_t trace_mtime;
+	uint32_t ip;		// filter the index was built with
+	uint32_t port;
+	int64_t t0;		// nsec timestamp where bucket 0 starts
+	int64_t bucket_nsec;
+	uint32_t n_sessions;
+	uint32_t n_buckets;
+	uint64_t n_ckpts;
+	uint64_t n_recs;
+} pcap_index_hdr;
+
+typedef struct pcap_index_session {
+	uint32_t sip;
+	uint32_t dip;
+	uint16_t sport;		// network byte order, like tcp_session
+	uint16_t dport;
+	uint32_t n_recs;
+	uint64_t first_rec;	// into recs[]
+} pcap_index_session;
+
+typedef struct pcap_index_bucket {
+	uint64_t offset;	// first record of the bucket
+	uint64_t first_ckpt;	// into ckpts[]
+	uint32_t n_ckpts;
+	uint32_t pad;
+} pcap_index_bucket;
+
+typedef struct pcap_index_ckpt {
+	uint32_t session;	// into sessions[]
+	uint32_t seqno;		// host byte order; next byte to deliver
+	uint64_t offset;	// oldest record still queued, or the bucket's first record
+} pcap_index_ckpt;
+
+// an index read back from disk; everything points into the mapping
+typedef struct pcap_index {
+	char * map;
+	size_t map_len;
+	pcap_index_hdr * hdr;
+	pcap_index_session * sessions;
+	pcap_index_bucket * buckets;
+	pcap_index_ckpt * ckpts;
+	uint64_t * recs;	// each session's record offsets, in file order
+} pcap_index;
+
+typedef struct pcap_index_builder pcap_index_builder;
+
+/***************************
+ * 	start collecting an index; ip and port are only recorded
+ */
+pcap_index_builder * pcap_index_builder_new(int64_t bucket_nsec, uint32_t ip, int port);
+
+/***************************
+ * 	return the index's id for this 4-tuple, adding it if new
+ */
+int pcap_index_session_id(pcap_index_builder * ib, uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+
+/***************************
+ * 	called for every record, at time t (nsec) and file offset
+ * 	return 1 if this record starts a new bucket; the caller then
+ * 	adds a checkpoint for every live session
+ */
+int pcap_index_start_bucket(pcap_index_builder * ib, int64_t t, off_t offset);
+void pcap_index_add_ckpt(pcap_index_builder * ib, int session, uint32_t seqno, off_t offset);
+
+/***************************
+ * 	session has a record with payload at offset
+ */
+void pcap_index_add_rec(pcap_index_builder * ib, int session, off_t offset);
+
+/***************************
+ * 	write everything out to indexfile, stamped with tracefile's
+ * 	size and mtime; return 0 on success
+ */
+int pcap_index_write(pcap_index_builder * ib, char * indexfile, char * tracefile);
+void pcap_index_builder_free(pcap_index_builder * ib);
+
+/***************************
+ * 	map indexfile; return NULL if it is missing, corrupt, or
+ * 	doesn't match tracefile any more
+ */
+pcap_index * pcap_index_open(char * indexfile, char * tracefile);
+
+/***************************
+ * 	return the session with this 4-tuple, or -1
+ */
+int pcap_index_find_session(pcap_index * pi, uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+
+/***************************
+ * 	return the bucket holding time t (nsec), clamped to the trace
+ */
+int pcap_index_find_bucket(pcap_index * pi, int64_t t);
+
+/***************************
+ * 	return the first of session's records at or after offset
+ * 	(n_recs if there is none), by bisection
+ */
+uint64_t pcap_index_find_rec(pcap_index * pi, int session, off_t offset);
+
+void pcap_index_close(pcap_index * pi);
+
+#endif
@@ -0,0 +1,292 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "pcap_merge.h"
+#include "utils.h"
+
+static int pcap_merge_add(pcap_merge * pm, char * filename, int64_t offset);
+static int pcap_merge_fill(pcap_merge * pm, int i);
+static int pcap_merge_start(pcap_merge * pm);
+static int heap_before(pcap_merge * pm, int a, int b);
+static void heap_down(pcap_merge * pm, int slot);
+
+/**********************************************************
+ * pcap_merge * pcap_merge_open(char ** patterns, int n_patterns, const double * clock_offsets)
+ * 	expand the patterns, open a reader per file and prime the heap
+ */
+pcap_merge * pcap_merge_open(char ** patterns, int n_patterns, const double * clock_offsets)
+{
+	pcap_merge * pm;
+	glob_t g;
+	int64_t offset;
+	int i,j,err;
+
+	pm = malloc_and_check(sizeof(pcap_merge));
+	bzero(pm,sizeof(pcap_merge));
+	for(i=0;i<n_patterns;i++)
+	{
+		offset = clock_offsets ? (int64_t) (clock_offsets[i] * NSEC_PER_SEC) : 0;
+		err = glob(patterns[i],0,NULL,&g);
+		if(err == GLOB_NOMATCH)	// let the open fail with a real error
+			err = pcap_merge_add(pm,patterns[i],offset);
+		else if(err)
+			fprintf(stderr,"Failed to expand %s\n",patterns[i]);
+		for(j=0; err == 0 && j<g.gl_pathc; j++)
+			err = pcap_merge_add(pm,g.gl_pathv[j],offset);
+		globfree(&g);
+		if(err)
+		{
+			pcap_merge_close(pm);
+			return NULL;
+		}
+	}
+	if(pm->n_readers == 0)
+	{
+		fprintf(stderr,"No capture files to read\n");
+		pcap_merge_close(pm);
+		return NULL;
+	}
+	pm->recs = malloc_and_check(pm->n_readers * sizeof(pcap_record));
+	pm->keys = malloc_and_check(pm->n_readers * sizeof(int64_t));
+	pm->heap = malloc_and_check(pm->n_readers * sizeof(int));
+	if(pcap_merge_start(pm))
+	{
+		pcap_merge_close(pm);
+		return NULL;
+	}
+	return pm;
+}
+
+/**********************************************************
+ * int pcap_merge_next(pcap_merge * pm, pcap_record * rec)
+ * 	the record handed out last time stays on top of the heap
+ * 	until now, so its reader's buffer is not touched while the
+ * 	caller still looks at it
+ */
+int pcap_merge_next(pcap_merge * pm, pcap_record * rec)
+{
+	int err;
+
+	if(pm->last >= 0)
+	{
+		err = pcap_merge_fill(pm,pm->last);
+		if(err < 0)
+			return -1;
+		if(err == 0)	// that file is done
+			pm->heap[0] = pm->heap[--pm->n_heap];
+		heap_down(pm,0);
+		pm->last = -1;
+	}
+	if(pm->n_heap == 0)
+		return 0;
+	pm->last = pm->heap[0];
+	*rec = pm->recs[pm->last];
+	return 1;
+}
+
+/**********************************************************
+ * int pcap_merge_rewind(pcap_merge * pm)
+ */
+int pcap_merge_rewind(pcap_merge * pm)
+{
+	int i;
+	for(i=0;i<pm->n_readers;i++)
+		if(pcap_reader_rewind(pm->readers[i]))
+			return -1;
+	return pcap_merge_start(pm);
+}
+
+/**********************************************************
+ * int pcap_merge_seek_time(pcap_merge * pm, int64_t t)
+ */
+int pcap_merge_seek_time(pcap_merge * pm, int64_t t)
+{
+	int i;
+	for(i=0;i<pm->n_readers;i++)
+		if(pcap_reader_seek_time(pm->readers[i],t - pm->offsets[i]))
+			return -1;
+	return pcap_merge_start(pm);
+}
+
+/**********************************************************
+ * double pcap_merge_progress(pcap_merge * pm)
+ * 	the files' progress, weighted by their sizes
+ */
+double pcap_merge_progress(pcap_merge * pm)
+{
+	double done = 0, total = 0, p;
+	int i;
+	for(i=0;i<pm->n_readers;i++)
+	{
+		p = pcap_reader_progress(pm->readers[i]);
+		if(p < 0)
+			return p;
+		done += p * pm->sizes[i];
+		total += pm->sizes[i];
+	}
+	return total > 0 ? done / total : 0;
+}
+
+/**********************************************************
+ * void pcap_merge_close(pcap_merge * pm)
+ */
+void pcap_merge_close(pcap_merge * pm)
+{
+	int i;
+	if(!pm)
+		return;
+	for(i=0;i<pm->n_readers;i++)
+		pcap_reader_close(pm->readers[i]);
+	if(pm->readers)
+		free(pm->readers);
+	if(pm->offsets)
+		free(pm->offsets);
+	if(pm->sizes)
+		free(pm->sizes);
+	if(pm->recs)
+		free(pm->recs);
+	if(pm->keys)
+		free(pm->keys);
+	if(pm->heap)
+		free(pm->heap);
+	free(pm);
+}
+
+/**********************************************************
+ * static int pcap_merge_add(pcap_merge * pm, char * filename, int64_t offset)
+ */
+static int pcap_merge_add(pcap_merge * pm, char * filename, int64_t offset)
+{
+	pcap_reader * pr;
+	struct stat sbuf;
+	int n = pm->n_readers;
+
+	pr = pcap_reader_open(filename,0);
+	if(pr == NULL)
+		return -1;
+	pm->readers = realloc_and_check(pm->readers,(n+1) * sizeof(pcap_reader *));
+	pm->offsets = realloc_and_check(pm->offsets,(n+1) * sizeof(int64_t));
+	pm->sizes = realloc_and_check(pm->sizes,(n+1) * sizeof(off_t));
+	pm->readers[n] = pr;
+	pm->offsets[n] = offset;
+	pm->sizes[n] = (fstat(pr->fd,&sbuf) == 0 && sbuf.st_size > 0) ? sbuf.st_size : 1;
+	pm->n_readers++;
+	return 0;
+}
+
+/**********************************************************
+ * static int pcap_merge_fill(pcap_merge * pm, int i)
+ * 	read reader i's next record and work out its key,
+ * 	applying the clock correction to the record itself
+ */
+static int pcap_merge_fill(pcap_merge * pm, int i)
+{
+	pcap_record * rec = &pm->recs[i];
+	int64_t t;
+	int err;
+
+	err = pcap_reader_next(pm->readers[i],rec);
+	if(err <= 0)
+		return err;
+	t = (int64_t) rec->phdr.ts_sec * NSEC_PER_SEC + rec->ts_nsec + pm->offsets[i];
+	if(pm->offsets[i])
+	{
+		rec->phdr.ts_sec = t / NSEC_PER_SEC;
+		rec->ts_nsec = t % NSEC_PER_SEC;
+		rec->phdr.ts_usec = rec->ts_nsec / 1000;
+	}
+	pm->keys[i] = t;
+	return 1;
+}
+
+/**********************************************************
+ * static int pcap_merge_start(pcap_merge * pm)
+ * 	read the first record of every file and heapify
+ */
+static int pcap_merge_start(pcap_merge * pm)
+{
+	int i, err;
+
+	pm->n_heap = 0;
+	pm->last = -1;
+	for(i=0;i<pm->n_readers;i++)
+	{
+		err = pcap_merge_fill(pm,i);
+		if(err < 0)
+			return -1;
+		if(err > 0)
+			pm->heap[pm->n_heap++] = i;
+	}
+	for(i=pm->n_heap/2 - 1; i>=0; i--)
+		heap_down(pm,i);
+	return 0;
+}
+
+/**********************************************************
+ * static int heap_before(pcap_merge * pm, int a, int b)
+ * 	does reader a's record come first?  Ties go to the file
+ * 	listed first, so the output order is repeatable
+ */
+static int heap_before(pcap_merge * pm, int a, int b)
+{
+	if(pm->keys[a] != pm->keys[b])
+		return pm->keys[a] < pm->keys[b];
+	return a < b;
+}
+
+/**********************************************************
+ * static void heap_down(pcap_merge * pm, int slot)
+ */
+static void heap_down(pcap_merge * pm, int slot)
+{
+	int child, tmp;
+	while((child = 2*slot + 1) < pm->n_heap)
+	{
+		if(child + 1 < pm->n_heap && heap_before(pm,pm->heap[child+1],pm->heap[child]))
+			child++;
+		if(!heap_before(pm,pm->heap[child],pm->heap[slot]))
+			break;
+		tmp = pm->heap[slot];
+		pm->heap[slot] = pm->heap[child];
+		pm->heap[child] = tmp;
+		slot = child;
+	}
+}
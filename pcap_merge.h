@@ -0,0 +1,86 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef PCAP_MERGE_H
+#define PCAP_MERGE_H
+
+#include <stdint.h>
+
+#include "pcap_reader.h"
+
+/*******************************************************
+ * pcap_merge: several captures read as one
+ *
+ * 	each file gets its own pcap_reader; the readers' next
+ * 	records sit in a binary heap keyed by timestamp, so
+ * 	every record costs O(log n_files) and nothing is copied.
+ * 	Used for rotated tcpdump series and for simultaneous
+ * 	captures from several interfaces
+ */
+
+typedef struct pcap_merge {
+	int n_readers;
+	pcap_reader ** readers;
+	int64_t * offsets;	// nsec added to each file's timestamps
+	off_t * sizes;		// for weighting progress
+	pcap_record * recs;	// next record from each reader
+	int64_t * keys;		// ... and its (corrected) time in nsec
+	int * heap;		// reader indices, earliest record on top
+	int n_heap;
+	int last;		// reader the previous record came from, or -1
+} pcap_merge;
+
+/***************************
+ * 	open every file matching each of the n_patterns glob(3)
+ * 	patterns; clock_offsets (may be NULL) is in seconds, one per
+ * 	pattern, and is added to the timestamps of its files
+ * 	return NULL on failure
+ */
+pcap_merge * pcap_merge_open(char ** patterns, int n_patterns, const double * clock_offsets);
+
+/***************************
+ * 	fill in rec with the earliest record across all files;
+ * 	same contract as pcap_reader_next(): 1, 0 on EOF, -1 on error
+ */
+int pcap_merge_next(pcap_merge * pm, pcap_record * rec);
+
+int pcap_merge_rewind(pcap_merge * pm);
+
+/***************************
+ * 	position every file at its first record at or after t (nsec,
+ * 	after clock correction)
+ */
+int pcap_merge_seek_time(pcap_merge * pm, int64_t t);
+double pcap_merge_progress(pcap_merge * pm);
+void pcap_merge_close(pcap_merge * pm);
+
+#endif
@@ -0,0 +1,1520 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "pcap_decompress.h"
+#include "pcap_reader.h"
+#include "utils.h"
+
+/*******************************************************
+ * read-ahead ring: the reader thread fills blocks at tail, the
+ * 	parser consumes them from head; rd_off is how far into
+ * 	the head block the parser has gotten
+ */
+struct pcap_readahead {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	char * blocks[OFTRACE_READAHEAD_BLOCKS];
+	int lens[OFTRACE_READAHEAD_BLOCKS];
+	off_t raw_starts[OFTRACE_READAHEAD_BLOCKS];	// compressed offsets at either end of each block
+	off_t raw_ends[OFTRACE_READAHEAD_BLOCKS];
+	int head;
+	int tail;
+	int count;		// number of filled blocks
+	int done;		// reader thread hit EOF or an error
+	int stop;		// ask the reader thread to exit
+	int rd_off;
+	int want;		// bytes the parser is blocked waiting for, or 0
+	int is_file;		// regular file: use fadvise hints
+	off_t file_off;		// where the reader thread is reading
+};
+
+/*******************************************************
+ * per-interface state from a pcapng interface description block
+ */
+struct pcapng_if {
+	int linktype;
+	pcap_link_decoder link;
+	uint32_t snaplen;
+	uint64_t units;		// timestamp ticks per second (if_tsresol)
+	int64_t offset;		// seconds to add to every timestamp (if_tsoffset)
+};
+
+static int pcap_reader_map(pcap_reader * pr, int len);
+static int pcap_reader_fill(pcap_reader * pr, int len);
+static int pcap_reader_raw_read(void * ctx, char * buf, int len);
+static int pcap_reader_source_read(pcap_reader * pr, char * buf, int len);
+static void pcap_reader_use_stdio(pcap_reader * pr);
+static int pcap_reader_use_thread(pcap_reader * pr, int is_file);
+static void pcap_reader_stop_thread(pcap_reader * pr);
+static char * pcap_readahead_peek(pcap_reader * pr, int len);
+static void * pcap_readahead_main(void * arg);
+static off_t pcap_readahead_raw_pos(pcap_reader * pr);
+static int pcap_reader_read_ghdr(pcap_reader * pr);
+static int pcapng_next(pcap_reader * pr, pcap_record * rec);
+static int pcapng_add_if(pcap_reader * pr, char * block, uint32_t len);
+static int pcap_reader_discard(pcap_reader * pr, off_t len);
+static uint16_t rd16(pcap_reader * pr, char * p);
+static uint32_t rd32(pcap_reader * pr, char * p);
+static uint64_t rd64(pcap_reader * pr, char * p);
+static int pcap_reader_next_record(pcap_reader * pr, pcap_record * rec);
+static void pcap_follow_init(pcap_reader * pr);
+static void pcap_follow_wait(pcap_reader * pr);
+static char * pcap_follow_next_name(pcap_reader * pr);
+static int pcap_follow_same_pattern(const char * name, const char * base);
+static int pcap_follow_rotate(pcap_reader * pr);
+static uint16_t bswap_16(uint16_t v);
+static uint32_t bswap_32(uint32_t v);
+static int pcap_reader_resync(pcap_reader * pr, off_t from, off_t * rec_off, int64_t * t);
+static int pcap_hdr_plausible(pcap_reader * pr, char * p, int avail, int at_eof, int64_t * t);
+static int pcapng_epb_plausible(pcap_reader * pr, char * p, int avail, int at_eof, int64_t * t);
+static void pcap_reader_unread(pcap_reader * pr, pcap_record * rec);
+
+/**********************************************************
+ * pcap_reader * pcap_reader_open(char * filename, int flags)
+ * 	open the file, pick a reading mode and parse the global header
+ */
+pcap_reader * pcap_reader_open(char * filename, int flags)
+{
+	pcap_reader * pr;
+	struct stat sbuf;
+	unsigned char magic[4];
+	int mlen, err, is_file;
+	int fd;
+
+	if(filename==NULL || !strcmp(filename,"-")) {
+		fd = STDIN_FILENO;
+		filename = "(stdin)";
+	} else {
+		fd = open(filename,O_RDONLY);
+	}
+	if(fd < 0)
+	{
+		fprintf(stderr,"Failed to open %s ; exiting\n",filename);
+		perror("open");
+		return NULL;
+	}
+	pr = malloc_and_check(sizeof(pcap_reader));
+	bzero(pr,sizeof(pcap_reader));
+	pr->fd = fd;
+	pr->filename = strdup(filename);
+	if((flags & PCAP_READER_FOLLOW) && fstat(fd,&sbuf)==0 && S_ISREG(sbuf.st_mode))
+	{
+		// a file that is still being written: plain read(2), which
+		// 	pcap_reader_fill() retries as the file grows (pipes
+		// 	already block, so they need nothing special)
+		mlen = pread(fd,magic,sizeof(magic),0);
+		if(pcap_decompress_detect(magic,mlen) != PCAP_COMPRESS_NONE)
+		{
+			fprintf(stderr,"Can't follow %s: it is compressed\n",filename);
+			pcap_reader_close(pr);
+			return NULL;
+		}
+		pcap_reader_use_stdio(pr);
+		pcap_follow_init(pr);
+		if(pcap_reader_read_ghdr(pr))
+		{
+			pcap_reader_close(pr);
+			return NULL;
+		}
+		return pr;
+	}
+	is_file = (fstat(fd,&sbuf)==0 && S_ISREG(sbuf.st_mode) && sbuf.st_size > 0);
+	if(is_file)
+	{
+		pr->pos = lseek(fd,0,SEEK_CUR);	// stdin may already be part way in
+		if(pr->pos < 0)
+			pr->pos = 0;
+		mlen = pread(fd,magic,sizeof(magic),pr->pos);
+	}
+	else
+	{
+		// can't look ahead on a pipe; hang on to what we read
+		for(mlen = 0; mlen < sizeof(pr->prefix); mlen += err)
+		{
+			err = read(fd,&pr->prefix[mlen],sizeof(pr->prefix) - mlen);
+			if(err < 0 && errno == EINTR)
+				err = 0;
+			else if(err <= 0)
+				break;
+		}
+		pr->prefix_len = mlen;
+		memcpy(magic,pr->prefix,mlen);
+	}
+	pr->compression = pcap_decompress_detect(magic,mlen);
+	if(pr->compression != PCAP_COMPRESS_NONE)
+	{
+		pr->dc = pcap_decompress_new(pr->compression,pcap_reader_raw_read,pr,
+				fd, is_file ? sbuf.st_size : 0);
+		if(pr->dc == NULL)
+		{
+			pcap_reader_close(pr);
+			return NULL;
+		}
+		fprintf(stderr,"DBG: decompressing %s trace %s\n",
+				pcap_decompress_name(pr->compression),filename);
+		if(pcap_reader_use_thread(pr,is_file))
+			pcap_reader_use_stdio(pr);
+	}
+	else if(is_file)
+	{
+		pr->mode = PCAP_READER_MMAP;
+		pr->size = sbuf.st_size;
+	}
+	else if(pcap_reader_use_thread(pr,0))
+		pcap_reader_use_stdio(pr);
+
+	if(pcap_reader_read_ghdr(pr))
+	{
+		pcap_reader_close(pr);
+		return NULL;
+	}
+	return pr;
+}
+
+/**********************************************************
+ * static int pcap_reader_read_ghdr(pcap_reader * pr)
+ * 	figure out the file format from the magic number; classic
+ * 	pcap headers get byte swapped into host order as needed
+ * 	return 0 on success
+ */
+static int pcap_reader_read_ghdr(pcap_reader * pr)
+{
+	uint32_t magic;
+	char * p;
+
+	p = pcap_reader_peek(pr,sizeof(magic));
+	if(p == NULL)
+	{
+		fprintf(stderr," Short file read on pcap global header!\n");
+		return -1;
+	}
+	memcpy(&magic,p,sizeof(magic));
+	if(magic == PCAPNG_MAGIC)
+	{
+		// the section header block is handled like any other block
+		pr->format = PCAP_FORMAT_PCAPNG;
+		pr->data_start = pr->pos;
+		pr->ghdr.magic_number = magic;
+		return 0;
+	}
+	p = pcap_reader_peek(pr,sizeof(pr->ghdr));
+	if(p == NULL)
+	{
+		fprintf(stderr," Short file read on pcap global header!\n");
+		return -1;
+	}
+	memcpy(&pr->ghdr,p,sizeof(pr->ghdr));
+	pcap_reader_skip(pr,sizeof(pr->ghdr));
+	pr->format = PCAP_FORMAT_PCAP;
+	pr->data_start = pr->pos;
+	switch(magic)	// make sure the magic number is right
+	{
+		case PCAP_NSEC_BACKWARDS_MAGIC:
+			pr->nsec = 1;
+			// fall through
+		case PCAP_BACKWARDS_MAGIC:
+			pr->swapped = 1;
+			pr->ghdr.version_major = bswap_16(pr->ghdr.version_major);
+			pr->ghdr.version_minor = bswap_16(pr->ghdr.version_minor);
+			pr->ghdr.thiszone = bswap_32(pr->ghdr.thiszone);
+			pr->ghdr.sigfigs = bswap_32(pr->ghdr.sigfigs);
+			pr->ghdr.snaplen = bswap_32(pr->ghdr.snaplen);
+			pr->ghdr.network = bswap_32(pr->ghdr.network);
+			break;
+		case PCAP_NSEC_MAGIC:
+			pr->nsec = 1;
+			break;
+		case PCAP_MAGIC:
+			break;
+		default:
+			fprintf(stderr,"Got %u for pcap magic number: are you sure this is a pcap file?\n",
+					pr->ghdr.magic_number);
+			return -1;
+	}
+	pr->ghdr.network &= 0x0fffffff;		// upper bits may carry FCS info
+	pr->link = pcap_decode_link(pr->ghdr.network);
+	return 0;
+}
+
+/**********************************************************
+ * int pcap_reader_next(pcap_reader * pr, pcap_record * rec)
+ * 	point rec at the next record; the packet bytes stay wherever
+ * 	the reader has them (the mapping or the read buffer)
+ *
+ * 	when following, this only returns at the end of the file if
+ * 	the next file of a rotated series has shown up; then it moves
+ * 	on to that file
+ */
+int pcap_reader_next(pcap_reader * pr, pcap_record * rec)
+{
+	int err;
+	for(;;)
+	{
+		err = pcap_reader_next_record(pr,rec);
+		if(err != 0 || pr->follow_next == NULL)
+			return err;
+		if(pcap_follow_rotate(pr))
+			return -1;
+	}
+}
+
+/**********************************************************
+ * static int pcap_reader_next_record(pcap_reader * pr, pcap_record * rec)
+ */
+static int pcap_reader_next_record(pcap_reader * pr, pcap_record * rec)
+{
+	char * p;
+	int len;
+
+	if(pr->format == PCAP_FORMAT_PCAPNG)
+		return pcapng_next(pr,rec);
+	p = pcap_reader_peek(pr,sizeof(rec->phdr));	// grab a header
+	if(p == NULL)
+		return pr->eof ? 0 : -1;		// not found; stop
+	memcpy(&rec->phdr,p,sizeof(rec->phdr));
+	if(pr->swapped)
+	{
+		rec->phdr.ts_sec = bswap_32(rec->phdr.ts_sec);
+		rec->phdr.ts_usec = bswap_32(rec->phdr.ts_usec);
+		rec->phdr.incl_len = bswap_32(rec->phdr.incl_len);
+		rec->phdr.orig_len = bswap_32(rec->phdr.orig_len);
+	}
+	if(pr->nsec)
+	{
+		rec->ts_nsec = rec->phdr.ts_usec;
+		rec->phdr.ts_usec /= 1000;
+	}
+	else
+		rec->ts_nsec = rec->phdr.ts_usec * 1000;
+	rec->linktype = pr->ghdr.network;
+	rec->link = pr->link;
+	if(rec->phdr.incl_len > BUFLEN)
+	{
+		fprintf(stderr,"bogus record length %u at offset %lld -- terminating\n",
+				rec->phdr.incl_len, (long long) pr->pos);
+		return -1;
+	}
+	len = sizeof(rec->phdr) + rec->phdr.incl_len;
+	p = pcap_reader_peek(pr,len);
+	if(p == NULL)
+	{
+		if(pr->follow_next)
+			return 0;	// tcpdump moved on without finishing this one
+		fprintf(stderr,"short file reading packet (wanted %d bytes) -- terminating\n",
+				rec->phdr.incl_len);
+		return -1;	// not found; stop
+	}
+	rec->offset = pr->pos;
+	rec->data = p + sizeof(rec->phdr);
+	pcap_reader_skip(pr,len);
+	return 1;
+}
+
+/**********************************************************
+ * static int pcapng_next(pcap_reader * pr, pcap_record * rec)
+ * 	walk pcapng blocks until the next packet; section headers
+ * 	and interface descriptions update the reader's state on
+ * 	the way past, everything else is skipped
+ */
+static int pcapng_next(pcap_reader * pr, pcap_record * rec)
+{
+	struct pcapng_if * iface;
+	uint32_t type, len, ifid, caplen, bom;
+	uint64_t ts;
+	char * p;
+
+	for(;;)
+	{
+		p = pcap_reader_peek(pr,8);
+		if(p == NULL)
+			return pr->eof ? 0 : -1;
+		memcpy(&type,p,sizeof(type));
+		if(type == PCAPNG_MAGIC)	// new section: byte order and interfaces start over
+		{
+			p = pcap_reader_peek(pr,12);
+			if(p == NULL)
+				return pr->eof ? 0 : -1;
+			memcpy(&bom,&p[8],sizeof(bom));
+			if(bom == PCAPNG_BYTE_ORDER_MAGIC)
+				pr->swapped = 0;
+			else if(bom == bswap_32(PCAPNG_BYTE_ORDER_MAGIC))
+				pr->swapped = 1;
+			else
+			{
+				fprintf(stderr,"bogus pcapng byte order magic 0x%x at offset %lld -- terminating\n",
+						bom, (long long) pr->pos);
+				return -1;
+			}
+			pr->n_ifaces = 0;
+		}
+		type = rd32(pr,p);
+		len = rd32(pr,&p[4]);
+		if(len < 12 || (len % 4) != 0)
+		{
+			fprintf(stderr,"bogus pcapng block length %u at offset %lld -- terminating\n",
+					len, (long long) pr->pos);
+			return -1;
+		}
+		if(len > (BUFLEN + 64))
+		{
+			if(type == PCAPNG_BLOCK_EPB || type == PCAPNG_BLOCK_SPB || type == PCAPNG_BLOCK_OPB)
+			{
+				fprintf(stderr,"bogus record length %u at offset %lld -- terminating\n",
+						len, (long long) pr->pos);
+				return -1;
+			}
+			if(pcap_reader_discard(pr,len))		// some huge block we don't care about
+				return -1;
+			continue;
+		}
+		p = pcap_reader_peek(pr,len);
+		if(p == NULL)
+		{
+			if(pr->follow_next)
+				return 0;	// tcpdump moved on without finishing this one
+			fprintf(stderr,"short file reading pcapng block (wanted %u bytes) -- terminating\n",len);
+			return -1;
+		}
+		rec->offset = pr->pos;
+		switch(type)
+		{
+			case PCAPNG_BLOCK_IDB:
+				if(pcapng_add_if(pr,p,len))
+					return -1;
+				break;
+			case PCAPNG_BLOCK_EPB:
+			case PCAPNG_BLOCK_OPB:
+				if(type == PCAPNG_BLOCK_EPB)
+					ifid = rd32(pr,&p[8]);
+				else
+					ifid = rd16(pr,&p[8]);
+				caplen = rd32(pr,&p[20]);
+				if(ifid >= pr->n_ifaces || (28 + caplen + 4) > len)
+				{
+					fprintf(stderr,"bogus pcapng packet block at offset %lld -- skipping\n",
+							(long long) pr->pos);
+					break;
+				}
+				iface = &pr->ifaces[ifid];
+				ts = ((uint64_t) rd32(pr,&p[12]) << 32) | rd32(pr,&p[16]);
+				rec->phdr.ts_sec = ts / iface->units + iface->offset;
+				rec->ts_nsec = (uint32_t) ((long double) (ts % iface->units) * 1000000000 / iface->units);
+				rec->phdr.ts_usec = rec->ts_nsec / 1000;
+				rec->phdr.incl_len = caplen;
+				rec->phdr.orig_len = rd32(pr,&p[24]);
+				rec->linktype = iface->linktype;
+				rec->link = iface->link;
+				rec->data = &p[28];
+				pcap_reader_skip(pr,len);
+				return 1;
+			case PCAPNG_BLOCK_SPB:
+				if(pr->n_ifaces == 0)
+				{
+					fprintf(stderr,"pcapng simple packet block before any interface -- skipping\n");
+					break;
+				}
+				iface = &pr->ifaces[0];
+				rec->phdr.orig_len = rd32(pr,&p[8]);
+				caplen = MIN(rec->phdr.orig_len,len - 16);
+				if(iface->snaplen > 0)
+					caplen = MIN(caplen,iface->snaplen);
+				bzero(&rec->phdr,sizeof(rec->phdr.ts_sec) + sizeof(rec->phdr.ts_usec));	// no timestamp
+				rec->ts_nsec = 0;
+				rec->phdr.incl_len = caplen;
+				rec->linktype = iface->linktype;
+				rec->link = iface->link;
+				rec->data = &p[12];
+				pcap_reader_skip(pr,len);
+				return 1;
+			default:
+				break;		// section header, statistics, name resolution, ...
+		}
+		pcap_reader_skip(pr,len);
+	}
+}
+
+/**********************************************************
+ * static int pcapng_add_if(pcap_reader * pr, char * block, uint32_t len)
+ * 	record an interface description block: link type plus the
+ * 	if_tsresol and if_tsoffset options, which say how to turn
+ * 	its packet timestamps into seconds
+ */
+static int pcapng_add_if(pcap_reader * pr, char * block, uint32_t len)
+{
+	struct pcapng_if * iface;
+	uint16_t code, olen;
+	uint32_t off;
+	uint8_t resol;
+	int i;
+
+	if(pr->n_ifaces >= pr->max_ifaces)
+	{
+		pr->max_ifaces = pr->max_ifaces ? 2 * pr->max_ifaces : 4;
+		pr->ifaces = realloc_and_check(pr->ifaces,pr->max_ifaces * sizeof(struct pcapng_if));
+	}
+	iface = &pr->ifaces[pr->n_ifaces++];
+	iface->linktype = rd16(pr,&block[8]);
+	iface->link = pcap_decode_link(iface->linktype);
+	iface->snaplen = rd32(pr,&block[12]);
+	iface->units = 1000000;		// default resolution is microseconds
+	iface->offset = 0;
+	for(off = 16; off + 4 <= len - 4; off += 4 + ((olen + 3) & ~3))
+	{
+		code = rd16(pr,&block[off]);
+		olen = rd16(pr,&block[off+2]);
+		if(code == 0 || off + 4 + olen > len - 4)
+			break;		// opt_endofopt
+		if(code == 9 && olen >= 1)		// if_tsresol
+		{
+			resol = block[off+4];
+			if(resol & 0x80)
+				iface->units = (uint64_t) 1 << MIN(resol & 0x7f,63);
+			else
+				for(iface->units = 1, i = 0; i < MIN(resol,19); i++)
+					iface->units *= 10;
+		}
+		else if(code == 14 && olen >= 8)	// if_tsoffset
+			iface->offset = (int64_t) rd64(pr,&block[off+4]);
+	}
+	if(pr->n_ifaces == 1)
+	{
+		pr->ghdr.network = iface->linktype;
+		pr->link = iface->link;
+	}
+	return 0;
+}
+
+/**********************************************************
+ * static int pcap_reader_discard(pcap_reader * pr, off_t len)
+ * 	skip len bytes, which may be more than we can peek at once
+ */
+static int pcap_reader_discard(pcap_reader * pr, off_t len)
+{
+	int n;
+	while(len > 0)
+	{
+		n = MIN(len, OFTRACE_READ_BUFLEN);
+		if(pcap_reader_peek(pr,n) == NULL)
+			return -1;
+		pcap_reader_skip(pr,n);
+		len -= n;
+	}
+	return 0;
+}
+
+static uint16_t rd16(pcap_reader * pr, char * p)
+{
+	uint16_t v;
+	memcpy(&v,p,sizeof(v));
+	return pr->swapped ? bswap_16(v) : v;
+}
+
+static uint32_t rd32(pcap_reader * pr, char * p)
+{
+	uint32_t v;
+	memcpy(&v,p,sizeof(v));
+	return pr->swapped ? bswap_32(v) : v;
+}
+
+static uint64_t rd64(pcap_reader * pr, char * p)
+{
+	uint64_t v;
+	memcpy(&v,p,sizeof(v));
+	if(pr->swapped)
+		v = ((uint64_t) bswap_32(v & 0xffffffff) << 32) | bswap_32(v >> 32);
+	return v;
+}
+
+// <byteswap.h> is glibc only
+static uint16_t bswap_16(uint16_t v)
+{
+	return (v >> 8) | (v << 8);
+}
+
+static uint32_t bswap_32(uint32_t v)
+{
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+/**********************************************************
+ * char * pcap_reader_peek(pcap_reader * pr, int len)
+ * 	return a pointer to the next len contiguous bytes
+ */
+char * pcap_reader_peek(pcap_reader * pr, int len)
+{
+	assert(pr);
+	if(pr->mode == PCAP_READER_MMAP)
+	{
+		if((pr->pos + len) > pr->size)
+		{
+			pr->eof = 1;
+			return NULL;
+		}
+		if(pr->pos < pr->map_off || (pr->pos + len) > (pr->map_off + (off_t) pr->map_len))
+			if(pcap_reader_map(pr,len))
+				return pcap_reader_peek(pr,len);	// mmap failed; fell back to read()
+		return &pr->map[pr->pos - pr->map_off];
+	}
+	if(pr->mode == PCAP_READER_THREAD)
+		return pcap_readahead_peek(pr,len);
+	if((pr->buf_end - pr->buf_start) < len && pcap_reader_fill(pr,len))
+		return NULL;
+	return &pr->buf[pr->buf_start];
+}
+
+/**********************************************************
+ * void pcap_reader_skip(pcap_reader * pr, int len)
+ */
+void pcap_reader_skip(pcap_reader * pr, int len)
+{
+	assert(pr);
+	pr->pos += len;
+	if(pr->mode == PCAP_READER_STDIO)
+	{
+		pr->buf_start += len;
+		assert(pr->buf_start <= pr->buf_end);
+	}
+	else if(pr->mode == PCAP_READER_THREAD)
+		pr->ra->rd_off += len;	// blocks are released on the next peek
+}
+
+/**********************************************************
+ * int pcap_reader_seek(pcap_reader * pr, off_t offset)
+ */
+int pcap_reader_seek(pcap_reader * pr, off_t offset)
+{
+	int is_file;
+	assert(pr);
+	if(pr->mode != PCAP_READER_MMAP && lseek(pr->fd,0,SEEK_CUR) == (off_t) -1)
+		return -1;	// pipe or stdin; can't go back
+	if(pr->dc)
+	{
+		// can't jump into the middle of a compressed stream: decode
+		// 	from the top and throw away everything before offset
+		if(pr->ra)
+		{
+			is_file = pr->ra->is_file;
+			pcap_reader_stop_thread(pr);
+		}
+		else
+			is_file = 1;
+		if(pcap_decompress_reset(pr->dc))
+			return -1;
+		pr->pos = pr->raw_pos = 0;
+		pr->eof = 0;
+		pr->buf_start = pr->buf_end = 0;
+		if(pr->mode == PCAP_READER_THREAD && pcap_reader_use_thread(pr,is_file))
+			return -1;
+		return pcap_reader_discard(pr,offset);
+	}
+	if(pr->mode == PCAP_READER_STDIO)
+	{
+		lseek(pr->fd,offset,SEEK_SET);
+		pr->buf_start = pr->buf_end = 0;
+	}
+	else if(pr->mode == PCAP_READER_THREAD)
+	{
+		is_file = pr->ra->is_file;
+		pcap_reader_stop_thread(pr);
+		lseek(pr->fd,offset,SEEK_SET);
+		pr->pos = offset;
+		if(pcap_reader_use_thread(pr,is_file))
+			return -1;
+	}
+	pr->pos = offset;
+	pr->eof = 0;
+	return 0;
+}
+
+/**********************************************************
+ * int pcap_reader_seek_time(pcap_reader * pr, int64_t t)
+ * 	lo is always a record boundary before t, so whatever the
+ * 	bisection does, reading on from lo finds the right record
+ */
+int pcap_reader_seek_time(pcap_reader * pr, int64_t t)
+{
+	pcap_record rec;
+	off_t lo, hi, mid, off;
+	int64_t ts = 0;
+	int err;
+
+	assert(pr);
+	if(pr->mode == PCAP_READER_MMAP && !pr->dc)
+	{
+		if(pr->format == PCAP_FORMAT_PCAPNG && pr->n_ifaces == 0)
+		{
+			// need the interface descriptions to read timestamps
+			if(pcap_reader_rewind(pr) || pcap_reader_next(pr,&rec) < 0)
+				return -1;
+		}
+		lo = pr->data_start;
+		hi = pr->size;
+		while(hi - lo > OFTRACE_SEEK_LINEAR)
+		{
+			mid = lo + (hi - lo) / 2;
+			if(pcap_reader_resync(pr,mid,&off,&ts) || off >= hi)
+				hi = mid;	// nothing recognizable; look lower
+			else if(ts < t)
+				lo = off;
+			else
+				hi = mid;
+		}
+		if(pcap_reader_seek(pr,lo))
+			return -1;
+	}
+	else if(pr->dc && pcap_reader_rewind(pr))
+		return -1;
+	// and from here on, one record at a time
+	for(;;)
+	{
+		err = pcap_reader_next(pr,&rec);
+		if(err < 1)
+			return err;
+		ts = (int64_t) rec.phdr.ts_sec * NSEC_PER_SEC + rec.ts_nsec;
+		if(ts >= t)
+		{
+			pcap_reader_unread(pr,&rec);
+			return 0;
+		}
+	}
+}
+
+/**********************************************************
+ * int pcap_reader_seek_record(pcap_reader * pr, off_t from)
+ */
+int pcap_reader_seek_record(pcap_reader * pr, off_t from)
+{
+	pcap_record rec;
+	off_t off;
+	int64_t ts;
+
+	assert(pr);
+	if(pr->mode != PCAP_READER_MMAP || pr->dc)
+		return -1;
+	if(pr->format == PCAP_FORMAT_PCAPNG && pr->n_ifaces == 0)
+	{
+		// need the interface descriptions to recognize packet blocks
+		if(pcap_reader_rewind(pr) || pcap_reader_next(pr,&rec) < 0)
+			return -1;
+	}
+	if(from < pr->data_start)
+		from = pr->data_start;
+	if(pcap_reader_resync(pr,from,&off,&ts))
+		off = pr->size;		// nothing after from
+	return pcap_reader_seek(pr,off);
+}
+
+/**********************************************************
+ * static int pcap_reader_resync(pcap_reader * pr, off_t from, off_t * rec_off, int64_t * t)
+ * 	find the first record (pcapng: enhanced packet block) at or
+ * 	after from, and its timestamp; return 0 if found
+ */
+static int pcap_reader_resync(pcap_reader * pr, off_t from, off_t * rec_off, int64_t * t)
+{
+	int avail, at_eof, k, step;
+	char * p;
+
+	step = 1;
+	if(pr->format == PCAP_FORMAT_PCAPNG)
+	{
+		from = (from + 3) & ~((off_t) 3);	// blocks are 32 bit aligned
+		step = 4;
+	}
+	if(from >= pr->size)
+		return -1;
+	avail = MIN(pr->size - from, (off_t) OFTRACE_RESYNC_CHAIN * (BUFLEN + 64) * 2);
+	at_eof = (from + avail == pr->size);
+	if(pcap_reader_seek(pr,from) || (p = pcap_reader_peek(pr,avail)) == NULL)
+		return -1;
+	for(k = 0; k < avail; k += step)
+	{
+		if(pr->format == PCAP_FORMAT_PCAPNG ?
+				pcapng_epb_plausible(pr,&p[k],avail - k,at_eof,t) :
+				pcap_hdr_plausible(pr,&p[k],avail - k,at_eof,t))
+		{
+			*rec_off = from + k;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**********************************************************
+ * static int pcap_hdr_plausible(pcap_reader * pr, char * p, int avail, int at_eof, int64_t * t)
+ * 	does a pcaprec_hdr_t start at p?  Check the lengths against
+ * 	each other and the snaplen, and that the records after it
+ * 	check out too and have timestamps that move forward
+ */
+static int pcap_hdr_plausible(pcap_reader * pr, char * p, int avail, int at_eof, int64_t * t)
+{
+	uint32_t snaplen = (pr->ghdr.snaplen > 0) ? MIN(pr->ghdr.snaplen,BUFLEN) : BUFLEN;
+	uint32_t frac_max = pr->nsec ? 1000000000 : 1000000;
+	uint32_t sec, frac, incl, orig;
+	int64_t ts, prev = 0;
+	int off = 0, n;
+
+	for(n = 0; n < OFTRACE_RESYNC_CHAIN; n++)
+	{
+		if(off == avail && at_eof)
+			break;		// ran cleanly into the end of the file
+		if(off + (int) sizeof(pcaprec_hdr_t) > avail)
+			return 0;
+		sec = rd32(pr,&p[off]);
+		frac = rd32(pr,&p[off+4]);
+		incl = rd32(pr,&p[off+8]);
+		orig = rd32(pr,&p[off+12]);
+		if(frac >= frac_max || incl > snaplen || incl > orig || orig == 0 || orig > 4 * BUFLEN)
+			return 0;
+		ts = (int64_t) sec * NSEC_PER_SEC + (pr->nsec ? frac : frac * 1000);
+		if(n == 0)
+			*t = ts;
+		else if(ts < prev - NSEC_PER_SEC || ts > prev + 3600 * NSEC_PER_SEC)
+			return 0;	// time went backwards, or jumped an hour
+		prev = ts;
+		off += sizeof(pcaprec_hdr_t) + incl;
+		if(off > avail)
+			return 0;
+	}
+	return 1;
+}
+
+/**********************************************************
+ * static int pcapng_epb_plausible(pcap_reader * pr, char * p, int avail, int at_eof, int64_t * t)
+ * 	same idea for pcapng: an enhanced packet block whose total
+ * 	length is repeated at its end, followed by more blocks that
+ * 	do the same
+ */
+static int pcapng_epb_plausible(pcap_reader * pr, char * p, int avail, int at_eof, int64_t * t)
+{
+	struct pcapng_if * iface;
+	uint32_t type, len, ifid;
+	uint64_t ts;
+	int off = 0, n;
+
+	for(n = 0; n < OFTRACE_RESYNC_CHAIN; n++)
+	{
+		if(off == avail && at_eof)
+			break;
+		if(off + 12 > avail)
+			return 0;
+		type = rd32(pr,&p[off]);
+		len = rd32(pr,&p[off+4]);
+		if(len < 12 || (len % 4) != 0 || len > (BUFLEN + 64) || off + len > avail ||
+				rd32(pr,&p[off + len - 4]) != len)
+			return 0;
+		if(n == 0)
+		{
+			if(type != PCAPNG_BLOCK_EPB || len < 32)
+				return 0;
+			ifid = rd32(pr,&p[8]);
+			if(ifid >= pr->n_ifaces || 28 + rd32(pr,&p[20]) + 4 > len)
+				return 0;
+			iface = &pr->ifaces[ifid];
+			ts = ((uint64_t) rd32(pr,&p[12]) << 32) | rd32(pr,&p[16]);
+			*t = (int64_t) (ts / iface->units + iface->offset) * NSEC_PER_SEC +
+				(int64_t) ((long double) (ts % iface->units) * 1000000000 / iface->units);
+		}
+		off += len;
+	}
+	return 1;
+}
+
+/**********************************************************
+ * static void pcap_reader_unread(pcap_reader * pr, pcap_record * rec)
+ * 	put back the record pcap_reader_next() just returned; its bytes
+ * 	are still wherever the last peek left them
+ */
+static void pcap_reader_unread(pcap_reader * pr, pcap_record * rec)
+{
+	off_t len = pr->pos - rec->offset;
+	pr->pos = rec->offset;
+	if(pr->mode == PCAP_READER_STDIO)
+	{
+		pr->buf_start -= len;
+		assert(pr->buf_start >= 0);
+	}
+	else if(pr->mode == PCAP_READER_THREAD)
+	{
+		pr->ra->rd_off -= len;
+		assert(pr->ra->rd_off >= 0);
+	}
+}
+
+/**********************************************************
+ * int pcap_reader_rewind(pcap_reader * pr)
+ * 	skip back to just past the global header
+ */
+int pcap_reader_rewind(pcap_reader * pr)
+{
+	return pcap_reader_seek(pr,pr->data_start);
+}
+
+/**********************************************************
+ * double pcap_reader_progress(pcap_reader * pr)
+ */
+double pcap_reader_progress(pcap_reader * pr)
+{
+	struct stat sbuf;
+	off_t done = pr->pos;
+	assert(pr);
+	if(pr->dc)	// measure against the compressed file
+	{
+		if(pr->mode == PCAP_READER_THREAD)
+			done = pcap_readahead_raw_pos(pr);
+		else
+			done = pcap_decompress_consumed(pr->dc);
+	}
+	if(pr->mode != PCAP_READER_MMAP)
+	{
+		if(fstat(pr->fd,&sbuf) || sbuf.st_size == 0)
+			return -2.0;	// stat failed for some reason, or is a pipe
+		return (double) done / (double) sbuf.st_size;
+	}
+	return (double) done / (double) pr->size;
+}
+
+/**********************************************************
+ * int pcap_reader_stable(pcap_reader * pr)
+ * 	the whole file fits in one window, so it's never remapped
+ */
+int pcap_reader_stable(pcap_reader * pr)
+{
+	assert(pr);
+	return pr->mode == PCAP_READER_MMAP && !pr->follow &&
+		pr->size <= (off_t) OFTRACE_MMAP_WINDOW;
+}
+
+/**********************************************************
+ * void pcap_reader_close(pcap_reader * pr)
+ */
+void pcap_reader_close(pcap_reader * pr)
+{
+	if(!pr)
+		return;
+	if(pr->ra)
+		pcap_reader_stop_thread(pr);
+	if(pr->dc)
+		pcap_decompress_free(pr->dc);
+	if(pr->map)
+		munmap(pr->map,pr->map_len);
+	if(pr->buf)
+		free(pr->buf);
+	if(pr->fd != STDIN_FILENO)
+		close(pr->fd);
+	if(pr->ifaces)
+		free(pr->ifaces);
+	if(pr->ino_fd > 0)
+		close(pr->ino_fd);
+	if(pr->follow_next)
+		free(pr->follow_next);
+	free(pr->filename);
+	free(pr);
+}
+
+/**********************************************************
+ * static int pcap_reader_map(pcap_reader * pr, int len)
+ * 	slide the mapped window so that it covers [pos,pos+len)
+ * 	return 0 on success; if mmap() fails, switch the
+ * 	reader over to the read-ahead thread and return 1
+ */
+static int pcap_reader_map(pcap_reader * pr, int len)
+{
+	if(pr->map)
+		munmap(pr->map,pr->map_len);
+	pr->map_off = pr->pos & ~((off_t) OFTRACE_MMAP_ALIGN - 1);
+	pr->map_len = MIN((off_t) OFTRACE_MMAP_WINDOW, pr->size - pr->map_off);
+	assert((pr->pos + len) <= (pr->map_off + (off_t) pr->map_len));
+	pr->map = mmap(NULL,pr->map_len,PROT_READ,MAP_SHARED,pr->fd,pr->map_off);
+	if(pr->map == MAP_FAILED)
+	{
+		perror("mmap");
+		fprintf(stderr,"WARN: couldn't mmap %s; falling back to read()\n",pr->filename);
+		pr->map = NULL;
+		pr->map_len = 0;
+		lseek(pr->fd,pr->pos,SEEK_SET);
+		if(pcap_reader_use_thread(pr,1))
+			pcap_reader_use_stdio(pr);
+		return 1;
+	}
+	// we walk the trace front to back exactly once
+	madvise(pr->map,pr->map_len,MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise(pr->map,pr->map_len,MADV_HUGEPAGE);
+#endif
+	return 0;
+}
+
+/**********************************************************
+ * static int pcap_reader_fill(pcap_reader * pr, int len)
+ * 	read() until at least len bytes are buffered
+ * 	return 0 on success, 1 on EOF or error
+ */
+static int pcap_reader_fill(pcap_reader * pr, int len)
+{
+	int err;
+	assert(len <= OFTRACE_READ_BUFLEN);
+	if(pr->buf_start > 0)		// slide what's left to the front
+	{
+		memmove(pr->buf,&pr->buf[pr->buf_start],pr->buf_end - pr->buf_start);
+		pr->buf_end -= pr->buf_start;
+		pr->buf_start = 0;
+	}
+	while(pr->buf_end < len)
+	{
+		err = pcap_reader_source_read(pr,&pr->buf[pr->buf_end],OFTRACE_READ_BUFLEN - pr->buf_end);
+		if(err == 0 && pr->follow)
+		{
+			if(pr->follow_next)
+			{
+				pr->eof = 1;	// this file is done; rotate to the next one
+				return 1;
+			}
+			// once the next file exists, tcpdump is done with this
+			// 	one; give it one more read() before leaving
+			if((pr->follow_next = pcap_follow_next_name(pr)) == NULL)
+				pcap_follow_wait(pr);
+			continue;
+		}
+		if(err <= 0)
+		{
+			pr->eof = 1;
+			return 1;
+		}
+		pr->buf_end += err;
+	}
+	return 0;
+}
+
+/**********************************************************
+ * static void pcap_reader_use_stdio(pcap_reader * pr)
+ */
+static void pcap_reader_use_stdio(pcap_reader * pr)
+{
+	pr->mode = PCAP_READER_STDIO;
+	pr->buf = malloc_and_check(OFTRACE_READ_BUFLEN);
+	pr->buf_start = pr->buf_end = 0;
+}
+
+/**********************************************************
+ * static int pcap_reader_use_thread(pcap_reader * pr, int is_file)
+ * 	start a read-ahead thread at the current file offset
+ * 	return 0 on success, 1 if the thread couldn't be started
+ */
+static int pcap_reader_use_thread(pcap_reader * pr, int is_file)
+{
+	struct pcap_readahead * ra;
+	int i;
+
+	ra = malloc_and_check(sizeof(struct pcap_readahead));
+	bzero(ra,sizeof(*ra));
+	for(i=0;i<OFTRACE_READAHEAD_BLOCKS;i++)
+		ra->blocks[i] = malloc_and_check(OFTRACE_READAHEAD_BLOCKLEN);
+	pthread_mutex_init(&ra->lock,NULL);
+	pthread_cond_init(&ra->not_empty,NULL);
+	pthread_cond_init(&ra->not_full,NULL);
+	ra->is_file = is_file;
+	ra->file_off = pr->pos;
+#ifdef HAVE_POSIX_FADVISE
+	if(is_file)
+		posix_fadvise(pr->fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+	if(!pr->buf)
+		pr->buf = malloc_and_check(OFTRACE_READ_BUFLEN);	// for straddling records
+	pr->ra = ra;
+	if(pthread_create(&ra->thread,NULL,pcap_readahead_main,pr))
+	{
+		perror("pthread_create");
+		for(i=0;i<OFTRACE_READAHEAD_BLOCKS;i++)
+			free(ra->blocks[i]);
+		free(ra);
+		pr->ra = NULL;
+		return 1;
+	}
+	pr->mode = PCAP_READER_THREAD;
+	return 0;
+}
+
+/**********************************************************
+ * static void pcap_reader_stop_thread(pcap_reader * pr)
+ * 	tell the read-ahead thread to quit, wait for it and free the ring
+ */
+static void pcap_reader_stop_thread(pcap_reader * pr)
+{
+	struct pcap_readahead * ra = pr->ra;
+	int i;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = 1;
+	pthread_cond_signal(&ra->not_full);
+	pthread_mutex_unlock(&ra->lock);
+	pthread_join(ra->thread,NULL);
+	for(i=0;i<OFTRACE_READAHEAD_BLOCKS;i++)
+		free(ra->blocks[i]);
+	pthread_mutex_destroy(&ra->lock);
+	pthread_cond_destroy(&ra->not_empty);
+	pthread_cond_destroy(&ra->not_full);
+	free(ra);
+	pr->ra = NULL;
+}
+
+/**********************************************************
+ * static char * pcap_readahead_peek(pcap_reader * pr, int len)
+ * 	return len bytes starting at rd_off in the head block; if they
+ * 	run past the end of the block, stitch them together in pr->buf
+ */
+static char * pcap_readahead_peek(pcap_reader * pr, int len)
+{
+	struct pcap_readahead * ra = pr->ra;
+	int have, i, n, blk;
+
+	assert(len <= OFTRACE_READ_BUFLEN);
+	pthread_mutex_lock(&ra->lock);
+	// hand back blocks that were skip()'ed past since the last peek
+	while(ra->count > 0 && ra->rd_off >= ra->lens[ra->head])
+	{
+		ra->rd_off -= ra->lens[ra->head];
+		pr->raw_pos = ra->raw_ends[ra->head];
+		ra->head = (ra->head + 1) % OFTRACE_READAHEAD_BLOCKS;
+		ra->count--;
+		pthread_cond_signal(&ra->not_full);
+	}
+	// wait until len bytes are buffered, or the reader gives up
+	for(;;)
+	{
+		have = -ra->rd_off;
+		for(i=0;i<ra->count;i++)
+			have += ra->lens[(ra->head + i) % OFTRACE_READAHEAD_BLOCKS];
+		if(have >= len)
+			break;
+		if(ra->done)
+		{
+			pr->eof = 1;
+			pthread_mutex_unlock(&ra->lock);
+			return NULL;
+		}
+		// blocks are only handed over part full when that is enough
+		// 	to satisfy us, so a full ring always has len bytes
+		assert(ra->count < OFTRACE_READAHEAD_BLOCKS);
+		ra->want = len - have;
+		pthread_cond_wait(&ra->not_empty,&ra->lock);
+	}
+	ra->want = 0;
+	pthread_mutex_unlock(&ra->lock);
+	// the filled blocks between head and head+count are ours until released
+	if(ra->lens[ra->head] - ra->rd_off >= len)
+		return &ra->blocks[ra->head][ra->rd_off];	// common case: no copy
+	blk = ra->head;
+	n = ra->lens[blk] - ra->rd_off;
+	memcpy(pr->buf,&ra->blocks[blk][ra->rd_off],n);
+	while(n < len)
+	{
+		blk = (blk + 1) % OFTRACE_READAHEAD_BLOCKS;
+		i = MIN(ra->lens[blk],len - n);
+		memcpy(&pr->buf[n],ra->blocks[blk],i);
+		n += i;
+	}
+	return pr->buf;
+}
+
+/**********************************************************
+ * static void * pcap_readahead_main(void * arg)
+ * 	the reader thread: fill blocks with big read()s for as long as
+ * 	there is room in the ring.  A partly filled block is handed over
+ * 	early only when the parser is waiting and the block has what it
+ * 	needs, so a slow pipe doesn't leave the parser stuck behind a
+ * 	block that takes forever to fill
+ */
+static void * pcap_readahead_main(void * arg)
+{
+	pcap_reader * pr = arg;
+	struct pcap_readahead * ra = pr->ra;
+	int slot, filled, err, enough;
+	int done = 0;
+
+	while(!done)
+	{
+		pthread_mutex_lock(&ra->lock);
+		while(ra->count == OFTRACE_READAHEAD_BLOCKS && !ra->stop)
+			pthread_cond_wait(&ra->not_full,&ra->lock);
+		if(ra->stop)
+		{
+			pthread_mutex_unlock(&ra->lock);
+			break;
+		}
+		slot = ra->tail;
+		pthread_mutex_unlock(&ra->lock);
+#ifdef HAVE_POSIX_FADVISE
+		if(ra->is_file && !pr->dc)	// start the disk on the block after this one
+			posix_fadvise(pr->fd,ra->file_off + OFTRACE_READAHEAD_BLOCKLEN,
+					OFTRACE_READAHEAD_BLOCKLEN,POSIX_FADV_WILLNEED);
+#endif
+		filled = 0;
+		ra->raw_starts[slot] = pr->dc ? pcap_decompress_consumed(pr->dc) : ra->file_off;
+		while(filled < OFTRACE_READAHEAD_BLOCKLEN)
+		{
+			err = pcap_reader_source_read(pr,&ra->blocks[slot][filled],OFTRACE_READAHEAD_BLOCKLEN - filled);
+			if(err <= 0)
+			{
+				done = 1;
+				break;
+			}
+			filled += err;
+			ra->file_off += err;
+			pthread_mutex_lock(&ra->lock);
+			enough = (ra->want > 0 && filled >= ra->want);
+			pthread_mutex_unlock(&ra->lock);
+			if(enough)
+				break;
+		}
+		pthread_mutex_lock(&ra->lock);
+		if(filled > 0)
+		{
+			ra->lens[slot] = filled;
+			ra->raw_ends[slot] = pr->dc ? pcap_decompress_consumed(pr->dc) : ra->file_off;
+			ra->tail = (ra->tail + 1) % OFTRACE_READAHEAD_BLOCKS;
+			ra->count++;
+		}
+		ra->done = done;
+		pthread_cond_signal(&ra->not_empty);
+		pthread_mutex_unlock(&ra->lock);
+	}
+	return NULL;
+}
+
+/**********************************************************
+ * static int pcap_reader_raw_read(void * ctx, char * buf, int len)
+ * 	read(2) from the trace, starting with any bytes that were
+ * 	already pulled off a pipe to sniff the magic number
+ */
+static int pcap_reader_raw_read(void * ctx, char * buf, int len)
+{
+	pcap_reader * pr = ctx;
+	int err;
+
+	if(pr->prefix_len > 0)
+	{
+		err = MIN(len,pr->prefix_len);
+		memcpy(buf,pr->prefix,err);
+		memmove(pr->prefix,&pr->prefix[err],pr->prefix_len - err);
+		pr->prefix_len -= err;
+		return err;
+	}
+	do {
+		err = read(pr->fd,buf,len);
+	} while(err < 0 && errno == EINTR);
+	if(err < 0)
+		perror("read");
+	return err;
+}
+
+/**********************************************************
+ * static int pcap_reader_source_read(pcap_reader * pr, char * buf, int len)
+ * 	next chunk of (decompressed) trace
+ */
+static int pcap_reader_source_read(pcap_reader * pr, char * buf, int len)
+{
+	if(pr->dc)
+		return pcap_decompress_read(pr->dc,buf,len);
+	return pcap_reader_raw_read(pr,buf,len);
+}
+
+/**********************************************************
+ * static off_t pcap_readahead_raw_pos(pcap_reader * pr)
+ * 	compressed offset of the parser, interpolated across the
+ * 	block it is in the middle of
+ */
+static off_t pcap_readahead_raw_pos(pcap_reader * pr)
+{
+	struct pcap_readahead * ra = pr->ra;
+	off_t start, end;
+	int len;
+
+	pthread_mutex_lock(&ra->lock);
+	if(ra->count == 0)
+	{
+		pthread_mutex_unlock(&ra->lock);
+		return pr->raw_pos;
+	}
+	start = ra->raw_starts[ra->head];
+	end = ra->raw_ends[ra->head];
+	len = ra->lens[ra->head];
+	pthread_mutex_unlock(&ra->lock);
+	return start + (off_t)((double)(end - start) * MIN(ra->rd_off,len) / len);
+}
+
+/**********************************************************
+ * static void pcap_follow_init(pcap_reader * pr)
+ * 	watch the file for appends, and its directory for the next
+ * 	file of a rotated series
+ */
+static void pcap_follow_init(pcap_reader * pr)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	char dir[BUFLEN];
+	char * slash;
+
+	pr->follow = 1;
+	pr->ino_fd = inotify_init();
+	if(pr->ino_fd < 0)
+	{
+		perror("inotify_init: falling back to polling");
+		pr->ino_fd = 0;
+		return;
+	}
+	inotify_add_watch(pr->ino_fd,pr->filename,IN_MODIFY | IN_CLOSE_WRITE);
+	strncpy(dir,pr->filename,BUFLEN-1);
+	dir[BUFLEN-1] = 0;
+	slash = strrchr(dir,'/');
+	if(slash)
+		*slash = 0;
+	else
+		strcpy(dir,".");
+	inotify_add_watch(pr->ino_fd,dir,IN_CREATE | IN_MOVED_TO);
+#else
+	pr->follow = 1;
+#endif
+}
+
+/**********************************************************
+ * static void pcap_follow_wait(pcap_reader * pr)
+ * 	sleep until the file (or its directory) changes; wake up
+ * 	once a second regardless in case we missed something
+ */
+static void pcap_follow_wait(pcap_reader * pr)
+{
+	struct pollfd pfd;
+	char events[4096];
+
+	if(pr->ino_fd <= 0)
+	{
+		poll(NULL,0,OFTRACE_FOLLOW_POLL_MS);
+		return;
+	}
+	pfd.fd = pr->ino_fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd,1,OFTRACE_FOLLOW_POLL_MS) > 0)
+		if(read(pr->ino_fd,events,sizeof(events)) < 0)	// just drain them; we re-read either way
+			perror("read(inotify)");
+}
+
+/**********************************************************
+ * static char * pcap_follow_next_name(pcap_reader * pr)
+ * 	return the (malloc'ed) name of the file that comes after this
+ * 	one in a tcpdump series, or NULL if it doesn't exist yet
+ *
+ * 	-C names them foo, foo1, foo2, ... (zero padded with -W); for
+ * 	anything else (-G strftime names) take the next name in the
+ * 	directory that only differs from ours in its digits, so not
+ * 	an index sidecar or a compressed copy
+ */
+static char * pcap_follow_next_name(pcap_reader * pr)
+{
+	char next[BUFLEN], best[BUFLEN];
+	char * base, * dir, * digits;
+	struct stat sbuf;
+	struct dirent * de;
+	int n, width, prefix_len;
+	DIR * dp;
+
+	base = strrchr(pr->filename,'/');
+	base = base ? base + 1 : pr->filename;
+	digits = &pr->filename[strlen(pr->filename)];
+	while(digits > base && digits[-1] >= '0' && digits[-1] <= '9')
+		digits--;
+	if(*digits)
+	{
+		width = strlen(digits);
+		n = atoi(digits);
+		snprintf(next,BUFLEN,"%.*s%0*d",(int) (digits - pr->filename),pr->filename,width,n+1);
+	}
+	else
+		snprintf(next,BUFLEN,"%s1",pr->filename);
+	if(stat(next,&sbuf) == 0)
+		return strdup(next);
+
+	// strftime style names
+	prefix_len = strcspn(base,"0123456789");
+	if(base[prefix_len] == 0)
+		return NULL;	// no digits, so not a time stamped name
+	dir = strndup(pr->filename,base - pr->filename);
+	dp = opendir(*dir ? dir : ".");
+	best[0] = 0;
+	while(dp && (de = readdir(dp)) != NULL)
+	{
+		if(!pcap_follow_same_pattern(de->d_name,base) || strcmp(de->d_name,base) <= 0)
+			continue;
+		if(best[0] == 0 || strcmp(de->d_name,best) < 0)
+			strncpy(best,de->d_name,BUFLEN-1);
+	}
+	if(dp)
+		closedir(dp);
+	if(best[0] == 0)
+	{
+		free(dir);
+		return NULL;
+	}
+	snprintf(next,BUFLEN,"%s%s",dir,best);
+	free(dir);
+	return strdup(next);
+}
+
+/**********************************************************
+ * static int pcap_follow_same_pattern(const char * name, const char * base)
+ * 	same length, with digits wherever base has them and the
+ * 	same characters everywhere else
+ */
+static int pcap_follow_same_pattern(const char * name, const char * base)
+{
+	for(; *name && *base; name++, base++)
+	{
+		if(*base >= '0' && *base <= '9')
+		{
+			if(*name < '0' || *name > '9')
+				return 0;
+		}
+		else if(*name != *base)
+			return 0;
+	}
+	return *name == 0 && *base == 0;
+}
+
+/**********************************************************
+ * static int pcap_follow_rotate(pcap_reader * pr)
+ * 	switch over to pr->follow_next; the new file has its own
+ * 	global header (or pcapng section) to parse
+ */
+static int pcap_follow_rotate(pcap_reader * pr)
+{
+	int fd;
+
+	if(pr->buf_end > pr->buf_start)
+		fprintf(stderr,"WARN: %s ends with a partial record (%d bytes); dropping it\n",
+				pr->filename, pr->buf_end - pr->buf_start);
+	fprintf(stderr,"DBG: following rotation from %s to %s\n",pr->filename,pr->follow_next);
+	fd = open(pr->follow_next,O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr,"Failed to open %s ; exiting\n",pr->follow_next);
+		perror("open");
+		return -1;
+	}
+	close(pr->fd);
+	pr->fd = fd;
+	free(pr->filename);
+	pr->filename = pr->follow_next;
+	pr->follow_next = NULL;
+	pr->pos = 0;
+	pr->eof = 0;
+	pr->buf_start = pr->buf_end = 0;
+	pr->swapped = pr->nsec = 0;
+	pr->n_ifaces = 0;
+	if(pr->ino_fd > 0)	// start watching the new file
+	{
+		close(pr->ino_fd);
+		pcap_follow_init(pr);
+	}
+	return pcap_reader_read_ghdr(pr);
+}
+
+/**********************************************************
+ * int unittest_do_pcap_reader(void);
+ * 	follow the next file of a -G series, past the index sidecar,
+ * 	compressed copies and other files that sort in between
+ */
+int unittest_do_pcap_reader(void)
+{
+	static char * files[] = {
+		"x-2024-01-01_18:00.pcap",
+		"x-2024-01-01_18:00.pcap.oftidx",
+		"x-2024-01-01_18:00.pcap.gz",
+		"x-2024-01-01_18:30.pcap.zst",
+		"x-2024-01-01_18:notes",
+		"x-2024-01-01_19:00.pcap",
+		"x-2024-01-01_20:00.pcap",
+		NULL
+	};
+	int series[] = { 0, 5, 6, -1 };
+	char dir[PATH_MAX - 64], path[PATH_MAX], cur[PATH_MAX], * next;	// room for the names
+	pcap_reader pr;
+	char * tmp;
+	int i, fd;
+
+	if((tmp = getenv("TMPDIR")) == NULL)
+		tmp = "/tmp";
+	snprintf(dir,sizeof(dir),"%s/oftrace-unittest.XXXXXX",tmp);
+	if(mkdtemp(dir) == NULL)
+		return 0;
+	for(i = 0; files[i]; i++)
+	{
+		snprintf(path,PATH_MAX,"%s/%s",dir,files[i]);
+		if((fd = open(path,O_CREAT | O_WRONLY,0600)) < 0)
+			return 0;
+		close(fd);
+	}
+	bzero(&pr,sizeof(pr));
+	pr.filename = cur;
+	for(i = 0; series[i + 1] >= 0; i++)
+	{
+		snprintf(cur,PATH_MAX,"%s/%s",dir,files[series[i]]);
+		snprintf(path,PATH_MAX,"%s/%s",dir,files[series[i + 1]]);
+		next = pcap_follow_next_name(&pr);
+		assert(next && strcmp(next,path) == 0);
+		free(next);
+	}
+	snprintf(cur,PATH_MAX,"%s/%s",dir,files[series[i]]);
+	assert(pcap_follow_next_name(&pr) == NULL);	// the newest one
+	for(i = 0; files[i]; i++)
+	{
+		snprintf(path,PATH_MAX,"%s/%s",dir,files[i]);
+		unlink(path);
+	}
+	rmdir(dir);
+	return 1;
+}
@@ -0,0 +1,243 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <sys/types.h>
+
+#include "oftrace.h"
+#include "pcap_decode.h"
+
+/*******************************************************
+ * pcap_reader: the byte-level input underneath oftrace
+ *
+ * 	regular files are mmap()'d and walked by pointer, so
+ * 	records are parsed in place without being copied;
+ * 	anything else (stdin, pipes, fifos) is pulled in big
+ * 	blocks by a read-ahead thread so that I/O overlaps with
+ * 	parsing.  Compressed traces are recognized by their magic
+ * 	number and decompressed on that same thread
+ *
+ * 	classic pcap (either byte order, micro- or nanosecond
+ * 	timestamps) and pcapng are both understood; every record is
+ * 	normalized into a pcaprec_hdr_s plus a nanosecond timestamp
+ * 	and the link type of the interface it was captured on
+ */
+
+#define PCAP_READER_STDIO	0	// buffered read(2)
+#define PCAP_READER_MMAP	1	// zero-copy mmap() windows
+#define PCAP_READER_THREAD	2	// ring of blocks filled by a reader thread
+
+// flags to pcap_reader_open()
+#define PCAP_READER_FOLLOW	0x1	// keep reading as the file grows, like tail -f
+
+#ifndef OFTRACE_FOLLOW_POLL_MS
+// how long to sleep at the end of a followed file if nothing wakes us first
+#define OFTRACE_FOLLOW_POLL_MS	1000
+#endif
+
+#ifndef OFTRACE_MMAP_WINDOW
+// how much of the file to map at once; must be a multiple of
+// 	OFTRACE_MMAP_ALIGN.  Files smaller than this are mapped whole.
+#define OFTRACE_MMAP_WINDOW	(1<<30)
+#endif
+// map windows on 2MB boundaries so transparent huge pages can back them
+#define OFTRACE_MMAP_ALIGN	(1<<21)
+
+#ifndef OFTRACE_SEEK_LINEAR
+// when bisecting for a timestamp, read linearly once the range is this small
+#define OFTRACE_SEEK_LINEAR	(1<<20)
+#endif
+// how many records in a row must look right to trust a guessed record boundary
+#define OFTRACE_RESYNC_CHAIN	3
+
+#ifndef OFTRACE_READ_BUFLEN
+#define OFTRACE_READ_BUFLEN	(1<<20)
+#endif
+
+#ifndef OFTRACE_READAHEAD_BLOCKLEN
+#define OFTRACE_READAHEAD_BLOCKLEN	(4<<20)
+#endif
+#ifndef OFTRACE_READAHEAD_BLOCKS
+#define OFTRACE_READAHEAD_BLOCKS	8
+#endif
+
+#define NSEC_PER_SEC	1000000000LL
+
+#define PCAP_FORMAT_PCAP	0
+#define PCAP_FORMAT_PCAPNG	1
+
+#define PCAPNG_BLOCK_IDB	0x00000001	// interface description
+#define PCAPNG_BLOCK_OPB	0x00000002	// (obsolete) packet block
+#define PCAPNG_BLOCK_SPB	0x00000003	// simple packet block
+#define PCAPNG_BLOCK_EPB	0x00000006	// enhanced packet block
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1a2b3c4d
+
+struct pcap_readahead;
+struct pcap_decompressor;
+struct pcapng_if;
+
+typedef struct pcap_hdr_s {
+	uint32_t magic_number;   /* magic number */
+	uint16_t version_major;  /* major version number */
+	uint16_t version_minor;  /* minor version number */
+	int32_t  thiszone;       /* GMT to local correction */
+	uint32_t sigfigs;        /* accuracy of timestamps */
+	uint32_t snaplen;        /* max length of captured packets, in octets */
+	uint32_t network;        /* data link type */
+} pcap_hdr_t;
+
+typedef struct pcap_reader {
+	int mode;		// PCAP_READER_*
+	int fd;
+	char * filename;
+	off_t size;		// size of the file, or 0 if unknown (e.g., a pipe)
+	off_t pos;		// file offset of the next unread byte (after decompression)
+	int eof;
+	int format;		// PCAP_FORMAT_*
+	int swapped;		// file was written on a machine of the other endianness
+	int nsec;		// classic pcap with nanosecond timestamps
+	off_t data_start;	// where the first record (or pcapng block) starts
+	struct pcap_hdr_s ghdr;	// for pcapng, network is the first interface's link type
+	pcap_link_decoder link;	// for ghdr.network
+	// PCAP_FORMAT_PCAPNG: interfaces of the current section
+	struct pcapng_if * ifaces;
+	int n_ifaces;
+	int max_ifaces;
+	// PCAP_READER_MMAP
+	char * map;
+	off_t map_off;		// file offset of map[0]
+	size_t map_len;
+	// PCAP_READER_STDIO; PCAP_READER_THREAD uses buf to stitch records
+	// 	that straddle two blocks
+	char * buf;
+	int buf_start;		// buf[buf_start] is the byte at file offset pos
+	int buf_end;
+	// PCAP_READER_THREAD
+	struct pcap_readahead * ra;
+	// compressed input
+	int compression;	// PCAP_COMPRESS_*
+	struct pcap_decompressor * dc;
+	off_t raw_pos;		// compressed bytes behind pos
+	char prefix[4];		// magic number read off a pipe, not yet decoded
+	int prefix_len;
+	// PCAP_READER_FOLLOW
+	int follow;
+	int ino_fd;		// inotify descriptor, or 0 to just poll
+	char * follow_next;	// next file of the series, once it has appeared
+} pcap_reader;
+
+typedef struct pcap_record {
+	struct pcaprec_hdr_s phdr;	// always in host byte order
+	uint32_t ts_nsec;	// full precision fraction of phdr.ts_sec
+	int linktype;		// DLT_* of the interface this was captured on
+	pcap_link_decoder link;	// for linktype; NULL if it isn't supported
+	off_t offset;		// file offset of the record header
+	char * data;		// phdr.incl_len bytes; only valid until the next pcap_reader call
+} pcap_record;
+
+/***************************
+ * 	open filename (or stdin if NULL) and parse the global header
+ * 	flags is zero or PCAP_READER_FOLLOW
+ * 	return NULL on failure
+ */
+pcap_reader * pcap_reader_open(char * filename, int flags);
+
+/***************************
+ * 	fill in rec with the next record in the file, without copying
+ * 	the packet data out of the reader
+ * 	return 1 on success, 0 on end of file, -1 on error
+ */
+int pcap_reader_next(pcap_reader * pr, pcap_record * rec);
+
+/***************************
+ * 	return a pointer to the next len bytes without consuming them
+ * 	or NULL if fewer than len bytes are left
+ */
+char * pcap_reader_peek(pcap_reader * pr, int len);
+
+/***************************
+ * 	consume len bytes, which must have been peek'ed first
+ */
+void pcap_reader_skip(pcap_reader * pr, int len);
+
+/***************************
+ * 	move to an absolute file offset; return 0 on success, -1 if the
+ * 	input can't seek (e.g., a pipe)
+ */
+int pcap_reader_seek(pcap_reader * pr, off_t offset);
+
+/***************************
+ * 	position the reader at the first record stamped at or after
+ * 	t (nsec since the epoch).  Regular files are bisected by offset,
+ * 	guessing record boundaries from what looks like a run of
+ * 	sane headers, which assumes the records are roughly in time
+ * 	order; anything else is read forward until t.
+ * 	return 0 on success (including running into EOF), -1 on error
+ */
+int pcap_reader_seek_time(pcap_reader * pr, int64_t t);
+
+/***************************
+ * 	position the reader at the first record that starts at or
+ * 	after the file offset from, guessing the boundary the same
+ * 	way; only for regular, uncompressed files
+ * 	return 0 on success (including there being none), -1 if not
+ */
+int pcap_reader_seek_record(pcap_reader * pr, off_t from);
+
+/***************************
+ * 	go back to the first record (for pcapng, the first block)
+ */
+int pcap_reader_rewind(pcap_reader * pr);
+
+/***************************
+ * 	fraction of the input consumed, or -2.0 if the size is unknown
+ * 	for compressed traces, this is measured in compressed bytes
+ */
+double pcap_reader_progress(pcap_reader * pr);
+
+/***************************
+ * 	do records stay where pcap_reader_next() left them, past the
+ * 	next call, until the reader is closed or seeks?  True for a
+ * 	regular file that is mapped all at once
+ */
+int pcap_reader_stable(pcap_reader * pr);
+
+void pcap_reader_close(pcap_reader * pr);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_pcap_reader(void);
+
+#endif
@@ -0,0 +1,242 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+#include "utils.h"
+
+static void * spsc_ring_unittest_producer(void * arg);
+
+/***************************
+ * spsc_ring * spsc_ring_new(int n_slots, size_t slot_size);
+ */
+spsc_ring * spsc_ring_new(int n_slots, size_t slot_size)
+{
+	spsc_ring * r = malloc_and_check(sizeof(spsc_ring));
+
+	bzero(r,sizeof(spsc_ring));
+	r->n_slots = 1;
+	while(r->n_slots < n_slots)
+		r->n_slots *= 2;
+	r->slot_size = slot_size;
+	r->slots = malloc_and_check(r->n_slots * slot_size);
+	pthread_mutex_init(&r->lock,NULL);
+	pthread_cond_init(&r->not_full,NULL);
+	pthread_cond_init(&r->not_empty,NULL);
+	return r;
+}
+
+/***************************
+ * void spsc_ring_free(spsc_ring * r);
+ */
+void spsc_ring_free(spsc_ring * r)
+{
+	if(r == NULL)
+		return;
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->not_full);
+	pthread_cond_destroy(&r->not_empty);
+	free(r->slots);
+	free(r);
+}
+
+/***************************
+ * void * spsc_ring_claim(spsc_ring * r);
+ * 	the waiting flag goes up before the last look at head, and
+ * 	spsc_ring_release() moves head before it looks at the flag, so
+ * 	one of the two always sees the other
+ */
+void * spsc_ring_claim(spsc_ring * r)
+{
+	uint32_t tail = r->tail;
+	int spins = 0;
+
+	while(tail - __atomic_load_n(&r->head,__ATOMIC_ACQUIRE) == r->n_slots)
+	{
+		if(__atomic_load_n(&r->closed,__ATOMIC_ACQUIRE))
+			return NULL;
+		if(spins++ < OFTRACE_RING_SPINS)
+			continue;
+		pthread_mutex_lock(&r->lock);
+		__atomic_store_n(&r->producer_waiting,1,__ATOMIC_SEQ_CST);
+		while(tail - __atomic_load_n(&r->head,__ATOMIC_SEQ_CST) == r->n_slots && !r->closed)
+			pthread_cond_wait(&r->not_full,&r->lock);
+		__atomic_store_n(&r->producer_waiting,0,__ATOMIC_RELAXED);
+		pthread_mutex_unlock(&r->lock);
+	}
+	if(__atomic_load_n(&r->closed,__ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->slots[(tail & (r->n_slots - 1)) * r->slot_size];
+}
+
+/***************************
+ * void spsc_ring_publish(spsc_ring * r);
+ */
+void spsc_ring_publish(spsc_ring * r)
+{
+	__atomic_store_n(&r->tail,r->tail + 1,__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->consumer_waiting,__ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_signal(&r->not_empty);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+/***************************
+ * void * spsc_ring_peek(spsc_ring * r);
+ * 	mirror image of spsc_ring_claim(); what was published before
+ * 	the ring was closed is still handed out
+ */
+void * spsc_ring_peek(spsc_ring * r)
+{
+	uint32_t head = r->head;
+	int spins = 0;
+
+	while(__atomic_load_n(&r->tail,__ATOMIC_ACQUIRE) == head)
+	{
+		if(__atomic_load_n(&r->closed,__ATOMIC_ACQUIRE))
+		{
+			// published, then closed, since the look at tail?
+			if(__atomic_load_n(&r->tail,__ATOMIC_ACQUIRE) != head)
+				break;
+			return NULL;
+		}
+		if(spins++ < OFTRACE_RING_SPINS)
+			continue;
+		pthread_mutex_lock(&r->lock);
+		__atomic_store_n(&r->consumer_waiting,1,__ATOMIC_SEQ_CST);
+		while(__atomic_load_n(&r->tail,__ATOMIC_SEQ_CST) == head && !r->closed)
+			pthread_cond_wait(&r->not_empty,&r->lock);
+		__atomic_store_n(&r->consumer_waiting,0,__ATOMIC_RELAXED);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return &r->slots[(head & (r->n_slots - 1)) * r->slot_size];
+}
+
+/***************************
+ * void * spsc_ring_poll(spsc_ring * r);
+ * 	sequentially consistent, so that a consumer can put up a flag
+ * 	of its own, poll, and sleep, the way spsc_ring_peek() does
+ */
+void * spsc_ring_poll(spsc_ring * r)
+{
+	if(__atomic_load_n(&r->tail,__ATOMIC_SEQ_CST) == r->head)
+		return NULL;
+	return &r->slots[(r->head & (r->n_slots - 1)) * r->slot_size];
+}
+
+/***************************
+ * void spsc_ring_release(spsc_ring * r);
+ */
+void spsc_ring_release(spsc_ring * r)
+{
+	__atomic_store_n(&r->head,r->head + 1,__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&r->producer_waiting,__ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_signal(&r->not_full);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+/***************************
+ * void spsc_ring_close(spsc_ring * r);
+ */
+void spsc_ring_close(spsc_ring * r)
+{
+	pthread_mutex_lock(&r->lock);
+	__atomic_store_n(&r->closed,1,__ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&r->not_full);
+	pthread_cond_broadcast(&r->not_empty);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/***************************
+ * int unittest_do_spsc_ring(void);
+ * 	a small ring, so that both sides have to wait a lot
+ */
+#define UNITTEST_RING_N	100000
+static void * spsc_ring_unittest_producer(void * arg)
+{
+	spsc_ring * r = arg;
+	uint32_t * slot;
+	uint32_t i;
+
+	for(i = 0; i < UNITTEST_RING_N; i++)
+	{
+		slot = spsc_ring_claim(r);
+		assert(slot);
+		slot[0] = i;
+		slot[1] = ~i;
+		spsc_ring_publish(r);
+	}
+	spsc_ring_close(r);
+	return NULL;
+}
+
+int unittest_do_spsc_ring(void)
+{
+	spsc_ring * r = spsc_ring_new(3,2 * sizeof(uint32_t));
+	pthread_t producer;
+	uint32_t * slot;
+	uint32_t i;
+
+	assert(r->n_slots == 4);
+	assert(pthread_create(&producer,NULL,spsc_ring_unittest_producer,r) == 0);
+	for(i = 0; (slot = spsc_ring_peek(r)) != NULL; i++)
+	{
+		assert(slot[0] == i);	// in order, and whole
+		assert(slot[1] == ~i);
+		spsc_ring_release(r);
+	}
+	assert(i == UNITTEST_RING_N);
+	pthread_join(producer,NULL);
+	spsc_ring_free(r);
+	// closing from the consumer's side stops the producer
+	r = spsc_ring_new(2,sizeof(uint32_t));
+	assert(spsc_ring_poll(r) == NULL);
+	assert(spsc_ring_claim(r) != NULL);
+	spsc_ring_publish(r);
+	assert(spsc_ring_poll(r) == spsc_ring_peek(r));
+	assert(spsc_ring_claim(r) != NULL);
+	spsc_ring_publish(r);
+	spsc_ring_close(r);
+	assert(spsc_ring_claim(r) == NULL);
+	assert(spsc_ring_peek(r) != NULL);	// but what's there can still be read
+	spsc_ring_free(r);
+	return 1;
+}
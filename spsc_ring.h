@@ -0,0 +1,118 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ * spsc_ring: a bounded queue of fixed size slots between one
+ * 	producer thread and one consumer thread
+ *
+ * 	the slots are written and read in place: the producer claims
+ * 	the next free one, fills it and publishes it, and the consumer
+ * 	peeks at the oldest one and releases it when it's done with it.
+ * 	Each side only writes its own index, with atomic loads and
+ * 	stores, so passing a slot takes no lock; a side only takes
+ * 	the lock to sleep, after spinning a little, when the ring is
+ * 	full (backpressure) or empty
+ */
+
+#ifndef OFTRACE_RING_SPINS
+#define OFTRACE_RING_SPINS	200
+#endif
+
+typedef struct spsc_ring {
+	char * slots;
+	size_t slot_size;
+	uint32_t n_slots;	// a power of two
+	uint32_t head;		// next to read; only the consumer writes it
+	uint32_t tail;		// next to fill; only the producer writes it
+	int closed;		// no more publishing, or no more reading
+	int producer_waiting;	// asleep on not_full
+	int consumer_waiting;	// asleep on not_empty
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+} spsc_ring;
+
+/***************************
+ * 	n_slots (rounded up to a power of two) slots of slot_size bytes;
+ * 	they aren't zeroed, since a ring of big slots would touch all of them
+ */
+spsc_ring * spsc_ring_new(int n_slots, size_t slot_size);
+void spsc_ring_free(spsc_ring * r);
+
+/***************************
+ * 	producer: the next slot to fill, waiting for one to be
+ * 	released if the ring is full; NULL once it's closed
+ */
+void * spsc_ring_claim(spsc_ring * r);
+
+/***************************
+ * 	producer: hand the slot from spsc_ring_claim() to the consumer
+ */
+void spsc_ring_publish(spsc_ring * r);
+
+/***************************
+ * 	consumer: the oldest published slot, waiting for one if the
+ * 	ring is empty; NULL once it's closed and empty
+ */
+void * spsc_ring_peek(spsc_ring * r);
+
+/***************************
+ * 	consumer: spsc_ring_peek() without the waiting; NULL if the
+ * 	ring is empty right now
+ */
+void * spsc_ring_poll(spsc_ring * r);
+
+/***************************
+ * 	consumer: give the slot from spsc_ring_peek() (or
+ * 	spsc_ring_poll()) back
+ */
+void spsc_ring_release(spsc_ring * r);
+
+/***************************
+ * 	either side: the producer is done, or the consumer doesn't
+ * 	want any more; wakes up the other side either way
+ */
+void spsc_ring_close(spsc_ring * r);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_spsc_ring(void);
+
+#endif
@@ -0,0 +1,332 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "tcp_endpoints.h"
+#include "utils.h"
+
+#define TCP_ENDPOINTS_MAX_TOKEN	256
+
+typedef struct tcp_endpoint {
+	uint32_t ip;		// network byte order, masked to the prefix
+	uint16_t port;		// network byte order, 0 for any
+	uint8_t prefix_len;
+	uint8_t used;
+} tcp_endpoint;
+
+struct tcp_endpoints {
+	tcp_endpoint * slots;
+	int n_slots;		// a power of two, at most half full
+	int n;
+	int lens[33];		// prefix lengths in use, longest first
+	int n_lens;
+	int any_port;		// some entry is for any port
+};
+
+static uint32_t tcp_endpoints_hash(uint32_t ip, uint16_t port, int prefix_len);
+static void tcp_endpoints_insert(tcp_endpoints * te, tcp_endpoint * e);
+static int tcp_endpoints_find(const tcp_endpoints * te, uint32_t ip, uint16_t port, int prefix_len);
+static int tcp_endpoints_parse_one(tcp_endpoints * te, char * tok);
+
+/***************************
+ * tcp_endpoints * tcp_endpoints_new(void);
+ */
+tcp_endpoints * tcp_endpoints_new(void)
+{
+	tcp_endpoints * te = malloc_and_check(sizeof(tcp_endpoints));
+	bzero(te,sizeof(tcp_endpoints));
+	te->n_slots = 16;
+	te->slots = malloc_and_check(te->n_slots * sizeof(tcp_endpoint));
+	bzero(te->slots,te->n_slots * sizeof(tcp_endpoint));
+	return te;
+}
+
+void tcp_endpoints_free(tcp_endpoints * te)
+{
+	if(te == NULL)
+		return;
+	free(te->slots);
+	free(te);
+}
+
+/***************************
+ * void tcp_endpoints_add(tcp_endpoints * te, uint32_t ip, int prefix_len, uint16_t port);
+ */
+void tcp_endpoints_add(tcp_endpoints * te, uint32_t ip, int prefix_len, uint16_t port)
+{
+	tcp_endpoint e, * old;
+	int i, old_n;
+
+	assert(prefix_len >= 0 && prefix_len <= 32);
+	e.ip = ip & htonl(prefix_len ? 0xffffffffu << (32 - prefix_len) : 0);
+	e.port = port;
+	e.prefix_len = prefix_len;
+	e.used = 1;
+	if(tcp_endpoints_find(te,e.ip,e.port,prefix_len))
+		return;		// already there
+	if(2 * (te->n + 1) > te->n_slots)
+	{
+		// grow and rehash
+		old = te->slots;
+		old_n = te->n_slots;
+		te->n_slots *= 2;
+		te->slots = malloc_and_check(te->n_slots * sizeof(tcp_endpoint));
+		bzero(te->slots,te->n_slots * sizeof(tcp_endpoint));
+		for(i = 0; i < old_n; i++)
+			if(old[i].used)
+				tcp_endpoints_insert(te,&old[i]);
+		free(old);
+	}
+	tcp_endpoints_insert(te,&e);
+	te->n++;
+	if(port == 0)
+		te->any_port = 1;
+	for(i = 0; i < te->n_lens && te->lens[i] > prefix_len; i++)
+		;
+	if(i == te->n_lens || te->lens[i] != prefix_len)
+	{
+		memmove(&te->lens[i + 1],&te->lens[i],(te->n_lens - i) * sizeof(int));
+		te->lens[i] = prefix_len;
+		te->n_lens++;
+	}
+}
+
+/***************************
+ * int tcp_endpoints_parse(tcp_endpoints * te, const char * spec);
+ */
+int tcp_endpoints_parse(tcp_endpoints * te, const char * spec)
+{
+	char tok[TCP_ENDPOINTS_MAX_TOKEN];
+	const char * p = spec;
+	int len, n, total = 0;
+
+	while(1)
+	{
+		while(isspace(*p))
+			p++;
+		if(*p == 0)
+			break;
+		for(len = 0; p[len] && !isspace(p[len]); len++)
+			;
+		if(len >= sizeof(tok))
+		{
+			fprintf(stderr,"WARN: bad endpoint list '%s': '%.20s...' is too long\n",spec,p);
+			return -1;
+		}
+		memcpy(tok,p,len);
+		tok[len] = 0;
+		if((n = tcp_endpoints_parse_one(te,tok)) < 0)
+		{
+			fprintf(stderr,"WARN: bad endpoint list '%s': can't parse '%.*s'; want ip[/len][:port[-port],...]\n",
+					spec,len,p);
+			return -1;
+		}
+		total += n;
+		p += len;
+	}
+	if(total == 0)
+		fprintf(stderr,"WARN: empty endpoint list '%s'\n",spec);
+	return total > 0 ? total : -1;
+}
+
+/***************************
+ * int tcp_endpoints_match(const tcp_endpoints * te, uint32_t ip, uint16_t port);
+ */
+int tcp_endpoints_match(const tcp_endpoints * te, uint32_t ip, uint16_t port)
+{
+	uint32_t masked;
+	int i, len;
+
+	for(i = 0; i < te->n_lens; i++)
+	{
+		len = te->lens[i];
+		masked = ip & htonl(len ? 0xffffffffu << (32 - len) : 0);
+		if(tcp_endpoints_find(te,masked,port,len))
+			return 1;
+		if(te->any_port && tcp_endpoints_find(te,masked,0,len))
+			return 1;
+	}
+	return 0;
+}
+
+/***************************
+ * static uint32_t tcp_endpoints_hash(uint32_t ip, uint16_t port, int prefix_len);
+ * 	same mix as tcp_session_hash()
+ */
+static uint32_t tcp_endpoints_hash(uint32_t ip, uint16_t port, int prefix_len)
+{
+	uint32_t h = ip;
+	h = h * 0x9e3779b1 ^ (((uint32_t) prefix_len << 16) | port);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static void tcp_endpoints_insert(tcp_endpoints * te, tcp_endpoint * e)
+{
+	uint32_t mask = te->n_slots - 1;
+	uint32_t i;
+
+	for(i = tcp_endpoints_hash(e->ip,e->port,e->prefix_len) & mask; te->slots[i].used; i = (i + 1) & mask)
+		;
+	te->slots[i] = *e;
+}
+
+static int tcp_endpoints_find(const tcp_endpoints * te, uint32_t ip, uint16_t port, int prefix_len)
+{
+	uint32_t mask = te->n_slots - 1;
+	const tcp_endpoint * e;
+	uint32_t i;
+
+	for(i = tcp_endpoints_hash(ip,port,prefix_len) & mask; (e = &te->slots[i])->used; i = (i + 1) & mask)
+		if(e->ip == ip && e->port == port && e->prefix_len == prefix_len)
+			return 1;
+	return 0;
+}
+
+/***************************
+ * static int tcp_endpoints_parse_one(tcp_endpoints * te, char * tok);
+ * 	ip[/prefix_len][:ports]; return how many were added, -1 on error
+ */
+static int tcp_endpoints_parse_one(tcp_endpoints * te, char * tok)
+{
+	char * colon, * slash, * port, * end;
+	struct in_addr addr;
+	long prefix_len = 32, first, last, p;
+	int n = 0;
+
+	if((colon = strchr(tok,':')) != NULL)
+		*colon = 0;
+	if(*tok == 0)
+	{
+		addr.s_addr = 0;	// any ip
+		prefix_len = 0;
+	}
+	else
+	{
+		if((slash = strchr(tok,'/')) != NULL)
+		{
+			*slash = 0;
+			prefix_len = strtol(slash + 1,&end,10);
+			if(end == slash + 1 || *end || prefix_len < 0 || prefix_len > 32)
+				return -1;
+		}
+		if(inet_pton(AF_INET,tok,&addr) != 1)
+			return -1;
+	}
+	if(colon == NULL || colon[1] == 0)
+	{
+		tcp_endpoints_add(te,addr.s_addr,prefix_len,0);
+		return 1;
+	}
+	for(port = strtok(colon + 1,","); port; port = strtok(NULL,","))
+	{
+		first = last = strtol(port,&end,10);
+		if(end == port)
+			return -1;
+		if(*end == '-')
+		{
+			port = end + 1;
+			last = strtol(port,&end,10);
+			if(end == port)
+				return -1;
+		}
+		if(*end || first < 1 || last > 65535 || first > last)
+			return -1;
+		for(p = first; p <= last; p++, n++)
+			tcp_endpoints_add(te,addr.s_addr,prefix_len,htons(p));
+	}
+	return n;
+}
+
+/*************************************************************
+ * unittest hooks
+ */
+
+static uint32_t unittest_ip(const char * s)
+{
+	struct in_addr addr;
+	inet_pton(AF_INET,s,&addr);
+	return addr.s_addr;
+}
+
+int unittest_do_tcp_endpoints(void)
+{
+	tcp_endpoints * te = tcp_endpoints_new();
+	char spec[64];
+	int i;
+
+	assert(tcp_endpoints_parse(te,"10.0.0.1:6633,6634  10.0.0.2:6633\t10.1.0.0/16:6653-6655") == 6);
+	assert(tcp_endpoints_match(te,unittest_ip("10.0.0.1"),htons(6633)));
+	assert(tcp_endpoints_match(te,unittest_ip("10.0.0.1"),htons(6634)));
+	assert(!tcp_endpoints_match(te,unittest_ip("10.0.0.1"),htons(6635)));
+	assert(tcp_endpoints_match(te,unittest_ip("10.0.0.2"),htons(6633)));
+	assert(!tcp_endpoints_match(te,unittest_ip("10.0.0.2"),htons(6634)));
+	assert(tcp_endpoints_match(te,unittest_ip("10.1.200.7"),htons(6654)));
+	assert(!tcp_endpoints_match(te,unittest_ip("10.2.0.7"),htons(6654)));
+	assert(!tcp_endpoints_match(te,unittest_ip("10.1.0.1"),htons(6633)));
+	assert(tcp_endpoints_parse(te,"192.168.0.9") == 1);	// any port
+	assert(tcp_endpoints_match(te,unittest_ip("192.168.0.9"),htons(80)));
+	assert(!tcp_endpoints_match(te,unittest_ip("192.168.0.8"),htons(6633)));
+	assert(tcp_endpoints_parse(te,":6700") == 1);		// any ip
+	assert(tcp_endpoints_match(te,unittest_ip("1.2.3.4"),htons(6700)));
+	// enough to make it grow a few times
+	for(i = 0; i < 200; i++)
+	{
+		snprintf(spec,sizeof(spec),"172.16.%d.%d:%d",i / 10,i % 10,7000 + i);
+		assert(tcp_endpoints_parse(te,spec) == 1);
+	}
+	for(i = 0; i < 200; i++)
+	{
+		snprintf(spec,sizeof(spec),"172.16.%d.%d",i / 10,i % 10);
+		assert(tcp_endpoints_match(te,unittest_ip(spec),htons(7000 + i)));
+		assert(!tcp_endpoints_match(te,unittest_ip(spec),htons(7001 + i)));
+	}
+	assert(tcp_endpoints_match(te,unittest_ip("10.0.0.1"),htons(6633)));
+	// these shouldn't parse
+	assert(tcp_endpoints_parse(te,"10.0.0.300:6633") == -1);
+	assert(tcp_endpoints_parse(te,"10.0.0.1/33") == -1);
+	assert(tcp_endpoints_parse(te,"10.0.0.1:6634-6633") == -1);
+	assert(tcp_endpoints_parse(te,"10.0.0.1:http") == -1);
+	assert(tcp_endpoints_parse(te,"  ") == -1);
+	tcp_endpoints_free(te);
+	return 1;
+}
@@ -0,0 +1,79 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef TCP_ENDPOINTS_H
+#define TCP_ENDPOINTS_H
+
+#include <stdint.h>
+
+/*******************************************************
+ * tcp_endpoints: a set of (ip, port) endpoints, e.g. the controllers
+ * 	of a cluster and a FlowVisor in front of them
+ *
+ * 	entries are an address prefix and a port (or any port), kept
+ * 	in an open addressed hash table keyed on the masked address,
+ * 	port and prefix length; a lookup tries each prefix length in
+ * 	use, longest first, so the usual handful of /32s costs one
+ * 	probe (two if some entry takes any port)
+ */
+
+typedef struct tcp_endpoints tcp_endpoints;
+
+tcp_endpoints * tcp_endpoints_new(void);
+void tcp_endpoints_free(tcp_endpoints * te);
+
+/***************************
+ * 	add ip/prefix_len (network byte order) on port (network byte
+ * 	order, 0 for any)
+ */
+void tcp_endpoints_add(tcp_endpoints * te, uint32_t ip, int prefix_len, uint16_t port);
+
+/***************************
+ * 	add the endpoints in spec: whitespace separated
+ * 	ip[/prefix_len][:ports], where ports is a comma separated list
+ * 	of ports and first-last ranges; no ip, or no ports, means any.
+ * 	return the number added, or -1 (after saying why on stderr) if
+ * 	spec doesn't parse
+ */
+int tcp_endpoints_parse(tcp_endpoints * te, const char * spec);
+
+/***************************
+ * 	is ip:port (network byte order) in the set?
+ */
+int tcp_endpoints_match(const tcp_endpoints * te, uint32_t ip, uint16_t port);
+
+/***************************
+ * 	expose hooks for unittesting
+ */
+int unittest_do_tcp_endpoints(void);
+
+#endif
@@ -31,13 +31,57 @@ without specific, written prior permission.
 *****************************************************************/
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "tcp_session.h"
 #include "utils.h"
 
 static int pcap_dropped_segment_test(tcp_session * ts);
+static int tcp_session_queue_limit(tcp_session * ts);
 static char * data2hexstr(char * data, int n_bytes,char * buf, int buflen);
+static int ofp_headers_plausible(char * data, int len);
+// bytes behind a fragment of size class c, and where they come from
+#define FRAG_CAP(c) (1<<(OFTRACE_FRAG_MIN_SHIFT+(c)))
+#define FRAG_BYTES(c) (sizeof(tcp_frag) + FRAG_CAP(c))
+#define FRAG_FROM_SLAB(c) (FRAG_BYTES(c) <= OFTRACE_FRAG_SLAB/4)
+#define FRAG_MAX FRAG_CAP(OFTRACE_FRAG_CLASSES-1)
+// room left after a fragment's data
+#define FRAG_ROOM(f) (FRAG_CAP((f)->size_class) - ((f)->data - (char *) ((f)+1)) - (int) (f)->len)
+// how far seq is past the front of the stream; everything queued is
+// 	less than 2^31 ahead, so this orders correctly across wraparound
+#define SEQ_OFF(ts,seq) ((uint32_t) ((seq) - (ts)->seqno))
+// RFC 1982 serial number order: is a before b?  Unlike seqno_cmp(),
+// 	good for anything up to 2^31 apart, i.e. a long backlog
+#define SEQ_LT(a,b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)) < 0)
+#define SEQ_LEQ(a,b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)) <= 0)
+
+static tcp_frag * tcp_frag_alloc(tcp_session * ts, int size);
+static tcp_frag * tcp_frag_new(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off);
+static tcp_frag * tcp_frag_spilled(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off);
+static void tcp_frag_free(tcp_session * ts, tcp_frag * frag);
+static void tcp_frag_pool_free(tcp_session * ts);
+static void tcp_session_append(tcp_session * ts, char * data, int len, off_t rec_off);
+static void tcp_session_drain(tcp_session * ts);
+static void tcp_session_spill(tcp_session * ts);
+static off_t tcp_session_buffered_offset(tcp_session * ts);
+static void overlap_check(tcp_session * ts, uint32_t seqno, char * old, char * neo, int len);
+static void tcp_ooo_add(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off);
+static int tcp_ooo_find(tcp_session * ts, uint32_t seqno);
+static void tcp_ooo_insert(tcp_session * ts, int i, tcp_frag * frag);
+static void tcp_ooo_remove(tcp_session * ts, int i);
+static int tcp_ooo_merge(tcp_session * ts, int i);
+static uint32_t tcp_session_hash(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+static tcp_session * tcp_session_alloc(uint32_t sip, uint32_t dip, struct oft_tcphdr * tcp);
+static void tcp_session_table_insert(tcp_session_table * table, tcp_session * ts);
+static void tcp_session_table_grow(tcp_session_table * table);
+static void tcp_session_table_remove(tcp_session_table * table, tcp_session * ts);
+static void tcp_session_evicted_add(tcp_session_table * table, tcp_session * ts);
+static uint32_t tcp_session_evicted_find(tcp_session_table * table, tcp_session * ts);
+static void tcp_session_lru_unlink(tcp_session_table * table, tcp_session * ts);
+static void tcp_session_lru_append(tcp_session_table * table, tcp_session * ts);
+static size_t tcp_session_mem(tcp_session * ts);
+static uint64_t tcp_session_queued_bytes(tcp_session * ts);
 
 /********************************************************
  * Return whether seq1 came before or after seq2
@@ -78,272 +122,1346 @@ int seqno_cmp(uint32_t seq1,uint32_t seq2)
 tcp_session * tcp_session_new(struct oft_iphdr * ip, struct oft_tcphdr * tcp)
 {
 	char srcaddr[BUFLEN], dstaddr[BUFLEN];
+	tcp_session * ts = tcp_session_alloc(ip->saddr,ip->daddr,tcp);
+
+	tcp_session_ntop(ts,srcaddr,dstaddr,BUFLEN);
+	fprintf(stderr,"DBG: tracking NEW stream : %s:%u-> %s:%u \n",
+			srcaddr, ntohs(ts->sport),
+			dstaddr, ntohs(ts->dport));
+	return ts;
+}
+
+/***********************
+ * tcp_session * tcp_session_new6(const uint8_t * saddr6, const uint8_t * daddr6, struct oft_tcphdr * tcp)
+ */
+tcp_session * tcp_session_new6(const uint8_t * saddr6, const uint8_t * daddr6, struct oft_tcphdr * tcp)
+{
+	char srcaddr[BUFLEN], dstaddr[BUFLEN];
+	tcp_session * ts = tcp_session_alloc(tcp_session_addr6(saddr6),tcp_session_addr6(daddr6),tcp);
+
+	ts->ip6=1;
+	memcpy(ts->sip6,saddr6,sizeof(ts->sip6));
+	memcpy(ts->dip6,daddr6,sizeof(ts->dip6));
+	tcp_session_ntop(ts,srcaddr,dstaddr,BUFLEN);
+	fprintf(stderr,"DBG: tracking NEW stream : [%s]:%u-> [%s]:%u \n",
+			srcaddr, ntohs(ts->sport),
+			dstaddr, ntohs(ts->dport));
+	return ts;
+}
+
+/***********************
+ * static tcp_session * tcp_session_alloc(uint32_t sip, uint32_t dip, struct oft_tcphdr * tcp)
+ */
+static tcp_session * tcp_session_alloc(uint32_t sip, uint32_t dip, struct oft_tcphdr * tcp)
+{
 	tcp_session * ts = malloc_and_check(sizeof(tcp_session));
-	ts->sip=ip->saddr;
+	ts->sip=sip;
 	ts->n_segs=0;
-	ts->dip=ip->daddr;
+	ts->dip=dip;
 	ts->sport=tcp->source;	// network byte order!
 	ts->dport=tcp->dest;	// network byte order!
 	ts->isn = ts->seqno = ntohl(tcp->seq);	// host byte order (we do arith on this)
 	ts->close_on_empty= 0;
 	ts->skipped_count=0;
-	ts->next=NULL;	
-	inet_ntop(AF_INET,&ts->sip,srcaddr,BUFLEN);
+	ts->mid_range=0;
+	ts->anchored=0;
+	ts->resync=0;
+	ts->index_id=-1;
+	ts->dpid=0;
+	ts->ip6=0;
+	ts->hash=0;
+	ts->table_index=-1;
+	ts->buf=NULL;
+	ts->buf_start=ts->buf_len=ts->buf_size=0;
+	ts->marks=NULL;
+	ts->mark_first=ts->n_marks=ts->max_marks=0;
+	bzero(&ts->pool,sizeof(ts->pool));
+	ts->ooo=NULL;
+	ts->n_ooo=ts->max_ooo=0;
+	ts->ooo_bytes=0;
+	ts->spill=NULL;
+	ts->spill_after=0;
+	ts->last_nsec=-1;
+	ts->mem=0;
+	ts->lru_prev=ts->lru_next=NULL;
+	return ts;
+}
 
-	inet_ntop(AF_INET,&ts->dip,dstaddr,BUFLEN);
-	fprintf(stderr,"DBG: tracking NEW stream : %s:%u-> %s:%u \n",
+/***********************
+ * tcp_session * tcp_session_resume(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport, uint32_t seqno)
+ * 	sport and dport in network byte order, seqno in host byte order
+ */
+tcp_session * tcp_session_resume(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport, uint32_t seqno)
+{
+	struct oft_iphdr ip;
+	struct oft_tcphdr tcp;
+	tcp_session * ts;
+
+	bzero(&ip,sizeof(ip));
+	bzero(&tcp,sizeof(tcp));
+	ip.saddr = sip;
+	ip.daddr = dip;
+	tcp.source = sport;
+	tcp.dest = dport;
+	tcp.seq = htonl(seqno);
+	ts = tcp_session_new(&ip,&tcp);
+	ts->anchored = 1;
+	return ts;
+}
+
+/***************************
+ * 	find the session matching the passes parameters
+ * 	return NULL if not found
+ */
+tcp_session * tcp_session_find(tcp_session_table * table,struct oft_iphdr * ip, struct oft_tcphdr * tcp)
+{
+	uint32_t hash = tcp_session_hash(ip->saddr,ip->daddr,tcp->source,tcp->dest);
+	uint32_t mask = table->n_slots - 1;
+	uint32_t i;
+	tcp_session *ts;
+	for(i = hash & mask; (ts = table->slots[i].ts) != NULL; i = (i+1) & mask)
+	{	
+		if( table->slots[i].hash == hash &&
+				ts->sip == ip->saddr &&
+				ts->dip == ip->daddr &&
+				ts->sport == tcp->source &&
+				ts->dport == tcp->dest)
+			return ts;
+	}
+	return NULL;
+}
+
+/***************************
+ * tcp_session * tcp_session_find_reverse(tcp_session_table * table, tcp_session * ts);
+ */
+tcp_session * tcp_session_find_reverse(tcp_session_table * table, tcp_session * ts)
+{
+	struct oft_iphdr ip;
+	struct oft_tcphdr tcp;
+
+	tcp.source = ts->dport;
+	tcp.dest = ts->sport;
+	if(ts->ip6)
+		return tcp_session_find6(table,ts->dip6,ts->sip6,&tcp);
+	ip.saddr = ts->dip;
+	ip.daddr = ts->sip;
+	return tcp_session_find(table,&ip,&tcp);
+}
+
+/***************************
+ * tcp_session * tcp_session_find6(tcp_session_table * table, const uint8_t * saddr6,
+ * 		const uint8_t * daddr6, struct oft_tcphdr * tcp);
+ * 	sessions resumed from an index checkpoint only have the
+ * 	folded addresses: the first packet that matches those fills
+ * 	in the rest
+ */
+tcp_session * tcp_session_find6(tcp_session_table * table, const uint8_t * saddr6,
+		const uint8_t * daddr6, struct oft_tcphdr * tcp)
+{
+	uint32_t sip = tcp_session_addr6(saddr6);
+	uint32_t dip = tcp_session_addr6(daddr6);
+	uint32_t hash = tcp_session_hash(sip,dip,tcp->source,tcp->dest);
+	uint32_t mask = table->n_slots - 1;
+	uint32_t i;
+	tcp_session *ts;
+	for(i = hash & mask; (ts = table->slots[i].ts) != NULL; i = (i+1) & mask)
+	{
+		if( table->slots[i].hash != hash ||
+				ts->sip != sip ||
+				ts->dip != dip ||
+				ts->sport != tcp->source ||
+				ts->dport != tcp->dest)
+			continue;
+		if(!ts->ip6)
+		{
+			ts->ip6 = 1;
+			memcpy(ts->sip6,saddr6,sizeof(ts->sip6));
+			memcpy(ts->dip6,daddr6,sizeof(ts->dip6));
+			return ts;
+		}
+		if(!memcmp(ts->sip6,saddr6,sizeof(ts->sip6)) && !memcmp(ts->dip6,daddr6,sizeof(ts->dip6)))
+			return ts;
+	}
+	return NULL;
+}
+
+/***************************
+ * uint32_t tcp_session_addr6(const uint8_t * addr6);
+ * 	fold the 16 bytes into 28 bits, and put them in 240.0.0.0/4,
+ * 	which no ipv4 packet comes from or goes to
+ */
+uint32_t tcp_session_addr6(const uint8_t * addr6)
+{
+	uint32_t w, h = 0;
+	int i;
+
+	for(i = 0; i < 16; i += 4)
+	{
+		memcpy(&w,&addr6[i],sizeof(w));
+		h = (h ^ w) * 0x9e3779b1;
+	}
+	h ^= h >> 15;
+	return htonl(0xf0000000 | (h & 0x0fffffff));
+}
+
+/***************************
+ * void tcp_session_ntop(const tcp_session * ts, char * srcaddr, char * dstaddr, int len);
+ */
+void tcp_session_ntop(const tcp_session * ts, char * srcaddr, char * dstaddr, int len)
+{
+	if(ts->ip6)
+	{
+		inet_ntop(AF_INET6,ts->sip6,srcaddr,len);
+		inet_ntop(AF_INET6,ts->dip6,dstaddr,len);
+	}
+	else
+	{
+		inet_ntop(AF_INET,&ts->sip,srcaddr,len);
+		inet_ntop(AF_INET,&ts->dip,dstaddr,len);
+	}
+}
+
+/***************************
+ * void tcp_session_add(tcp_session_table * table, tcp_session * ts);
+ * 	the caller already checked it isn't there
+ */
+void tcp_session_add(tcp_session_table * table, tcp_session * ts)
+{
+	if(2 * (table->n_sessions + 1) > table->n_slots)
+		tcp_session_table_grow(table);
+	tcp_session_table_insert(table,ts);
+	if(table->n_sessions >= table->max_sessions)		// grow list if need be
+	{
+		table->max_sessions*=2;
+		table->list=realloc_and_check(table->list, sizeof(tcp_session *)*table->max_sessions);
+	}
+	ts->table_index = table->n_sessions;
+	table->list[table->n_sessions++]=ts;
+	tcp_session_lru_append(table,ts);
+	ts->spill = table->spill;
+	ts->spill_after = table->spill_after;
+}
+
+/***************************
+ * int tcp_session_table_spill(tcp_session_table * table, const char * dir, size_t threshold);
+ */
+int tcp_session_table_spill(tcp_session_table * table, const char * dir, size_t threshold)
+{
+	int i;
+
+	if(table->spill == NULL && (table->spill = tcp_spill_open(dir)) == NULL)
+		return -1;
+	table->spill_after = threshold;
+	for(i=0;i<table->n_sessions;i++)
+	{
+		table->list[i]->spill = table->spill;
+		table->list[i]->spill_after = threshold;
+	}
+	return 0;
+}
+
+/***************************
+ * void tcp_session_touch(tcp_session_table * table, tcp_session * ts, int64_t now);
+ */
+void tcp_session_touch(tcp_session_table * table, tcp_session * ts, int64_t now)
+{
+	size_t mem = tcp_session_mem(ts);
+
+	table->mem += mem - ts->mem;	// unsigned, but comes out right when it shrank too
+	ts->mem = mem;
+	if(table->mem > table->peak_mem)
+		table->peak_mem = table->mem;
+	ts->last_nsec = now;
+	if(table->lru_tail != ts)
+	{
+		tcp_session_lru_unlink(table,ts);
+		tcp_session_lru_append(table,ts);
+	}
+}
+
+/***************************
+ * uint64_t tcp_session_table_expire(tcp_session_table * table, int64_t now, int64_t idle_nsec, size_t budget);
+ * 	the lru list is in order of last packet, so both only ever
+ * 	look at its head
+ */
+uint64_t tcp_session_table_expire(tcp_session_table * table, int64_t now, int64_t idle_nsec, size_t budget)
+{
+	char srcaddr[BUFLEN], dstaddr[BUFLEN];
+	tcp_session * ts;
+	uint64_t dropped = 0, queued;
+	int over_budget;
+
+	while((ts = table->lru_head) != NULL)
+	{
+		if(ts->last_nsec < 0)
+		{
+			// added without a packet (e.g., resumed from the index):
+			// its clock starts now
+			tcp_session_touch(table,ts,now);
+			continue;
+		}
+		over_budget = budget > 0 && table->mem > budget;
+		if(!over_budget && (idle_nsec <= 0 || now - ts->last_nsec <= idle_nsec))
+			break;
+		queued = tcp_session_queued_bytes(ts);
+		if(queued > 0)
+		{
+			tcp_session_ntop(ts,srcaddr,dstaddr,BUFLEN);
+			fprintf(stderr,"WARN: %s flow %s:%d->%s:%d : dropping %llu queued bytes\n",
+					over_budget ? "over the memory budget; evicting" : "evicting idle",
+					srcaddr,ntohs(ts->sport),dstaddr,ntohs(ts->dport),
+					(unsigned long long) queued);
+		}
+		if(queued > 0)
+			tcp_session_evicted_add(table,ts);
+		if(over_budget)
+			table->budget_evictions++;
+		else
+			table->idle_evictions++;
+		dropped += queued;
+		tcp_session_delete(table,ts);
+	}
+	table->evicted_bytes += dropped;
+	return dropped;
+}
+
+/***************************
+ * static void tcp_session_lru_unlink(tcp_session_table * table, tcp_session * ts);
+ */
+static void tcp_session_lru_unlink(tcp_session_table * table, tcp_session * ts)
+{
+	if(ts->lru_prev)
+		ts->lru_prev->lru_next = ts->lru_next;
+	else
+		table->lru_head = ts->lru_next;
+	if(ts->lru_next)
+		ts->lru_next->lru_prev = ts->lru_prev;
+	else
+		table->lru_tail = ts->lru_prev;
+	ts->lru_prev = ts->lru_next = NULL;
+}
+
+/***************************
+ * static void tcp_session_lru_append(tcp_session_table * table, tcp_session * ts);
+ * 	make ts the most recently used
+ */
+static void tcp_session_lru_append(tcp_session_table * table, tcp_session * ts)
+{
+	ts->lru_prev = table->lru_tail;
+	ts->lru_next = NULL;
+	if(table->lru_tail)
+		table->lru_tail->lru_next = ts;
+	else
+		table->lru_head = ts;
+	table->lru_tail = ts;
+}
+
+/***************************
+ * static size_t tcp_session_mem(tcp_session * ts);
+ * 	bytes malloc()'d on behalf of this session
+ */
+static size_t tcp_session_mem(tcp_session * ts)
+{
+	return sizeof(tcp_session) + ts->buf_size +
+		ts->max_marks * sizeof(tcp_mark) +
+		ts->max_ooo * sizeof(tcp_frag *) +
+		ts->pool.bytes;
+}
+
+/***************************
+ * static uint64_t tcp_session_queued_bytes(tcp_session * ts);
+ * 	stream bytes waiting to be handed out
+ */
+static uint64_t tcp_session_queued_bytes(tcp_session * ts)
+{
+	uint64_t n = ts->buf_len;
+	int i;
+
+	for(i=0;i<ts->n_ooo;i++)
+		n += ts->ooo[i]->len;
+	return n;
+}
+
+/***************************
+ * void tcp_session_table_init(tcp_session_table * table);
+ */
+void tcp_session_table_init(tcp_session_table * table)
+{
+	table->max_sessions = 10;			// will dynamically re-allocate - don't worry
+	table->n_sessions = 0;
+	table->list = malloc_and_check(table->max_sessions * sizeof(tcp_session *));
+	table->n_slots = OFTRACE_SESSION_SLOTS;
+	table->slots = malloc_and_check(table->n_slots * sizeof(tcp_session_slot));
+	bzero(table->slots,table->n_slots * sizeof(tcp_session_slot));
+	table->lru_head = table->lru_tail = NULL;
+	table->mem = table->peak_mem = 0;
+	table->idle_evictions = table->budget_evictions = table->evicted_bytes = 0;
+	table->evicted = NULL;
+	table->n_evicted = table->n_evicted_slots = 0;
+	table->spill = NULL;
+	table->spill_after = 0;
+}
+
+/***************************
+ * void tcp_session_table_free(tcp_session_table * table);
+ */
+void tcp_session_table_free(tcp_session_table * table)
+{
+	while(table->n_sessions > 0)
+		tcp_session_delete(table,table->list[0]);
+	free(table->list);
+	free(table->slots);
+	if(table->evicted)
+		free(table->evicted);
+	tcp_spill_close(table->spill);
+	table->list = NULL;
+	table->slots = NULL;
+	table->spill = NULL;
+	table->evicted = NULL;
+	table->max_sessions = table->n_slots = 0;
+	table->n_evicted = table->n_evicted_slots = 0;
+}
+
+/***************************
+ * static void tcp_session_evicted_add(tcp_session_table * table, tcp_session * ts);
+ * 	the set doubles when half full, like the slots
+ */
+static void tcp_session_evicted_add(tcp_session_table * table, tcp_session * ts)
+{
+	tcp_session_key * old = table->evicted;
+	int k, n_old = table->n_evicted_slots;
+	uint32_t mask, i;
+
+	if(tcp_session_evicted_find(table,ts) != (uint32_t) -1)
+		return;		// already there
+	if(2 * (table->n_evicted + 1) > table->n_evicted_slots)
+	{
+		table->n_evicted_slots = MAX(2 * n_old,OFTRACE_SESSION_SLOTS);
+		table->evicted = malloc_and_check(table->n_evicted_slots * sizeof(tcp_session_key));
+		bzero(table->evicted,table->n_evicted_slots * sizeof(tcp_session_key));
+		mask = table->n_evicted_slots - 1;
+		for(k = 0; k < n_old; k++)
+			if(old[k].used)
+			{
+				for(i = old[k].hash & mask; table->evicted[i].used; i = (i+1) & mask)
+					;
+				table->evicted[i] = old[k];
+			}
+		if(old)
+			free(old);
+	}
+	mask = table->n_evicted_slots - 1;
+	for(i = ts->hash & mask; table->evicted[i].used; i = (i+1) & mask)
+		;
+	table->evicted[i].sip = ts->sip;
+	table->evicted[i].dip = ts->dip;
+	table->evicted[i].sport = ts->sport;
+	table->evicted[i].dport = ts->dport;
+	table->evicted[i].hash = ts->hash;
+	table->evicted[i].used = 1;
+	table->n_evicted++;
+}
+
+/***************************
+ * static uint32_t tcp_session_evicted_find(tcp_session_table * table, tcp_session * ts);
+ * 	the slot with ts's key, or -1
+ */
+static uint32_t tcp_session_evicted_find(tcp_session_table * table, tcp_session * ts)
+{
+	uint32_t mask = table->n_evicted_slots - 1;
+	uint32_t i, hash = tcp_session_hash(ts->sip,ts->dip,ts->sport,ts->dport);
+	tcp_session_key * k;
+
+	if(table->n_evicted == 0)
+		return -1;
+	for(i = hash & mask; table->evicted[i].used; i = (i+1) & mask)
+	{
+		k = &table->evicted[i];
+		if(k->hash == hash && k->sip == ts->sip && k->dip == ts->dip &&
+				k->sport == ts->sport && k->dport == ts->dport)
+			return i;
+	}
+	return -1;
+}
+
+/***************************
+ * int tcp_session_was_evicted(tcp_session_table * table, tcp_session * ts);
+ * 	forgetting it shifts back what comes after it, like
+ * 	tcp_session_table_remove()
+ */
+int tcp_session_was_evicted(tcp_session_table * table, tcp_session * ts)
+{
+	uint32_t mask = table->n_evicted_slots - 1;
+	uint32_t i, j, home;
+
+	if((i = tcp_session_evicted_find(table,ts)) == (uint32_t) -1)
+		return 0;
+	j = i;
+	while(1)
+	{
+		j = (j+1) & mask;
+		if(!table->evicted[j].used)
+			break;
+		home = table->evicted[j].hash & mask;
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			table->evicted[i] = table->evicted[j];
+			i = j;
+		}
+	}
+	table->evicted[i].used = 0;
+	table->n_evicted--;
+	return 1;
+}
+
+/***************************
+ * static uint32_t tcp_session_hash(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+ * 	mix the 4-tuple so the low bits are usable as a slot number
+ */
+static uint32_t tcp_session_hash(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport)
+{
+	uint32_t h = sip;
+	h = h * 0x9e3779b1 ^ dip;
+	h = h * 0x9e3779b1 ^ (((uint32_t) sport << 16) | dport);
+	// murmur3's finalizer
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/***************************
+ * uint32_t tcp_session_conn_hash(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+ * 	tcp_session_hash() of the lower end first
+ */
+uint32_t tcp_session_conn_hash(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport)
+{
+	if(sip > dip || (sip == dip && sport > dport))
+		return tcp_session_hash(dip,sip,dport,sport);
+	return tcp_session_hash(sip,dip,sport,dport);
+}
+
+/***************************
+ * static void tcp_session_table_insert(tcp_session_table * table, tcp_session * ts);
+ * 	put ts in the first free slot from where its hash says
+ */
+static void tcp_session_table_insert(tcp_session_table * table, tcp_session * ts)
+{
+	uint32_t mask = table->n_slots - 1;
+	uint32_t i;
+
+	ts->hash = tcp_session_hash(ts->sip,ts->dip,ts->sport,ts->dport);
+	for(i = ts->hash & mask; table->slots[i].ts != NULL; i = (i+1) & mask)
+		;
+	table->slots[i].hash = ts->hash;
+	table->slots[i].ts = ts;
+}
+
+/***************************
+ * static void tcp_session_table_grow(tcp_session_table * table);
+ * 	double the slots and rehash everything into them
+ */
+static void tcp_session_table_grow(tcp_session_table * table)
+{
+	int i;
+
+	free(table->slots);
+	table->n_slots *= 2;
+	table->slots = malloc_and_check(table->n_slots * sizeof(tcp_session_slot));
+	bzero(table->slots,table->n_slots * sizeof(tcp_session_slot));
+	for(i=0;i<table->n_sessions;i++)
+		tcp_session_table_insert(table,table->list[i]);
+}
+
+/***************************
+ * static void tcp_session_table_remove(tcp_session_table * table, tcp_session * ts);
+ * 	take ts out of its slot, and shift back anything after it
+ * 	that would otherwise be cut off from its home slot, so no
+ * 	tombstones are needed
+ */
+static void tcp_session_table_remove(tcp_session_table * table, tcp_session * ts)
+{
+	uint32_t mask = table->n_slots - 1;
+	uint32_t i, j, home;
+	int tcp_session_not_found=0;
+
+	for(i = ts->hash & mask; table->slots[i].ts != ts; i = (i+1) & mask)
+		if(table->slots[i].ts == NULL)
+			assert(tcp_session_not_found);
+	j = i;
+	while(1)
+	{
+		j = (j+1) & mask;
+		if(table->slots[j].ts == NULL)
+			break;
+		home = table->slots[j].hash & mask;
+		// can j move back to i? only if home isn't cyclically in (i,j]
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			table->slots[i] = table->slots[j];
+			i = j;
+		}
+	}
+	table->slots[i].ts = NULL;
+}
+
+/****************************
+ * 	point data at the contiguous bytes queued at the front of this
+ * 	session, without dequeuing or copying them; return how many
+ * 	there are.  The view is good until the next add_frag/pull/delete
+ */
+int tcp_session_peek(tcp_session * ts, char ** data)
+{
+	assert(ts);
+
+	pcap_dropped_segment_test(ts);
+	if(ts->resync && !tcp_session_resync(ts))
+		return 0;	// no message boundary yet
+	*data = &ts->buf[ts->buf_start];
+	if(ts->buf_len >= sizeof(struct ofp_header))
+		ts->skipped_count=0;	// there's something to frame
+	return ts->buf_len;
+}
+
+int tcp_session_close(tcp_session_table * table,tcp_session * ts)
+{
+	assert(ts);
+	if(tcp_session_is_empty(ts))
+	{
+		tcp_session_delete(table,ts);	// just delete now; is empty
+		return 1;
+	}
+	ts->close_on_empty = 1;
+	return 0;
+}
+
+/****************************
+ * 	add this fragment to this session
+ */
+int tcp_session_add_frag(tcp_session * ts, uint32_t seqno , char * tmpdata, int cap_len, int full_len, off_t rec_off)
+{
+	char srcaddr[BUFLEN];
+	char dstaddr[BUFLEN];
+	char *data,*orig_data;
+	uint32_t trim, buf_end;
+
+	if(ts->anchored && SEQ_LT(seqno,ts->seqno))
+	{
+		// resent bytes that were already delivered
+		if(SEQ_LEQ(seqno + full_len,ts->seqno))
+			return 0;
+		trim = ts->seqno - seqno;
+		tmpdata += trim;
+		cap_len = MAX(cap_len - (int) trim, 0);
+		full_len -= trim;
+		seqno = ts->seqno;
+	}
+
+	assert(cap_len <= full_len);
+	assert(full_len < BUFLEN);
+	if(cap_len < full_len)
+	{
+		// fill in uncaptured data with zeros; kinda have to do this for packet reconstruction
+		orig_data=data = malloc_and_check(full_len);
+		memcpy(data,tmpdata,cap_len);
+		bzero(&data[cap_len],full_len-cap_len);
+	}
+	else
+	{
+		orig_data=NULL;		// copied straight into the buffer/fragments
+		data = tmpdata;
+	}
+	/* fprintf(stderr,"DBG: adding seg of size %d to "
+			"%s:%u-> %s:%u \n",
+			cap_len,
 			srcaddr, ntohs(ts->sport),
-			dstaddr, ntohs(ts->dport));
+			dstaddr, ntohs(ts->dport)); */
+
+	if(cap_len< full_len)
+	{
+		tcp_session_ntop(ts,srcaddr,dstaddr,BUFLEN);
+		fprintf(stderr,"WARN: incomplete capture (filling with zeros- hope that's okay!) for flow  "
+				"%s:%u-> %s:%u \n",
+				srcaddr, ntohs(ts->sport),
+				dstaddr, ntohs(ts->dport));
+	}
+
+	if(SEQ_LT(seqno,ts->seqno))
+	{
+		// nothing delivered yet, and the stream really starts
+		// earlier than we thought
+		tcp_session_spill(ts);
+		ts->seqno = seqno;
+	}
+	buf_end = ts->seqno + ts->buf_len;
+	if(SEQ_LT(seqno,buf_end))	// overlaps what's already buffered
+	{
+		trim = MIN(buf_end - seqno, full_len);
+		overlap_check(ts,seqno,&ts->buf[ts->buf_start + (seqno - ts->seqno)],data,trim);
+		data += trim;
+		full_len -= trim;
+		seqno += trim;
+	}
+	if(full_len > 0 && seqno == buf_end)	// the common case: next in order
+	{
+		tcp_session_append(ts,data,full_len,rec_off);
+		tcp_session_drain(ts);	// may have filled a hole
+	}
+	else if(full_len > 0)
+		tcp_ooo_add(ts,seqno,data,full_len,rec_off);	// after a hole
+	if(orig_data)
+		free(orig_data);
+	return 0;
+}
+
+/****************************
+ * 	remove/dequeue len bytes from this session
+ * 		if there are holes in the space, erase the holes as well
+ * 			(used by pcap_dropped_segment_test() as well)
+ * 		don't bother copying it, b/c the tcp_session_peek pretty
+ * 		much already does that
+ */
+int tcp_session_pull(tcp_session * ts, int len)
+{
+	tcp_frag * curr;
+	int n;
+	assert(ts);
+	while(len > 0)
+	{
+		if(ts->buf_len > 0)	// from the buffer: just move the front up
+		{
+			n = MIN(len,ts->buf_len);
+			ts->buf_start += n;
+			ts->buf_len -= n;
+			ts->seqno += n;
+			len -= n;
+			ts->anchored = 1;	// anything before seqno is a resend now
+			continue;
+		}
+		if(ts->n_ooo == 0)
+		{
+			fprintf(stderr,"WARNING: tried to tcp_session_pull() more than was there :-(\n");
+			break;
+		}
+		// there's a hole: skip it, and the fragments after it become the stream
+		curr = ts->ooo[0];
+		len -= SEQ_OFF(ts,curr->start_seq);
+		ts->seqno = curr->start_seq;
+		ts->anchored = 1;
+		tcp_session_drain(ts);
+	}
+	if(ts->buf_len == 0)
+		ts->buf_start = ts->mark_first = ts->n_marks = 0;
+	while(ts->n_marks > 1 && SEQ_LEQ(ts->marks[ts->mark_first+1].seq,ts->seqno))
+	{
+		ts->mark_first++;	// those bytes are all gone
+		ts->n_marks--;
+	}
+	if(ts->close_on_empty || (ts->skipped_count > OFTRACE_SKIP_LIMIT))
+		return OFTRACE_DELETE_FLOW;
+	else
+		return OFTRACE_OK;
+}
+
+
+/*************************************************************
+ * int tcp_session_advance(tcp_session * ts, int len);
+ * 	the fast path's tcp_session_pull(): only for an empty session
+ */
+
+int tcp_session_advance(tcp_session * ts, int len)
+{
+	assert(ts);
+	assert(tcp_session_is_empty(ts));
+	ts->seqno += len;
+	ts->anchored = 1;
+	ts->skipped_count = 0;	// got a message out of it
+	if(ts->close_on_empty)
+		return OFTRACE_DELETE_FLOW;
+	else
+		return OFTRACE_OK;
+}
+
+/*************************************************************
+ * int tcp_session_is_empty(tcp_session * ts);
+ */
+
+int tcp_session_is_empty(tcp_session * ts)
+{
+	assert(ts);
+	return ts->buf_len == 0 && ts->n_ooo == 0;
+}
+
+/*************************************************************
+ * int tcp_session_resync(tcp_session * ts);
+ * 	only looks at the buffered bytes.  A boundary needs a whole
+ * 	message behind it; one that only has the start of a message
+ * 	so far is kept until the rest shows up, and otherwise the last
+ * 	few bytes are kept in case a header straddles the next segment.
+ * 	A hole gets skipped once it has been waited for long enough;
+ * 	partway into a range (see OFTRACE_RANGE_QUEUE_LIMIT), right away
+ * 	unless it's in the middle of a possible first message
+ */
+
+int tcp_session_resync(tcp_session * ts)
+{
+	char * data;
+	int k, r, maybe;
+	assert(ts);
+	if(!ts->resync)
+		return 1;
+	for(;;)
+	{
+		data = &ts->buf[ts->buf_start];
+		maybe = -1;
+		for(k=0;k<ts->buf_len;k++)
+		{
+			r = ofp_headers_plausible(&data[k],ts->buf_len-k);
+			if(r > 0)
+				break;
+			if(r < 0 && maybe < 0)
+				maybe = k;
+		}
+		if(k < ts->buf_len)
+		{
+			if(k > 0)
+				tcp_session_pull(ts,k);
+			ts->resync = 0;
+			return 1;
+		}
+		if(ts->n_ooo == 0)
+			break;
+		if((maybe >= 0 || !ts->mid_range) && ts->n_segs < tcp_session_queue_limit(ts))
+			break;
+		tcp_session_pull(ts,SEQ_OFF(ts,ts->ooo[0]->start_seq));
+	}
+	if(maybe >= 0)
+		tcp_session_pull(ts,maybe);
+	else if(ts->buf_len >= sizeof(struct ofp_header))
+		tcp_session_pull(ts,ts->buf_len - (sizeof(struct ofp_header) - 1));
+	return 0;
+}
+
+/*********************************************************
+ * static void tcp_session_append(tcp_session * ts, char * data, int len, off_t rec_off);
+ * 	add len in-order bytes to the end of the buffer; the buffer
+ * 	only moves when it runs out of room at the end, and only grows
+ * 	when it's more than half full
+ */
+static void tcp_session_append(tcp_session * ts, char * data, int len, off_t rec_off)
+{
+	char * neo;
+	int size;
+
+	if(ts->buf_start + ts->buf_len + len > ts->buf_size)
+	{
+		if(ts->buf_len + len <= ts->buf_size/2)
+			memmove(ts->buf,&ts->buf[ts->buf_start],ts->buf_len);
+		else
+		{
+			size = MAX(ts->buf_size,OFTRACE_STREAM_MIN);
+			while(size < 2 * (ts->buf_len + len))
+				size *= 2;
+			neo = malloc_and_check(size);
+			if(ts->buf_len > 0)
+				memcpy(neo,&ts->buf[ts->buf_start],ts->buf_len);
+			if(ts->buf)
+				free(ts->buf);
+			ts->buf = neo;
+			ts->buf_size = size;
+		}
+		ts->buf_start = 0;
+	}
+	memcpy(&ts->buf[ts->buf_start + ts->buf_len],data,len);
+	if(ts->n_marks == 0 || ts->marks[ts->mark_first + ts->n_marks - 1].rec_off != rec_off)
+	{
+		if(ts->mark_first + ts->n_marks >= ts->max_marks)
+		{
+			if(ts->mark_first > 0)
+				memmove(ts->marks,&ts->marks[ts->mark_first],ts->n_marks * sizeof(tcp_mark));
+			else
+			{
+				ts->max_marks = MAX(2 * ts->max_marks,8);
+				ts->marks = realloc_and_check(ts->marks,ts->max_marks * sizeof(tcp_mark));
+			}
+			ts->mark_first = 0;
+		}
+		ts->marks[ts->mark_first + ts->n_marks].seq = ts->seqno + ts->buf_len;
+		ts->marks[ts->mark_first + ts->n_marks].rec_off = rec_off;
+		ts->n_marks++;
+	}
+	ts->buf_len += len;
+}
+
+/*********************************************************
+ * static void tcp_session_drain(tcp_session * ts);
+ * 	move any fragments that are no longer out of order into
+ * 	the buffer
+ */
+static void tcp_session_drain(tcp_session * ts)
+{
+	tcp_frag * curr;
+	uint32_t buf_end;
+	int skip;
+
+	while(ts->n_ooo > 0)
+	{
+		curr = ts->ooo[0];
+		buf_end = ts->seqno + ts->buf_len;
+		if(SEQ_LT(buf_end,curr->start_seq))
+			break;	// still a hole in front of it
+		skip = MIN(buf_end - curr->start_seq,curr->len);
+		overlap_check(ts,curr->start_seq,
+				&ts->buf[ts->buf_start + (curr->start_seq - ts->seqno)],
+				curr->data,skip);
+		if(skip < curr->len)
+			tcp_session_append(ts,&curr->data[skip],curr->len - skip,curr->rec_off);
+		tcp_ooo_remove(ts,0);
+		ts->n_segs -= curr->segs;
+		assert(ts->n_segs>=0);
+		tcp_frag_free(ts,curr);
+	}
+}
+
+/*********************************************************
+ * static void tcp_session_spill(tcp_session * ts);
+ * 	turn the buffer back into fragments at the front of the
+ * 	queue, so something can go in front of it
+ */
+static void tcp_session_spill(tcp_session * ts)
+{
+	off_t rec_off = tcp_session_buffered_offset(ts);
+	int n, i = 0;
+
+	while(ts->buf_len > 0)
+	{
+		n = MIN(ts->buf_len,FRAG_MAX);
+		tcp_ooo_insert(ts,i++,tcp_frag_new(ts,ts->seqno,&ts->buf[ts->buf_start],n,rec_off));
+		ts->seqno += n;
+		ts->buf_start += n;
+		ts->buf_len -= n;
+	}
+	ts->buf_start = ts->mark_first = ts->n_marks = 0;
+}
+
+/*********************************************************
+ * static void tcp_ooo_add(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off);
+ * 	queue bytes that came after a hole; where they overlap what's
+ * 	queued already, the old bytes win
+ */
+static void tcp_ooo_add(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off)
+{
+	tcp_frag * curr;
+	int i, n, added = 0;
+
+	while(len > 0)
+	{
+		i = tcp_ooo_find(ts,seqno);
+		if(i < ts->n_ooo && SEQ_OFF(ts,ts->ooo[i]->start_seq) <= SEQ_OFF(ts,seqno))
+		{
+			// overlaps fragment i: skip past it
+			curr = ts->ooo[i];
+			n = MIN(curr->start_seq + curr->len - seqno,len);
+			overlap_check(ts,seqno,&curr->data[seqno - curr->start_seq],data,n);
+		}
+		else
+		{
+			// new bytes, up to the next fragment
+			n = len;
+			if(i < ts->n_ooo)
+				n = MIN(n,ts->ooo[i]->start_seq - seqno);
+			n = MIN(n,FRAG_MAX);
+			curr = NULL;
+			if(ts->spill && ts->ooo_bytes >= ts->spill_after)
+				curr = tcp_frag_spilled(ts,seqno,data,n,rec_off);	// a long backlog: keep it on disk
+			if(curr == NULL)
+				curr = tcp_frag_new(ts,seqno,data,n,rec_off);
+			curr->segs = added ? 0 : 1;	// count each segment once
+			added = 1;
+			tcp_ooo_insert(ts,i,curr);
+			tcp_ooo_merge(ts,i);	// with the next one
+			if(i > 0)
+				tcp_ooo_merge(ts,i-1);	// with the one before
+		}
+		seqno += n;
+		data += n;
+		len -= n;
+	}
+	if(added)
+		ts->n_segs++;
+}
+
+/*********************************************************
+ * static int tcp_ooo_find(tcp_session * ts, uint32_t seqno);
+ * 	bisect for the first fragment that ends after seqno
+ */
+static int tcp_ooo_find(tcp_session * ts, uint32_t seqno)
+{
+	int lo = 0, hi = ts->n_ooo, mid;
+	uint32_t off = SEQ_OFF(ts,seqno);
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(SEQ_OFF(ts,ts->ooo[mid]->start_seq) + ts->ooo[mid]->len <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*********************************************************
+ * static void tcp_ooo_insert(tcp_session * ts, int i, tcp_frag * frag);
+ */
+static void tcp_ooo_insert(tcp_session * ts, int i, tcp_frag * frag)
+{
+	if(ts->n_ooo >= ts->max_ooo)
+	{
+		ts->max_ooo = MAX(2 * ts->max_ooo,8);
+		ts->ooo = realloc_and_check(ts->ooo,ts->max_ooo * sizeof(tcp_frag *));
+	}
+	memmove(&ts->ooo[i+1],&ts->ooo[i],(ts->n_ooo - i) * sizeof(tcp_frag *));
+	ts->ooo[i] = frag;
+	ts->n_ooo++;
+	ts->ooo_bytes += frag->len;
+}
+
+/*********************************************************
+ * static void tcp_ooo_remove(tcp_session * ts, int i);
+ * 	just unlinks it; freeing it is the caller's business
+ */
+static void tcp_ooo_remove(tcp_session * ts, int i)
+{
+	ts->ooo_bytes -= ts->ooo[i]->len;
+	ts->n_ooo--;
+	memmove(&ts->ooo[i],&ts->ooo[i+1],(ts->n_ooo - i) * sizeof(tcp_frag *));
+}
+
+/*********************************************************
+ * static int tcp_ooo_merge(tcp_session * ts, int i);
+ * 	if fragment i+1 starts right where i ends, append it to i,
+ * 	moving i to a bigger buffer if need be; the power of two
+ * 	sizes keep a run of small segments from being copied over
+ * 	and over.  Spilled fragments only merge with each other, when
+ * 	their bytes are already next to each other in the file.
+ * 	Return 1 if they were merged
+ */
+static int tcp_ooo_merge(tcp_session * ts, int i)
+{
+	tcp_frag * a, * b, * neo;
+
+	if(i + 1 >= ts->n_ooo)
+		return 0;
+	a = ts->ooo[i];
+	b = ts->ooo[i+1];
+	if(a->start_seq + a->len != b->start_seq)
+		return 0;
+	if(a->size_class == OFTRACE_FRAG_SPILLED || b->size_class == OFTRACE_FRAG_SPILLED)
+	{
+		if(a->size_class != b->size_class || !tcp_spill_contiguous(ts->spill,a->data,a->len,b->data))
+			return 0;
+		a->len += b->len;
+		a->segs += b->segs;
+		a->rec_off = MIN(a->rec_off,b->rec_off);
+		tcp_ooo_remove(ts,i+1);
+		ts->ooo_bytes += b->len;	// still queued, in a
+		free(b);	// just the header; its bytes are a's now
+		ts->pool.bytes -= sizeof(tcp_frag);
+		return 1;
+	}
+	if(a->len + b->len > FRAG_MAX)
+		return 0;
+	if(FRAG_ROOM(a) < (int) b->len)
+	{
+		neo = tcp_frag_alloc(ts,a->len + b->len);
+		neo->start_seq = a->start_seq;
+		neo->len = a->len;
+		neo->segs = a->segs;
+		neo->rec_off = a->rec_off;
+		memcpy(neo->data,a->data,a->len);
+		tcp_frag_free(ts,a);
+		ts->ooo[i] = a = neo;
+	}
+	memcpy(&a->data[a->len],b->data,b->len);
+	a->len += b->len;
+	a->segs += b->segs;
+	a->rec_off = MIN(a->rec_off,b->rec_off);
+	tcp_ooo_remove(ts,i+1);
+	ts->ooo_bytes += b->len;
+	tcp_frag_free(ts,b);
+	return 1;
+}
+
+/*********************************************************
+ * static off_t tcp_session_buffered_offset(tcp_session * ts);
+ * 	oldest record with bytes in the buffer, or -1; drained
+ * 	fragments can be older than what came before them
+ */
+static off_t tcp_session_buffered_offset(tcp_session * ts)
+{
+	off_t off = -1;
+	int i;
+
+	if(ts->buf_len == 0)
+		return -1;
+	for(i=ts->mark_first;i<ts->mark_first+ts->n_marks;i++)
+		if(off < 0 || ts->marks[i].rec_off < off)
+			off = ts->marks[i].rec_off;
+	return off;
+}
+
+/*********************************************************
+ * static void overlap_check(tcp_session * ts, uint32_t seqno, char * old, char * neo, int len);
+ * 	complain if retransmitted bytes don't match what we have; the
+ * 	old ones win
+ */
+static void overlap_check(tcp_session * ts, uint32_t seqno, char * old, char * neo, int len)
+{
+	char srcaddr[BUFLEN],srcbuf[BUFLEN];
+	char dstaddr[BUFLEN],dstbuf[BUFLEN];
+
+	if(len <= 0 || memcmp(old,neo,len) == 0)
+		return;
+	tcp_session_ntop(ts,srcaddr,dstaddr,BUFLEN);
+	fprintf(stderr,"WEIRD: ignoring inconsistant overlapping segments for "
+			"%s:%u-> %s:%u start_overlap %u end %u\n",
+			srcaddr, ntohs(ts->sport),
+			dstaddr, ntohs(ts->dport),
+			seqno, len);
+	fprintf(stderr,"before:	%s\nafter:	%s\n",
+			data2hexstr(neo,10,srcbuf,BUFLEN),
+			data2hexstr(old,10,dstbuf,BUFLEN));
+}
+
+/*********************************************************
+ * static int ofp_headers_plausible(char * data, int len)
+ * 	do the len bytes at data start with a chain of sane openflow
+ * 	headers, each one where the previous message's length says?
+ * 	1 if so, and at least the first message is all there; -1 if
+ * 	it's too soon to tell, since the first runs past len; else 0
+ */
+static int ofp_headers_plausible(char * data, int len)
+{
+	struct ofp_header ofph;
+	int off = 0;
+	while(off + (int) sizeof(ofph) <= len)
+	{
+		memcpy(&ofph,&data[off],sizeof(ofph));
+		if( ofph.version != OFP_VERSION
+				|| ofph.type > OFPT_STATS_REPLY
+				|| ntohs(ofph.length) < sizeof(ofph)
+				|| ntohs(ofph.length) > 6000)
+			return 0;
+		off += ntohs(ofph.length);
+	}
+	if(off == 0)
+		return 0;
+	return (off > len && off == ntohs(ofph.length)) ? -1 : 1;
+}
+
+/*************************************************************
+ * int tcp_session_count_frags(tcp_session *ts);
+ * 	count the number of fragments
+ */
 
-	return ts;
+int tcp_session_count_frags(tcp_session *ts)
+{
+	assert(ts);
+	assert(ts->n_segs>=0);
+	return ts->n_segs;
 }
 
-/***************************
- * 	find the session matching the passes parameters
- * 	return NULL if not found
+/*************************************************************
+ * off_t tcp_session_queued_offset(tcp_session *ts);
+ * 	fragments are in seqno order, not record order, so look
+ * 	at all of them, and at the buffer
  */
-tcp_session * tcp_session_find(tcp_session ** sessions, int n_sessions,struct oft_iphdr * ip, struct oft_tcphdr * tcp)
+
+off_t tcp_session_queued_offset(tcp_session *ts)
 {
+	off_t off;
 	int i;
-	tcp_session *ts;
-	for(i=0; i < n_sessions; i++)
-	{	
-		ts = sessions[i];
-		if( ts->sip == ip->saddr &&
-				ts->dip == ip->daddr &&
-				ts->sport == tcp->source &&
-				ts->dport == tcp->dest)
-			return ts;
-	}
-	return NULL;
+	assert(ts);
+	off = tcp_session_buffered_offset(ts);
+	for(i=0;i<ts->n_ooo;i++)
+		if(off < 0 || ts->ooo[i]->rec_off < off)
+			off = ts->ooo[i]->rec_off;
+	return off;
 }
 
-/****************************
- * 	does this session have at least len contiguous bytes queued?
- * 	if yes, copy them to data, but don't dequeue, return 1
- * 	if not enough buffer, return -1
- * 	else return 0
+/*********************************************************
+ * static tcp_frag * tcp_frag_alloc(tcp_session * ts, int size);
+ * 	get an empty fragment with room for size bytes from the
+ * 	session's pool
  */
-int tcp_session_peek(tcp_session * ts, char * data, int len)
+static tcp_frag * tcp_frag_alloc(tcp_session * ts, int size)
 {
-	tcp_frag *curr;
-	int index=0;
-	uint32_t seqno;
-	int min;
-	assert(ts);
+	tcp_frag_pool * pool = &ts->pool;
+	tcp_frag * frag;
+	int c = 0;
 
-	pcap_dropped_segment_test(ts);
-	curr = ts->next;
-	seqno = ts->seqno;
-	while(curr)
+	assert(size >= 0 && size <= FRAG_MAX);
+	while(FRAG_CAP(c) < size)
+		c++;
+	if((frag = pool->free[c]) != NULL)	// reuse a released one
 	{
-		if(seqno != curr->start_seq)	// is the new fragment contiguous with the last?
-			return 0;
-		min = MIN(curr->len,len-index);
-		memcpy(&data[index],curr->data,min);
-		seqno +=min;		// this will autowrap, no worries about PAWS
-		index+=min;
-		if(index>=len)		// did we find all that we were looking for?
+		pool->free[c] = frag->next;
+		pool->n_free[c]--;
+	}
+	else if(FRAG_FROM_SLAB(c))	// small: carve it from a slab
+	{
+		if(pool->slab_left < FRAG_BYTES(c))
 		{
-			ts->skipped_count=0;
-			return 1;
+			// start a new slab; the first few bytes chain it to the old ones
+			void ** slab = malloc_and_check(OFTRACE_FRAG_SLAB);
+			pool->bytes += OFTRACE_FRAG_SLAB;
+			*slab = pool->slabs;
+			pool->slabs = slab;
+			pool->slab_next = (char *) slab + sizeof(tcp_frag);	// keeps the alignment
+			pool->slab_left = OFTRACE_FRAG_SLAB - sizeof(tcp_frag);
 		}
-		curr=curr->next;
+		frag = (tcp_frag *) pool->slab_next;
+		pool->slab_next += FRAG_BYTES(c);
+		pool->slab_left -= FRAG_BYTES(c);
+	}
+	else
+	{
+		frag = malloc_and_check(FRAG_BYTES(c));
+		pool->bytes += FRAG_BYTES(c);
 	}
-	return 0;	// ran out of fragments before finding len bytes
+	frag->size_class = c;
+	frag->start_seq = 0;
+	frag->len = 0;
+	frag->segs = 0;
+	frag->rec_off = -1;
+	frag->data = (char *) (frag + 1);
+	frag->next = NULL;
+	return frag;
 }
 
-int tcp_session_close(tcp_session ** sessions, int * n_sessions,tcp_session * ts)
+/*********************************************************
+ * static tcp_frag * tcp_frag_new(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off);
+ * 	a fragment holding a copy of len bytes; the caller puts it
+ * 	in the queue
+ */
+static tcp_frag * tcp_frag_new(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off)
 {
-	assert(ts);
-	if(ts->next == NULL )
-		 return tcp_session_delete(sessions,n_sessions,ts);	// just delete now; is empty
-	ts->close_on_empty = 1;
-	return 0;
+	tcp_frag * frag = tcp_frag_alloc(ts,len);
+
+	frag->start_seq = seqno;
+	frag->len = len;
+	frag->rec_off = rec_off;
+	memcpy(frag->data,data,len);
+	return frag;
 }
 
-/****************************
- * 	add this fragment to this session
+/*********************************************************
+ * static tcp_frag * tcp_frag_spilled(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off);
+ * 	like tcp_frag_new(), but with the bytes in the spill file; only
+ * 	the header takes memory.  NULL if they couldn't be written
  */
-int tcp_session_add_frag(tcp_session * ts, uint32_t seqno , char * tmpdata, int cap_len, int full_len)
+static tcp_frag * tcp_frag_spilled(tcp_session * ts, uint32_t seqno, char * data, int len, off_t rec_off)
 {
-	char srcaddr[BUFLEN],srcbuf[BUFLEN];
-	char dstaddr[BUFLEN],dstbuf[BUFLEN];
-	char *data,*orig_data;
-	tcp_frag *curr, *prev, *neo;
-	uint32_t start_overlap, end_overlap;
+	tcp_frag * frag;
+	char * where = tcp_spill_write(ts->spill,data,len);
 
-	// malloc some space
-	orig_data=data = malloc_and_check(BUFLEN);
-	// fill in uncaptured data with zeros; kinda have to do this for packet reconstruction
-	assert(cap_len <= full_len);
-	assert(full_len < BUFLEN);
-	bzero(data,BUFLEN);
-	memcpy(data,tmpdata,cap_len);
-	// setup initial pointers
-	prev=NULL;
-	inet_ntop(AF_INET,&ts->sip,srcaddr,BUFLEN);
-	inet_ntop(AF_INET,&ts->dip,dstaddr,BUFLEN);
-	curr = ts->next;
-	/* fprintf(stderr,"DBG: adding seg of size %d to "
-			"%s:%u-> %s:%u \n",
-			cap_len,
-			srcaddr, ntohs(ts->sport),
-			dstaddr, ntohs(ts->dport)); */
+	if(where == NULL)
+		return NULL;
+	frag = malloc_and_check(sizeof(tcp_frag));
+	ts->pool.bytes += sizeof(tcp_frag);
+	frag->start_seq = seqno;
+	frag->len = len;
+	frag->segs = 0;
+	frag->size_class = OFTRACE_FRAG_SPILLED;
+	frag->rec_off = rec_off;
+	frag->data = where;
+	frag->next = NULL;
+	return frag;
+}
 
-	if(cap_len< full_len)
-		fprintf(stderr,"WARN: incomplete capture (filling with zeros- hope that's okay!) for flow  "
-				"%s:%u-> %s:%u \n",
-				srcaddr, ntohs(ts->sport),
-				dstaddr, ntohs(ts->dport));
+/*********************************************************
+ * static void tcp_frag_free(tcp_session * ts, tcp_frag * frag);
+ * 	give an unlinked fragment back to the session's pool; n_segs
+ * 	is the caller's business
+ */
+static void tcp_frag_free(tcp_session * ts, tcp_frag * frag)
+{
+	tcp_frag_pool * pool = &ts->pool;
+	int c = frag->size_class;
 
-	while(curr)	// search for where this frag fits into the stream
+	if(c == OFTRACE_FRAG_SPILLED)
 	{
-		if((seqno +full_len) < curr->start_seq)	// have we gone too far?	// FIXME: PAWS!
-			break;
-		else if(seqno >= (curr->start_seq + curr->len) )	// not far enough; next
-		{
-			prev=curr;
-			curr=curr->next;
-		}
-		else
-		{
-			// if we are here, there is some level of (partial?) overlap
-			start_overlap = MAX(seqno,curr->start_seq);	// FIXME: PAWS!
-			end_overlap   = MIN(seqno+full_len, curr->start_seq + curr->len);	// FIXME: PAWS!
-			if(memcmp(&curr->data[curr->start_seq-start_overlap], 
-						&data[start_overlap-seqno],
-						end_overlap - start_overlap) != 0)
-			{
-				fprintf(stderr,"WEIRD: ignoring inconsistant overlapping segments for "
-						"%s:%u-> %s:%u start_overlap %u end %u\n",
-						srcaddr, ntohs(ts->sport),
-						dstaddr, ntohs(ts->dport),
-						start_overlap, end_overlap - start_overlap);
-				fprintf(stderr,"before:	%s\nafter:	%s\n",
-						data2hexstr(&data[start_overlap-seqno],10,srcbuf,BUFLEN),
-						data2hexstr(&curr->data[curr->start_seq-start_overlap],10,dstbuf,BUFLEN));
-			}
-			if(seqno < start_overlap)	// is there something new before the overlap?	// FIXME: PAWS!
-			{
-				// create a new frag just for the new part before the current frag
-				// FIXME: this is duplicated code from outside the while(); not obvious how to fix
-				neo = malloc_and_check(sizeof(tcp_frag));
-				neo->start_seq = seqno;
-				neo->len = start_overlap - seqno;
-				ts->n_segs++;
-				memcpy(neo->data,data,neo->len);
-				data+=neo->len;		// move our new data pointer forward the amount we added
-				full_len -= neo->len;
-				neo->next = curr;
-				if(prev)
-					prev->next = neo;
-				else
-				{
-					ts->next = neo;
-					ts->seqno = neo->start_seq;
-				}
-			}
-			if((seqno+full_len) > end_overlap)	// is there something new *after* the overlap?
-			{
-				// advance our new data pointer past the overlap and loop again to keep adding
-				data+= end_overlap - start_overlap;	// jump past the overlap
-				full_len -= end_overlap - start_overlap;
-			}
-			else
-			{
-				free(orig_data);
-				return 0;	// if there is nothing after the overlap, we're done
-			}
-		}
+		tcp_spill_free(ts->spill,frag->data,frag->len);
+		free(frag);
+		pool->bytes -= sizeof(tcp_frag);
+		return;
 	}
-	// now, insert the (remaining) new data between prev and curr
-	neo = malloc_and_check(sizeof(tcp_frag));
-	neo->start_seq = seqno;
-	neo->len = full_len;
-	memcpy(neo->data,data,neo->len);
-	neo->next = curr;
-	ts->n_segs++;
-	if(prev)
-		prev->next = neo;
-	else
+	if(!FRAG_FROM_SLAB(c) && pool->n_free[c] >= OFTRACE_FRAG_KEEP)
 	{
-		ts->next = neo;
-		ts->seqno = neo->start_seq;
+		free(frag);	// don't hoard big buffers
+		pool->bytes -= FRAG_BYTES(c);
+		return;
 	}
-	free(orig_data);
-	return 0;
+	frag->next = pool->free[c];
+	pool->free[c] = frag;
+	pool->n_free[c]++;
 }
 
-/****************************
- * 	remove/dequeue len bytes from this session
- * 		if there are holes in the space, erase the holes as well
- * 			(used by pcap_dropped_segment_test() as well)
- * 		don't bother copying it, b/c the tcp_session_peek pretty
- * 		much already does that
+/*********************************************************
+ * static void tcp_frag_pool_free(tcp_session * ts);
+ * 	release every fragment of the session, queued or not, and
+ * 	its slabs
  */
-int tcp_session_pull(tcp_session * ts, int len)
+static void tcp_frag_pool_free(tcp_session * ts)
 {
-	tcp_frag * curr, * neo;
-	assert(ts);
-	while(len > 0)
+	tcp_frag_pool * pool = &ts->pool;
+	tcp_frag * curr, * next;
+	void * slab;
+	int c, i;
+
+	for(i=0;i<ts->n_ooo;i++)
 	{
-		curr = ts->next;
-		if(curr == NULL)
-		{
-			fprintf(stderr,"WARNING: tried to tcp_session_pull() more than was there :-(\n");
-			break;
-		}
-		if(curr->start_seq != ts->seqno)	// is there a hole?
-		{
-			len -= curr->start_seq - ts->seqno;	// skip the hole: FIXME PAWS
-			ts->seqno = curr->start_seq;
-			if(len<=0)			
-				break;
-		}
-		if(curr->len <= len) 	// do we erase the whole fragment?
-		{
-			len -= curr->len;
-			ts->next = curr->next;
-			ts->seqno = curr->start_seq+curr->len;
-			assert(ts->n_segs>0);
-			ts->n_segs--;
-			free(curr);
-		}
-		else
-		{
-			// just erase the first part of the current fragment
-			// todo this: create a new fragment with what's left
-			neo = malloc_and_check(sizeof(tcp_frag));
-			neo->start_seq = curr->start_seq + len;
-			neo->len = curr->len-len;
-			// don't increment or decrement ts->n_segs
-			// we just removed one and added one
-			memcpy(neo->data,&curr->data[len],neo->len);
-			neo->next = curr->next;
-			ts->next = neo;
-			ts->seqno = neo->start_seq;
+		curr = ts->ooo[i];
+		if(curr->size_class == OFTRACE_FRAG_SPILLED)
+			tcp_spill_free(ts->spill,curr->data,curr->len);
+		if(!FRAG_FROM_SLAB(curr->size_class))
 			free(curr);
-			len= 0;
-		}
 	}
-	if(ts->close_on_empty || (ts->skipped_count > OFTRACE_SKIP_LIMIT))
-		return OFTRACE_DELETE_FLOW;
-	else
-		return OFTRACE_OK;
+	ts->n_ooo = 0;
+	ts->ooo_bytes = 0;
+	for(c=0;c<OFTRACE_FRAG_CLASSES;c++)
+	{
+		if(!FRAG_FROM_SLAB(c))
+			for(curr = pool->free[c]; curr; curr = next)
+			{
+				next = curr->next;
+				free(curr);
+			}
+		pool->free[c] = NULL;
+		pool->n_free[c] = 0;
+	}
+	while((slab = pool->slabs) != NULL)
+	{
+		pool->slabs = *(void **) slab;
+		free(slab);
+	}
+	pool->slab_next = NULL;
+	pool->slab_left = 0;
+	pool->bytes = 0;
 }
 
-
-/*************************************************************
- * int tcp_session_count_frags(tcp_session *ts);
- * 	count the number of fragments
+/*********************************************************
+ * static int tcp_session_queue_limit(tcp_session * ts);
+ * 	how many segments may wait behind a hole
  */
-
-int tcp_session_count_frags(tcp_session *ts)
+static int tcp_session_queue_limit(tcp_session * ts)
 {
-	assert(ts);
-	assert(ts->n_segs>=0);
-	return ts->n_segs;
+	if(ts->mid_range && (uint32_t) (ts->seqno - ts->isn) < OFTRACE_RANGE_CATCHUP)
+		return OFTRACE_RANGE_QUEUE_LIMIT;
+	return OFTRACE_QUEUE_LIMIT;
 }
 
 /*********************************************************
@@ -359,30 +1477,32 @@ static int pcap_dropped_segment_test(tcp_session * ts)
 	char * what_skipped;
 
 	assert(ts);
-	if(ts->n_segs < OFTRACE_QUEUE_LIMIT)	// make sure we have ~200+ queued segments 
+	if(ts->n_segs < tcp_session_queue_limit(ts))	// make sure we have ~200+ queued segments 
 		return 0;	// before we even think about this test
-	curr = ts->next;
-    assert(curr);
+	assert(ts->n_ooo > 0);
+	curr = ts->ooo[0];
+	ofph = (struct ofp_header * ) &ts->buf[ts->buf_start];
+	if( (ts->buf_len>=sizeof(struct ofp_header)) && (ts->buf_len >= ntohs(ofph->length)))
+		return 0;	// not stuck: there's a whole message to hand out
 
-	ofph = (struct ofp_header * ) curr->data;
-	inet_ntop(AF_INET,&ts->sip,srcaddr,BUFLEN);
-	inet_ntop(AF_INET,&ts->dip,dstaddr,BUFLEN);
-	if( (curr->len>=sizeof(struct ofp_header))
+	tcp_session_ntop(ts,srcaddr,dstaddr,BUFLEN);
+	if( (ts->buf_len>=sizeof(struct ofp_header))
 			&& ( ofph->version == OFP_VERSION ) 	// version is sane
 			&& ( ofph->type <= OFPT_STATS_REPLY)	// type is sane
 			&& ( ntohs(ofph->length) <= 6000))	// length is sane (arbitary)
 	{
-		// we have a valid openflow header
+		// we have a valid openflow header; if the hole ends inside
+		// this message, skip it and the framing stays right
+		if(ntohs(ofph->length) < SEQ_OFF(ts,curr->start_seq))
+			ts->resync = 1;	// the hole runs past it: look again after
 		tcp_session_pull(ts,ntohs(ofph->length));	// just skip this message
 		what_skipped = "an openflow message";
 	}
 	else
 	{
-		ts->next = curr->next;
-        assert(ts->next);
-		ts->seqno = ts->next->start_seq;
-        ts->n_segs--;
-		free(curr);
+		// give up on the hole, and look for the framing after it
+		tcp_session_pull(ts,SEQ_OFF(ts,curr->start_seq));
+		ts->resync = 1;
 		what_skipped = "a tcp segment";
 	}
 	ts->skipped_count++;
@@ -411,34 +1531,32 @@ static char * data2hexstr(char * data, int n_bytes,char * buf, int buflen)
  * 	throw an assert if not found
  */
 
-int tcp_session_delete(tcp_session ** sessions, int * n_sessions, tcp_session * ts)
+int tcp_session_delete(tcp_session_table * table, tcp_session * ts)
 {
-	int i;
+	int i = ts->table_index;
 	char srcbuf[BUFLEN], dstbuf[BUFLEN];
-	tcp_frag * curr, * prev;
 	int tcp_session_not_found=0;
-	assert(*n_sessions>0);
-	for(i=0;i<(*n_sessions);i++)
-		if(sessions[i] == ts)
-			break;
-	if(i>=*n_sessions)
+	assert(table->n_sessions>0);
+	if(i < 0 || i >= table->n_sessions || table->list[i] != ts)
 		assert(tcp_session_not_found);
-	inet_ntop(AF_INET,&ts->sip,srcbuf,BUFLEN);
-	inet_ntop(AF_INET,&ts->dip,dstbuf,BUFLEN);
+	tcp_session_ntop(ts,srcbuf,dstbuf,BUFLEN);
 	fprintf(stderr, "DELETING %s:%d --> %s:%d with %d segments left at index %d \n",
 			srcbuf, ntohs(ts->sport), 
 			dstbuf, ntohs(ts->dport),
 			ts->n_segs, i);
-	(*n_sessions)--;
-	sessions[i]=sessions[*n_sessions];
-	curr = ts->next;
-	while(curr)
-	{
-		prev=curr;
-		curr = curr->next;
-		bzero(prev,sizeof(*prev));
-		free(prev);
-	}
+	tcp_session_table_remove(table,ts);
+	tcp_session_lru_unlink(table,ts);
+	table->mem -= ts->mem;
+	table->n_sessions--;
+	table->list[i]=table->list[table->n_sessions];
+	table->list[i]->table_index = i;
+	tcp_frag_pool_free(ts);
+	if(ts->buf)
+		free(ts->buf);
+	if(ts->marks)
+		free(ts->marks);
+	if(ts->ooo)
+		free(ts->ooo);
 	bzero(ts,sizeof(*ts));
 	free(ts);	
 	return 0;
@@ -484,16 +1602,16 @@ static int mk_test_packet(char * buf,int buflen, uint32_t sip, uint32_t dip, uin
 int unittest_do_tcp_session_delete(void)
 {
 	int success=1;
-	tcp_session ** tcp_sessions;
-	int max=10;
-	int n_sessions=0;
+	tcp_session_table table;
+	tcp_session * tcp_sessions[10];
 	char p1[BUFLEN];
 	int i,j;
 	struct oft_tcphdr * tcp;
 	struct oft_iphdr * ip;
 	char * data = "blah blah!";
+	int order[10] = { 0, 9, 6, 4, 1, 3, 5, 7, 2, 8 };
 
-	tcp_sessions  = malloc( max * sizeof(tcp_session *));
+	tcp_session_table_init(&table);
 	
 	for(i = 0 ; i < 10 ; i ++ )  // make ten connections and add some data
 	{
@@ -502,24 +1620,487 @@ int unittest_do_tcp_session_delete(void)
 				6633, 12345, 
 				data, strlen(data), &tcp, &ip);
 		tcp_sessions[i] = tcp_session_new(ip,tcp);
+		tcp_session_add(&table,tcp_sessions[i]);
 		for( j = 0 ; j < 10 ; j ++)
-			tcp_session_add_frag(tcp_sessions[i], j * strlen(data) , data, strlen(data), strlen(data));
+			tcp_session_add_frag(tcp_sessions[i], j * strlen(data) , data, strlen(data), strlen(data), 0);
+	}
+	for(i = 0 ; i < 10 ; i ++ )
+	{
+		tcp_session_delete(&table, tcp_sessions[order[i]]);
+		assert(table.n_sessions == 9 - i);
+		// the deleted one is gone, and the rest are still there
+		for(j = 0 ; j < 10 ; j ++ )
+		{
+			mk_test_packet(p1, BUFLEN, j, 2, 0, 6633, 12345, data, strlen(data), &tcp, &ip);
+			if(j == order[i])
+				assert(tcp_session_find(&table,ip,tcp) == NULL);
+			else if(tcp_session_find(&table,ip,tcp))
+				assert(table.list[tcp_sessions[j]->table_index] == tcp_sessions[j]);
+		}
 	}
-	n_sessions=10;
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[0]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[9]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[6]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[4]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[1]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[3]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[5]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[7]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[2]);
-	tcp_session_delete(tcp_sessions, &n_sessions, tcp_sessions[8]);
 
-	assert(n_sessions == 0);
+	assert(table.n_sessions == 0);
+	tcp_session_table_free(&table);
 
 
 	return success;
 }
 
+
+/***************************
+ * static tcp_session * unittest_session(tcp_session_table * table, uint32_t sip, uint16_t sport, uint32_t isn);
+ * 	a new ipv4 session to the controller, starting at isn, in table
+ */
+static tcp_session * unittest_session(tcp_session_table * table, uint32_t sip, uint16_t sport, uint32_t isn)
+{
+	char p[BUFLEN];
+	struct oft_tcphdr * tcp;
+	struct oft_iphdr * ip;
+	tcp_session * ts;
+
+	mk_test_packet(p, BUFLEN, sip, 2, isn, sport, 6633, "", 0, &tcp, &ip);
+	ts = tcp_session_new(ip,tcp);
+	tcp_session_add(table,ts);
+	return ts;
+}
+
+/***************************
+ * 	stream bytes that can be told apart, by sequence number
+ */
+#define UNITTEST_BYTE(seq) ((char) ((seq) ^ ((seq) >> 8) ^ ((seq) >> 16)))
+
+static void unittest_fill(char * buf, uint32_t seq, int len)
+{
+	int i;
+	for(i = 0; i < len; i++)
+		buf[i] = UNITTEST_BYTE(seq + i);
+}
+
+/***************************
+ * int unittest_do_tcp_session_seq(void);
+ * 	a 1 byte hole with 1.5MB queued behind it, arriving back to
+ * 	front, in a session that has delivered something (so drops
+ * 	what's before seqno) and one that hasn't (so moves seqno back
+ * 	for it), away from the 2^32 wrap and across it: nothing gets
+ * 	dropped or moved
+ */
+int unittest_do_tcp_session_seq(void)
+{
+	static char seg[50000];
+	tcp_session_table table;
+	tcp_session * ts;
+	char * data;
+	uint32_t isns[] = { 0x10000000, 0xfff00000 };
+	uint32_t start;
+	int anchored, i, k, n, w;
+
+	for(w = 0; w < 4; w++)
+	{
+		anchored = w & 1;
+		tcp_session_table_init(&table);
+		ts = unittest_session(&table, 1, 40000, isns[w >> 1]);
+		if(anchored)
+		{
+			unittest_fill(seg, ts->seqno, 10);
+			tcp_session_add_frag(ts, ts->seqno, seg, 10, 10, 0);
+			assert(tcp_session_peek(ts, &data) == 10);
+			tcp_session_pull(ts, 10);
+			assert(ts->anchored);
+		}
+		start = ts->seqno;
+		for(k = 29; k >= 0; k--)
+		{
+			unittest_fill(seg, start + 1 + k * 50000, 50000);
+			tcp_session_add_frag(ts, start + 1 + k * 50000, seg, 50000, 50000, 0);
+			assert(ts->seqno == start);
+		}
+		assert(ts->ooo_bytes == 1500000 && ts->n_ooo > 1);
+		for(i = 1; i < ts->n_ooo; i++)	// in order, across the wrap
+			assert(SEQ_OFF(ts,ts->ooo[i-1]->start_seq) + ts->ooo[i-1]->len <= SEQ_OFF(ts,ts->ooo[i]->start_seq));
+		assert(ts->ooo[0]->start_seq == start + 1);
+		if(w >> 1)
+			assert(ts->ooo[ts->n_ooo-1]->start_seq < start);	// wrapped
+		// fill the hole
+		unittest_fill(seg, start, 1);
+		tcp_session_add_frag(ts, start, seg, 1, 1, 0);
+		assert(ts->n_ooo == 0 && ts->ooo_bytes == 0);
+		n = tcp_session_peek(ts, &data);
+		assert(n == 1500001);
+		for(i = 0; i < n; i++)
+			assert(data[i] == UNITTEST_BYTE(start + i));
+		tcp_session_pull(ts, n);
+		assert(ts->seqno == start + 1500001 && tcp_session_is_empty(ts));
+		// an old resend is dropped, or trimmed to what's new
+		if(anchored)
+		{
+			unittest_fill(seg, start + 1500001 - 2000000, 100);
+			tcp_session_add_frag(ts, start + 1500001 - 2000000, seg, 100, 100, 0);
+			assert(tcp_session_is_empty(ts) && ts->seqno == start + 1500001);
+			unittest_fill(seg, start + 1500001 - 50, 100);
+			tcp_session_add_frag(ts, start + 1500001 - 50, seg, 100, 100, 0);
+			assert(tcp_session_peek(ts, &data) == 50 && data[0] == UNITTEST_BYTE(start + 1500001));
+		}
+		tcp_session_table_free(&table);
+	}
+	return 1;
+}
+
+/***************************
+ * int unittest_do_tcp_session_spill(void);
+ * 	3MB behind a hole, in a scrambled order, with the default
+ * 	threshold: what's past it goes to the spill file, and all of
+ * 	it comes back out in order once the hole fills
+ */
+int unittest_do_tcp_session_spill(void)
+{
+	static char seg[50000];
+	tcp_session_table table;
+	tcp_session * ts;
+	char * data;
+	uint32_t start, seq;
+	int i, k, n, spilled;
+
+	tcp_session_table_init(&table);
+	if(tcp_session_table_spill(&table, NULL, OFTRACE_SPILL_AFTER))
+		return 0;
+	ts = unittest_session(&table, 1, 40000, 0x7ff00000);
+	start = ts->seqno;
+	for(i = 0; i < 60; i++)
+	{
+		k = (i * 37) % 60;
+		seq = start + 1 + k * 50000;
+		unittest_fill(seg, seq, 50000);
+		tcp_session_add_frag(ts, seq, seg, 50000, 50000, 0);
+	}
+	unittest_fill(seg, start + 1 + 1000, 50000);	// a resend, overlapping two
+	tcp_session_add_frag(ts, start + 1 + 1000, seg, 50000, 50000, 0);
+	assert(ts->seqno == start && ts->ooo_bytes == 3000000);
+	spilled = 0;
+	for(i = 0; i < ts->n_ooo; i++)
+		if(ts->ooo[i]->size_class == OFTRACE_FRAG_SPILLED)
+			spilled += ts->ooo[i]->len;
+	assert(spilled >= 3000000 - OFTRACE_SPILL_AFTER - FRAG_MAX);
+	assert(tcp_spill_bytes(table.spill) == spilled);
+	unittest_fill(seg, start, 1);
+	tcp_session_add_frag(ts, start, seg, 1, 1, 0);
+	assert(ts->n_ooo == 0 && tcp_spill_bytes(table.spill) == 0);
+	n = tcp_session_peek(ts, &data);
+	assert(n == 3000001);
+	for(i = 0; i < n; i++)
+		assert(data[i] == UNITTEST_BYTE(start + i));
+	tcp_session_table_free(&table);
+	return 1;
+}
+
+/***************************
+ * int unittest_do_tcp_session_table(void);
+ * 	enough sessions to make the table double a few times: every
+ * 	one can still be found afterwards, and nothing that isn't
+ */
+int unittest_do_tcp_session_table(void)
+{
+	tcp_session_table table;
+	tcp_session * sessions[1000];
+	char p[BUFLEN];
+	struct oft_tcphdr * tcp;
+	struct oft_iphdr * ip;
+	int i, n_slots;
+
+	tcp_session_table_init(&table);
+	assert(table.n_slots == OFTRACE_SESSION_SLOTS);
+	n_slots = table.n_slots;
+	for(i = 0; i < 1000; i++)
+	{
+		sessions[i] = unittest_session(&table, htonl(0x0a000000 + i / 10), 40000 + i % 10, i);
+		if(table.n_slots != n_slots)	// just rehashed: nothing lost
+		{
+			assert(table.n_slots == 2 * n_slots && 2 * table.n_sessions <= table.n_slots);
+			n_slots = table.n_slots;
+			mk_test_packet(p, BUFLEN, htonl(0x0a000000), 2, 0, 40000, 6633, "", 0, &tcp, &ip);
+			assert(tcp_session_find(&table,ip,tcp) == sessions[0]);
+		}
+	}
+	assert(table.n_sessions == 1000 && table.n_slots == 2048);
+	for(i = 0; i < 1000; i++)
+	{
+		mk_test_packet(p, BUFLEN, htonl(0x0a000000 + i / 10), 2, 0, 40000 + i % 10, 6633, "", 0, &tcp, &ip);
+		assert(tcp_session_find(&table,ip,tcp) == sessions[i]);
+		tcp->dest = 6634;
+		assert(tcp_session_find(&table,ip,tcp) == NULL);
+	}
+	tcp_session_table_free(&table);
+	return 1;
+}
+
+/***************************
+ * int unittest_do_tcp_session_chain(void);
+ * 	three sessions that all hash to the last slot, so they probe
+ * 	on around to the first ones: take out the middle one, and the
+ * 	last has to move back into its slot to stay reachable
+ */
+int unittest_do_tcp_session_chain(void)
+{
+	tcp_session_table table;
+	tcp_session * chain[3];
+	uint32_t sips[3], mask = OFTRACE_SESSION_SLOTS - 1;
+	char p[BUFLEN];
+	struct oft_tcphdr * tcp;
+	struct oft_iphdr * ip;
+	uint32_t sip;
+	int i, n;
+
+	for(sip = 1, n = 0; n < 3; sip++)
+		if((tcp_session_hash(sip,2,40000,6633) & mask) == mask)
+			sips[n++] = sip;
+	tcp_session_table_init(&table);
+	for(i = 0; i < 3; i++)
+		chain[i] = unittest_session(&table, sips[i], 40000, 0);
+	assert(table.n_slots == OFTRACE_SESSION_SLOTS);
+	assert(table.slots[mask].ts == chain[0]);
+	assert(table.slots[0].ts == chain[1]);
+	assert(table.slots[1].ts == chain[2]);
+	tcp_session_delete(&table, chain[1]);
+	assert(table.slots[0].ts == chain[2] && table.slots[1].ts == NULL);
+	for(i = 0; i < 3; i++)
+	{
+		mk_test_packet(p, BUFLEN, sips[i], 2, 0, 40000, 6633, "", 0, &tcp, &ip);
+		assert(tcp_session_find(&table,ip,tcp) == (i == 1 ? NULL : chain[i]));
+	}
+	tcp_session_delete(&table, chain[0]);
+	assert(table.slots[mask].ts == chain[2] && table.slots[0].ts == NULL);
+	mk_test_packet(p, BUFLEN, sips[2], 2, 0, 40000, 6633, "", 0, &tcp, &ip);
+	assert(tcp_session_find(&table,ip,tcp) == chain[2]);
+	tcp_session_table_free(&table);
+	return 1;
+}
+
+/***************************
+ * int unittest_do_tcp_session_v6(void);
+ * 	two sessions whose addresses differ in one byte, and one
+ * 	resumed from a checkpoint, with only the folded addresses
+ */
+int unittest_do_tcp_session_v6(void)
+{
+	tcp_session_table table;
+	tcp_session * v6[3];
+	uint8_t a6[3][16];
+	char p[BUFLEN];
+	struct oft_tcphdr * tcp;
+	struct oft_iphdr * ip;
+	int i;
+
+	tcp_session_table_init(&table);
+	mk_test_packet(p, BUFLEN, 0, 0, 0, 6633, 12345, "", 0, &tcp, &ip);
+	bzero(a6,sizeof(a6));
+	a6[0][0] = a6[1][0] = a6[2][0] = 0x20;
+	a6[0][15] = 1;
+	a6[1][15] = 2;
+	a6[2][15] = 3;
+	v6[0] = tcp_session_new6(a6[0],a6[2],tcp);
+	tcp_session_add(&table,v6[0]);
+	v6[1] = tcp_session_new6(a6[1],a6[2],tcp);
+	tcp_session_add(&table,v6[1]);
+	v6[2] = tcp_session_resume(tcp_session_addr6(a6[2]),tcp_session_addr6(a6[0]),tcp->dest,tcp->source,0);
+	tcp_session_add(&table,v6[2]);
+	// folded into 240/4, which no ipv4 packet comes from
+	assert((ntohl(v6[0]->sip) >> 28) == 0xf && v6[0]->sip != v6[1]->sip);
+	assert(tcp_session_find6(&table,a6[0],a6[2],tcp) == v6[0]);
+	assert(tcp_session_find6(&table,a6[1],a6[2],tcp) == v6[1]);
+	assert(tcp_session_find6(&table,a6[2],a6[1],tcp) == NULL);
+	assert(v6[2]->ip6 == 0);
+	tcp->source = v6[2]->sport;
+	tcp->dest = v6[2]->dport;
+	assert(tcp_session_find6(&table,a6[2],a6[0],tcp) == v6[2]);
+	assert(v6[2]->ip6 && !memcmp(v6[2]->dip6,a6[0],16));
+	assert(tcp_session_find_reverse(&table,v6[2]) == v6[0]);
+	assert(tcp_session_find_reverse(&table,v6[0]) == v6[2]);
+	for(i = 0; i < 3; i++)
+		tcp_session_delete(&table, v6[i]);
+	tcp_session_table_free(&table);
+	return 1;
+}
+
+/***************************
+ * int unittest_do_tcp_session_conn_hash(void);
+ * 	both directions of a connection hash the same, and only they do
+ */
+int unittest_do_tcp_session_conn_hash(void)
+{
+	uint32_t a = htonl(0x0a000001), b = htonl(0x0a010002);
+	uint16_t p = htons(6633), q = htons(40000);
+
+	assert(tcp_session_conn_hash(a,b,p,q) == tcp_session_conn_hash(b,a,q,p));
+	assert(tcp_session_conn_hash(a,a,p,q) == tcp_session_conn_hash(a,a,q,p));	// loopback
+	assert(tcp_session_conn_hash(a,b,p,q) != tcp_session_conn_hash(a,b,q,p));	// ports swapped alone
+	assert(tcp_session_conn_hash(a,b,p,q) != tcp_session_conn_hash(b,a,p,q));	// addresses swapped alone
+	assert(tcp_session_conn_hash(a,b,p,q) != tcp_session_conn_hash(a,b,p,htons(40001)));
+	assert(tcp_session_conn_hash(tcp_session_addr6((uint8_t *) "\x20\x01\0\0\0\0\0\0\0\0\0\0\0\0\0\x01"),b,p,q) ==
+		tcp_session_conn_hash(b,tcp_session_addr6((uint8_t *) "\x20\x01\0\0\0\0\0\0\0\0\0\0\0\0\0\x01"),q,p));
+	return 1;
+}
+
+/***************************
+ * static tcp_session * unittest_find(tcp_session_table * table, uint32_t sip, uint16_t sport);
+ * 	the session unittest_session() made, or NULL
+ */
+static tcp_session * unittest_find(tcp_session_table * table, uint32_t sip, uint16_t sport)
+{
+	char p[BUFLEN];
+	struct oft_tcphdr * tcp;
+	struct oft_iphdr * ip;
+
+	mk_test_packet(p, BUFLEN, sip, 2, 0, sport, 6633, "", 0, &tcp, &ip);
+	return tcp_session_find(table,ip,tcp);
+}
+
+/***************************
+ * int unittest_do_tcp_session_expire(void);
+ * 	sessions touched at made up trace times, some with bytes
+ * 	queued: the idle ones go first, then the least recently
+ * 	used until the rest fit the budget; the ones that had bytes
+ * 	queued are remembered
+ */
+int unittest_do_tcp_session_expire(void)
+{
+	static char data[2000];
+	tcp_session_table table;
+	tcp_session * s[6];
+	int64_t sec = 1000000000;
+	int i;
+
+	tcp_session_table_init(&table);
+	for(i = 0; i < 5; i++)
+		s[i] = unittest_session(&table, 1, 40000 + i, 0);
+	unittest_fill(data, s[2]->seqno, 100);
+	tcp_session_add_frag(s[2], s[2]->seqno, data, 100, 100, 0);
+	unittest_fill(data, s[3]->seqno, 1000);
+	tcp_session_add_frag(s[3], s[3]->seqno, data, 1000, 1000, 0);
+	unittest_fill(data, s[3]->seqno + 1001, 2000);	// after a hole
+	tcp_session_add_frag(s[3], s[3]->seqno + 1001, data, 2000, 2000, 0);
+	for(i = 0; i < 5; i++)
+		tcp_session_touch(&table, s[i], (i + 1) * sec);
+	tcp_session_touch(&table, s[1], 6 * sec);	// now s0 s2 s3 s4 s1
+
+	// idle for more than 6.5s at 10s: s0 and s2, with its 100 bytes
+	assert(tcp_session_table_expire(&table, 10 * sec, 6.5 * sec, 0) == 100);
+	assert(table.idle_evictions == 2 && table.budget_evictions == 0 && table.evicted_bytes == 100);
+	assert(unittest_find(&table, 1, 40000) == NULL && unittest_find(&table, 1, 40002) == NULL);
+	for(i = 3; i < 5; i++)
+		assert(unittest_find(&table, 1, 40000 + i) == s[i]);
+	assert(unittest_find(&table, 1, 40001) == s[1]);
+	// nothing more is idle
+	assert(tcp_session_table_expire(&table, 10 * sec, 6.5 * sec, 0) == 0);
+	assert(table.n_sessions == 3);
+
+	tcp_session_touch(&table, s[3], 11 * sec);	// now s4 s1 s3
+	assert(table.lru_head == s[4] && table.lru_tail == s[3]);
+	// one byte over: only the least recently used goes
+	assert(tcp_session_table_expire(&table, 11 * sec, 0, table.mem - 1) == 0);
+	assert(table.budget_evictions == 1 && unittest_find(&table, 1, 40004) == NULL);
+	// room for s3 alone, the biggest and most recent
+	assert(tcp_session_table_expire(&table, 11 * sec, 0, s[3]->mem) == 0);
+	assert(table.budget_evictions == 2 && table.n_sessions == 1 && table.lru_head == s[3]);
+	assert(table.mem == s[3]->mem && table.peak_mem >= table.mem);
+	// and then not even that: its 3000 queued bytes are counted
+	assert(tcp_session_table_expire(&table, 11 * sec, 0, 1) == 3000);
+	assert(table.budget_evictions == 3 && table.n_sessions == 0 && table.mem == 0);
+	assert(table.idle_evictions == 2 && table.evicted_bytes == 3100);
+	assert(table.lru_head == NULL && table.lru_tail == NULL);
+
+	// one that hasn't had a packet isn't idle: its clock starts
+	s[5] = unittest_session(&table, 1, 40005, 0);
+	assert(tcp_session_table_expire(&table, 100 * sec, sec, 0) == 0);
+	assert(table.n_sessions == 1 && s[5]->last_nsec == 100 * sec);
+	assert(tcp_session_table_expire(&table, 102 * sec, sec, 0) == 0);
+	assert(table.n_sessions == 0 && table.idle_evictions == 3);
+
+	// only the ones dropped with bytes queued pick up mid-message, once
+	assert(table.n_evicted == 2);
+	for(i = 0; i < 6; i++)
+	{
+		s[i] = unittest_session(&table, 1, 40000 + i, 0);
+		assert(tcp_session_was_evicted(&table, s[i]) == (i == 2 || i == 3));
+		assert(!tcp_session_was_evicted(&table, s[i]));
+	}
+	assert(table.n_evicted == 0);
+	tcp_session_table_free(&table);
+
+	// enough of them for the set to grow
+	tcp_session_table_init(&table);
+	for(i = 0; i < 200; i++)
+	{
+		s[0] = unittest_session(&table, 2, 40000 + i, 0);
+		tcp_session_add_frag(s[0], s[0]->seqno, data, 1, 1, 0);
+		tcp_session_touch(&table, s[0], sec);
+	}
+	assert(tcp_session_table_expire(&table, sec, 0, 1) == 200);
+	assert(table.n_evicted == 200 && table.n_evicted_slots == 512);
+	for(i = 199; i >= 0; i--)
+	{
+		s[0] = unittest_session(&table, 2, 40000 + i, 0);
+		assert(tcp_session_was_evicted(&table, s[0]));
+		assert(table.n_evicted == i);
+	}
+	tcp_session_table_free(&table);
+	return 1;
+}
+
+/***************************
+ * int unittest_do_tcp_session_pool(void);
+ * 	fragments of every size class, queued behind a hole and
+ * 	drained; the second time around they all come from what
+ * 	the first released, and the big ones aren't hoarded
+ */
+int unittest_do_tcp_session_pool(void)
+{
+	static char seg[FRAG_MAX];
+	int sizes[] = { 1, 7, 63, 64, 65, 500, 1448, 3000, 9000, 40000, 2, 100 };
+	int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+	tcp_session_table table;
+	tcp_session * ts;
+	char * data;
+	uint32_t start, offs[12 * 8];
+	size_t bytes = 0;
+	void * slabs = NULL;
+	int c, i, k, n, len, round;
+
+	tcp_session_table_init(&table);
+	ts = unittest_session(&table, 1, 40000, 0xffff0000);
+	for(round = 0; round < 2; round++)
+	{
+		start = ts->seqno;
+		len = 1;	// leave a one byte hole
+		for(k = 0; k < 12 * 8; k++)
+		{
+			offs[k] = len;
+			len += sizes[k % n_sizes];
+		}
+		for(k = 12 * 8 - 1; k >= 0; k--)
+		{
+			unittest_fill(seg, start + offs[k], sizes[k % n_sizes]);
+			tcp_session_add_frag(ts, start + offs[k], seg, sizes[k % n_sizes], sizes[k % n_sizes], 0);
+		}
+		assert(ts->n_ooo > 1 && ts->ooo_bytes == len - 1);
+		unittest_fill(seg, start, 1);
+		tcp_session_add_frag(ts, start, seg, 1, 1, 0);
+		n = tcp_session_peek(ts, &data);
+		assert(n == len);
+		for(i = 0; i < n; i++)
+			assert(data[i] == UNITTEST_BYTE(start + i));
+		tcp_session_pull(ts, n);
+		assert(tcp_session_is_empty(ts));
+		for(c = 0; c < OFTRACE_FRAG_CLASSES; c++)
+			if(!FRAG_FROM_SLAB(c))
+				assert(ts->pool.n_free[c] <= OFTRACE_FRAG_KEEP);
+		if(round == 0)
+		{
+			bytes = ts->pool.bytes;
+			slabs = ts->pool.slabs;
+			assert(slabs != NULL);
+		}
+		else	// no new slabs, and nothing more held
+			assert(ts->pool.bytes == bytes && ts->pool.slabs == slabs);
+	}
+	tcp_session_table_free(&table);
+	return 1;
+}
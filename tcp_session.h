@@ -38,16 +38,60 @@ without specific, written prior permission.
 
 #define OFTRACE_SKIP_LIMIT 100
 #define OFTRACE_QUEUE_LIMIT 200
+// 	or, in the first OFTRACE_RANGE_CATCHUP bytes of a session picked
+// 	up partway into a range of the file, where a hole may well be
+// 	bytes from before the range (and while it looks for its framing,
+// 	none at all)
+#define OFTRACE_RANGE_QUEUE_LIMIT 8
+#define OFTRACE_RANGE_CATCHUP 65536
+
+#include <sys/types.h>
 
 // hack to get uint32_t etc..
 #include "oftrace.h"
+#include "tcp_spill.h"
+// fragment buffers come in power of two size classes, 64 bytes to 64KB
+#define OFTRACE_FRAG_MIN_SHIFT 6
+#define OFTRACE_FRAG_CLASSES 11
+// small fragments are carved out of per-session slabs of this size;
+// bigger ones are malloc()'d one at a time
+#define OFTRACE_FRAG_SLAB (16*1024)
+// how many of the malloc()'d ones to keep around for reuse, per class
+#define OFTRACE_FRAG_KEEP 4
+// size_class of a fragment whose data is in the spill file
+#define OFTRACE_FRAG_SPILLED OFTRACE_FRAG_CLASSES
+// default for how many bytes of out of order data a session keeps
+// in memory before the rest goes to the spill file, if there is one
+#define OFTRACE_SPILL_AFTER (1<<20)
+
 typedef struct tcp_frag {
 	uint32_t start_seq;
-	uint16_t len;
-	char data[BUFLEN];
-	struct tcp_frag * next;
+	uint32_t len;
+	uint32_t segs;		// how many segments went into it
+	uint16_t size_class;	// buffer is (1<<(OFTRACE_FRAG_MIN_SHIFT+size_class)) bytes
+	off_t rec_off;	// file offset of the (oldest) record the bytes came from
+	char * data;	// len bytes in the buffer right after this struct
+	struct tcp_frag * next;	// in the pool's free lists
 } tcp_frag;
 
+typedef struct tcp_frag_pool {
+	tcp_frag * free[OFTRACE_FRAG_CLASSES];	// released fragments, by size class
+	int n_free[OFTRACE_FRAG_CLASSES];
+	void * slabs;		// chain of slabs, released with the session
+	char * slab_next;	// unused space in the newest slab
+	int slab_left;
+	size_t bytes;		// malloc()'d for slabs and big fragments
+} tcp_frag_pool;
+
+// stream buffers start this big, and double when they need to
+#define OFTRACE_STREAM_MIN 2048
+
+// which record the buffered bytes from seq on came from
+typedef struct tcp_mark {
+	uint32_t seq;
+	off_t rec_off;
+} tcp_mark;
+
 typedef struct tcp_session {
 	uint32_t sip;
 	uint32_t dip;
@@ -55,38 +99,185 @@ typedef struct tcp_session {
 	uint16_t dport;	// stored in network byte order!
 	uint32_t seqno;	// stored in HOST byte order
 	uint32_t isn;	// stored in HOST byte order (initial seqno)
-	int n_segs;
+	int n_segs;	// segments waiting in ooo
 	int skipped_count;
 	int close_on_empty;
-	tcp_frag * next;
+	int anchored;	// bytes before seqno were already delivered: drop, don't rewind
+			// (set by the first pull)
+	int resync;	// picked up mid-stream: seqno may not be at a message boundary
+	int mid_range;	// picked up partway into a range of the file: see OFTRACE_RANGE_QUEUE_LIMIT
+	int index_id;	// session in the index being built
+	uint64_t dpid;	// of the switch at one end, once its FEATURES_REPLY
+			// 	went by in either direction; 0 until then
+	int ip6;	// an ipv6 connection: sip and dip are then
+	uint8_t sip6[16];	// 	tcp_session_addr6() of these; one resumed from
+	uint8_t dip6[16];	// 	an index checkpoint learns them from its first packet
+	uint32_t hash;	// of the 4-tuple, see tcp_session_hash()
+	int table_index;	// where it is in the table's list
+	// in-order bytes, seqno onwards, are kept contiguous in
+	// buf[buf_start .. buf_start+buf_len); anything after a hole
+	// waits in ooo until the hole fills
+	char * buf;
+	int buf_start;
+	int buf_len;
+	int buf_size;
+	tcp_mark * marks;	// marks[mark_first .. mark_first+n_marks), by seq
+	int mark_first;
+	int n_marks;
+	int max_marks;
+	tcp_frag_pool pool;	// where this session's fragments come from
+	// out of order data: sorted by seq (wrap safe, relative to
+	// seqno), never overlapping, adjacent ranges coalesced
+	tcp_frag ** ooo;
+	int n_ooo;
+	int max_ooo;
+	size_t ooo_bytes;	// in ooo, in memory or spilled
+	tcp_spill * spill;	// the table's, or NULL
+	size_t spill_after;	// spill new fragments once ooo_bytes gets here
+	// for tcp_session_table_expire()
+	int64_t last_nsec;	// trace time of its last packet; -1 before the first
+	size_t mem;		// bytes it held then
+	struct tcp_session * lru_prev;	// least recently used first
+	struct tcp_session * lru_next;
 } tcp_session;
 
+// open addressing with linear probing; an empty slot has ts == NULL
+typedef struct tcp_session_slot {
+	uint32_t hash;
+	tcp_session * ts;
+} tcp_session_slot;
+
+// the table starts with this many slots, and doubles when half full
+#define OFTRACE_SESSION_SLOTS 64
+
+// one direction of a connection that was evicted with bytes queued;
+// 	kept in a set with open addressing like the sessions' slots
+typedef struct tcp_session_key {
+	uint32_t sip;
+	uint32_t dip;
+	uint16_t sport;	// network byte order
+	uint16_t dport;
+	uint32_t hash;	// see tcp_session_hash()
+	int used;
+} tcp_session_key;
+
+typedef struct tcp_session_table {
+	tcp_session ** list;	// every session, in no particular order
+	int n_sessions;
+	int max_sessions;
+	tcp_session_slot * slots;	// n_slots, a power of two
+	int n_slots;
+	tcp_session * lru_head;	// least recently used
+	tcp_session * lru_tail;
+	size_t mem;		// sum of the sessions' mem
+	size_t peak_mem;
+	uint64_t idle_evictions;
+	uint64_t budget_evictions;
+	uint64_t evicted_bytes;	// queued stream bytes dropped with them
+	tcp_session_key * evicted;	// which ones had any, see tcp_session_was_evicted()
+	int n_evicted;
+	int n_evicted_slots;	// a power of two, or 0
+	tcp_spill * spill;	// see tcp_session_table_spill()
+	size_t spill_after;
+} tcp_session_table;
+
+
+/***************************
+ * 	setup an empty table, or free one and all its sessions
+ */
+void tcp_session_table_init(tcp_session_table * table);
+void tcp_session_table_free(tcp_session_table * table);
+
+/***************************
+ * 	from now on, once a session has threshold bytes of out of order
+ * 	data, put any more in a temp file in dir (NULL for $TMPDIR);
+ * 	calling it again just changes the threshold
+ * 	return 0 on success, -1 if the file couldn't be created
+ */
+int tcp_session_table_spill(tcp_session_table * table, const char * dir, size_t threshold);
 
 tcp_session * tcp_session_new(struct oft_iphdr * ip, struct oft_tcphdr * tcp);
+tcp_session * tcp_session_new6(const uint8_t * saddr6, const uint8_t * daddr6, struct oft_tcphdr * tcp);
+
+/***************************
+ * 	recreate a session from an index checkpoint: seqno is the
+ * 	next byte to deliver, and anything before it that shows up
+ * 	again is dropped
+ */
+tcp_session * tcp_session_resume(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport, uint32_t seqno);
 
 /***************************
  * 	find the session matching the passes parameters
  * 	return NULL if not found
  */
-tcp_session * tcp_session_find(tcp_session ** sessions, int n_sessions,struct oft_iphdr * ip, struct oft_tcphdr * tcp);
+tcp_session * tcp_session_find(tcp_session_table * table,struct oft_iphdr * ip, struct oft_tcphdr * tcp);
+tcp_session * tcp_session_find6(tcp_session_table * table, const uint8_t * saddr6,
+		const uint8_t * daddr6, struct oft_tcphdr * tcp);
+
+/***************************
+ * 	what an ipv6 session uses for sip and dip (network byte order)
+ */
+uint32_t tcp_session_addr6(const uint8_t * addr6);
+
+/***************************
+ * 	a well mixed hash of a connection that comes out the same for
+ * 	both of its directions (for ipv6, pass tcp_session_addr6()'s)
+ */
+uint32_t tcp_session_conn_hash(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+
+/***************************
+ * 	print ts's addresses, ipv4 or ipv6, into len byte buffers
+ */
+void tcp_session_ntop(const tcp_session * ts, char * srcaddr, char * dstaddr, int len);
+
+/***************************
+ * 	the other direction of ts's connection, or NULL
+ */
+tcp_session * tcp_session_find_reverse(tcp_session_table * table, tcp_session * ts);
+
+/***************************
+ * 	add a new session to the table
+ */
+void tcp_session_add(tcp_session_table * table, tcp_session * ts);
+
+/***************************
+ * 	ts just got a packet at trace time now (nanoseconds): make it
+ * 	the most recently used, and recount the bytes it holds
+ */
+void tcp_session_touch(tcp_session_table * table, tcp_session * ts, int64_t now);
+
+/***************************
+ * 	delete sessions that haven't had a packet for more than
+ * 	idle_nsec, then the least recently used ones until the
+ * 	sessions hold no more than budget bytes; 0 turns either off
+ * 	return how many bytes of queued stream data were thrown away
+ */
+uint64_t tcp_session_table_expire(tcp_session_table * table, int64_t now, int64_t idle_nsec, size_t budget);
+
+/***************************
+ * 	was ts's connection (this direction) evicted with bytes queued,
+ * 	so that it may pick up again in the middle of a message?  Only
+ * 	says so once: the table forgets it then
+ */
+int tcp_session_was_evicted(tcp_session_table * table, tcp_session * ts);
 
 /***************************
- * 	remove the session from the lists of sessions
+ * 	remove the session from the table
  * 	and free it's contents
  * 	throw an assert if not found
  */
-int tcp_session_delete(tcp_session ** sessions, int * n_sessions, tcp_session * ts);
+int tcp_session_delete(tcp_session_table * table, tcp_session * ts);
 /****************************
- * 	does this session have at least len contiguous bytes queued?
- * 	if yes, copy them to data, but don't dequeue, return 1
- * 	else return 0
+ * 	point data at the contiguous bytes queued at the front of this
+ * 	session, without dequeuing or copying them; return how many
+ * 	there are.  The view is good until the next add_frag/pull/delete
  */
-int tcp_session_peek(tcp_session * ts, char * data, int len);
+int tcp_session_peek(tcp_session * ts, char ** data);
 
 /****************************
- * 	add this fragment to this session
+ * 	add this fragment, from the record at file offset rec_off, to this session
  */
-int tcp_session_add_frag(tcp_session * ts, uint32_t seqno, char * data, int cap_len, int full_len);
+int tcp_session_add_frag(tcp_session * ts, uint32_t seqno, char * data, int cap_len, int full_len, off_t rec_off);
 
 /****************************
  * 	remove/dequeue len bytes from this session
@@ -96,20 +287,53 @@ int tcp_session_add_frag(tcp_session * ts, uint32_t seqno, char * data, int cap_
  */
 int tcp_session_pull(tcp_session * ts, int len);
 
+/****************************
+ * 	len bytes at seqno were handled without ever being queued;
+ * 	move seqno past them.  Same return as tcp_session_pull()
+ */
+int tcp_session_advance(tcp_session * ts, int len);
+
+/****************************
+ * 	nothing queued, in order or not?
+ */
+int tcp_session_is_empty(tcp_session * ts);
+
+/****************************
+ * 	for a session picked up in the middle of its stream, drop
+ * 	bytes until a run of plausible openflow headers starts
+ * 	return 1 once framing is recovered, 0 if still looking
+ */
+int tcp_session_resync(tcp_session * ts);
+
 /*************************
- * 	count the number of stored fragments
+ * 	count the number of stored out of order fragments
  */
 int tcp_session_count_frags(tcp_session *ts);
 
+/*************************
+ * 	file offset of the oldest record with bytes still queued
+ * 	here, or -1 if nothing is queued
+ */
+off_t tcp_session_queued_offset(tcp_session *ts);
+
 /************************
  * set close_on_empty flag
+ * 	return 1 if the session was already empty and got deleted
  */
-int tcp_session_close(tcp_session ** sessions, int * n_sessions,tcp_session *ts);
+int tcp_session_close(tcp_session_table * table,tcp_session *ts);
 
 /*************************
  * expose hooks for unittesting
  */
 
 int unittest_do_tcp_session_delete(void);
+int unittest_do_tcp_session_table(void);
+int unittest_do_tcp_session_chain(void);
+int unittest_do_tcp_session_v6(void);
+int unittest_do_tcp_session_conn_hash(void);
+int unittest_do_tcp_session_seq(void);
+int unittest_do_tcp_session_spill(void);
+int unittest_do_tcp_session_expire(void);
+int unittest_do_tcp_session_pool(void);
 
 #endif
@@ -0,0 +1,245 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#define _GNU_SOURCE	// for fallocate()
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "tcp_spill.h"
+#include "utils.h"
+
+typedef struct tcp_spill_chunk {
+	char * map;	// OFTRACE_SPILL_CHUNK bytes of the file, read only
+	int used;	// bytes handed out, from the front
+	int live;	// of those, not freed yet
+} tcp_spill_chunk;
+
+struct tcp_spill {
+	int fd;
+	tcp_spill_chunk * chunks;	// chunk i is at file offset i*OFTRACE_SPILL_CHUNK
+	int n_chunks;
+	int max_chunks;
+	int curr;		// the one being filled, or -1
+	size_t bytes;
+	int warned;		// about a failed write
+};
+
+static int tcp_spill_chunk_of(tcp_spill * sp, char * data);
+static int tcp_spill_grab_chunk(tcp_spill * sp);
+static char * tcp_spill_failed(tcp_spill * sp);
+
+/***************************************************
+ * tcp_spill * tcp_spill_open(const char * dir);
+ */
+tcp_spill * tcp_spill_open(const char * dir)
+{
+	tcp_spill * sp;
+	char path[PATH_MAX];
+	int fd;
+
+	if(dir == NULL && (dir = getenv("TMPDIR")) == NULL)
+		dir = "/tmp";
+	snprintf(path,PATH_MAX,"%s/oftrace-spill.XXXXXX",dir);
+	if((fd = mkstemp(path)) < 0)
+	{
+		fprintf(stderr,"Failed to create spill file in %s: %s\n",dir,strerror(errno));
+		return NULL;
+	}
+	unlink(path);	// gone when we close it, or die
+	sp = malloc_and_check(sizeof(tcp_spill));
+	bzero(sp,sizeof(tcp_spill));
+	sp->fd = fd;
+	sp->curr = -1;
+	return sp;
+}
+
+/***************************************************
+ * void tcp_spill_close(tcp_spill * sp);
+ */
+void tcp_spill_close(tcp_spill * sp)
+{
+	int i;
+
+	if(!sp)
+		return;
+	for(i=0;i<sp->n_chunks;i++)
+		munmap(sp->chunks[i].map,OFTRACE_SPILL_CHUNK);
+	if(sp->chunks)
+		free(sp->chunks);
+	close(sp->fd);
+	free(sp);
+}
+
+/***************************************************
+ * char * tcp_spill_write(tcp_spill * sp, char * data, int len);
+ */
+char * tcp_spill_write(tcp_spill * sp, char * data, int len)
+{
+	tcp_spill_chunk * c;
+	off_t off;
+	int n, done = 0;
+
+	if(len <= 0 || len > OFTRACE_SPILL_CHUNK)
+		return NULL;
+	if(sp->curr < 0 || sp->chunks[sp->curr].used + len > OFTRACE_SPILL_CHUNK)
+		if((sp->curr = tcp_spill_grab_chunk(sp)) < 0)
+			return tcp_spill_failed(sp);
+	c = &sp->chunks[sp->curr];
+	off = (off_t) sp->curr * OFTRACE_SPILL_CHUNK + c->used;
+	while(done < len)
+	{
+		n = pwrite(sp->fd,&data[done],len - done,off + done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return tcp_spill_failed(sp);	// what's written is just never used
+		done += n;
+	}
+	c->used += len;
+	c->live += len;
+	sp->bytes += len;
+	return &c->map[c->used - len];
+}
+
+/***************************************************
+ * void tcp_spill_free(tcp_spill * sp, char * data, int len);
+ * 	an emptied chunk gets its pages dropped, and its disk space
+ * 	back where the filesystem can punch holes
+ */
+void tcp_spill_free(tcp_spill * sp, char * data, int len)
+{
+	int i = tcp_spill_chunk_of(sp,data);
+	tcp_spill_chunk * c;
+
+	assert(i >= 0);
+	c = &sp->chunks[i];
+	c->live -= len;
+	sp->bytes -= len;
+	assert(c->live >= 0);
+	if(c->live > 0)
+		return;
+	c->used = 0;	// start over
+	madvise(c->map,OFTRACE_SPILL_CHUNK,MADV_DONTNEED);
+#ifdef HAVE_FALLOCATE
+	fallocate(sp->fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+			(off_t) i * OFTRACE_SPILL_CHUNK,OFTRACE_SPILL_CHUNK);
+#endif
+}
+
+/***************************************************
+ * int tcp_spill_contiguous(tcp_spill * sp, char * a, int alen, char * b);
+ */
+int tcp_spill_contiguous(tcp_spill * sp, char * a, int alen, char * b)
+{
+	int i;
+
+	if(b != a + alen)
+		return 0;
+	i = tcp_spill_chunk_of(sp,a);
+	return i >= 0 && b < sp->chunks[i].map + OFTRACE_SPILL_CHUNK;
+}
+
+/***************************************************
+ * size_t tcp_spill_bytes(tcp_spill * sp);
+ */
+size_t tcp_spill_bytes(tcp_spill * sp)
+{
+	return sp ? sp->bytes : 0;
+}
+
+/***************************************************
+ * static char * tcp_spill_failed(tcp_spill * sp);
+ * 	say so, once; the caller keeps the data in memory instead
+ */
+static char * tcp_spill_failed(tcp_spill * sp)
+{
+	if(!sp->warned)
+		fprintf(stderr,"WARN: can't grow the spill file (%s); keeping out of order data in memory\n",
+				strerror(errno));
+	sp->warned = 1;
+	return NULL;
+}
+
+/***************************************************
+ * static int tcp_spill_chunk_of(tcp_spill * sp, char * data);
+ * 	which chunk data is in, or -1; there are few enough of them
+ * 	(one per 4MB of backlog) to just look
+ */
+static int tcp_spill_chunk_of(tcp_spill * sp, char * data)
+{
+	int i;
+
+	for(i=0;i<sp->n_chunks;i++)
+		if(data >= sp->chunks[i].map && data < sp->chunks[i].map + OFTRACE_SPILL_CHUNK)
+			return i;
+	return -1;
+}
+
+/***************************************************
+ * static int tcp_spill_grab_chunk(tcp_spill * sp);
+ * 	an empty chunk, reused or new at the end of the file
+ * 	return its index, or -1 if the file can't grow
+ */
+static int tcp_spill_grab_chunk(tcp_spill * sp)
+{
+	tcp_spill_chunk * c;
+	int i;
+
+	for(i=0;i<sp->n_chunks;i++)
+		if(sp->chunks[i].live == 0 && i != sp->curr)
+		{
+			sp->chunks[i].used = 0;
+			return i;
+		}
+	if(ftruncate(sp->fd,(off_t) (sp->n_chunks + 1) * OFTRACE_SPILL_CHUNK))
+		return -1;
+	if(sp->n_chunks >= sp->max_chunks)
+	{
+		sp->max_chunks = MAX(2 * sp->max_chunks,8);
+		sp->chunks = realloc_and_check(sp->chunks,sp->max_chunks * sizeof(tcp_spill_chunk));
+	}
+	c = &sp->chunks[sp->n_chunks];
+	c->map = mmap(NULL,OFTRACE_SPILL_CHUNK,PROT_READ,MAP_SHARED,sp->fd,
+			(off_t) sp->n_chunks * OFTRACE_SPILL_CHUNK);
+	if(c->map == MAP_FAILED)
+		return -1;
+	c->used = c->live = 0;
+	return sp->n_chunks++;
+}
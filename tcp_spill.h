@@ -0,0 +1,87 @@
+/***********************************************************
+Copyright (c) 2008 The Board of Trustees of The Leland Stanford Junior
+University
+
+We are making the OpenFlow specification and associated documentation
+(Software) available for public use and benefit with the expectation
+that others will use, modify and enhance the Software and contribute
+those enhancements back to the community. However, since we would
+like to make the Software available for broadest use, with as few
+restrictions as possible permission is hereby granted, free of charge,
+to any person obtaining a copy of this Software to deal in the Software
+under the copyrights without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+The name and trademarks of copyright holder(s) may NOT be used in
+advertising or publicity pertaining to the Software or any derivatives
+without specific, written prior permission.
+*****************************************************************/
+
+#ifndef TCP_SPILL_H
+#define TCP_SPILL_H
+
+#include <sys/types.h>
+
+/*******************************************************
+ * tcp_spill: a temporary file for out of order data that would
+ * 	otherwise pile up in memory behind a long hole
+ *
+ * 	the file is mmap()'d read only in fixed size chunks that never
+ * 	move, so a fragment's data pointer can point straight into it;
+ * 	the bytes go in with pwrite(), so they only take up memory once
+ * 	they are read back, when the hole fills or is skipped.  Chunks
+ * 	are reused once everything in them has been freed
+ */
+
+#ifndef OFTRACE_SPILL_CHUNK
+#define OFTRACE_SPILL_CHUNK	(4<<20)
+#endif
+
+typedef struct tcp_spill tcp_spill;
+
+/***************************
+ * 	create an (already unlinked) temp file in dir; NULL dir means
+ * 	$TMPDIR, or /tmp.  return NULL on failure
+ */
+tcp_spill * tcp_spill_open(const char * dir);
+
+void tcp_spill_close(tcp_spill * sp);
+
+/***************************
+ * 	copy len bytes into the file and return where they can be
+ * 	read; NULL if they don't fit (len > OFTRACE_SPILL_CHUNK) or
+ * 	the write failed
+ */
+char * tcp_spill_write(tcp_spill * sp, char * data, int len);
+
+/***************************
+ * 	release len bytes at data, as returned by tcp_spill_write(),
+ * 	or a piece of them, or two contiguous ones together
+ */
+void tcp_spill_free(tcp_spill * sp, char * data, int len);
+
+/***************************
+ * 	do the bytes at b come right after the alen bytes at a, in the
+ * 	same chunk, so that the two can be treated as one piece?
+ */
+int tcp_spill_contiguous(tcp_spill * sp, char * a, int alen, char * b);
+
+/***************************
+ * 	bytes in the file that haven't been freed
+ */
+size_t tcp_spill_bytes(tcp_spill * sp);
+
+#endif
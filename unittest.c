@@ -3,10 +3,35 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "ofp_filter.h"
+#include "oftrace.h"
+#include "oftrace_batch.h"
+#include "oftrace_parallel.h"
+#include "pcap_decode.h"
+#include "pcap_reader.h"
+#include "spsc_ring.h"
+#include "tcp_endpoints.h"
 #include "tcp_session.h"
 
 int main(int argc, char * argv[])
 {
 	assert(unittest_do_tcp_session_delete());
+	assert(unittest_do_tcp_session_table());
+	assert(unittest_do_tcp_session_chain());
+	assert(unittest_do_tcp_session_v6());
+	assert(unittest_do_tcp_session_conn_hash());
+	assert(unittest_do_tcp_session_seq());
+	assert(unittest_do_tcp_session_spill());
+	assert(unittest_do_tcp_session_expire());
+	assert(unittest_do_tcp_session_pool());
+	assert(unittest_do_ofp_filter());
+	assert(unittest_do_pcap_decode());
+	assert(unittest_do_pcap_reader());
+	assert(unittest_do_tcp_endpoints());
+	assert(unittest_do_oftrace_framing());
+	assert(unittest_do_oftrace_handoff());
+	assert(unittest_do_oftrace_parallel());
+	assert(unittest_do_spsc_ring());
+	assert(unittest_do_oftrace_batch());
 	return 0;
 }